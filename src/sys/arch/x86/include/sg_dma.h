@@ -85,6 +85,10 @@ struct sg_cookie {
 	void		(*bind_page)(void *, bus_addr_t, paddr_t, int);
 	void		(*unbind_page)(void *, bus_addr_t);
 	void		(*flush_tlb)(void *);
+	/* optional, NULL if the backend only binds page by page */
+	int		(*bind_range)(void *, bus_addr_t,
+			    const bus_dma_segment_t *, int, int);
+	int		(*unbind_range)(void *, bus_addr_t, bus_size_t);
 };
 
 /*
@@ -115,6 +119,8 @@ int	sg_dmatag_create(const char *, void *, bus_dma_tag_t,
 	    bus_addr_t, bus_size_t,
 	    void (*)(void *, bus_addr_t, paddr_t, int),
 	    void (*)(void *, bus_addr_t), void (*)(void *),
+	    int (*)(void *, bus_addr_t, const bus_dma_segment_t *, int, int),
+	    int (*)(void *, bus_addr_t, bus_size_t),
 	    void (*)(void *, bus_dma_tag_t, bus_dmamap_t, bus_addr_t,
 		bus_size_t, int),
 	    bus_dma_tag_t *);
@@ -175,6 +175,27 @@ agp_sg_unbind_page(void *dev, bus_addr_t address)
 		    __func__, address);
 }
 
+/*
+ * Segments carry physical addresses, which the backend takes as bus
+ * addresses; _BUS_PHYS_TO_BUS() is the identity on x86.
+ */
+static int
+agp_sg_bind_range(void *dev, bus_addr_t address,
+    const bus_dma_segment_t *segs, int nsegs, int flags)
+{
+	struct agp_softc *sc = dev;
+
+	return AGP_BIND_RANGE(sc, address - sc->as_apaddr, segs, nsegs, flags);
+}
+
+static int
+agp_sg_unbind_range(void *dev, bus_addr_t address, bus_size_t size)
+{
+	struct agp_softc *sc = dev;
+
+	return AGP_UNBIND_RANGE(sc, address - sc->as_apaddr, size);
+}
+
 static void
 agp_sg_flush_tlb(void *dev)
 {
@@ -194,6 +215,8 @@ agp_bus_dma_init(struct agp_softc *sc, bus_dma_tag_t odmat, bus_addr_t start,
 	 */
 	return sg_dmatag_create("agpgtt", sc, odmat, start, end - start,
 	    agp_sg_bind_page, agp_sg_unbind_page, agp_sg_flush_tlb,
+	    sc->as_methods->bind_range != NULL ? agp_sg_bind_range : NULL,
+	    sc->as_methods->unbind_range != NULL ? agp_sg_unbind_range : NULL,
 	    sc->as_methods->dma_sync, dmat);
 }
 
@@ -213,9 +236,13 @@ agp_bus_dma_destroy(struct agp_softc *sc, bus_dma_tag_t dmat)
 	 * some backends use a dummy page to avoid errors on prefetching, etc.
 	 * make sure that all of them are clean.
 	 */
-	for (offset = cookie->sg_ex->ex_start;
-	    offset < cookie->sg_ex->ex_end; offset += PAGE_SIZE)
-		agp_sg_unbind_page(sc, offset);
+	if (sc->as_methods->unbind_range == NULL ||
+	    agp_sg_unbind_range(sc, cookie->sg_ex->ex_start,
+	    cookie->sg_ex->ex_end + 1 - cookie->sg_ex->ex_start) != 0) {
+		for (offset = cookie->sg_ex->ex_start;
+		    offset < cookie->sg_ex->ex_end; offset += PAGE_SIZE)
+			agp_sg_unbind_page(sc, offset);
+	}
 
 	sg_dmatag_destroy(cookie);
 	bus_dma_tag_destroy(dmat);
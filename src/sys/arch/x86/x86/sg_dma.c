@@ -109,7 +109,7 @@ static int	sg_dmamap_append_range(bus_dma_tag_t, bus_dmamap_t, paddr_t,
 static int	sg_iomap_insert_page(struct sg_page_map *, paddr_t);
 static bus_addr_t	sg_iomap_translate(struct sg_page_map *, paddr_t);
 static void	sg_iomap_load_map(struct sg_cookie *, struct sg_page_map *,
-		    bus_addr_t, int);
+		    bus_addr_t, int, bus_dma_segment_t *, int);
 static void	sg_iomap_unload_map(struct sg_cookie *, struct sg_page_map *);
 static void	sg_iomap_destroy(struct sg_page_map *);
 static void	sg_iomap_clear_pages(struct sg_page_map *);
@@ -119,6 +119,8 @@ sg_dmatag_create(const char *name, void *hdl, bus_dma_tag_t odmat,
     bus_addr_t start, bus_size_t size,
     void bind(void *, bus_addr_t, paddr_t, int),
     void unbind(void *, bus_addr_t), void flushtlb(void *),
+    int bindrange(void *, bus_addr_t, const bus_dma_segment_t *, int, int),
+    int unbindrange(void *, bus_addr_t, bus_size_t),
     void dmasync(void *, bus_dma_tag_t, bus_dmamap_t, bus_addr_t,
 	bus_size_t, int),
     bus_dma_tag_t *dmat)
@@ -185,6 +187,8 @@ sg_dmatag_create(const char *name, void *hdl, bus_dma_tag_t odmat,
 	sg->bind_page = bind;
 	sg->unbind_page = unbind;
 	sg->flush_tlb = flushtlb;
+	sg->bind_range = bindrange;
+	sg->unbind_range = unbindrange;
 
 	return (0);
 }
@@ -368,7 +372,7 @@ sg_dmamap_load(void *ctx, bus_dma_tag_t t, bus_dmamap_t map, void *buf,
 
 	map->dm_mapsize = buflen;
 
-	sg_iomap_load_map(sg, spm, dvmaddr, flags);
+	sg_iomap_load_map(sg, spm, dvmaddr, flags, NULL, 0);
 
 	{ /* Scope */
 		bus_addr_t a, aend;
@@ -586,6 +590,7 @@ sg_dmamap_load_raw(void *ctx, bus_dma_tag_t t, bus_dmamap_t map,
 	u_long dvmaddr, sgstart, sgend;
 	struct sg_cookie *sg = ctx;
 	struct sg_page_map *spm = map->_dm_sg_cookie;
+	int rangeok, rangepages;
 
 	if (map->dm_nsegs) {
 		/* Already in use?? */
@@ -611,6 +616,8 @@ sg_dmamap_load_raw(void *ctx, bus_dma_tag_t t, bus_dmamap_t map,
 	map->dm_nsegs = 0;
 
 	sg_iomap_clear_pages(spm);
+	rangeok = (sg->bind_range != NULL);
+	rangepages = 0;
 	/* Count up the total number of pages we need */
 	for (i = 0, left = size; left > 0 && i < nsegs; i++) {
 		bus_addr_t a, aend;
@@ -618,8 +625,14 @@ sg_dmamap_load_raw(void *ctx, bus_dma_tag_t t, bus_dmamap_t map,
 		bus_addr_t addr = segs[i].ds_addr;
 		int seg_len = MIN(left, len);
 
-		if (len < 1)
+		if (len < 1) {
+			rangeok = 0;
 			continue;
+		}
+		if ((addr & PAGE_MASK) != 0 || (len & PAGE_MASK) != 0 ||
+		    seg_len != len)
+			rangeok = 0;
+		rangepages += len >> PAGE_SHIFT;
 
 		aend = round_page(addr + seg_len);
 		for (a = trunc_page(addr); a < aend; a += PAGE_SIZE) {
@@ -635,6 +648,8 @@ sg_dmamap_load_raw(void *ctx, bus_dma_tag_t t, bus_dmamap_t map,
 
 		left -= seg_len;
 	}
+	if (i != nsegs)
+		rangeok = 0;
 	sgsize = spm->spm_pagecnt * PAGE_SIZE;
 
 	mutex_enter(&sg->sg_mtx);
@@ -670,7 +685,15 @@ sg_dmamap_load_raw(void *ctx, bus_dma_tag_t t, bus_dmamap_t map,
 
 	map->dm_mapsize = size;
 
-	sg_iomap_load_map(sg, spm, dvmaddr, flags);
+	/*
+	 * If every page of segs got its own entry, in order, the segments
+	 * describe the page map exactly and may be handed to the backend
+	 * in one go.
+	 */
+	if (rangeok && rangepages == spm->spm_pagecnt)
+		sg_iomap_load_map(sg, spm, dvmaddr, flags, segs, nsegs);
+	else
+		sg_iomap_load_map(sg, spm, dvmaddr, flags, NULL, 0);
 
 	err = sg_dmamap_load_seg(t, sg, map, segs, nsegs, flags,
 	    size, boundary);
@@ -1015,19 +1038,29 @@ sg_iomap_insert_page(struct sg_page_map *spm, paddr_t pa)
 /*
  * Locate the iomap by filling in the pa->va mapping and inserting it
  * into the IOMMU tables.
+ *
+ * If segs is not NULL, it describes the pages of the iomap in order and
+ * is handed to the backend's bind_range hook, if any, so that the whole
+ * map is written at once.  Otherwise pages are bound one at a time.
  */
 static void
 sg_iomap_load_map(struct sg_cookie *sg, struct sg_page_map *spm,
-    bus_addr_t vmaddr, int flags)
+    bus_addr_t vmaddr, int flags, bus_dma_segment_t *segs, int nsegs)
 {
 	struct sg_page_entry	*e;
+	bus_addr_t		 start = vmaddr;
 	int			 i;
 
 	for (i = 0, e = spm->spm_map; i < spm->spm_pagecnt; ++i, ++e) {
 		e->spe_va = vmaddr;
-		sg->bind_page(sg->sg_hdl, e->spe_va, e->spe_pa, flags);
 		vmaddr += PAGE_SIZE;
 	}
+
+	if (segs == NULL || sg->bind_range == NULL ||
+	    sg->bind_range(sg->sg_hdl, start, segs, nsegs, flags) != 0) {
+		for (i = 0, e = spm->spm_map; i < spm->spm_pagecnt; ++i, ++e)
+			sg->bind_page(sg->sg_hdl, e->spe_va, e->spe_pa, flags);
+	}
 	sg->flush_tlb(sg->sg_hdl);
 }
 
@@ -1040,8 +1073,13 @@ sg_iomap_unload_map(struct sg_cookie *sg, struct sg_page_map *spm)
 	struct sg_page_entry	*e;
 	int			 i;
 
-	for (i = 0, e = spm->spm_map; i < spm->spm_pagecnt; ++i, ++e)
-		sg->unbind_page(sg->sg_hdl, e->spe_va);
+	/* load_map hands out contiguous dvma, so this is one range. */
+	if (spm->spm_pagecnt == 0 || sg->unbind_range == NULL ||
+	    sg->unbind_range(sg->sg_hdl, spm->spm_map[0].spe_va,
+	    spm->spm_pagecnt * PAGE_SIZE) != 0) {
+		for (i = 0, e = spm->spm_map; i < spm->spm_pagecnt; ++i, ++e)
+			sg->unbind_page(sg->sg_hdl, e->spe_va);
+	}
 	sg->flush_tlb(sg->sg_hdl);
 }
 
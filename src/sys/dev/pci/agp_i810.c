@@ -59,18 +59,6 @@ struct agp_softc *agp_i810_sc = NULL;
 #define READ4(off)	bus_space_read_4(isc->bst, isc->bsh, off)
 #define WRITE4(off,v)	bus_space_write_4(isc->bst, isc->bsh, off, v)
 
-/* Memory is snooped, must not be accessed through gtt from the cpu. */
-#define	INTEL_COHERENT	0x6
-
-#define CHIP_I810 0	/* i810/i815 */
-#define CHIP_I830 1	/* 830M/845G */
-#define CHIP_I855 2	/* 852GM/855GM/865G */
-#define CHIP_I915 3	/* 915G/915GM/945G/945GM/945GME */
-#define CHIP_I965 4	/* 965Q/965PM */
-#define CHIP_G33  5	/* G33/Q33/Q35 */
-#define CHIP_G4X  6	/* G45/Q45 */
-#define CHIP_SNB  7	/* Sandy/Ivy Bridge */
-
 /* XXX hack, see below */
 static bool agp_i810_vga_mapped = false;
 static bus_addr_t agp_i810_vga_regbase;
@@ -81,6 +69,9 @@ static u_int32_t agp_i810_get_aperture(struct agp_softc *);
 static int agp_i810_set_aperture(struct agp_softc *, u_int32_t);
 static int agp_i810_bind_page(struct agp_softc *, off_t, bus_addr_t, int);
 static int agp_i810_unbind_page(struct agp_softc *, off_t);
+static int agp_i810_bind_segs(struct agp_softc *, off_t,
+			      const bus_dma_segment_t *, int, int);
+static int agp_i810_unbind_segs(struct agp_softc *, off_t, bus_size_t);
 static void agp_i810_flush_tlb(struct agp_softc *);
 static int agp_i810_enable(struct agp_softc *, u_int32_t mode);
 static struct agp_memory *agp_i810_alloc_memory(struct agp_softc *, int,
@@ -102,6 +93,8 @@ static struct agp_methods agp_i810_methods = {
 	.set_aperture	= agp_i810_set_aperture,
 	.bind_page	= agp_i810_bind_page,
 	.unbind_page	= agp_i810_unbind_page,
+	.bind_range	= agp_i810_bind_segs,
+	.unbind_range	= agp_i810_unbind_segs,
 	.flush_tlb	= agp_i810_flush_tlb,
 	.dma_sync	= intagp_dma_sync,
 	.enable		= agp_i810_enable,
@@ -111,95 +104,6 @@ static struct agp_methods agp_i810_methods = {
 	.unbind_memory	= agp_i810_unbind_memory,
 };
 
-int
-agp_i810_write_gtt_entry(struct agp_i810_softc *isc, off_t off, bus_addr_t v)
-{
-	u_int32_t pte;
-	bus_size_t base_off, wroff;
-
-	/* Bits 11:4 (physical start address extension) should be zero. */
-	if ((v & 0xff0) != 0)
-		return EINVAL;
-
-	pte = (u_int32_t)v;
-	/*
-	 * We need to massage the pte if bus_addr_t is wider than 32 bits.
-	 * The compiler isn't smart enough, hence the casts to uintmax_t.
-	 */
-	if (sizeof(bus_addr_t) > sizeof(u_int32_t)) {
-		/* gen6+ can do 40 bit addressing. */
-		if (isc->chiptype == CHIP_SNB) {
-			if (((uintmax_t)v >> 40) != 0)
-				return EINVAL;
-			pte |= (v >> 28) & 0xff0;
-		/* 965+ can do 36-bit addressing, add in the extra bits. */
-		} else if (isc->chiptype == CHIP_I965 ||
-		    isc->chiptype == CHIP_G33 ||
-		    isc->chiptype == CHIP_G4X) {
-			if (((uintmax_t)v >> 36) != 0)
-				return EINVAL;
-			pte |= (v >> 28) & 0xf0;
-		} else {
-			if (((uintmax_t)v >> 32) != 0)
-				return EINVAL;
-		}
-	}
-
-	base_off = 0;
-	wroff = (off >> AGP_PAGE_SHIFT) * 4;
-
-	switch (isc->chiptype) {
-	case CHIP_I810:
-	case CHIP_I830:
-	case CHIP_I855:
-		base_off = AGP_I810_GTT;
-		break;
-	case CHIP_I965:
-		base_off = AGP_I965_GTT;
-		break;
-	case CHIP_G4X:
-	case CHIP_SNB:
-		base_off = AGP_G4X_GTT;
-		break;
-	case CHIP_I915:
-	case CHIP_G33:
-		bus_space_write_4(isc->gtt_bst, isc->gtt_bsh, wroff, pte);
-		return 0;
-	}
-
-	WRITE4(base_off + wroff, pte);
-	return 0;
-}
-
-void
-agp_i810_post_gtt_entry(struct agp_i810_softc *isc, off_t off)
-{
-	bus_size_t base_off, wroff;
-
-	base_off = 0;
-	wroff = (off >> AGP_PAGE_SHIFT) * 4;
-
-	switch (isc->chiptype) {
-	case CHIP_I810:
-	case CHIP_I830:
-	case CHIP_I855:
-		base_off = AGP_I810_GTT;
-		break;
-	case CHIP_I965:
-		base_off = AGP_I965_GTT;
-		break;
-	case CHIP_G4X:
-		base_off = AGP_G4X_GTT;
-		break;
-	case CHIP_I915:
-	case CHIP_G33:
-		(void)bus_space_read_4(isc->gtt_bst, isc->gtt_bsh, wroff);
-		return;
-	}
-
-	(void)READ4(base_off + wroff);
-}
-
 /* XXXthorpej -- duplicated code (see arch/x86/pci/pchb.c) */
 static int
 agp_i810_vgamatch(const struct pci_attach_args *pa)
@@ -1110,6 +1014,37 @@ agp_i810_unbind_page(struct agp_softc *sc, off_t offset)
 	    isc->scrib_dmamap->dm_segs[0].ds_addr | 1);
 }
 
+static int
+agp_i810_bind_segs(struct agp_softc *sc, off_t offset,
+    const bus_dma_segment_t *segs, int nsegs, int flags)
+{
+	struct agp_i810_softc *isc = sc->as_chipc;
+	int error;
+
+	error = agp_i810_bind_range(isc, offset, segs, nsegs, flags);
+#ifdef AGP_DEBUG
+	if (error)
+		printf("%s: failed to bind range at 0x%08x: %d\n",
+		    device_xname(sc->as_dev), (int)offset, error);
+#endif
+	return error;
+}
+
+static int
+agp_i810_unbind_segs(struct agp_softc *sc, off_t offset, bus_size_t size)
+{
+	struct agp_i810_softc *isc = sc->as_chipc;
+	int error;
+
+	error = agp_i810_unbind_range(isc, offset, size);
+#ifdef AGP_DEBUG
+	if (error)
+		printf("%s: failed to unbind range at 0x%08x: %d\n",
+		    device_xname(sc->as_dev), (int)offset, error);
+#endif
+	return error;
+}
+
 /*
  * Writing via memory mapped registers already flushes all TLBs.
  */
@@ -0,0 +1,708 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2000 Doug Rabson
+ * Copyright (c) 2000 Ruslan Ermilov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * GTT binding for the i810 family.  This file only computes PTEs and
+ * pushes them through bus_space, so that it can be built on its own
+ * against a counting stand-in for the GTT:
+ *
+ *	cc -DAGP_I810_GTT_MAIN=1 -o gtt agp_i810_gtt.c && ./gtt
+ *
+ * binds objects of various sizes page by page and a range at a time and
+ * reports the PTE writes, bus_space calls and posting reads of each.
+ */
+
+#ifndef AGP_I810_GTT_MAIN
+#define AGP_I810_GTT_MAIN 0
+#endif
+
+#if AGP_I810_GTT_MAIN
+#include <sys/types.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agpreg.h"
+#include "agp_i810var.h"
+
+#define	AGP_PAGE_SHIFT		12
+#define	AGP_PAGE_SIZE		(1 << AGP_PAGE_SHIFT)
+#define	BUS_DMA_COHERENT	0x0004
+
+/* 64-bit bus addresses, so that the 36 and 40 bit PTE formats are used. */
+typedef uint64_t bus_addr_t;
+typedef uint64_t bus_size_t;
+
+/*
+ * The tag is the GTT being written and counts what is done to it; the
+ * handle is the base of the register window.
+ */
+struct gtt_space {
+	u_int32_t	*regs;
+	size_t		 nregs;
+	u_long		 calls;		/* bus_space calls */
+	u_long		 writes;	/* 32-bit stores */
+	u_long		 reads;		/* 32-bit loads */
+};
+typedef struct gtt_space *bus_space_tag_t;
+typedef u_int32_t *bus_space_handle_t;
+
+typedef struct {
+	bus_addr_t	ds_addr;
+	bus_size_t	ds_len;
+} bus_dma_segment_t;
+
+struct bus_dmamap {
+	bus_dma_segment_t dm_segs[1];
+};
+typedef struct bus_dmamap *bus_dmamap_t;
+
+struct agp_gatt {
+	u_int32_t	ag_entries;
+};
+
+struct agp_i810_softc {
+	bus_dmamap_t	scrib_dmamap;
+	struct agp_gatt	*gatt;
+	int		chiptype;
+	u_int32_t	stolen;
+	bus_space_tag_t	bst;
+	bus_space_handle_t bsh;
+	bus_space_tag_t	gtt_bst;
+	bus_space_handle_t gtt_bsh;
+};
+
+static u_int32_t *
+gtt_reg(bus_space_tag_t t, bus_space_handle_t h, bus_size_t o, bus_size_t n)
+{
+	if ((o & 3) != 0 || h + o / 4 + n > t->regs + t->nregs) {
+		fprintf(stderr, "gtt: access 0x%llx+%llu out of range\n",
+		    (unsigned long long)o, (unsigned long long)n);
+		abort();
+	}
+	t->calls++;
+	return h + o / 4;
+}
+
+static u_int32_t
+bus_space_read_4(bus_space_tag_t t, bus_space_handle_t h, bus_size_t o)
+{
+	t->reads++;
+	return *gtt_reg(t, h, o, 1);
+}
+
+static void
+bus_space_write_4(bus_space_tag_t t, bus_space_handle_t h, bus_size_t o,
+    u_int32_t v)
+{
+	t->writes++;
+	*gtt_reg(t, h, o, 1) = v;
+}
+
+static void
+bus_space_write_region_4(bus_space_tag_t t, bus_space_handle_t h,
+    bus_size_t o, const u_int32_t *p, bus_size_t n)
+{
+	t->writes += n;
+	memcpy(gtt_reg(t, h, o, n), p, n * 4);
+}
+
+static void
+bus_space_set_region_4(bus_space_tag_t t, bus_space_handle_t h,
+    bus_size_t o, u_int32_t v, bus_size_t n)
+{
+	u_int32_t *p = gtt_reg(t, h, o, n);
+
+	t->writes += n;
+	while (n-- > 0)
+		*p++ = v;
+}
+
+int	agp_i810_write_gtt_entry(struct agp_i810_softc *, off_t, bus_addr_t);
+void	agp_i810_post_gtt_entry(struct agp_i810_softc *, off_t);
+int	agp_i810_bind_range(struct agp_i810_softc *, off_t,
+	    const bus_dma_segment_t *, int, int);
+int	agp_i810_unbind_range(struct agp_i810_softc *, off_t, bus_size_t);
+
+#define	AGP_I810_EVCNT_DECL(name)					\
+static struct { u_long ev_count; } agp_i810_ev_##name
+#else
+#include <sys/cdefs.h>
+__KERNEL_RCSID(0, "$NetBSD$");
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/evcnt.h>
+#include <sys/agpio.h>
+#include <sys/bus.h>
+
+#include <dev/pci/agpvar.h>
+#include <dev/pci/agpreg.h>
+#include <dev/pci/agp_i810var.h>
+
+#define	AGP_I810_EVCNT_DECL(name)					\
+static struct evcnt agp_i810_ev_##name =				\
+    EVCNT_INITIALIZER(EVCNT_TYPE_MISC, NULL, "agp_i810", #name);	\
+EVCNT_ATTACH_STATIC(agp_i810_ev_##name)
+#endif /* AGP_I810_GTT_MAIN */
+
+#define	AGP_I810_EVCNT_INCR(name)	agp_i810_ev_##name.ev_count++
+#define	AGP_I810_EVCNT_ADD(name, n)	agp_i810_ev_##name.ev_count += (n)
+
+AGP_I810_EVCNT_DECL(pte_writes);
+AGP_I810_EVCNT_DECL(pte_posts);
+AGP_I810_EVCNT_DECL(range_binds);
+AGP_I810_EVCNT_DECL(range_unbinds);
+
+/*
+ * Number of PTEs staged on the stack before they are pushed to the GTT
+ * with a single bus_space_write_region_4().
+ */
+#define	AGP_I810_PTE_BATCH	64
+
+/*
+ * Compute the GTT page table entry for physical address v.
+ */
+static int
+agp_i810_make_pte(struct agp_i810_softc *isc, bus_addr_t v, u_int32_t *ptep)
+{
+	u_int32_t pte;
+
+	/* Bits 11:4 (physical start address extension) should be zero. */
+	if ((v & 0xff0) != 0)
+		return EINVAL;
+
+	pte = (u_int32_t)v;
+	/*
+	 * We need to massage the pte if bus_addr_t is wider than 32 bits.
+	 * The compiler isn't smart enough, hence the casts to uintmax_t.
+	 */
+	if (sizeof(bus_addr_t) > sizeof(u_int32_t)) {
+		/* gen6+ can do 40 bit addressing. */
+		if (isc->chiptype == CHIP_SNB) {
+			if (((uintmax_t)v >> 40) != 0)
+				return EINVAL;
+			pte |= (v >> 28) & 0xff0;
+		/* 965+ can do 36-bit addressing, add in the extra bits. */
+		} else if (isc->chiptype == CHIP_I965 ||
+		    isc->chiptype == CHIP_G33 ||
+		    isc->chiptype == CHIP_G4X) {
+			if (((uintmax_t)v >> 36) != 0)
+				return EINVAL;
+			pte |= (v >> 28) & 0xf0;
+		} else {
+			if (((uintmax_t)v >> 32) != 0)
+				return EINVAL;
+		}
+	}
+
+	*ptep = pte;
+	return 0;
+}
+
+/*
+ * Locate the GTT: return the bus space tag and handle through which the
+ * page table is accessed, and the offset of the first entry in it.
+ */
+static void
+agp_i810_gtt_space(struct agp_i810_softc *isc, bus_space_tag_t *bstp,
+    bus_space_handle_t *bshp, bus_size_t *basep)
+{
+
+	*bstp = isc->bst;
+	*bshp = isc->bsh;
+	*basep = 0;
+
+	switch (isc->chiptype) {
+	case CHIP_I810:
+	case CHIP_I830:
+	case CHIP_I855:
+		*basep = AGP_I810_GTT;
+		break;
+	case CHIP_I965:
+		*basep = AGP_I965_GTT;
+		break;
+	case CHIP_G4X:
+	case CHIP_SNB:
+		*basep = AGP_G4X_GTT;
+		break;
+	case CHIP_I915:
+	case CHIP_G33:
+		*bstp = isc->gtt_bst;
+		*bshp = isc->gtt_bsh;
+		break;
+	}
+}
+
+int
+agp_i810_write_gtt_entry(struct agp_i810_softc *isc, off_t off, bus_addr_t v)
+{
+	bus_space_tag_t bst;
+	bus_space_handle_t bsh;
+	bus_size_t base_off, wroff;
+	u_int32_t pte;
+	int error;
+
+	if ((error = agp_i810_make_pte(isc, v, &pte)) != 0)
+		return error;
+
+	agp_i810_gtt_space(isc, &bst, &bsh, &base_off);
+	wroff = (off >> AGP_PAGE_SHIFT) * 4;
+
+	bus_space_write_4(bst, bsh, base_off + wroff, pte);
+	AGP_I810_EVCNT_INCR(pte_writes);
+	return 0;
+}
+
+void
+agp_i810_post_gtt_entry(struct agp_i810_softc *isc, off_t off)
+{
+	bus_space_tag_t bst;
+	bus_space_handle_t bsh;
+	bus_size_t base_off, wroff;
+
+	agp_i810_gtt_space(isc, &bst, &bsh, &base_off);
+	wroff = (off >> AGP_PAGE_SHIFT) * 4;
+
+	(void)bus_space_read_4(bst, bsh, base_off + wroff);
+	AGP_I810_EVCNT_INCR(pte_posts);
+}
+
+/*
+ * Check that [off, off + size) lies in the GTT, outside stolen memory.
+ */
+static int
+agp_i810_check_range(struct agp_i810_softc *isc, off_t off, bus_size_t size)
+{
+	off_t end = off + size;
+
+	if (off < 0 || (off & (AGP_PAGE_SIZE - 1)) != 0 ||
+	    (size & (AGP_PAGE_SIZE - 1)) != 0 || size == 0 ||
+	    end > ((off_t)isc->gatt->ag_entries << AGP_PAGE_SHIFT))
+		return EINVAL;
+
+	if (isc->chiptype != CHIP_I810 &&
+	    (off >> AGP_PAGE_SHIFT) < isc->stolen)
+		return EINVAL;
+
+	return 0;
+}
+
+/*
+ * Bind the pages described by segs at GTT offset off.  The PTEs are
+ * staged in batches and written with bus_space_write_region_4(), and a
+ * single posting read of the last entry is done once the whole range is
+ * written, instead of one write and one read per page.
+ *
+ * Segments must be page aligned.  On failure, the part of the range that
+ * was already written is left bound.
+ */
+int
+agp_i810_bind_range(struct agp_i810_softc *isc, off_t off,
+    const bus_dma_segment_t *segs, int nsegs, int flags)
+{
+	u_int32_t ptes[AGP_I810_PTE_BATCH];
+	bus_space_tag_t bst;
+	bus_space_handle_t bsh;
+	bus_size_t base_off, wroff, size;
+	bus_addr_t pa, extra;
+	off_t cur;
+	int error, i, n;
+
+	size = 0;
+	for (i = 0; i < nsegs; i++) {
+		if ((segs[i].ds_addr & (AGP_PAGE_SIZE - 1)) != 0 ||
+		    (segs[i].ds_len & (AGP_PAGE_SIZE - 1)) != 0)
+			return EINVAL;
+		size += segs[i].ds_len;
+	}
+	if ((error = agp_i810_check_range(isc, off, size)) != 0)
+		return error;
+
+	/* See agp_i810_bind_page() in agp_i810.c. */
+	extra = 1;
+	if (flags & BUS_DMA_COHERENT)
+		extra |= INTEL_COHERENT;
+
+	agp_i810_gtt_space(isc, &bst, &bsh, &base_off);
+	wroff = (off >> AGP_PAGE_SHIFT) * 4;
+
+	cur = off;
+	n = 0;
+	error = 0;
+	for (i = 0; i < nsegs && error == 0; i++) {
+		for (pa = segs[i].ds_addr;
+		    pa < segs[i].ds_addr + segs[i].ds_len;
+		    pa += AGP_PAGE_SIZE) {
+			if ((error = agp_i810_make_pte(isc, pa | extra,
+			    &ptes[n])) != 0)
+				break;
+			if (++n == AGP_I810_PTE_BATCH) {
+				bus_space_write_region_4(bst, bsh,
+				    base_off + wroff, ptes, n);
+				AGP_I810_EVCNT_ADD(pte_writes, n);
+				wroff += n * 4;
+				n = 0;
+			}
+			cur += AGP_PAGE_SIZE;
+		}
+	}
+	if (n > 0) {
+		bus_space_write_region_4(bst, bsh, base_off + wroff, ptes, n);
+		AGP_I810_EVCNT_ADD(pte_writes, n);
+	}
+
+	if (cur > off)
+		agp_i810_post_gtt_entry(isc, cur - AGP_PAGE_SIZE);
+	AGP_I810_EVCNT_INCR(range_binds);
+
+	return error;
+}
+
+/*
+ * Point [off, off + size) of the GTT back at the scratch page, with a
+ * single bus_space_set_region_4() and a single posting read.
+ */
+int
+agp_i810_unbind_range(struct agp_i810_softc *isc, off_t off, bus_size_t size)
+{
+	bus_space_tag_t bst;
+	bus_space_handle_t bsh;
+	bus_size_t base_off, wroff, count;
+	u_int32_t pte;
+	int error;
+
+	if ((error = agp_i810_check_range(isc, off, size)) != 0)
+		return error;
+	if ((error = agp_i810_make_pte(isc,
+	    isc->scrib_dmamap->dm_segs[0].ds_addr | 1, &pte)) != 0)
+		return error;
+
+	agp_i810_gtt_space(isc, &bst, &bsh, &base_off);
+	wroff = (off >> AGP_PAGE_SHIFT) * 4;
+	count = size >> AGP_PAGE_SHIFT;
+
+	bus_space_set_region_4(bst, bsh, base_off + wroff, pte, count);
+	AGP_I810_EVCNT_ADD(pte_writes, count);
+	agp_i810_post_gtt_entry(isc, off + size - AGP_PAGE_SIZE);
+	AGP_I810_EVCNT_INCR(range_unbinds);
+
+	return 0;
+}
+
+#if AGP_I810_GTT_MAIN
+#define	GTT_ENTRIES	(256 * 1024 * 1024 / AGP_PAGE_SIZE)
+#define	GTT_STOLEN	2048
+#define	GTT_SCRATCH	0x7f000
+
+static struct gtt_space gtt;
+static struct bus_dmamap scratch = { { { GTT_SCRATCH, AGP_PAGE_SIZE } } };
+static struct agp_gatt gatt = { GTT_ENTRIES };
+static struct agp_i810_softc sc = {
+	.scrib_dmamap = &scratch,
+	.gatt = &gatt,
+	.stolen = GTT_STOLEN,
+};
+static int failures;
+
+static const struct {
+	const char	*name;
+	int		 chiptype;
+	int		 pabits;
+} chips[] = {
+	{ "i915", CHIP_I915, 32 },
+	{ "g4x", CHIP_G4X, 36 },
+	{ "snb", CHIP_SNB, 40 },
+};
+
+#define	FAIL(...) do {							\
+	printf("FAIL: " __VA_ARGS__);					\
+	printf("\n");							\
+	failures++;							\
+} while (0)
+
+static void
+gtt_setup(int chiptype)
+{
+	bus_size_t base;
+
+	switch (chiptype) {
+	case CHIP_I965:
+		base = AGP_I965_GTT;
+		break;
+	case CHIP_G4X:
+	case CHIP_SNB:
+		base = AGP_G4X_GTT;
+		break;
+	default:
+		base = 0;
+		break;
+	}
+	free(gtt.regs);
+	gtt.nregs = base / 4 + GTT_ENTRIES;
+	if ((gtt.regs = calloc(gtt.nregs, 4)) == NULL)
+		abort();
+	sc.chiptype = chiptype;
+	sc.bst = sc.gtt_bst = &gtt;
+	sc.bsh = sc.gtt_bsh = gtt.regs;
+}
+
+static u_int32_t *
+gtt_entries(void)
+{
+	return gtt.regs + gtt.nregs - GTT_ENTRIES;
+}
+
+static void
+gtt_reset(void)
+{
+	gtt.calls = gtt.writes = gtt.reads = 0;
+}
+
+/* What the page-at-a-time path did: one agp_i810_bind_page() per page. */
+static int
+bind_pages(off_t off, const bus_dma_segment_t *segs, int nsegs, int flags)
+{
+	bus_addr_t pa;
+	int error, i;
+
+	for (i = 0; i < nsegs; i++) {
+		for (pa = segs[i].ds_addr;
+		    pa < segs[i].ds_addr + segs[i].ds_len;
+		    pa += AGP_PAGE_SIZE) {
+			error = agp_i810_write_gtt_entry(&sc, off, pa |
+			    ((flags & BUS_DMA_COHERENT) ? INTEL_COHERENT : 0) |
+			    1);
+			if (error)
+				return error;
+			off += AGP_PAGE_SIZE;
+		}
+	}
+	return 0;
+}
+
+static void
+unbind_pages(off_t off, bus_size_t size)
+{
+	for (; size > 0; off += AGP_PAGE_SIZE, size -= AGP_PAGE_SIZE)
+		(void)agp_i810_write_gtt_entry(&sc, off, GTT_SCRATCH | 1);
+}
+
+static bus_addr_t
+random_page(int pabits)
+{
+	bus_addr_t pa;
+
+	pa = ((bus_addr_t)random() << 31) ^ (bus_addr_t)random();
+	return (pa & (((bus_addr_t)1 << pabits) - 1)) & ~(bus_addr_t)0xfff;
+}
+
+/*
+ * Describe an object of npages pages as segments of run pages each
+ * (one segment for the whole object if run is 0), at random addresses.
+ */
+static int
+make_segs(bus_dma_segment_t *segs, int npages, int run, int pabits)
+{
+	int i, n, nsegs;
+
+	if (run == 0)
+		run = npages;
+	for (i = nsegs = 0; i < npages; i += n, nsegs++) {
+		n = npages - i < run ? npages - i : run;
+		do {
+			segs[nsegs].ds_addr = random_page(pabits);
+		} while (segs[nsegs].ds_addr + (bus_addr_t)n * AGP_PAGE_SIZE >
+		    ((bus_addr_t)1 << pabits));
+		segs[nsegs].ds_len = (bus_size_t)n * AGP_PAGE_SIZE;
+	}
+	return nsegs;
+}
+
+static int
+check_scratch(u_int npages, u_int first)
+{
+	const u_int32_t *e = gtt_entries();
+	u_int i;
+
+	for (i = first; i < first + npages; i++)
+		if (e[i] != (GTT_SCRATCH | 1))
+			return 0;
+	return 1;
+}
+
+static void
+compare(const char *chip, int pabits, int npages, int run)
+{
+	static bus_dma_segment_t segs[4096];
+	static u_int32_t want[4096];
+	u_long pcalls, pwrites, preads, ucalls;
+	off_t off = (off_t)(GTT_STOLEN + 100) << AGP_PAGE_SHIFT;
+	u_int first = GTT_STOLEN + 100;
+	int nsegs, error;
+
+	nsegs = make_segs(segs, npages, run, pabits);
+
+	gtt_reset();
+	if ((error = bind_pages(off, segs, nsegs, 0)) != 0) {
+		FAIL("%s: page bind of %d pages: %d", chip, npages, error);
+		return;
+	}
+	pcalls = gtt.calls;
+	pwrites = gtt.writes;
+	preads = gtt.reads;
+	memcpy(want, gtt_entries() + first, npages * 4);
+	gtt_reset();
+	unbind_pages(off, (bus_size_t)npages << AGP_PAGE_SHIFT);
+	ucalls = gtt.calls;
+	if (!check_scratch(npages, first))
+		FAIL("%s: page unbind of %d pages", chip, npages);
+
+	gtt_reset();
+	if ((error = agp_i810_bind_range(&sc, off, segs, nsegs, 0)) != 0) {
+		FAIL("%s: range bind of %d pages: %d", chip, npages, error);
+		return;
+	}
+	if (memcmp(want, gtt_entries() + first, npages * 4) != 0)
+		FAIL("%s: range bind of %d pages differs", chip, npages);
+	if (gtt.writes != pwrites)
+		FAIL("%s: %lu PTE writes, expected %lu", chip, gtt.writes,
+		    pwrites);
+	if (gtt.reads != 1)
+		FAIL("%s: %lu posting reads, expected 1", chip, gtt.reads);
+	printf("%-5s %5d %5d %4d | %5lu %5lu %2lu %5lu | %4lu %5lu %2lu",
+	    chip, npages, run ? run : npages, nsegs, pcalls, pwrites, preads,
+	    ucalls, gtt.calls, gtt.writes, gtt.reads);
+
+	gtt_reset();
+	if ((error = agp_i810_unbind_range(&sc, off,
+	    (bus_size_t)npages << AGP_PAGE_SHIFT)) != 0)
+		FAIL("%s: range unbind of %d pages: %d", chip, npages, error);
+	if (!check_scratch(npages, first))
+		FAIL("%s: range unbind of %d pages", chip, npages);
+	printf(" %4lu\n", gtt.calls);
+}
+
+/*
+ * Requests that must be refused, and must leave the GTT alone when they
+ * are refused before anything is written.
+ */
+static void
+check_errors(const char *chip, int pabits)
+{
+	bus_dma_segment_t seg;
+	off_t off = (off_t)(GTT_STOLEN + 100) << AGP_PAGE_SHIFT;
+	int error;
+
+	gtt_reset();
+	seg.ds_addr = 0x10000 + 0x800;
+	seg.ds_len = AGP_PAGE_SIZE;
+	if (agp_i810_bind_range(&sc, off, &seg, 1, 0) != EINVAL)
+		FAIL("%s: misaligned segment accepted", chip);
+	seg.ds_addr = 0x10000;
+	seg.ds_len = AGP_PAGE_SIZE + 4;
+	if (agp_i810_bind_range(&sc, off, &seg, 1, 0) != EINVAL)
+		FAIL("%s: partial page accepted", chip);
+	seg.ds_len = AGP_PAGE_SIZE;
+	if (agp_i810_bind_range(&sc, off + 4, &seg, 1, 0) != EINVAL)
+		FAIL("%s: misaligned offset accepted", chip);
+	if (agp_i810_bind_range(&sc,
+	    (off_t)(GTT_STOLEN - 1) << AGP_PAGE_SHIFT, &seg, 1, 0) != EINVAL)
+		FAIL("%s: bind into stolen memory accepted", chip);
+	if (agp_i810_bind_range(&sc,
+	    (off_t)GTT_ENTRIES << AGP_PAGE_SHIFT, &seg, 1, 0) != EINVAL)
+		FAIL("%s: bind past the GTT accepted", chip);
+	if (agp_i810_bind_range(&sc, off, &seg, 0, 0) != EINVAL)
+		FAIL("%s: empty bind accepted", chip);
+	if (agp_i810_unbind_range(&sc, off, 0) != EINVAL ||
+	    agp_i810_unbind_range(&sc,
+	    (off_t)(GTT_ENTRIES - 1) << AGP_PAGE_SHIFT,
+	    2 * AGP_PAGE_SIZE) != EINVAL ||
+	    agp_i810_unbind_range(&sc, 0, AGP_PAGE_SIZE) != EINVAL)
+		FAIL("%s: bad unbind accepted", chip);
+	if (gtt.calls != 0)
+		FAIL("%s: refused requests touched the GTT", chip);
+
+	/* A page the PTE cannot address is refused when it is reached. */
+	seg.ds_addr = (bus_addr_t)1 << pabits;
+	error = agp_i810_bind_range(&sc, off, &seg, 1, 0);
+	if (error != EINVAL)
+		FAIL("%s: %d-bit address accepted: %d", chip, pabits + 1,
+		    error);
+
+	/* The coherent bits end up in the PTE. */
+	seg.ds_addr = 0x10000;
+	if (agp_i810_bind_range(&sc, off, &seg, 1, BUS_DMA_COHERENT) != 0 ||
+	    gtt_entries()[GTT_STOLEN + 100] != (0x10000 | INTEL_COHERENT | 1))
+		FAIL("%s: coherent bind", chip);
+
+	/* So do the address bits above 32, in bits 11:4. */
+	if (pabits > 32) {
+		seg.ds_addr = ((bus_addr_t)(pabits - 33) << 32) | 0x12345000;
+		if (agp_i810_bind_range(&sc, off, &seg, 1, 0) != 0 ||
+		    gtt_entries()[GTT_STOLEN + 100] !=
+		    (0x12345000 | ((u_int32_t)(pabits - 33) << 4) | 1))
+			FAIL("%s: high address bind", chip);
+	}
+	(void)agp_i810_unbind_range(&sc, off, AGP_PAGE_SIZE);
+}
+
+int
+main(void)
+{
+	static const int sizes[] = { 1, 16, 64, 65, 256, 4096 };
+	static const int runs[] = { 0, 16, 1 };
+	size_t c, i, j;
+
+	srandom(1);
+	printf("                       | page at a time        | range at a time\n");
+	printf("chip  pages   run segs | calls  PTEs rd unbnd | calls  PTEs rd unbnd\n");
+	for (c = 0; c < sizeof(chips) / sizeof(chips[0]); c++) {
+		gtt_setup(chips[c].chiptype);
+		unbind_pages(0, (bus_size_t)GTT_ENTRIES << AGP_PAGE_SHIFT);
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			for (j = 0; j < sizeof(runs) / sizeof(runs[0]); j++)
+				if (runs[j] < sizes[i])
+					compare(chips[c].name,
+					    chips[c].pabits, sizes[i],
+					    runs[j]);
+		check_errors(chips[c].name, chips[c].pabits);
+	}
+	free(gtt.regs);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
+#endif /* AGP_I810_GTT_MAIN */
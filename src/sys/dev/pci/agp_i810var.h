@@ -27,6 +27,23 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Generations of the i810 family, as kept in agp_i810_softc.chiptype;
+ * the GTT location and the PTE format depend on them.
+ */
+#define CHIP_I810 0	/* i810/i815 */
+#define CHIP_I830 1	/* 830M/845G */
+#define CHIP_I855 2	/* 852GM/855GM/865G */
+#define CHIP_I915 3	/* 915G/915GM/945G/945GM/945GME */
+#define CHIP_I965 4	/* 965Q/965PM */
+#define CHIP_G33  5	/* G33/Q33/Q35 */
+#define CHIP_G4X  6	/* G45/Q45 */
+#define CHIP_SNB  7	/* Sandy/Ivy Bridge */
+
+/* Memory is snooped, must not be accessed through gtt from the cpu. */
+#define	INTEL_COHERENT	0x6
+
+#ifdef _KERNEL
 #include <sys/types.h>
 #include <sys/bus.h>
 
@@ -57,3 +74,7 @@ extern struct agp_softc	*agp_i810_sc;
 
 int	agp_i810_write_gtt_entry(struct agp_i810_softc *, off_t, bus_addr_t);
 void	agp_i810_post_gtt_entry(struct agp_i810_softc *, off_t);
+int	agp_i810_bind_range(struct agp_i810_softc *, off_t,
+	    const bus_dma_segment_t *, int, int);
+int	agp_i810_unbind_range(struct agp_i810_softc *, off_t, bus_size_t);
+#endif /* _KERNEL */
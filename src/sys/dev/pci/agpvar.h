@@ -107,6 +107,10 @@ struct agp_methods {
 	int (*set_aperture)(struct agp_softc *, u_int32_t);
 	int (*bind_page)(struct agp_softc *, off_t, bus_addr_t, int);
 	int (*unbind_page)(struct agp_softc *, off_t);
+	/* optional: bind/unbind a whole range with one posting read */
+	int (*bind_range)(struct agp_softc *, off_t, const bus_dma_segment_t *,
+	    int, int);
+	int (*unbind_range)(struct agp_softc *, off_t, bus_size_t);
 	void (*flush_tlb)(struct agp_softc *);
 	void (*dma_sync)(void *, bus_dma_tag_t, bus_dmamap_t, bus_addr_t,
 	    bus_size_t, int);
@@ -121,6 +125,10 @@ struct agp_methods {
 #define AGP_SET_APERTURE(sc,a)	 ((sc)->as_methods->set_aperture((sc),(a)))
 #define AGP_BIND_PAGE(sc,o,p,f)	 ((sc)->as_methods->bind_page((sc),(o),(p),(f)))
 #define AGP_UNBIND_PAGE(sc,o)	 ((sc)->as_methods->unbind_page((sc), (o)))
+#define AGP_BIND_RANGE(sc,o,s,n,f) \
+	((sc)->as_methods->bind_range((sc),(o),(s),(n),(f)))
+#define AGP_UNBIND_RANGE(sc,o,s) \
+	((sc)->as_methods->unbind_range((sc),(o),(s)))
 #define AGP_FLUSH_TLB(sc)	 ((sc)->as_methods->flush_tlb(sc))
 #define AGP_ENABLE(sc,m)	 ((sc)->as_methods->enable((sc),(m)))
 #define AGP_ALLOC_MEMORY(sc,t,s) ((sc)->as_methods->alloc_memory((sc),(t),(s)))
@@ -863,6 +863,8 @@ int	drm_sg_alloc_ioctl(struct drm_device *, void *, struct drm_file *);
 int	drm_sg_free(struct drm_device *, void *, struct drm_file *);
 
 struct drm_obj *drm_gem_object_alloc(struct drm_device *, size_t);
+struct drm_obj *drm_gem_object_alloc_uao(struct drm_device *,
+	     struct uvm_object *, size_t);
 void	 drm_unref(struct uvm_object *);
 void	 drm_ref(struct uvm_object *);
 void	 drm_unref_locked(struct uvm_object *);
@@ -1573,24 +1573,42 @@ drm_fault(struct uvm_faultinfo *ufi, vaddr_t vaddr, vm_page_t *pps,
  */
 struct drm_obj *
 drm_gem_object_alloc(struct drm_device *dev, size_t size)
+{
+	KASSERT((size & (PAGE_SIZE -1)) == 0);
+
+	/* uao create can't fail in the 0 case, it just sleeps */
+	return (drm_gem_object_alloc_uao(dev, uao_create(size, 0), size));
+}
+
+/*
+ * Create an object backed by an existing anonymous uvm object, such as
+ * the one behind a SysV shared memory segment.  The caller's reference
+ * to uao is handed over to the new object, and dropped on failure.
+ */
+struct drm_obj *
+drm_gem_object_alloc_uao(struct drm_device *dev, struct uvm_object *uao,
+    size_t size)
 {
 	struct drm_obj	*obj;
 
 	KASSERT((size & (PAGE_SIZE -1)) == 0);
 
 #if !defined(__NetBSD__)
-	if ((obj = pool_get(&dev->objpl, PR_WAITOK | PR_ZERO)) == NULL)
+	if ((obj = pool_get(&dev->objpl, PR_WAITOK | PR_ZERO)) == NULL) {
+		uao_detach(uao);
 		return (NULL);
+	}
 #else /* !defined(__NetBSD__) */
-	if ((obj = pool_get(&dev->objpl, PR_WAITOK)) == NULL)
+	if ((obj = pool_get(&dev->objpl, PR_WAITOK)) == NULL) {
+		uao_detach(uao);
 		return (NULL);
+	}
 	memset(obj, 0, dev->objpl.pr_size);
 #endif /* !defined(__NetBSD__) */
 
 	obj->dev = dev;
 
-	/* uao create can't fail in the 0 case, it just sleeps */
-	obj->uao = uao_create(size, 0);
+	obj->uao = uao;
 	obj->size = size;
 #if !defined(__NetBSD__)
 	uvm_objinit(&obj->uobj, &drm_pgops, 1);
@@ -193,6 +193,8 @@ typedef struct drm_i915_sarea {
 #endif /* !defined(__NetBSD__) */
 #define DRM_I915_GET_SPRITE_COLORKEY 0x2a
 #define DRM_I915_SET_SPRITE_COLORKEY 0x2b
+#define DRM_I915_GEM_USERPTR	0x33	/* as upstream */
+#define DRM_I915_GEM_UNSYNCHRONIZED	0x3f	/* no upstream equivalent */
 
 #define DRM_IOCTL_I915_INIT		DRM_IOW( DRM_COMMAND_BASE + DRM_I915_INIT, drm_i915_init_t)
 #define DRM_IOCTL_I915_FLUSH		DRM_IO ( DRM_COMMAND_BASE + DRM_I915_FLUSH)
@@ -236,6 +238,8 @@ typedef struct drm_i915_sarea {
 #define DRM_IOCTL_I915_OVERLAY_ATTRS	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_OVERLAY_ATTRS, struct drm_intel_overlay_attrs)
 #define DRM_IOCTL_I915_SET_SPRITE_COLORKEY	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_SET_SPRITE_COLORKEY, struct drm_intel_sprite_colorkey)
 #define DRM_IOCTL_I915_GET_SPRITE_COLORKEY	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GET_SPRITE_COLORKEY, struct drm_intel_sprite_colorkey)
+#define DRM_IOCTL_I915_GEM_USERPTR	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_USERPTR, struct drm_i915_gem_userptr)
+#define DRM_IOCTL_I915_GEM_UNSYNCHRONIZED	DRM_IOW(DRM_COMMAND_BASE + DRM_I915_GEM_UNSYNCHRONIZED, struct drm_i915_gem_unsynchronized)
 
 /* Allow drivers to submit batchbuffers directly to hardware, relying
  * on the security mechanisms provided by hardware.
@@ -290,6 +294,7 @@ typedef struct drm_i915_irq_wait {
 #define I915_PARAM_HAS_RELAXED_DELTA	 15
 #define I915_PARAM_HAS_GEN7_SOL_RESET	 16
 #define I915_PARAM_HAS_LLC		 17
+#define I915_PARAM_HAS_UNSYNCHRONIZED	 64	/* no upstream equivalent */
 
 typedef struct drm_i915_getparam {
 	int param;
@@ -712,6 +717,34 @@ struct drm_i915_get_pipe_from_crtc_id {
 	uint32_t pipe;
 };
 
+struct drm_i915_gem_userptr {
+	/**
+	 * Page aligned start and size of the user range.  The range must
+	 * be the start of a shared anonymous mapping, such as an attached
+	 * SysV shared memory segment, mapped read/write.
+	 */
+	uint64_t user_ptr;
+	uint64_t user_size;
+
+	/** Must be zero. */
+	uint32_t flags;
+
+	/** Returned handle for the object. */
+	uint32_t handle;
+};
+
+struct drm_i915_gem_unsynchronized {
+	/** Handle of the buffer */
+	uint32_t handle;
+
+	/**
+	 * Nonzero if userland will sync its gtt accesses to the buffer
+	 * itself: mappings then survive execbuffer and faults don't wait
+	 * for rendering.  Zero restores the default.
+	 */
+	uint32_t enable;
+};
+
 #define I915_MADV_WILLNEED 0
 #define I915_MADV_DONTNEED 1
 #define __I915_MADV_PURGED 2 /* internal state */
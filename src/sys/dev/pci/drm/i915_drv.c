@@ -135,6 +135,7 @@ int	inteldrm_getparam(struct inteldrm_softc *dev_priv, void *data);
 int	inteldrm_setparam(struct inteldrm_softc *dev_priv, void *data);
 int	i915_gem_init_ioctl(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_create_ioctl(struct drm_device *, void *, struct drm_file *);
+int	i915_gem_userptr_ioctl(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_pread_ioctl(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_pwrite_ioctl(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_set_domain_ioctl(struct drm_device *, void *,
@@ -151,6 +152,8 @@ int	i915_gem_set_tiling(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_get_tiling(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_gtt_map_ioctl(struct drm_device *, void *, struct drm_file *);
 int	i915_gem_madvise_ioctl(struct drm_device *, void *, struct drm_file *);
+int	i915_gem_unsynchronized_ioctl(struct drm_device *, void *,
+	    struct drm_file *);
 
 /* GEM memory manager functions */
 int	i915_gem_init_object(struct drm_obj *);
@@ -161,6 +164,7 @@ void	i915_gem_retire_requests(struct inteldrm_softc *);
 void	i915_gem_retire_request(struct inteldrm_softc *,
 	    struct inteldrm_request *);
 void	i915_gem_retire_work_handler(void *, void*);
+void	i915_gem_retire_schedule(struct inteldrm_softc *);
 int	i915_gem_idle(struct inteldrm_softc *);
 void	i915_gem_object_move_to_active(struct drm_obj *);
 void	i915_gem_object_move_off_active(struct drm_obj *);
@@ -176,7 +180,7 @@ int	i915_gem_init_ringbuffer(struct inteldrm_softc *);
 int	inteldrm_start_ring(struct inteldrm_softc *);
 void	i915_gem_cleanup_ringbuffer(struct inteldrm_softc *);
 int	i915_gem_ring_throttle(struct drm_device *, struct drm_file *);
-int	i915_gem_evict_inactive(struct inteldrm_softc *, int);
+int	i915_gem_evict_inactive(struct inteldrm_softc *, int, int);
 int	i915_gem_get_relocs_from_user(struct drm_i915_gem_exec_object2 *,
 	    u_int32_t, struct drm_i915_gem_relocation_entry **);
 int	i915_gem_put_relocs_to_user(struct drm_i915_gem_exec_object2 *,
@@ -191,13 +195,18 @@ int	i915_gem_object_bind_to_gtt(struct drm_obj *, bus_size_t, int);
 int	i915_wait_request(struct inteldrm_softc *, uint32_t, int);
 u_int32_t	i915_gem_flush(struct inteldrm_softc *, uint32_t, uint32_t);
 int	i915_gem_object_unbind(struct drm_obj *, int);
+int	i915_gem_object_unbind_lazy(struct drm_obj *, int);
+int	i915_gem_object_rebind_stale(struct drm_obj *, bus_size_t);
+void	i915_gem_object_reap_stale(struct drm_obj *);
+int	i915_gem_reap_stale_one(struct inteldrm_softc *);
+void	i915_gem_reap_stale(struct inteldrm_softc *);
 
 struct drm_obj	*i915_gem_find_inactive_object(struct inteldrm_softc *,
 		     size_t);
 
-int	i915_gem_evict_everything(struct inteldrm_softc *, int);
+int	i915_gem_evict_everything(struct inteldrm_softc *, int, int);
 int	i915_gem_evict_something(struct inteldrm_softc *, size_t, int);
-int	i915_gem_object_set_to_gtt_domain(struct drm_obj *, int, int);
+int	i915_gem_object_set_to_gtt_domain(struct drm_obj *, int, int, int);
 int	i915_gem_object_set_to_cpu_domain(struct drm_obj *, int, int);
 int	i915_gem_object_flush_gpu_write_domain(struct drm_obj *, int, int, int);
 int	i915_gem_get_fence_reg(struct drm_obj *, int);
@@ -574,7 +583,9 @@ inteldrm_attach(struct device *parent, struct device *self, void *aux)
 	TAILQ_INIT(&dev_priv->mm.active_list);
 	TAILQ_INIT(&dev_priv->mm.flushing_list);
 	TAILQ_INIT(&dev_priv->mm.inactive_list);
-	TAILQ_INIT(&dev_priv->mm.gpu_write_list);
+	TAILQ_INIT(&dev_priv->mm.stale_list);
+	for (i = 0; i < I915_GEM_WRITE_DOMAINS; i++)
+		TAILQ_INIT(&dev_priv->mm.gpu_write_list[i]);
 	TAILQ_INIT(&dev_priv->mm.request_list);
 	TAILQ_INIT(&dev_priv->mm.fence_list);
 	timeout_set(&dev_priv->mm.retire_timer, inteldrm_timeout, dev_priv);
@@ -582,6 +593,32 @@ inteldrm_attach(struct device *parent, struct device *self, void *aux)
 	dev_priv->mm.next_gem_seqno = 1;
 	dev_priv->mm.suspended = 1;
 
+#if defined(__NetBSD__)
+	evcnt_attach_dynamic(&dev_priv->ev_gtt_lazy_unbinds, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "gtt lazy unbinds");
+	evcnt_attach_dynamic(&dev_priv->ev_gtt_stale_rebinds, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "gtt stale rebinds");
+	evcnt_attach_dynamic(&dev_priv->ev_gtt_stale_reaps, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "gtt stale reaps");
+	evcnt_attach_dynamic(&dev_priv->ev_gtt_ptes_avoided, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "gtt pte writes avoided");
+	evcnt_attach_dynamic(&dev_priv->ev_hang_kicks, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "hangcheck ring kicks");
+	evcnt_attach_dynamic(&dev_priv->ev_hang_render_resets, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "hangcheck render resets");
+	evcnt_attach_dynamic(&dev_priv->ev_hang_full_resets, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "hangcheck full resets");
+	evcnt_attach_dynamic(&dev_priv->ev_hang_kick_recoveries,
+	    EVCNT_TYPE_MISC, NULL, device_xname(self),
+	    "hangcheck kicks recovered");
+	evcnt_attach_dynamic(&dev_priv->ev_hang_detect_ms, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "hangcheck detection ms");
+	evcnt_attach_dynamic(&dev_priv->ev_retire_irqs, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "retire interrupts");
+	evcnt_attach_dynamic(&dev_priv->ev_retire_tasks, EVCNT_TYPE_MISC,
+	    NULL, device_xname(self), "retire tasks");
+#endif /* defined(__NetBSD__) */
+
 	/* On GEN3 we really need to make sure the ARB C3 LP bit is set */
 	if (IS_GEN3(dev_priv)) {
 		u_int32_t tmp = I915_READ(MI_ARB_STATE);
@@ -775,6 +812,17 @@ inteldrm_detach(struct device *self, int flags)
 	pci_intr_disestablish(dev_priv->pc, dev_priv->irqh);
 
 #if defined(__NetBSD__)
+	evcnt_detach(&dev_priv->ev_gtt_lazy_unbinds);
+	evcnt_detach(&dev_priv->ev_gtt_stale_rebinds);
+	evcnt_detach(&dev_priv->ev_gtt_stale_reaps);
+	evcnt_detach(&dev_priv->ev_gtt_ptes_avoided);
+	evcnt_detach(&dev_priv->ev_hang_kicks);
+	evcnt_detach(&dev_priv->ev_hang_render_resets);
+	evcnt_detach(&dev_priv->ev_hang_full_resets);
+	evcnt_detach(&dev_priv->ev_hang_kick_recoveries);
+	evcnt_detach(&dev_priv->ev_hang_detect_ms);
+	evcnt_detach(&dev_priv->ev_retire_irqs);
+	evcnt_detach(&dev_priv->ev_retire_tasks);
 	cv_destroy(&dev_priv->condvar);
 	mutex_destroy(&dev_priv->fence_lock);
 	mutex_destroy(&dev_priv->request_lock);
@@ -908,6 +956,8 @@ inteldrm_doioctl(struct drm_device *dev, u_long cmd, caddr_t data,
 			return (i915_gem_gtt_map_ioctl(dev, data, file_priv));
 		case DRM_IOCTL_I915_GEM_CREATE:
 			return (i915_gem_create_ioctl(dev, data, file_priv));
+		case DRM_IOCTL_I915_GEM_USERPTR:
+			return (i915_gem_userptr_ioctl(dev, data, file_priv));
 		case DRM_IOCTL_I915_GEM_PREAD:
 			return (i915_gem_pread_ioctl(dev, data, file_priv));
 		case DRM_IOCTL_I915_GEM_PWRITE:
@@ -924,6 +974,9 @@ inteldrm_doioctl(struct drm_device *dev, u_long cmd, caddr_t data,
 			    file_priv));
 		case DRM_IOCTL_I915_GEM_MADVISE:
 			return (i915_gem_madvise_ioctl(dev, data, file_priv));
+		case DRM_IOCTL_I915_GEM_UNSYNCHRONIZED:
+			return (i915_gem_unsynchronized_ioctl(dev, data,
+			    file_priv));
 		default:
 			break;
 		}
@@ -985,9 +1038,10 @@ inteldrm_ironlake_intr(void *arg)
 #else /* !defined(__NetBSD__) */
 		cv_broadcast(&dev_priv->condvar);
 #endif /* !defined(__NetBSD__) */
+		i915_gem_retire_schedule(dev_priv);
 		mtx_leave(&dev_priv->user_irq_lock);
-		dev_priv->mm.hang_cnt = 0;
-		timeout_add_msec(&dev_priv->mm.hang_timer, 750);
+		timeout_add_msec(&dev_priv->mm.hang_timer,
+		    inteldrm_hangcheck_period);
 	}
 	if (gt_iir & GT_MASTER_ERROR)
 		inteldrm_error(dev_priv);
@@ -1061,8 +1115,9 @@ inteldrm_intr(void *arg)
 #else /* !defined(__NetBSD__) */
 		cv_broadcast(&dev_priv->condvar);
 #endif /* !defined(__NetBSD__) */
-		dev_priv->mm.hang_cnt = 0;
-		timeout_add_msec(&dev_priv->mm.hang_timer, 750);
+		i915_gem_retire_schedule(dev_priv);
+		timeout_add_msec(&dev_priv->mm.hang_timer,
+		    inteldrm_hangcheck_period);
 	}
 
 	mtx_leave(&dev_priv->user_irq_lock);
@@ -1428,6 +1483,7 @@ inteldrm_getparam(struct inteldrm_softc *dev_priv, void *data)
 		value = dev_priv->num_fence_regs - dev_priv->fence_reg_start;
 		break;
 	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_UNSYNCHRONIZED:
 		value = 1;
 		break;
 	default:
@@ -1571,6 +1627,74 @@ i915_gem_create_ioctl(struct drm_device *dev, void *data,
 	return (ret);
 }
 
+/**
+ * Creates an object sharing the pages of a range of the caller's address
+ * space and returns a handle to it, so the gpu can use the data in place.
+ *
+ * Rather than wiring arbitrary user pages, which would go stale once the
+ * range is unmapped, the range must be the start of a shared mapping of an
+ * anonymous uvm object, as for an attached SysV shared memory segment. The
+ * object takes its own reference to that uvm object, so the pages outlive
+ * any later munmap or shmdt and are wired and bound like any other object's.
+ */
+int
+i915_gem_userptr_ioctl(struct drm_device *dev, void *data,
+    struct drm_file *file_priv)
+{
+	struct inteldrm_softc		*dev_priv = device_private(dev->dev_private);
+	struct drm_i915_gem_userptr	*args = data;
+	struct vm_map			*map = &curproc->p_vmspace->vm_map;
+	struct vm_map_entry		*entry;
+	struct uvm_object		*uao;
+	struct drm_obj			*obj;
+	vaddr_t				 start;
+	vsize_t				 size;
+	int				 handle, ret;
+
+	if (args->flags != 0)
+		return (EINVAL);
+	start = (vaddr_t)args->user_ptr;
+	size = (vsize_t)args->user_size;
+	if (start != args->user_ptr || size != args->user_size ||
+	    size == 0 || (start & PAGE_MASK) != 0 || (size & PAGE_MASK) != 0)
+		return (EINVAL);
+	if (size > dev_priv->max_gem_obj_size)
+		return (EFBIG);
+
+	vm_map_lock_read(map);
+	if (uvm_map_lookup_entry(map, start, &entry) == FALSE ||
+	    UVM_ET_ISSUBMAP(entry) || entry->aref.ar_amap != NULL ||
+	    (uao = entry->object.uvm_obj) == NULL || !UVM_OBJ_IS_AOBJ(uao) ||
+	    entry->offset + (start - entry->start) != 0 ||
+	    entry->end - start < size) {
+		vm_map_unlock_read(map);
+		return (EINVAL);
+	}
+	if ((entry->protection & (VM_PROT_READ | VM_PROT_WRITE)) !=
+	    (VM_PROT_READ | VM_PROT_WRITE)) {
+		vm_map_unlock_read(map);
+		return (EACCES);
+	}
+	uao_reference(uao);
+	vm_map_unlock_read(map);
+
+	/* the new object takes over our reference to uao */
+	obj = drm_gem_object_alloc_uao(dev, uao, size);
+	if (obj == NULL)
+		return (ENOMEM);
+	atomic_setbits_int(&obj->do_flags, I915_USERPTR);
+
+	/* we give our reference to the handle */
+	ret = drm_handle_create(file_priv, obj, &handle);
+
+	if (ret == 0)
+		args->handle = handle;
+	else
+		drm_unref(&obj->uobj);
+
+	return (ret);
+}
+
 /**
  * Reads data from the object referenced by handle.
  *
@@ -1609,7 +1733,7 @@ i915_gem_pread_ioctl(struct drm_device *dev, void *data,
 	if (ret) {
 		goto out;
 	}
-	ret = i915_gem_object_set_to_gtt_domain(obj, 0, 1);
+	ret = i915_gem_object_set_to_gtt_domain(obj, 0, 0, 1);
 	if (ret)
 		goto unpin;
 
@@ -1678,7 +1802,7 @@ i915_gem_pwrite_ioctl(struct drm_device *dev, void *data,
 	if (ret) {
 		goto out;
 	}
-	ret = i915_gem_object_set_to_gtt_domain(obj, 1, 1);
+	ret = i915_gem_object_set_to_gtt_domain(obj, 1, 0, 1);
 	if (ret)
 		goto unpin;
 
@@ -1740,7 +1864,7 @@ i915_gem_set_domain_ioctl(struct drm_device *dev, void *data,
 		return (EBADF);
 	drm_hold_object(obj);
 
-	ret = i915_gem_object_set_to_gtt_domain(obj, write_domain != 0, 1);
+	ret = i915_gem_object_set_to_gtt_domain(obj, write_domain != 0, 0, 1);
 
 	drm_unhold_and_unref(obj);
 	/*
@@ -1942,20 +2066,24 @@ void
 inteldrm_process_flushing(struct inteldrm_softc *dev_priv,
     u_int32_t flush_domains)
 {
-	struct inteldrm_obj		*obj_priv, *next;
+	struct i915_gem_list		*head;
+	struct inteldrm_obj		*obj_priv;
+	u_int32_t			 domain;
 
 	MUTEX_ASSERT_LOCKED(&dev_priv->request_lock);
 	mtx_enter(&dev_priv->list_lock);
-	for (obj_priv = TAILQ_FIRST(&dev_priv->mm.gpu_write_list);
-	    obj_priv != TAILQ_END(&dev_priv->mm.gpu_write_list);
-	    obj_priv = next) {
-		struct drm_obj *obj = &(obj_priv->obj);
-
-		next = TAILQ_NEXT(obj_priv, write_list);
-
-		if ((obj->write_domain & flush_domains)) {
-			TAILQ_REMOVE(&dev_priv->mm.gpu_write_list,
-			    obj_priv, write_list);
+	/* write domains are single bits, so each list is flushed whole */
+	flush_domains &= (1 << I915_GEM_WRITE_DOMAINS) - 1;
+	while (flush_domains != 0) {
+		domain = flush_domains & -flush_domains;
+		flush_domains &= ~domain;
+		head = i915_gem_write_list(dev_priv, domain);
+
+		while ((obj_priv = TAILQ_FIRST(head)) != NULL) {
+			struct drm_obj *obj = &(obj_priv->obj);
+
+			KASSERT(obj->write_domain == domain);
+			TAILQ_REMOVE(head, obj_priv, write_list);
 			atomic_clearbits_int(&obj->do_flags,
 			     I915_GPU_WRITE);
 			i915_gem_object_move_to_active(obj);
@@ -1970,7 +2098,6 @@ inteldrm_process_flushing(struct inteldrm_softc *dev_priv,
 				 */
 				i915_gem_get_fence_reg(obj, 1);
 			}
-
 		}
 	}
 	mtx_leave(&dev_priv->list_lock);
@@ -2027,10 +2154,19 @@ i915_add_request(struct inteldrm_softc *dev_priv)
 	TAILQ_INSERT_TAIL(&dev_priv->mm.request_list, request, list);
 
 	if (dev_priv->mm.suspended == 0) {
-		if (was_empty)
+		if (was_empty) {
+			/* keep the user irq on so completion drives retiring */
+			mtx_enter(&dev_priv->user_irq_lock);
+			if (dev_priv->mm.retire_irq == 0) {
+				dev_priv->mm.retire_irq = 1;
+				i915_user_irq_get(dev_priv);
+			}
+			mtx_leave(&dev_priv->user_irq_lock);
 			timeout_add_sec(&dev_priv->mm.retire_timer, 1);
+		}
 		/* XXX was_empty? */
-		timeout_add_msec(&dev_priv->mm.hang_timer, 750);
+		timeout_add_msec(&dev_priv->mm.hang_timer,
+		    inteldrm_hangcheck_period);
 	}
 	return seqno;
 }
@@ -2050,7 +2186,10 @@ i915_gem_retire_request(struct inteldrm_softc *dev_priv,
 	MUTEX_ASSERT_LOCKED(&dev_priv->request_lock);
 	mtx_enter(&dev_priv->list_lock);
 	/* Move any buffers on the active list that are no longer referenced
-	 * by the ringbuffer to the flushing/inactive lists as appropriate.  */
+	 * by the ringbuffer to the flushing/inactive lists as appropriate.
+	 * The active list is kept in seqno order (objects only ever join it
+	 * at the tail with next_gem_seqno), so the objects of this request
+	 * are exactly the run at its head and nothing else is looked at. */
 	while ((obj_priv  = TAILQ_FIRST(&dev_priv->mm.active_list)) != NULL) {
 		struct drm_obj *obj = &obj_priv->obj;
 
@@ -2109,14 +2248,50 @@ i915_gem_retire_requests(struct inteldrm_softc *dev_priv)
 		} else
 			break;
 	}
+	/* nothing left to complete, stop taking interrupts for it */
+	if (TAILQ_EMPTY(&dev_priv->mm.request_list)) {
+		mtx_enter(&dev_priv->user_irq_lock);
+		if (dev_priv->mm.retire_irq) {
+			dev_priv->mm.retire_irq = 0;
+			i915_user_irq_put(dev_priv);
+		}
+		mtx_leave(&dev_priv->user_irq_lock);
+	}
 	mtx_leave(&dev_priv->request_lock);
 }
 
+/*
+ * Queue a retire task from the interrupt handler.  Further interrupts
+ * coalesce into the pending task until it has started running.
+ *
+ * Called with user_irq_lock held.
+ */
+void
+i915_gem_retire_schedule(struct inteldrm_softc *dev_priv)
+{
+	MUTEX_ASSERT_LOCKED(&dev_priv->user_irq_lock);
+
+	INTELDRM_EVCNT_INCR(dev_priv, retire_irqs);
+	if (dev_priv->mm.retire_pending)
+		return;
+	if (workq_add_task(dev_priv->workq, 0, i915_gem_retire_work_handler,
+	    dev_priv, NULL) == 0) {
+		dev_priv->mm.retire_pending = 1;
+		INTELDRM_EVCNT_INCR(dev_priv, retire_tasks);
+	}
+	/* otherwise the retire timer will pick it up */
+}
+
 void
 i915_gem_retire_work_handler(void *arg1, void *unused)
 {
 	struct inteldrm_softc	*dev_priv = arg1;
 
+	/* interrupts from here on need another pass */
+	mtx_enter(&dev_priv->user_irq_lock);
+	dev_priv->mm.retire_pending = 0;
+	mtx_leave(&dev_priv->user_irq_lock);
+
 	i915_gem_retire_requests(dev_priv);
 	if (!TAILQ_EMPTY(&dev_priv->mm.request_list))
 		timeout_add_sec(&dev_priv->mm.retire_timer, 1);
@@ -2259,10 +2434,15 @@ i915_gem_flush(struct inteldrm_softc *dev_priv, uint32_t invalidate_domains,
 /**
  * Unbinds an object from the GTT aperture.
  *
+ * If lazy is set and the object is not purgeable, the GTT binding is only
+ * forgotten: the dmamap stays loaded, the pages stay wired and the object
+ * goes on the stale list until the space is needed (see
+ * i915_gem_reap_stale_one()) or it is rebound at the same offset.
+ *
  * XXX track dirty and pass down to uvm (note, DONTNEED buffers are clean).
  */
-int
-i915_gem_object_unbind(struct drm_obj *obj, int interruptible)
+static int
+i915_gem_object_do_unbind(struct drm_obj *obj, int interruptible, int lazy)
 {
 	struct drm_device	*dev = obj->dev;
 	struct inteldrm_softc	*dev_priv = device_private(dev->dev_private);
@@ -2274,8 +2454,11 @@ i915_gem_object_unbind(struct drm_obj *obj, int interruptible)
 	 * if it's already unbound, or we've already done lastclose, just
 	 * let it happen. XXX does this fail to unwire?
 	 */
-	if (obj_priv->dmamap == NULL || dev_priv->agpdmat == NULL)
+	if (obj_priv->dmamap == NULL || dev_priv->agpdmat == NULL) {
+		if (!lazy)
+			i915_gem_object_reap_stale(obj);
 		return 0;
+	}
 
 	if (obj_priv->pin_count != 0) {
 		DRM_ERROR("Attempting to unbind pinned buffer\n");
@@ -2299,10 +2482,33 @@ i915_gem_object_unbind(struct drm_obj *obj, int interruptible)
 	/* if it's purgeable don't bother dirtying the pages */
 	if (i915_obj_purgeable(obj_priv))
 		atomic_clearbits_int(&obj->do_flags, I915_DIRTY);
+	i915_gem_save_bit_17_swizzle(obj);
+
+	if (lazy && !i915_obj_purgeable(obj_priv)) {
+		/*
+		 * Leave the PTEs and the wiring alone, the GPU can't be
+		 * using the range any more and nobody else gets it until
+		 * we are reaped.
+		 */
+		obj_priv->stale_dmamap = obj_priv->dmamap;
+		obj_priv->stale_segs = obj_priv->dma_segs;
+		obj_priv->stale_offset = obj_priv->gtt_offset;
+		obj_priv->dmamap = NULL;
+		obj_priv->dma_segs = NULL;
+		obj_priv->gtt_offset = 0;
+		atomic_dec(&dev->gtt_count);
+		atomic_sub(obj->size, &dev->gtt_memory);
+
+		mtx_enter(&dev_priv->list_lock);
+		i915_move_to_tail(obj_priv, &dev_priv->mm.stale_list);
+		mtx_leave(&dev_priv->list_lock);
+		INTELDRM_EVCNT_INCR(dev_priv, gtt_lazy_unbinds);
+		return (0);
+	}
+
 	/*
 	 * unload the map, then unwire the backing object.
 	 */
-	i915_gem_save_bit_17_swizzle(obj);
 	bus_dmamap_unload(dev_priv->agpdmat, obj_priv->dmamap);
 	uvm_objunwire(obj->uao, 0, obj->size);
 	/* XXX persistent dmamap worth the memory? */
@@ -2326,6 +2532,165 @@ i915_gem_object_unbind(struct drm_obj *obj, int interruptible)
 	return (0);
 }
 
+int
+i915_gem_object_unbind(struct drm_obj *obj, int interruptible)
+{
+	return (i915_gem_object_do_unbind(obj, interruptible, 0));
+}
+
+/*
+ * Unbind without giving the range back: keep the binding around in case
+ * the object comes back before anybody else wants the range.  This frees
+ * no aperture space, so it is only for unbinds that are not made to fit
+ * a particular object (see i915_gem_evict_everything()).
+ */
+int
+i915_gem_object_unbind_lazy(struct drm_obj *obj, int interruptible)
+{
+	return (i915_gem_object_do_unbind(obj, interruptible, 1));
+}
+
+/*
+ * Tear down the binding left behind by a lazy unbind, if any.
+ */
+void
+i915_gem_object_reap_stale(struct drm_obj *obj)
+{
+	struct drm_device	*dev = obj->dev;
+	struct inteldrm_softc	*dev_priv = device_private(dev->dev_private);
+	struct inteldrm_obj	*obj_priv = (struct inteldrm_obj *)obj;
+
+	DRM_ASSERT_HELD(obj);
+	if (obj_priv->stale_dmamap == NULL)
+		return;
+
+	mtx_enter(&dev_priv->list_lock);
+	i915_list_remove(obj_priv);
+	mtx_leave(&dev_priv->list_lock);
+
+	bus_dmamap_unload(dev_priv->agpdmat, obj_priv->stale_dmamap);
+	uvm_objunwire(obj->uao, 0, obj->size);
+	bus_dmamap_destroy(dev_priv->agpdmat, obj_priv->stale_dmamap);
+	obj_priv->stale_dmamap = NULL;
+	free(obj_priv->stale_segs, M_DRM);
+	obj_priv->stale_segs = NULL;
+	obj_priv->stale_offset = 0;
+	/* XXX this should change whether we tell uvm the page is dirty */
+	atomic_clearbits_int(&obj->do_flags, I915_DIRTY);
+
+	INTELDRM_EVCNT_INCR(dev_priv, gtt_stale_reaps);
+}
+
+/*
+ * Try to bring back the binding left behind by a lazy unbind.  This only
+ * works if the old offset still satisfies alignment and fencing, in which
+ * case neither the PTEs nor the wiring need touching.  Otherwise the stale
+ * binding is torn down.  Returns non-zero if the object is bound again.
+ */
+int
+i915_gem_object_rebind_stale(struct drm_obj *obj, bus_size_t alignment)
+{
+	struct drm_device	*dev = obj->dev;
+	struct inteldrm_softc	*dev_priv = device_private(dev->dev_private);
+	struct inteldrm_obj	*obj_priv = (struct inteldrm_obj *)obj;
+
+	DRM_ASSERT_HELD(obj);
+	KASSERT(obj_priv->dmamap == NULL);
+	if (obj_priv->stale_dmamap == NULL)
+		return (0);
+
+	obj_priv->dmamap = obj_priv->stale_dmamap;
+	obj_priv->gtt_offset = obj_priv->stale_offset;
+	if ((obj_priv->gtt_offset & (alignment - 1)) != 0 ||
+	    !i915_gem_object_fence_offset_ok(obj, obj_priv->tiling_mode)) {
+		obj_priv->dmamap = NULL;
+		obj_priv->gtt_offset = 0;
+		i915_gem_object_reap_stale(obj);
+		return (0);
+	}
+
+	mtx_enter(&dev_priv->list_lock);
+	i915_list_remove(obj_priv);
+	mtx_leave(&dev_priv->list_lock);
+
+	obj_priv->dma_segs = obj_priv->stale_segs;
+	obj_priv->stale_dmamap = NULL;
+	obj_priv->stale_segs = NULL;
+	obj_priv->stale_offset = 0;
+
+	atomic_inc(&dev->gtt_count);
+	atomic_add(obj->size, &dev->gtt_memory);
+
+	/* one scratch PTE on unbind and one real PTE on bind, per page */
+	INTELDRM_EVCNT_INCR(dev_priv, gtt_stale_rebinds);
+	INTELDRM_EVCNT_ADD(dev_priv, gtt_ptes_avoided,
+	    2 * (obj->size >> PAGE_SHIFT));
+	return (1);
+}
+
+/*
+ * Give back the GTT range of the least recently unbound stale object that
+ * we can get a hold on.  Objects of the execbuffer being fitted are only
+ * taken when nothing else is left, since they are about to be rebound.
+ * Returns non-zero if some space was freed.
+ */
+int
+i915_gem_reap_stale_one(struct inteldrm_softc *dev_priv)
+{
+	struct drm_obj		*obj = NULL;
+	struct inteldrm_obj	*obj_priv;
+	int			 pass;
+
+	mtx_enter(&dev_priv->list_lock);
+	for (pass = 0; pass < 2 && obj == NULL; pass++) {
+		TAILQ_FOREACH(obj_priv, &dev_priv->mm.stale_list, list) {
+			obj = &obj_priv->obj;
+			if (pass == 0 && (obj->do_flags & I915_IN_EXEC)) {
+				obj = NULL;
+				continue;
+			}
+			drm_ref(&obj->uobj);
+			/* we may well be holding some of these in execbuffer */
+			if (drm_try_hold_object(obj))
+				break;
+			drm_unref(&obj->uobj);
+			obj = NULL;
+		}
+	}
+	mtx_leave(&dev_priv->list_lock);
+
+	if (obj == NULL)
+		return (0);
+
+	i915_gem_object_reap_stale(obj);
+	drm_unhold_and_unref(obj);
+	return (1);
+}
+
+/*
+ * Tear down every stale binding, for when the GTT is about to go away or
+ * can't be trusted any more.
+ */
+void
+i915_gem_reap_stale(struct inteldrm_softc *dev_priv)
+{
+	struct inteldrm_obj	*obj_priv;
+
+	mtx_enter(&dev_priv->list_lock);
+	while ((obj_priv = TAILQ_FIRST(&dev_priv->mm.stale_list)) != NULL) {
+		/* reference it so that we can frob it outside the lock */
+		drm_ref(&obj_priv->obj.uobj);
+		mtx_leave(&dev_priv->list_lock);
+
+		drm_hold_object(&obj_priv->obj);
+		i915_gem_object_reap_stale(&obj_priv->obj);
+		drm_unhold_and_unref(&obj_priv->obj);
+
+		mtx_enter(&dev_priv->list_lock);
+	}
+	mtx_leave(&dev_priv->list_lock);
+}
+
 int
 i915_gem_evict_something(struct inteldrm_softc *dev_priv, size_t min_size,
     int interruptible)
@@ -2406,10 +2771,10 @@ i915_gem_evict_something(struct inteldrm_softc *dev_priv, size_t min_size,
 		 */
 		if (!TAILQ_EMPTY(&dev_priv->mm.inactive_list))
 			return (i915_gem_evict_inactive(dev_priv,
-			    interruptible));
+			    interruptible, 0));
 		else
 			return (i915_gem_evict_everything(dev_priv,
-			    interruptible));
+			    interruptible, 0));
 	}
 	/* NOTREACHED */
 }
@@ -2457,8 +2822,14 @@ i915_gem_find_inactive_object(struct inteldrm_softc *dev_priv,
 	return (best);
 }
 
+/*
+ * Flush and unbind everything that isn't pinned.  If lazy is set the
+ * bindings are parked on the stale list instead of being torn down, for
+ * callers that are about to bind most of the same objects again.
+ */
 int
-i915_gem_evict_everything(struct inteldrm_softc *dev_priv, int interruptible)
+i915_gem_evict_everything(struct inteldrm_softc *dev_priv, int interruptible,
+    int lazy)
 {
 	u_int32_t	seqno;
 	int		ret;
@@ -2474,7 +2845,7 @@ i915_gem_evict_everything(struct inteldrm_softc *dev_priv, int interruptible)
 		return (ENOMEM);
 
 	if ((ret = i915_wait_request(dev_priv, seqno, interruptible)) != 0 ||
-	    (ret = i915_gem_evict_inactive(dev_priv, interruptible)) != 0)
+	    (ret = i915_gem_evict_inactive(dev_priv, interruptible, lazy)) != 0)
 		return (ret);
 
 	/*
@@ -2941,12 +3312,12 @@ inteldrm_fault(struct drm_obj *obj, struct uvm_faultinfo *ufi, off_t offset,
 	}
 
 	/*
-	 * We could only do this on bind so allow for map_buffer_range
-	 * unsynchronised objects (where buffer suballocation
-	 * is done by the GL application), however it gives coherency problems
-	 * normally.
+	 * Objects userland has marked unsynchronized (where buffer
+	 * suballocation is done by the GL application) only get their flush
+	 * queued; waiting for the gpu is up to userland.
 	 */
-	ret = i915_gem_object_set_to_gtt_domain(obj, write, 0);
+	ret = i915_gem_object_set_to_gtt_domain(obj, write,
+	    (obj->do_flags & I915_UNSYNCHRONIZED) != 0, 0);
 	if (ret) {
 		printf("%s: failed to set to gtt (%d)\n",
 		    __func__, ret);
@@ -3064,6 +3435,10 @@ i915_gem_object_bind_to_gtt(struct drm_obj *obj, bus_size_t alignment,
 		return (EINVAL);
 	}
 
+	/* Lazily unbound at a suitable offset?  Then there's nothing to do. */
+	if (i915_gem_object_rebind_stale(obj, alignment))
+		return (0);
+
 	if ((ret = bus_dmamap_create(dev_priv->agpdmat, obj->size, 1,
 	    obj->size, 0, BUS_DMA_WAITOK, &obj_priv->dmamap)) != 0) {
 		DRM_ERROR("Failed to create dmamap: %d\n", ret);
@@ -3087,11 +3462,16 @@ i915_gem_object_bind_to_gtt(struct drm_obj *obj, bus_size_t alignment,
 		 */
 		if (TAILQ_EMPTY(&dev_priv->mm.inactive_list) &&
 		    TAILQ_EMPTY(&dev_priv->mm.flushing_list) &&
-		    TAILQ_EMPTY(&dev_priv->mm.active_list)) {
+		    TAILQ_EMPTY(&dev_priv->mm.active_list) &&
+		    TAILQ_EMPTY(&dev_priv->mm.stale_list)) {
 			DRM_ERROR("GTT full, but LRU list empty\n");
 			goto error;
 		}
 
+		/* Stale bindings go first, they are free to take back. */
+		if (i915_gem_reap_stale_one(dev_priv))
+			goto search_free;
+
 		ret = i915_gem_evict_something(dev_priv, obj->size,
 		    interruptible);
 		if (ret != 0)
@@ -3164,11 +3544,12 @@ i915_gem_object_flush_gpu_write_domain(struct drm_obj *obj, int pipelined,
  * Moves a single object to the GTT and possibly write domain.
  *
  * This function returns when the move is complete, including waiting on
- * flushes to occur.
+ * flushes to occur, unless pipelined is set, in which case any flush is
+ * only queued.
  */
 int
 i915_gem_object_set_to_gtt_domain(struct drm_obj *obj, int write,
-    int interruptible)
+    int pipelined, int interruptible)
 {
 	struct drm_device	*dev = obj->dev;
 	struct inteldrm_softc	*dev_priv = device_private(dev->dev_private);
@@ -3181,7 +3562,7 @@ i915_gem_object_set_to_gtt_domain(struct drm_obj *obj, int write,
 		return (EINVAL);
 
 	/* Wait on any GPU rendering and flushing to occur. */
-	if ((ret = i915_gem_object_flush_gpu_write_domain(obj, 0,
+	if ((ret = i915_gem_object_flush_gpu_write_domain(obj, pipelined,
 	    interruptible, write)) != 0)
 		return (ret);
 
@@ -3437,7 +3818,18 @@ i915_gem_object_set_to_gpu_domain(struct drm_obj *obj)
 		bus_dmamap_sync(dev_priv->agpdmat, obj_priv->dmamap, 0,
 		    obj->size, BUS_DMASYNC_PREREAD | BUS_DMASYNC_PREWRITE);
 	}
-	if ((flush_domains | invalidate_domains) & I915_GEM_DOMAIN_GTT) {
+	if (obj->do_flags & I915_UNSYNCHRONIZED) {
+		/*
+		 * Userland may write through its mapping at any time and
+		 * syncs for itself, so keep the mapping rather than making
+		 * the next access fault and wait, and invalidate every gpu
+		 * cache the object is read through instead.
+		 */
+		DRM_MEMORYBARRIER();
+		invalidate_domains |= obj->pending_read_domains &
+		    I915_GEM_GPU_DOMAINS;
+	} else if ((flush_domains | invalidate_domains) &
+	    I915_GEM_DOMAIN_GTT) {
 		inteldrm_wipe_mappings(obj);
 	}
 
@@ -3588,7 +3980,7 @@ i915_gem_object_pin_and_relocate(struct drm_obj *obj,
 			 continue;
 		}
 
-		ret = i915_gem_object_set_to_gtt_domain(obj, 1, 1);
+		ret = i915_gem_object_set_to_gtt_domain(obj, 1, 0, 1);
 		if (ret != 0)
 			goto err;
 
@@ -3868,8 +4260,12 @@ i915_gem_execbuffer2(struct drm_device *dev, void *data,
 			drm_unhold_object(object_list[i]);
 		}
 		pinned = 0;
-		/* evict everyone we can from the aperture */
-		ret = i915_gem_evict_everything(dev_priv, 1);
+		/*
+		 * evict everyone we can from the aperture.  Most of what we
+		 * evict is ours and comes straight back, so leave the
+		 * bindings in place until the space is actually needed.
+		 */
+		ret = i915_gem_evict_everything(dev_priv, 1, 1);
 		if (ret)
 			goto err;
 	}
@@ -3923,17 +4319,17 @@ i915_gem_execbuffer2(struct drm_device *dev, void *data,
 		obj_priv = (struct inteldrm_obj *)obj;
 		drm_lock_obj(obj);
 
-		obj->write_domain = obj->pending_write_domain;
 		/*
 		 * if we have a write domain, add us to the gpu write list
 		 * else we can remove the bit because it has been flushed.
 		 */
 		if (obj->do_flags & I915_GPU_WRITE)
-			TAILQ_REMOVE(&dev_priv->mm.gpu_write_list, obj_priv,
-			     write_list);
+			TAILQ_REMOVE(i915_gem_write_list(dev_priv,
+			    obj->write_domain), obj_priv, write_list);
+		obj->write_domain = obj->pending_write_domain;
 		if (obj->write_domain) {
-			TAILQ_INSERT_TAIL(&dev_priv->mm.gpu_write_list,
-			    obj_priv, write_list);
+			TAILQ_INSERT_TAIL(i915_gem_write_list(dev_priv,
+			    obj->write_domain), obj_priv, write_list);
 			atomic_setbits_int(&obj->do_flags, I915_GPU_WRITE);
 		} else {
 			atomic_clearbits_int(&obj->do_flags,
@@ -4126,7 +4522,7 @@ i915_gem_pin_ioctl(struct drm_device *dev, void *data,
 	/* XXX - flush the CPU caches for pinned objects
 	 * as the X server doesn't manage domains yet
 	 */
-	i915_gem_object_set_to_gtt_domain(obj, 1, 1);
+	i915_gem_object_set_to_gtt_domain(obj, 1, 0, 1);
 	args->offset = obj_priv->gtt_offset;
 
 out:
@@ -4188,24 +4584,21 @@ i915_gem_busy_ioctl(struct drm_device *dev, void *data,
 	}
 	
 	obj_priv = (struct inteldrm_obj *)obj;
-	args->busy = inteldrm_is_active(obj_priv);
-	if (args->busy) {
+	/*
+	 * Compare against the status page rather than retiring here, the
+	 * user interrupt takes care of moving the object off the active
+	 * list.
+	 */
+	args->busy = inteldrm_obj_busy(dev_priv, obj_priv);
+	if (args->busy && obj->write_domain) {
 		/*
 		 * Unconditionally flush objects write domain if they are
 		 * busy. The fact userland is calling this ioctl means that
 		 * it wants to use this buffer sooner rather than later, so
 		 * flushing now shoul reduce latency.
 		 */
-		if (obj->write_domain)
-			(void)i915_gem_flush(dev_priv, obj->write_domain,
-			    obj->write_domain);
-		/*
-		 * Update the active list after the flush otherwise this is
-		 * only updated on a delayed timer. Updating now reduces 
-		 * working set size.
-		 */
-		i915_gem_retire_requests(dev_priv);
-		args->busy = inteldrm_is_active(obj_priv);
+		(void)i915_gem_flush(dev_priv, obj->write_domain,
+		    obj->write_domain);
 	}
 
 	drm_unref(&obj->uobj);
@@ -4239,8 +4632,11 @@ i915_gem_madvise_ioctl(struct drm_device *dev, void *data,
 	drm_hold_object(obj);
 	obj_priv = (struct inteldrm_obj *)obj;
 
-	/* invalid to madvise on a pinned BO */
-	if (obj_priv->pin_count) {
+	/*
+	 * invalid to madvise on a pinned BO, or to let the pages a user
+	 * mapping shares with us be purged
+	 */
+	if (obj_priv->pin_count || (obj->do_flags & I915_USERPTR)) {
 		ret = EINVAL;
 		goto out;
 	}
@@ -4256,8 +4652,10 @@ i915_gem_madvise_ioctl(struct drm_device *dev, void *data,
 
 
 	/* if the object is no longer bound, discard its backing storage */
-	if (i915_obj_purgeable(obj_priv) && obj_priv->dmamap == NULL)
+	if (i915_obj_purgeable(obj_priv) && obj_priv->dmamap == NULL) {
+		i915_gem_object_reap_stale(obj);
 		inteldrm_purge_obj(obj);
+	}
 
 	args->retained = !i915_obj_purged(obj_priv);
 
@@ -4267,6 +4665,41 @@ out:
 	return (ret);
 }
 
+/*
+ * Marks an object as synchronized by userland, or clears the mark.  Gtt
+ * mappings of a marked object survive execbuffer and faults on it do not
+ * wait for the gpu, so userland can write into ranges it knows are idle
+ * while the rest of the object is still in use.
+ */
+int
+i915_gem_unsynchronized_ioctl(struct drm_device *dev, void *data,
+    struct drm_file *file_priv)
+{
+	struct drm_i915_gem_unsynchronized	*args = data;
+	struct drm_obj				*obj;
+	struct inteldrm_obj			*obj_priv;
+
+	obj = drm_gem_object_lookup(dev, file_priv, args->handle);
+	if (obj == NULL)
+		return (EBADF);
+
+	drm_hold_object(obj);
+	obj_priv = (struct inteldrm_obj *)obj;
+
+	if (args->enable) {
+		atomic_setbits_int(&obj->do_flags, I915_UNSYNCHRONIZED);
+	} else if (obj->do_flags & I915_UNSYNCHRONIZED) {
+		atomic_clearbits_int(&obj->do_flags, I915_UNSYNCHRONIZED);
+		/* make the next access fault and sync again */
+		if (obj_priv->dmamap != NULL)
+			inteldrm_wipe_mappings(obj);
+	}
+
+	drm_unhold_and_unref(obj);
+
+	return (0);
+}
+
 int
 i915_gem_init_object(struct drm_obj *obj)
 {
@@ -4307,9 +4740,13 @@ i915_gem_free_object(struct drm_obj *obj)
 	/* XXX dmatag went away? */
 }
 
-/* Clear out the inactive list and unbind everything in it. */
+/*
+ * Clear out the inactive list and unbind everything in it, lazily if
+ * asked to (see i915_gem_object_unbind_lazy()).
+ */
 int
-i915_gem_evict_inactive(struct inteldrm_softc *dev_priv, int interruptible)
+i915_gem_evict_inactive(struct inteldrm_softc *dev_priv, int interruptible,
+    int lazy)
 {
 	struct inteldrm_obj	*obj_priv;
 	int			 ret = 0;
@@ -4326,7 +4763,12 @@ i915_gem_evict_inactive(struct inteldrm_softc *dev_priv, int interruptible)
 		mtx_leave(&dev_priv->list_lock);
 
 		drm_hold_object(&obj_priv->obj);
-		ret = i915_gem_object_unbind(&obj_priv->obj, interruptible);
+		if (lazy)
+			ret = i915_gem_object_unbind_lazy(&obj_priv->obj,
+			    interruptible);
+		else
+			ret = i915_gem_object_unbind(&obj_priv->obj,
+			    interruptible);
 		drm_unhold_and_unref(&obj_priv->obj);
 
 		mtx_enter(&dev_priv->list_lock);
@@ -4363,7 +4805,8 @@ inteldrm_quiesce(struct inteldrm_softc *dev_priv)
 	/* KASSERT(dev->pin_count == 0); */
 
 	/* can't fail since uninterruptible */
-	(void)i915_gem_evict_inactive(dev_priv, 0);
+	(void)i915_gem_evict_inactive(dev_priv, 0, 0);
+	i915_gem_reap_stale(dev_priv);
 }
 
 int
@@ -4380,7 +4823,8 @@ i915_gem_idle(struct inteldrm_softc *dev_priv)
 	if (dev_priv->mm.suspended || dev_priv->ring.ring_obj == NULL) {
 		KASSERT(TAILQ_EMPTY(&dev_priv->mm.flushing_list));
 		KASSERT(TAILQ_EMPTY(&dev_priv->mm.active_list));
-		(void)i915_gem_evict_inactive(dev_priv, 0);
+		(void)i915_gem_evict_inactive(dev_priv, 0, 0);
+		i915_gem_reap_stale(dev_priv);
 		DRM_UNLOCK();
 		return (0);
 	}
@@ -4388,10 +4832,12 @@ i915_gem_idle(struct inteldrm_softc *dev_priv)
 	/*
 	 * To idle the gpu, flush anything pending then unbind the whole
 	 * shebang. If we're wedged, assume that the reset workq will clear
-	 * everything out and continue as normal.
+	 * everything out and continue as normal.  Stale bindings go either
+	 * way; lastclose must not find any left behind.
 	 */
-	if ((ret = i915_gem_evict_everything(dev_priv, 1)) != 0 &&
-	    ret != ENOSPC && ret != EIO) {
+	ret = i915_gem_evict_everything(dev_priv, 1, 0);
+	i915_gem_reap_stale(dev_priv);
+	if (ret != 0 && ret != ENOSPC && ret != EIO) {
 		DRM_UNLOCK();
 		return (ret);
 	}
@@ -4865,8 +5311,8 @@ inteldrm_hung(void *arg, void *reset_type)
 	while ((obj_priv = TAILQ_FIRST(&dev_priv->mm.flushing_list)) != NULL) {
 		drm_lock_obj(&obj_priv->obj);
 		if (obj_priv->obj.write_domain & I915_GEM_GPU_DOMAINS) {
-			TAILQ_REMOVE(&dev_priv->mm.gpu_write_list,
-			    obj_priv, write_list);
+			TAILQ_REMOVE(i915_gem_write_list(dev_priv,
+			    obj_priv->obj.write_domain), obj_priv, write_list);
 			atomic_clearbits_int(&obj_priv->obj.do_flags,
 			    I915_GPU_WRITE);
 			obj_priv->obj.write_domain &= ~I915_GEM_GPU_DOMAINS;
@@ -4877,8 +5323,16 @@ inteldrm_hung(void *arg, void *reset_type)
 	}
 	mtx_leave(&dev_priv->list_lock);
 
-	/* unbind everything */
-	(void)i915_gem_evict_inactive(dev_priv, 0);
+	/*
+	 * A render reset leaves the GTT and the fence registers alone, so
+	 * bound objects stay where they are and the next execbuffer finds
+	 * them in place.  After a full reset (or none at all) nothing on the
+	 * chip can be trusted: unbind everything.
+	 */
+	if (!HAS_RESET(dev_priv) || reset == GRDOM_FULL) {
+		(void)i915_gem_evict_inactive(dev_priv, 0, 0);
+		i915_gem_reap_stale(dev_priv);
+	}
 
 	if (HAS_RESET(dev_priv))
 		dev_priv->mm.wedged = 0;
@@ -4888,14 +5342,29 @@ inteldrm_hung(void *arg, void *reset_type)
 void
 inteldrm_hangcheck(void *arg)
 {
-	struct inteldrm_softc	*dev_priv = arg;
-	u_int32_t		 acthd, instdone, instdone1;
+	struct inteldrm_softc		*dev_priv = arg;
+	struct inteldrm_hangcheck	*hc = &dev_priv->ring.hangcheck;
+	struct timeval			 now;
+	u_int32_t			 seqno, acthd, instdone, instdone1, tmp;
+	u_int8_t			 reset;
+	int				 action;
+
+	seqno = i915_get_gem_seqno(dev_priv);
+	if (seqno != hc->seqno) {
+		/* the ring came back after we poked it */
+		if (hc->stage == INTELDRM_HANG_KICK)
+			INTELDRM_EVCNT_INCR(dev_priv, hang_kick_recoveries);
+		getmicrouptime(&hc->since);
+	}
 
 	/* are we idle? no requests, or ring is empty */
 	if (TAILQ_EMPTY(&dev_priv->mm.request_list) ||
 	    (I915_READ(PRB0_HEAD) & HEAD_ADDR) ==
 	    (I915_READ(PRB0_TAIL) & TAIL_ADDR)) {
-		dev_priv->mm.hang_cnt = 0;
+		if (seqno != hc->seqno)
+			hc->stage = 0;
+		hc->seqno = seqno;
+		hc->stalled = hc->busy = 0;
 		return;
 	}
 
@@ -4909,45 +5378,63 @@ inteldrm_hangcheck(void *arg)
 		instdone1 = 0;
 	}
 
-	/* if we've hit ourselves before and the hardware hasn't moved, hung. */
-	if (dev_priv->mm.last_acthd == acthd &&
-	    dev_priv->mm.last_instdone == instdone &&
-	    dev_priv->mm.last_instdone1 == instdone1) {
-		/* if that's twice we didn't hit it, then we're hung */
-		if (++dev_priv->mm.hang_cnt >= 2) {
-			if (!IS_GEN2(dev_priv)) {
-				u_int32_t tmp = I915_READ(PRB0_CTL);
-				if (tmp & RING_WAIT) {
-					I915_WRITE(PRB0_CTL, tmp);
-					(void)I915_READ(PRB0_CTL);
-					goto out;
-				}
+	action = inteldrm_hangcheck_sample(hc, seqno, acthd, instdone,
+	    instdone1);
+
+	if (action == INTELDRM_HANG_KICK) {
+		/* the ring may just be stuck on a wait event, poke it */
+		if (!IS_GEN2(dev_priv)) {
+			tmp = I915_READ(PRB0_CTL);
+			if (tmp & RING_WAIT) {
+				I915_WRITE(PRB0_CTL, tmp);
+				(void)I915_READ(PRB0_CTL);
+				INTELDRM_EVCNT_INCR(dev_priv, hang_kicks);
+				goto out;
 			}
-			dev_priv->mm.hang_cnt = 0;
-			/* XXX atomic */
-			dev_priv->mm.wedged = 1; 
-			DRM_INFO("gpu hung!\n");
-			/* XXX locking */
-			mtx_enter(&dev_priv->user_irq_lock);
-#if !defined(__NetBSD__)
-			wakeup(dev_priv);
-#else /* !defined(__NetBSD__) */
-			cv_broadcast(&dev_priv->condvar);
-#endif /* !defined(__NetBSD__) */
-			mtx_leave(&dev_priv->user_irq_lock);
-			inteldrm_error(dev_priv);
-			return;
 		}
+		/* nothing to kick, don't wait for the next step */
+		action = ++hc->stage;
+	}
+	if (action == INTELDRM_HANG_NONE)
+		goto out;
+
+	getmicrouptime(&now);
+	timersub(&now, &hc->since, &now);
+	INTELDRM_EVCNT_ADD(dev_priv, hang_detect_ms,
+	    now.tv_sec * 1000 + now.tv_usec / 1000);
+	if (action == INTELDRM_HANG_RESET_RENDER) {
+		reset = GRDOM_RENDER;
+		INTELDRM_EVCNT_INCR(dev_priv, hang_render_resets);
 	} else {
-		dev_priv->mm.hang_cnt = 0;
+		reset = GRDOM_FULL;
+		INTELDRM_EVCNT_INCR(dev_priv, hang_full_resets);
+	}
 
-		dev_priv->mm.last_acthd = acthd;
-		dev_priv->mm.last_instdone = instdone;
-		dev_priv->mm.last_instdone1 = instdone1;
+	/* XXX atomic */
+	dev_priv->mm.wedged = 1;
+	DRM_INFO("gpu hung!\n");
+	/* XXX locking */
+	mtx_enter(&dev_priv->user_irq_lock);
+#if !defined(__NetBSD__)
+	wakeup(dev_priv);
+#else /* !defined(__NetBSD__) */
+	cv_broadcast(&dev_priv->condvar);
+#endif /* !defined(__NetBSD__) */
+	mtx_leave(&dev_priv->user_irq_lock);
+	/*
+	 * with error bits latched inteldrm_error picks the domain from them
+	 * and resets; a page table error wants the full reset either way.
+	 */
+	if (I915_READ(EIR) != 0) {
+		inteldrm_error(dev_priv);
+	} else if (workq_add_task(dev_priv->workq, 0, inteldrm_hung, dev_priv,
+	    (void *)(uintptr_t)reset) == ENOMEM) {
+		DRM_INFO("failed to schedule reset task\n");
 	}
+	return;
 out:
 	/* Set ourselves up again, in case we haven't added another batch */
-	timeout_add_msec(&dev_priv->mm.hang_timer, 750);
+	timeout_add_msec(&dev_priv->mm.hang_timer, inteldrm_hangcheck_period);
 }
 
 void
@@ -5527,6 +6014,12 @@ i915_gem_set_tiling(struct drm_device *dev, void *data,
 		ret = EINVAL;
 		goto out;
 	}
+	/* the user's view of the pages is linear, don't swizzle it */
+	if ((obj->do_flags & I915_USERPTR) &&
+	    args->tiling_mode != I915_TILING_NONE) {
+		ret = EINVAL;
+		goto out;
+	}
 
 	if (args->tiling_mode == I915_TILING_NONE) {
 		args->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
@@ -5624,22 +6117,17 @@ inteldrm_965_reset(struct inteldrm_softc *dev_priv, u_int8_t flags)
 	pcireg_t	reg;
 	int		i = 0;
 
-	/*
-	 * There seems to be soemthing wrong with !full reset modes, so force
-	 * the whole shebang for now.
-	 */
-	flags = GRDOM_FULL;
-
 	if (flags == GRDOM_FULL)
 		i915_save_display(dev_priv);
 
 	reg = pci_conf_read(dev_priv->pc, dev_priv->tag, I965_GDRST);
 	/*
 	 * Set the domains we want to reset, then bit 0 (reset itself).
-	 * then we wait for the hardware to clear it.
+	 * then we wait for the hardware to clear it.  Partial resets used
+	 * to leave bit 0 clear, so they never actually happened.
 	 */
 	pci_conf_write(dev_priv->pc, dev_priv->tag, I965_GDRST,
-	    reg | (u_int32_t)flags | ((flags == GRDOM_FULL) ? 0x1 : 0x0));
+	    reg | (u_int32_t)flags | 0x1);
 	delay(50);
 	/* don't clobber the rest of the register */
 	pci_conf_write(dev_priv->pc, dev_priv->tag, I965_GDRST, reg & 0xfe);
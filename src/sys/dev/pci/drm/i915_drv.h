@@ -32,6 +32,7 @@
 #define _I915_DRV_H_
 
 #include "i915_reg.h"
+#include "i915_hangcheck.h"
 
 /* General customization:
  */
@@ -69,10 +70,24 @@ struct inteldrm_ring {
 	int32_t			 space;
 	u_int32_t		 tail;
 	u_int32_t		 woffset;
+	struct inteldrm_hangcheck hangcheck;
 };
 
 #define I915_FENCE_REG_NONE -1
 
+/* I915_GEM_DOMAIN_CPU through I915_GEM_DOMAIN_GTT */
+#define I915_GEM_WRITE_DOMAINS	7
+
+#if defined(__NetBSD__)
+#define INTELDRM_EVCNT_INCR(dev_priv, name)				\
+	((dev_priv)->ev_##name.ev_count++)
+#define INTELDRM_EVCNT_ADD(dev_priv, name, n)				\
+	((dev_priv)->ev_##name.ev_count += (n))
+#else /* defined(__NetBSD__) */
+#define INTELDRM_EVCNT_INCR(dev_priv, name)	do { } while (0)
+#define INTELDRM_EVCNT_ADD(dev_priv, name, n)	do { } while (0)
+#endif /* defined(__NetBSD__) */
+
 struct inteldrm_fence {
 	TAILQ_ENTRY(inteldrm_fence)	 list;
 	struct drm_obj			*obj;
@@ -190,6 +205,21 @@ struct inteldrm_softc {
 	kmutex_t		 request_lock;
 #endif /* !defined(__NetBSD__) */
 
+#if defined(__NetBSD__)
+	/* event counters, see vmstat -e */
+	struct evcnt		 ev_gtt_lazy_unbinds;
+	struct evcnt		 ev_gtt_stale_rebinds;
+	struct evcnt		 ev_gtt_stale_reaps;
+	struct evcnt		 ev_gtt_ptes_avoided;
+	struct evcnt		 ev_hang_kicks;
+	struct evcnt		 ev_hang_render_resets;
+	struct evcnt		 ev_hang_full_resets;
+	struct evcnt		 ev_hang_kick_recoveries;
+	struct evcnt		 ev_hang_detect_ms;
+	struct evcnt		 ev_retire_irqs;
+	struct evcnt		 ev_retire_tasks;
+#endif /* defined(__NetBSD__) */
+
 	/* Register state */
 	u8 saveLBB;
 	u32 saveDSPACNTR;
@@ -374,13 +404,15 @@ struct inteldrm_softc {
 		struct i915_gem_list flushing_list;
 
 		/*
-		 * list of objects currently pending a GPU write flush.
+		 * lists of objects currently pending a GPU write flush, one
+		 * per write domain (see i915_gem_write_list()) so that a
+		 * flush only visits the objects it actually flushes.
 		 *
-		 * All elements on this list will either be on the active
+		 * All elements on these lists will either be on the active
 		 * or flushing list, last rendiering_seqno differentiates the
 		 * two.
 		 */
-		struct i915_gem_list gpu_write_list;
+		struct i915_gem_list gpu_write_list[I915_GEM_WRITE_DOMAINS];
 		/**
 		 * LRU list of objects which are not in the ringbuffer and
 		 * are ready to unbind, but are still in the GTT.
@@ -393,6 +425,18 @@ struct inteldrm_softc {
 		 */
 		struct i915_gem_list inactive_list;
 
+		/**
+		 * LRU list of objects which have been unbound lazily: they
+		 * are not in the GTT as far as the rest of the driver is
+		 * concerned, but their dmamap is still loaded, so the PTEs
+		 * and the wiring of their pages are left in place until the
+		 * GTT range is needed by the allocator.  Rebinding such an
+		 * object at the same offset costs nothing.
+		 *
+		 * Like the inactive list, no reference is held.
+		 */
+		struct i915_gem_list stale_list;
+
 		/* Fence LRU */
 		TAILQ_HEAD(i915_fence, inteldrm_fence)	fence_list;
 
@@ -403,11 +447,12 @@ struct inteldrm_softc {
 		TAILQ_HEAD(i915_request , inteldrm_request) request_list;
 
 		/**
-		 * We leave the user IRQ off as much as possible,
-		 * but this means that requests will finish and never
-		 * be retired once the system goes idle. Set a timer to
-		 * fire periodically while the ring is running. When it
-		 * fires, go retire requests in a workq.
+		 * The user IRQ is left on while requests are outstanding
+		 * (retire_irq holds the reference) and each MI_USER_INTERRUPT
+		 * queues a retire task on the workq.  retire_pending, under
+		 * user_irq_lock, coalesces interrupts into a single task.
+		 * The timer is only a slow backstop in case an interrupt is
+		 * lost or the task could not be queued.
 		 */
 #if !defined(__NetBSD__)
 		struct timeout retire_timer;
@@ -416,12 +461,8 @@ struct inteldrm_softc {
 		callout_t retire_timer;
 		callout_t hang_timer;
 #endif /* !defined(__NetBSD__) */
-		/* for hangcheck */
-		int		hang_cnt;
-		u_int32_t	last_acthd;
-		u_int32_t	last_instdone;
-		u_int32_t	last_instdone1;
-
+		int retire_pending;
+		int retire_irq;
 		uint32_t next_gem_seqno;
 
 		/**
@@ -496,6 +537,8 @@ struct inteldrm_file {
 #define I915_EXEC_NEEDS_FENCE	0x0800	/* being processed but will need fence*/
 #define I915_FENCED_EXEC	0x1000	/* Most recent exec needs fence */
 #define I915_FENCE_INVALID	0x2000	/* fence has been lazily invalidated */
+#define I915_USERPTR		0x4000	/* BO shares a user mapping's pages */
+#define I915_UNSYNCHRONIZED	0x8000	/* userland syncs its gtt accesses */
 
 /** driver private structure attached to each drm_gem_object */
 struct inteldrm_obj {
@@ -510,6 +553,10 @@ struct inteldrm_obj {
 	bus_dma_segment_t			*dma_segs;
 	/* Current offset of the object in GTT space. */
 	bus_addr_t				 gtt_offset;
+	/* GTT binding left in place by a lazy unbind, see stale_list. */
+	bus_dmamap_t				 stale_dmamap;
+	bus_dma_segment_t			*stale_segs;
+	bus_addr_t				 stale_offset;
 	u_int32_t				*bit_17;
 	/* extra flags to bus_dma */
 	int					 dma_flags;
@@ -781,6 +828,33 @@ inteldrm_is_active(struct inteldrm_obj *obj_priv)
 	return (obj_priv->obj.do_flags & I915_ACTIVE);
 }
 
+/*
+ * Is the gpu still using this object?  Unlike inteldrm_is_active() this
+ * does not wait for the request to be retired, it compares the last seqno
+ * against the status page.  Objects with unflushed gpu writes or waiting
+ * on a flush are always busy.
+ */
+static __inline int
+inteldrm_obj_busy(struct inteldrm_softc *dev_priv,
+    struct inteldrm_obj *obj_priv)
+{
+	u_int32_t	seqno = obj_priv->last_rendering_seqno;
+
+	if (!inteldrm_is_active(obj_priv))
+		return (0);
+	return (seqno == 0 || (obj_priv->obj.do_flags & I915_GPU_WRITE) ||
+	    !i915_seqno_passed(i915_get_gem_seqno(dev_priv), seqno));
+}
+
+/* gpu write list for a single write domain */
+static __inline struct i915_gem_list *
+i915_gem_write_list(struct inteldrm_softc *dev_priv, u_int32_t domain)
+{
+	KASSERT(domain != 0 && (domain & (domain - 1)) == 0);
+	KASSERT(ffs(domain) <= I915_GEM_WRITE_DOMAINS);
+	return (&dev_priv->mm.gpu_write_list[ffs(domain) - 1]);
+}
+
 static __inline int
 inteldrm_is_dirty(struct inteldrm_obj *obj_priv)
 {
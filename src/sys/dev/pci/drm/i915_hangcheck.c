@@ -0,0 +1,209 @@
+/* $OpenBSD$ */
+/*-
+ * Copyright © 2008 Intel Corporation
+ * Copyright 2003 Tungsten Graphics, Inc., Cedar Park, Texas.
+ * copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Hangcheck policy.  This file does no register access and needs nothing
+ * from the rest of the driver, so that it can be built on its own:
+ *
+ *	cc -DHANGCHECK_MAIN=1 -o hangcheck i915_hangcheck.c && ./hangcheck
+ *
+ * runs the policy against a table of simulated ring histories.
+ */
+
+#ifndef HANGCHECK_MAIN
+#define HANGCHECK_MAIN 0
+#endif
+
+#if HANGCHECK_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#include "i915_hangcheck.h"
+
+/*
+ * Hangcheck tuning.  The ring is sampled every inteldrm_hangcheck_period
+ * ms while requests are outstanding.  Recovery moves on one step (kick the
+ * ring, reset the render domain, reset the whole gpu) after
+ * inteldrm_hangcheck_stalls samples showing no new seqno and no sign of
+ * life.  A ring whose ACTHD or INSTDONE keeps moving is never treated as
+ * hung, however long the batch takes, unless inteldrm_hangcheck_runaway
+ * is set: then that many busy samples without a new seqno reset it.
+ */
+int	inteldrm_hangcheck_period = 100;
+int	inteldrm_hangcheck_stalls = 3;
+int	inteldrm_hangcheck_runaway = 0;
+
+/*
+ * Feed one sample of the ring state into its progress tracker, and decide
+ * what should be done about it.  Progress means a new seqno; a changing
+ * ACTHD or INSTDONE only means that the gpu is still chewing on something.
+ */
+int
+inteldrm_hangcheck_sample(struct inteldrm_hangcheck *hc, u_int32_t seqno,
+    u_int32_t acthd, u_int32_t instdone, u_int32_t instdone1)
+{
+	if (seqno != hc->seqno) {
+		hc->seqno = seqno;
+		hc->stalled = hc->busy = hc->stage = 0;
+		return (INTELDRM_HANG_NONE);
+	}
+
+	if (acthd != hc->acthd || instdone != hc->instdone ||
+	    instdone1 != hc->instdone1) {
+		hc->acthd = acthd;
+		hc->instdone = instdone;
+		hc->instdone1 = instdone1;
+		hc->stalled = 0;
+		if (inteldrm_hangcheck_runaway <= 0 ||
+		    ++hc->busy < inteldrm_hangcheck_runaway)
+			return (INTELDRM_HANG_NONE);
+		/* a busy ring has nothing to kick, start with a reset */
+		hc->busy = 0;
+		hc->stage = hc->stage < INTELDRM_HANG_RESET_RENDER ?
+		    INTELDRM_HANG_RESET_RENDER : INTELDRM_HANG_RESET_FULL;
+		return (hc->stage);
+	}
+
+	if (++hc->stalled < inteldrm_hangcheck_stalls)
+		return (INTELDRM_HANG_NONE);
+
+	hc->stalled = 0;
+	if (hc->stage < INTELDRM_HANG_RESET_FULL)
+		hc->stage++;
+	return (hc->stage);
+}
+
+#if HANGCHECK_MAIN
+/*
+ * Each step feeds count samples.  The seqno is bumped before the step if
+ * complete is set; ACTHD moves on every sample of the step if moving is
+ * set.  All samples but the last must report INTELDRM_HANG_NONE, the
+ * last must report expect.
+ */
+struct hang_step {
+	int		count;
+	int		complete;
+	int		moving;
+	int		expect;
+};
+
+struct hang_case {
+	const char	*name;
+	int		 runaway;
+	struct hang_step steps[8];
+};
+
+static const struct hang_case hang_cases[] = {
+	{ "long batch still running", 0, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 10000, 0, 1, INTELDRM_HANG_NONE },
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 0 } } },
+	{ "stall, kick, render reset, then full reset", 0, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 3, 0, 0, INTELDRM_HANG_KICK },
+		{ 3, 0, 0, INTELDRM_HANG_RESET_RENDER },
+		{ 3, 0, 0, INTELDRM_HANG_RESET_FULL },
+		{ 3, 0, 0, INTELDRM_HANG_RESET_FULL },
+		{ 0 } } },
+	{ "render reset recovers the ring", 0, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 3, 0, 0, INTELDRM_HANG_KICK },
+		{ 3, 0, 0, INTELDRM_HANG_RESET_RENDER },
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 3, 0, 0, INTELDRM_HANG_KICK },
+		{ 0 } } },
+	{ "kick recovers the ring", 0, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 3, 0, 0, INTELDRM_HANG_KICK },
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 3, 0, 0, INTELDRM_HANG_KICK },
+		{ 0 } } },
+	{ "activity restarts the stall count", 0, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 2, 0, 0, INTELDRM_HANG_NONE },
+		{ 1, 0, 1, INTELDRM_HANG_NONE },
+		{ 2, 0, 0, INTELDRM_HANG_NONE },
+		{ 1, 0, 0, INTELDRM_HANG_KICK },
+		{ 0 } } },
+	{ "runaway batch, opted in", 600, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 600, 0, 1, INTELDRM_HANG_RESET_RENDER },
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 599, 0, 1, INTELDRM_HANG_NONE },
+		{ 0 } } },
+	{ "runaway survives a render reset", 600, {
+		{ 1, 1, 0, INTELDRM_HANG_NONE },
+		{ 600, 0, 1, INTELDRM_HANG_RESET_RENDER },
+		{ 600, 0, 1, INTELDRM_HANG_RESET_FULL },
+		{ 0 } } },
+};
+
+static int
+hang_run(const struct hang_case *hcase)
+{
+	struct inteldrm_hangcheck	 hc = { 0 };
+	const struct hang_step		*step;
+	u_int32_t			 seqno = 0, acthd = 0;
+	int				 i, action, expect;
+
+	inteldrm_hangcheck_runaway = hcase->runaway;
+	for (step = hcase->steps; step->count; step++) {
+		if (step->complete)
+			seqno++;
+		for (i = 0; i < step->count; i++) {
+			if (step->moving)
+				acthd += 4;
+			action = inteldrm_hangcheck_sample(&hc, seqno, acthd,
+			    0, 0);
+			expect = i == step->count - 1 ? step->expect :
+			    INTELDRM_HANG_NONE;
+			if (action != expect) {
+				printf("%s: step %d sample %d: got %d, "
+				    "expected %d\n", hcase->name,
+				    (int)(step - hcase->steps), i, action,
+				    expect);
+				return (1);
+			}
+		}
+	}
+	printf("%s: ok\n", hcase->name);
+	return (0);
+}
+
+int
+main(void)
+{
+	size_t	i;
+	int	failed = 0;
+
+	for (i = 0; i < sizeof(hang_cases) / sizeof(hang_cases[0]); i++)
+		failed += hang_run(&hang_cases[i]);
+	return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+#endif /* HANGCHECK_MAIN */
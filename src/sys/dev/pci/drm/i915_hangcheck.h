@@ -0,0 +1,60 @@
+/* $OpenBSD$ */
+/*-
+ * Copyright © 2008 Intel Corporation
+ * Copyright 2003 Tungsten Graphics, Inc., Cedar Park, Texas.
+ * copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _I915_HANGCHECK_H_
+#define _I915_HANGCHECK_H_
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+/*
+ * Progress tracking for hangcheck, see inteldrm_hangcheck_sample().
+ */
+struct inteldrm_hangcheck {
+	u_int32_t		 seqno;		/* last completed seqno seen */
+	u_int32_t		 acthd;
+	u_int32_t		 instdone;
+	u_int32_t		 instdone1;
+	int			 stalled;	/* samples with no activity */
+	int			 busy;		/* busy samples, no new seqno */
+	int			 stage;		/* recovery steps taken */
+	struct timeval		 since;		/* last progress */
+};
+
+#define	INTELDRM_HANG_NONE		0	/* making progress */
+#define	INTELDRM_HANG_KICK		1	/* kick a waiting ring */
+#define	INTELDRM_HANG_RESET_RENDER	2	/* reset the render domain */
+#define	INTELDRM_HANG_RESET_FULL	3	/* reset the whole gpu */
+
+extern int	inteldrm_hangcheck_period;
+extern int	inteldrm_hangcheck_stalls;
+extern int	inteldrm_hangcheck_runaway;
+
+int	inteldrm_hangcheck_sample(struct inteldrm_hangcheck *, u_int32_t,
+	    u_int32_t, u_int32_t, u_int32_t);
+
+#endif /* _I915_HANGCHECK_H_ */
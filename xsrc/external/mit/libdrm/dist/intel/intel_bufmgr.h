@@ -98,6 +98,11 @@ drm_intel_bo *drm_intel_bo_alloc_tiled(drm_intel_bufmgr *bufmgr,
 				       uint32_t *tiling_mode,
 				       unsigned long *pitch,
 				       unsigned long flags);
+drm_intel_bo *drm_intel_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
+					 const char *name,
+					 void *addr, uint32_t tiling_mode,
+					 uint32_t stride, unsigned long size,
+					 unsigned long flags);
 void drm_intel_bo_reference(drm_intel_bo *bo);
 void drm_intel_bo_unreference(drm_intel_bo *bo);
 int drm_intel_bo_map(drm_intel_bo *bo, int write_enable);
@@ -140,6 +145,33 @@ int drm_intel_bo_is_reusable(drm_intel_bo *bo);
 int drm_intel_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo);
 
 /* drm_intel_bufmgr_gem.c */
+struct drm_intel_bo_cache_stats {
+	uint64_t hits;		/* allocations served from the cache */
+	uint64_t misses;	/* cacheable allocations that were not */
+	uint64_t evictions;	/* buffers freed by aging or the size limit */
+	uint64_t retiles;	/* hits that needed a SET_TILING */
+	unsigned int count;	/* buffers currently cached */
+	unsigned long size;	/* bytes currently cached */
+};
+
+struct drm_intel_bo_vma_stats {
+	uint64_t hits;		/* maps that reused a kept mapping */
+	uint64_t misses;	/* maps that needed a new mmap */
+	uint64_t unmaps;	/* mappings torn down */
+	unsigned int count;	/* idle mappings currently kept */
+	unsigned long size;	/* bytes of idle mappings currently kept */
+};
+
+struct drm_intel_stream_stats {
+	uint64_t allocs;	/* uploads placed in the stream */
+	uint64_t bytes;		/* bytes placed in the stream */
+	uint64_t wraps;		/* moves to the next segment */
+	uint64_t waits;		/* moves that waited for the GPU */
+	uint64_t orphans;	/* segments replaced while still referenced */
+};
+
+typedef struct _drm_intel_stream drm_intel_stream;
+
 drm_intel_bufmgr *drm_intel_bufmgr_gem_init(int fd, int batch_size);
 drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						const char *name,
@@ -148,17 +180,65 @@ void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+void drm_intel_bufmgr_gem_set_vma_cache_max_size(drm_intel_bufmgr *bufmgr,
+						 unsigned long size);
+void drm_intel_bufmgr_gem_get_vma_stats(drm_intel_bufmgr *bufmgr,
+					struct drm_intel_bo_vma_stats *stats);
+void drm_intel_bufmgr_gem_set_cache_size(drm_intel_bufmgr *bufmgr,
+					 unsigned long size);
+void drm_intel_bufmgr_gem_trim_cache(drm_intel_bufmgr *bufmgr);
+void drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+					  struct drm_intel_bo_cache_stats *stats);
+int drm_intel_bufmgr_gem_start_trace(drm_intel_bufmgr *bufmgr,
+				     const char *path);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
+int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
+int drm_intel_gem_bo_map_nonblocking(drm_intel_bo *bo, int write_enable);
 int drm_intel_gem_bo_get_reloc_count(drm_intel_bo *bo);
+drm_intel_stream *drm_intel_stream_create(drm_intel_bufmgr *bufmgr,
+					  const char *name,
+					  unsigned long size);
+void drm_intel_stream_destroy(drm_intel_stream *stream);
+void *drm_intel_stream_alloc(drm_intel_stream *stream, unsigned long size,
+			     unsigned int alignment, drm_intel_bo **bo,
+			     unsigned long *offset);
+int drm_intel_stream_write(drm_intel_stream *stream, const void *data,
+			   unsigned long size, unsigned int alignment,
+			   drm_intel_bo **bo, unsigned long *offset);
+void drm_intel_stream_get_stats(drm_intel_stream *stream,
+				struct drm_intel_stream_stats *stats);
 void drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start);
 void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable);
 
 int drm_intel_get_pipe_from_crtc_id(drm_intel_bufmgr *bufmgr, int crtc_id);
 
+int drm_intel_trace_replay(drm_intel_bufmgr *bufmgr, const char *path);
+
 int drm_intel_get_aperture_sizes(int fd, size_t *mappable, size_t *total);
 
 /* drm_intel_bufmgr_fake.c */
+struct drm_intel_fake_sim_params {
+	unsigned long aperture_size;	/* bytes of simulated aperture */
+	unsigned int max_fences;	/* batches in flight before a stall */
+	unsigned int batch_cost;	/* GPU ticks per batch */
+	unsigned int bytes_per_tick;	/* bytes the GPU reads per tick */
+	unsigned int cpu_cost;		/* CPU ticks to build a batch */
+	unsigned int policy;		/* DRM_INTEL_FAKE_SIM_POLICY_* */
+};
+
+#define DRM_INTEL_FAKE_SIM_POLICY_FAKE	0	/* the fake bufmgr's own */
+#define DRM_INTEL_FAKE_SIM_POLICY_GEM	1	/* what the GEM kernel does */
+
+struct drm_intel_fake_sim_stats {
+	uint64_t clock;		/* simulated time, in ticks */
+	uint64_t batches;	/* batches executed */
+	uint64_t evictions;	/* buffers evicted from the aperture */
+	uint64_t bytes_copied;	/* bytes copied in and out of the aperture */
+	uint64_t stalls;	/* waits for the simulated GPU */
+	uint64_t stall_ticks;	/* ticks spent waiting */
+};
+
 drm_intel_bufmgr *drm_intel_bufmgr_fake_init(int fd,
 					     unsigned long low_offset,
 					     void *low_virtual,
@@ -190,6 +270,10 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
+drm_intel_bufmgr *
+drm_intel_bufmgr_fake_init_sim(const struct drm_intel_fake_sim_params *params);
+void drm_intel_bufmgr_fake_get_sim_stats(drm_intel_bufmgr *bufmgr,
+					 struct drm_intel_fake_sim_stats *stats);
 
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
@@ -184,8 +184,39 @@ typedef struct _bufmgr_fake {
 	int debug;
 
 	int performed_rendering;
+
+	/** Buffers evicted from the aperture */
+	uint64_t evictions;
+	/** Bytes copied between backing store and the aperture */
+	uint64_t bytes_copied;
+
+	/** Simulated GPU, if created by drm_intel_bufmgr_fake_init_sim() */
+	struct fake_sim *sim;
 } drm_intel_bufmgr_fake;
 
+/**
+ * Deterministic stand-in for the GPU, driven by the fence and exec
+ * callbacks.  Time only moves when the CPU submits a batch (by cpu_cost)
+ * or has to wait for the GPU, so a given sequence of calls always produces
+ * the same placement decisions and statistics.
+ */
+struct fake_sim {
+	struct drm_intel_fake_sim_params params;
+	uint64_t clock;		/* current time, in ticks */
+	uint64_t gpu_idle;	/* when the last emitted batch completes */
+	uint64_t pending;	/* cost of work not yet fenced */
+	unsigned int seq;	/* last fence emitted */
+	unsigned int head, count;	/* outstanding fences */
+	struct fake_sim_fence {
+		unsigned int seq;
+		uint64_t done;
+	} *fences;
+	uint64_t batches;
+	uint64_t stalls;
+	uint64_t stall_ticks;
+	void *aperture;
+};
+
 typedef struct _drm_intel_bo_fake {
 	drm_intel_bo bo;
 
@@ -419,6 +450,31 @@ _fence_test(drm_intel_bufmgr_fake *bufmgr_fake, unsigned fence)
 	return fence == 0 || FENCE_LTE(fence, bufmgr_fake->last_fence);
 }
 
+/**
+ * Whether the simulated GPU places buffers the way GEM does: objects are
+ * bound in place rather than copied to and from the aperture, and space
+ * is found by evicting idle buffers in LRU order, then waiting for the
+ * oldest busy ones.
+ */
+static int
+fake_sim_gem_policy(drm_intel_bufmgr_fake *bufmgr_fake)
+{
+	return bufmgr_fake->sim != NULL &&
+	    bufmgr_fake->sim->params.policy == DRM_INTEL_FAKE_SIM_POLICY_GEM;
+}
+
+/**
+ * Accounts for size bytes copied between backing store and the aperture.
+ * GEM binds the object's own pages, so under its policy the copy only
+ * keeps the simulation's memory coherent and is not counted.
+ */
+static void
+count_copy(drm_intel_bufmgr_fake *bufmgr_fake, unsigned long size)
+{
+	if (!fake_sim_gem_policy(bufmgr_fake))
+		bufmgr_fake->bytes_copied += size;
+}
+
 /**
  * Allocate a memory manager block for the buffer.
  */
@@ -477,6 +533,7 @@ free_block(drm_intel_bufmgr_fake *bufmgr_fake, struct block *block,
 
 	if (!skip_dirty_copy && (bo_fake->card_dirty == 1)) {
 		memcpy(bo_fake->backing_store, block->virtual, block->bo->size);
+		count_copy(bufmgr_fake, block->bo->size);
 		bo_fake->card_dirty = 0;
 		bo_fake->dirty = 1;
 	}
@@ -560,6 +617,7 @@ evict_lru(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int max_fence)
 		bo_fake->block = NULL;
 
 		free_block(bufmgr_fake, block, 0);
+		bufmgr_fake->evictions++;
 		return 1;
 	}
 
@@ -583,6 +641,7 @@ evict_mru(drm_intel_bufmgr_fake *bufmgr_fake)
 		bo_fake->block = NULL;
 
 		free_block(bufmgr_fake, block, 0);
+		bufmgr_fake->evictions++;
 		return 1;
 	}
 
@@ -657,6 +716,29 @@ fence_blocks(drm_intel_bufmgr_fake *bufmgr_fake, unsigned fence)
 	assert(DRMLISTEMPTY(&bufmgr_fake->on_hardware));
 }
 
+/**
+ * GEM's eviction: idle buffers go first, least recently used first, and
+ * only then does it wait for the oldest rendering to retire.  There is
+ * no thrashing mode and nothing recently used is evicted ahead of time.
+ */
+static int
+evict_and_alloc_block_gem(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake =
+	    (drm_intel_bufmgr_fake *) bo->bufmgr;
+
+	for (;;) {
+		if (alloc_block(bo))
+			return 1;
+		if (evict_lru(bufmgr_fake, 0))
+			continue;
+		if (DRMLISTEMPTY(&bufmgr_fake->fenced))
+			return 0;
+		_fence_wait_internal(bufmgr_fake,
+				     bufmgr_fake->fenced.next->fence);
+	}
+}
+
 static int
 evict_and_alloc_block(drm_intel_bo *bo)
 {
@@ -666,6 +748,9 @@ evict_and_alloc_block(drm_intel_bo *bo)
 
 	assert(bo_fake->block == NULL);
 
+	if (fake_sim_gem_policy(bufmgr_fake))
+		return evict_and_alloc_block_gem(bo);
+
 	/* Search for already free memory:
 	 */
 	if (alloc_block(bo))
@@ -1061,6 +1146,7 @@ static int
 				memcpy(bo_fake->backing_store,
 				       bo_fake->block->virtual,
 				       bo_fake->block->bo->size);
+				count_copy(bufmgr_fake, bo->size);
 				bo_fake->card_dirty = 0;
 			}
 
@@ -1204,17 +1290,22 @@ static int
 
 		/* Actually, should be able to just wait for a fence on the
 		 * mmory, hich we would be tracking when we free it.  Waiting
-		 * for idle is a sufficiently large hammer for now.
+		 * for idle is a sufficiently large hammer for now.  GEM only
+		 * waits for the object itself.
 		 */
-		drm_intel_bufmgr_fake_wait_idle(bufmgr_fake);
+		if (!fake_sim_gem_policy(bufmgr_fake))
+			drm_intel_bufmgr_fake_wait_idle(bufmgr_fake);
+		else if (bo_fake->block->fenced)
+			drm_intel_fake_bo_wait_rendering_locked(bo);
 
 		/* we may never have mapped this BO so it might not have any
 		 * backing store if this happens it should be rare, but 0 the
 		 * card memory in any case */
-		if (bo_fake->backing_store)
+		if (bo_fake->backing_store) {
 			memcpy(bo_fake->block->virtual, bo_fake->backing_store,
 			       bo->size);
-		else
+			count_copy(bufmgr_fake, bo->size);
+		} else
 			memset(bo_fake->block->virtual, 0, bo->size);
 
 		bo_fake->dirty = 0;
@@ -1247,9 +1338,29 @@ static void
 drm_intel_fake_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_fake *bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
+	struct block *lists[3] = {
+		&bufmgr_fake->on_hardware, &bufmgr_fake->fenced, &bufmgr_fake->lru
+	};
+	struct block *block, *tmp;
+	int i;
+
+	/* Blocks left behind by freed buffers still await their fence; the
+	 * heap goes away with them.
+	 */
+	for (i = 0; i < 3; i++) {
+		DRMLISTFOREACHSAFE(block, tmp, lists[i]) {
+			DRMLISTDEL(block);
+			free(block);
+		}
+	}
 
 	pthread_mutex_destroy(&bufmgr_fake->lock);
 	mmDestroy(bufmgr_fake->heap);
+	if (bufmgr_fake->sim) {
+		free(bufmgr_fake->sim->fences);
+		free(bufmgr_fake->sim->aperture);
+		free(bufmgr_fake->sim);
+	}
 	free(bufmgr);
 }
 
@@ -1309,6 +1420,42 @@ drm_intel_fake_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	return 0;
 }
 
+/**
+ * Drops the relocations in bo after the first start, and recounts the
+ * size of what is left of its tree.
+ */
+static void
+drm_intel_fake_bo_clear_relocs(drm_intel_bo *bo, int start)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake =
+	    (drm_intel_bufmgr_fake *) bo->bufmgr;
+	drm_intel_bo_fake *bo_fake = (drm_intel_bo_fake *) bo;
+	int i;
+
+	pthread_mutex_lock(&bufmgr_fake->lock);
+
+	assert(bo_fake->nr_relocs >= start);
+	for (i = start; i < bo_fake->nr_relocs; i++)
+		drm_intel_fake_bo_unreference_locked(bo_fake->relocs[i].
+						     target_buf);
+	bo_fake->nr_relocs = start;
+
+	bo_fake->child_size = 0;
+	for (i = 0; i < bo_fake->nr_relocs; i++) {
+		drm_intel_bo *target_bo = bo_fake->relocs[i].target_buf;
+		drm_intel_bo_fake *target_fake =
+		    (drm_intel_bo_fake *) target_bo;
+
+		if (!target_fake->is_static) {
+			bo_fake->child_size +=
+			    ALIGN(target_bo->size, target_fake->alignment);
+			bo_fake->child_size += target_fake->child_size;
+		}
+	}
+
+	pthread_mutex_unlock(&bufmgr_fake->lock);
+}
+
 /**
  * Incorporates the validation flags associated with each relocation into
  * the combined validation flags for the buffer on this batchbuffer submission.
@@ -1620,6 +1767,7 @@ drm_intel_bufmgr *drm_intel_bufmgr_fake_init(int fd,
 	bufmgr_fake->bufmgr.bo_wait_rendering =
 	    drm_intel_fake_bo_wait_rendering;
 	bufmgr_fake->bufmgr.bo_emit_reloc = drm_intel_fake_emit_reloc;
+	bufmgr_fake->bufmgr.bo_clear_relocs = drm_intel_fake_bo_clear_relocs;
 	bufmgr_fake->bufmgr.destroy = drm_intel_fake_destroy;
 	bufmgr_fake->bufmgr.bo_exec = drm_intel_fake_bo_exec;
 	bufmgr_fake->bufmgr.check_aperture_space =
@@ -1631,3 +1779,191 @@ drm_intel_bufmgr *drm_intel_bufmgr_fake_init(int fd,
 
 	return &bufmgr_fake->bufmgr;
 }
+
+/* Simulated GPU.  All of these run with bufmgr_fake->lock held. */
+
+/** Retires fences whose batches have completed by the current time. */
+static void
+fake_sim_retire(drm_intel_bufmgr_fake *bufmgr_fake)
+{
+	struct fake_sim *sim = bufmgr_fake->sim;
+	unsigned int seq = 0;
+
+	while (sim->count && sim->fences[sim->head].done <= sim->clock) {
+		seq = sim->fences[sim->head].seq;
+		sim->head = (sim->head + 1) % sim->params.max_fences;
+		sim->count--;
+	}
+	if (seq)
+		clear_fenced(bufmgr_fake, seq);
+}
+
+/** Advances the clock to when, counting the wait as a stall. */
+static void
+fake_sim_stall(struct fake_sim *sim, uint64_t when)
+{
+	if (when > sim->clock) {
+		sim->stalls++;
+		sim->stall_ticks += when - sim->clock;
+		sim->clock = when;
+	}
+}
+
+static int
+fake_sim_exec(drm_intel_bo *bo, unsigned int used, void *priv)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = priv;
+	struct fake_sim *sim = bufmgr_fake->sim;
+	struct block *block, *tmp;
+	uint64_t bytes = used;
+
+	/* The batch reads every buffer validated for it. */
+	DRMLISTFOREACHSAFE(block, tmp, &bufmgr_fake->on_hardware)
+		bytes += block->mem->size;
+
+	sim->pending += sim->params.batch_cost +
+	    bytes / sim->params.bytes_per_tick;
+	sim->clock += sim->params.cpu_cost;
+	sim->batches++;
+	return 0;
+}
+
+static unsigned int
+fake_sim_fence_emit(void *priv)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = priv;
+	struct fake_sim *sim = bufmgr_fake->sim;
+	struct fake_sim_fence *fence;
+
+	fake_sim_retire(bufmgr_fake);
+
+	/* Out of fence registers: wait for the oldest. */
+	if (sim->count == sim->params.max_fences) {
+		fake_sim_stall(sim, sim->fences[sim->head].done);
+		fake_sim_retire(bufmgr_fake);
+	}
+
+	if (sim->gpu_idle < sim->clock)
+		sim->gpu_idle = sim->clock;
+	sim->gpu_idle += sim->pending;
+	sim->pending = 0;
+
+	sim->seq = sim->seq % MAXFENCE + 1;
+	fence = &sim->fences[(sim->head + sim->count) %
+			     sim->params.max_fences];
+	fence->seq = sim->seq;
+	fence->done = sim->gpu_idle;
+	sim->count++;
+
+	return sim->seq;
+}
+
+static void
+fake_sim_fence_wait(unsigned int seq, void *priv)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = priv;
+	struct fake_sim *sim = bufmgr_fake->sim;
+	unsigned int i;
+
+	/* Fences complete in order, so retire everything up to seq; the
+	 * caller clears the fenced list.
+	 */
+	for (i = 0; i < sim->count; i++) {
+		struct fake_sim_fence *fence =
+		    &sim->fences[(sim->head + i) % sim->params.max_fences];
+
+		if (fence->seq == seq) {
+			fake_sim_stall(sim, fence->done);
+			sim->head = (sim->head + i + 1) %
+			    sim->params.max_fences;
+			sim->count -= i + 1;
+			break;
+		}
+	}
+}
+
+/**
+ * Creates a fake bufmgr that runs against a simulated GPU instead of the
+ * DRM: the aperture is ordinary memory and batches "execute" by advancing
+ * a simulated clock by their modeled cost.  Runs are deterministic, so the
+ * placement and eviction policy can be measured on a machine with no GPU;
+ * see drm_intel_bufmgr_fake_get_sim_stats().  params->policy selects the
+ * fake bufmgr's own policy or GEM's, so the two can be compared on the
+ * same trace.
+ *
+ * Zero fields in params other than aperture_size get defaults.
+ */
+drm_intel_bufmgr *
+drm_intel_bufmgr_fake_init_sim(const struct drm_intel_fake_sim_params *params)
+{
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bufmgr_fake *bufmgr_fake;
+	struct fake_sim *sim;
+
+	if (params->aperture_size == 0)
+		return NULL;
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL)
+		return NULL;
+
+	sim->params = *params;
+	if (sim->params.max_fences == 0)
+		sim->params.max_fences = 8;
+	if (sim->params.batch_cost == 0)
+		sim->params.batch_cost = 1000;
+	if (sim->params.bytes_per_tick == 0)
+		sim->params.bytes_per_tick = 1024;
+
+	sim->fences = calloc(sim->params.max_fences, sizeof(*sim->fences));
+	sim->aperture = malloc(sim->params.aperture_size);
+	if (sim->fences == NULL || sim->aperture == NULL)
+		goto err;
+
+	bufmgr = drm_intel_bufmgr_fake_init(-1, 0, sim->aperture,
+					    sim->params.aperture_size, NULL);
+	if (bufmgr == NULL)
+		goto err;
+
+	bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
+	bufmgr_fake->sim = sim;
+	drm_intel_bufmgr_fake_set_fence_callback(bufmgr, fake_sim_fence_emit,
+						 fake_sim_fence_wait,
+						 bufmgr_fake);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, fake_sim_exec,
+						bufmgr_fake);
+
+	return bufmgr;
+
+err:
+	free(sim->fences);
+	free(sim->aperture);
+	free(sim);
+	return NULL;
+}
+
+/**
+ * Reports the simulated time, batches executed, evictions, bytes copied
+ * in and out of the aperture, and how often and how long the CPU waited
+ * for the simulated GPU.
+ */
+void
+drm_intel_bufmgr_fake_get_sim_stats(drm_intel_bufmgr *bufmgr,
+				    struct drm_intel_fake_sim_stats *stats)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
+	struct fake_sim *sim = bufmgr_fake->sim;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&bufmgr_fake->lock);
+	stats->evictions = bufmgr_fake->evictions;
+	stats->bytes_copied = bufmgr_fake->bytes_copied;
+	if (sim) {
+		stats->clock = sim->clock;
+		stats->batches = sim->batches;
+		stats->stalls = sim->stalls;
+		stats->stall_ticks = sim->stall_ticks;
+	}
+	pthread_mutex_unlock(&bufmgr_fake->lock);
+}
@@ -46,6 +46,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -62,6 +63,14 @@
 
 #include "i915_drm.h"
 
+#ifndef INTEL_BUFMGR_MAIN
+#define INTEL_BUFMGR_MAIN 0	/* Build the benchmarks at the end */
+#endif
+
+#if INTEL_BUFMGR_MAIN
+#include <time.h>
+#endif
+
 #define DBG(...) do {					\
 	if (bufmgr_gem->bufmgr.debug)			\
 		fprintf(stderr, __VA_ARGS__);		\
@@ -69,10 +78,41 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+/* Cached buffers unused for this many milliseconds are freed... */
+#define BO_CACHE_MAX_AGE	1000
+/* ...checked for at most this often, also in milliseconds. */
+#define BO_CACHE_TRIM_INTERVAL	250
+/* Default limit on the total size of cached buffers, in bytes. */
+#define BO_CACHE_MAX_SIZE	(128 * 1024 * 1024)
+/* Default limits on idle mappings kept for reuse, in count and bytes. */
+#define VMA_CACHE_MAX_COUNT	1024
+#define VMA_CACHE_MAX_SIZE	(256 * 1024 * 1024)
+
 typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 
+/* One list per tiling mode, I915_TILING_NONE to I915_TILING_Y */
+#define BO_CACHE_TILING_MODES	3
+/* How many buffers of a list to check for one with the right stride */
+#define BO_CACHE_STRIDE_SCAN	8
+/* Most buffers, and bytes, a thread keeps in its own cache */
+#define BO_THREAD_CACHE_COUNT	32
+#define BO_THREAD_CACHE_SIZE	(8 * 1024 * 1024)
+/* How many relocation trees a buffer remembers being counted in */
+#define BO_TREE_MARKS		4
+
+/** A relocation tree that a buffer has been counted in */
+struct drm_intel_gem_tree_mark {
+	/** tree_id of the root, 0 for an unused mark */
+	unsigned int tree;
+	/** Index of the buffer in the root's validation list */
+	int index;
+	/** Whether the buffer's fence was counted in the root's tree */
+	bool fence;
+};
+
 struct drm_intel_gem_bo_bucket {
-	drmMMListHead head;
+	/** Cached objects, kept apart by tiling mode to avoid SET_TILING */
+	drmMMListHead head[BO_CACHE_TILING_MODES];
 	unsigned long size;
 };
 
@@ -96,11 +136,33 @@ typedef struct _drm_intel_bufmgr_gem {
 	/** Array of lists of cached gem objects of power-of-two sizes */
 	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
-	time_t time;
-
-	drmMMListHead named;
+	/** Monotonic time in milliseconds of the last cache trim */
+	uint64_t time;
+	/** All cached gem objects, least recently freed first */
+	drmMMListHead cache_lru;
+	unsigned long cache_size, cache_max_size;
+	unsigned int cache_count;
+	struct drm_intel_bo_cache_stats cache_stats;
+	/** Key for this thread's struct drm_intel_gem_thread_cache */
+	pthread_key_t thread_key;
+	/** All the thread caches, for trimming and destroy */
+	drmMMListHead thread_caches;
+
+	/** flink name -> drm_intel_bo_gem, for imported and flinked BOs */
+	void *name_table;
+	/** GEM handle -> drm_intel_bo_gem, for every BO we hold a handle to */
+	void *handle_table;
+	/** Last generation handed out to a relocation tree */
+	atomic_t tree_gen;
+	/** Number of buffers currently holding relocations */
+	atomic_t tree_live;
+	/** Idle mappings kept for reuse, least recently unmapped first */
 	drmMMListHead vma_cache;
 	int vma_count, vma_open, vma_max;
+	unsigned long vma_size, vma_max_size;
+	struct drm_intel_bo_vma_stats vma_stats;
+	/** Trace being recorded, or NULL */
+	struct drm_intel_trace *trace;
 
 	uint64_t gtt_size;
 	int available_fences;
@@ -110,12 +172,40 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int has_blt : 1;
 	unsigned int has_relaxed_fencing : 1;
 	unsigned int has_llc : 1;
+	unsigned int has_unsynchronized : 1;
 	unsigned int bo_reuse : 1;
+	/** Reuse cached buffers whatever their tiling, for comparison */
+	unsigned int cache_any_tiling : 1;
 	bool fenced_relocs;
 } drm_intel_bufmgr_gem;
 
+/**
+ * Buffers freed by one thread, kept for its next allocations.
+ *
+ * Only the owning thread adds and takes buffers, so its lock is
+ * uncontended but for the odd trim from another thread, and the shared
+ * cache and bufmgr_gem->lock are only needed when this cache misses,
+ * overflows or ages.  bufmgr_gem->lock may be taken before this lock,
+ * never while holding it.
+ */
+struct drm_intel_gem_thread_cache {
+	drm_intel_bufmgr_gem *bufmgr_gem;
+	pthread_mutex_t lock;
+	/** Link in bufmgr_gem->thread_caches */
+	drmMMListHead link;
+	/** Cached objects of all sizes, least recently freed first */
+	drmMMListHead head;
+	unsigned long size, max_size;
+	unsigned int count;
+	/** Hits and retiles of this thread's allocations */
+	struct drm_intel_bo_cache_stats stats;
+};
+
 #define DRM_INTEL_RELOC_FENCE (1<<0)
 
+#define DRM_INTEL_MAP_UNSYNCHRONIZED	(1<<0)
+#define DRM_INTEL_MAP_NONBLOCKING	(1<<1)
+
 typedef struct _drm_intel_reloc_target_info {
 	drm_intel_bo *bo;
 	int flags;
@@ -132,7 +222,6 @@ struct _drm_intel_bo_gem {
 	 * Kenel-assigned global name for this object
 	 */
 	unsigned int global_name;
-	drmMMListHead name_list;
 
 	/**
 	 * Index of the buffer within the validation list while preparing a
@@ -147,7 +236,8 @@ struct _drm_intel_bo_gem {
 	uint32_t swizzle_mode;
 	unsigned long stride;
 
-	time_t free_time;
+	/** Monotonic time in milliseconds at which it entered the cache */
+	uint64_t free_time;
 
 	/** Array passed to the DRM containing relocation information. */
 	struct drm_i915_gem_relocation_entry *relocs;
@@ -166,6 +256,8 @@ struct _drm_intel_bo_gem {
 
 	/** BO cache list */
 	drmMMListHead head;
+	/** Link in the cache LRU across all buckets */
+	drmMMListHead lru;
 
 	/**
 	 * Boolean of whether this BO and its children have been included in
@@ -191,19 +283,73 @@ struct _drm_intel_bo_gem {
 	bool reusable;
 
 	/**
-	 * Size in bytes of this buffer and its relocation descendents.
+	 * Boolean of whether the kernel was told that we synchronize our
+	 * accesses to this buffer ourselves.
+	 */
+	bool unsynchronized;
+
+	/**
+	 * Boolean of whether a relocation to this buffer has asked for a
+	 * fence register.
+	 */
+	bool needs_fence;
+
+	/**
+	 * Highest tree_id whose mark this buffer dropped while other
+	 * relocation trees were live.  Tree ids only grow, so a tree above
+	 * it that has no mark here certainly does not hold this buffer.
+	 */
+	unsigned int tree_dropped;
+
+	/** Aperture space needed by this buffer alone. */
+	int aperture_size;
+
+	/**
+	 * Size in bytes of this buffer and its unique relocation descendents.
+	 *
+	 * Kept up to date as relocations are emitted, so that
+	 * drm_intel_bufmgr_check_aperture never has to walk the tree.
 	 *
-	 * Used to avoid costly tree walking in
-	 * drm_intel_bufmgr_check_aperture in the common case.
+	 * Exact as long as every descendent still holds the mark of this
+	 * tree.  A buffer counted in more than BO_TREE_MARKS trees since
+	 * this one last reached it has lost that mark (see tree_dropped),
+	 * and is counted again when a new relocation reaches it, so this is
+	 * an upper bound.  The check falls back to an exact walk when the
+	 * total nears the aperture size.
 	 */
 	int reloc_tree_size;
 
 	/**
-	 * Number of potential fence registers required by this buffer and its
-	 * relocations.
+	 * Number of unique buffers in this buffer's relocation tree, itself
+	 * included, that require a fence register.  An upper bound, for the
+	 * same reason as reloc_tree_size.
 	 */
 	int reloc_tree_fences;
 
+	/** Generation identifying the relocation tree rooted at this buffer */
+	unsigned int tree_id;
+
+	/**
+	 * Validation list for the relocation tree rooted at this buffer,
+	 * built in exec order as relocations are emitted, with a spare slot
+	 * for the buffer itself.  Only buffers that have been executed as a
+	 * batch get one; it is kept while the buffer sits in the cache so
+	 * that the next batch reusing it starts out large enough.
+	 */
+	struct drm_i915_gem_exec_object2 *exec2_objects;
+	drm_intel_bo **exec_bos;
+	int exec_count;
+	int exec_size;
+
+	/**
+	 * Boolean of whether exec_bos may be incomplete or hold a buffer
+	 * twice, in which case exec walks the tree as before.
+	 */
+	bool exec_stale;
+
+	/** Trees this buffer was last counted in, most recent first */
+	struct drm_intel_gem_tree_mark tree_marks[BO_TREE_MARKS];
+
 	/** Flags that we may need to do the SW_FINSIH ioctl on unmap. */
 	bool mapped_cpu_write;
 };
@@ -224,10 +370,16 @@ drm_intel_gem_bo_set_tiling_internal(drm_intel_bo *bo,
 				     uint32_t stride);
 
 static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time);
+						      uint64_t time);
+
+static void drm_intel_gem_bo_unreference_timed(drm_intel_bo *bo,
+					       uint64_t time);
 
 static void drm_intel_gem_bo_unreference(drm_intel_bo *bo);
 
+static void drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem,
+					   uint64_t time);
+
 static void drm_intel_gem_bo_free(drm_intel_bo *bo);
 
 static unsigned long
@@ -330,12 +482,13 @@ drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
 }
 
 static void
-drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
+drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem,
+				   drm_intel_bo **exec_bos, int exec_count)
 {
 	int i, j;
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+	for (i = 0; i < exec_count; i++) {
+		drm_intel_bo *bo = exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 		if (bo_gem->relocs == NULL) {
@@ -418,6 +571,22 @@ drm_intel_add_validate_buffer(drm_intel_bo *bo)
 }
 #endif
 
+static void
+drm_intel_gem_fill_exec_object2(struct drm_i915_gem_exec_object2 *entry,
+				drm_intel_bo_gem *bo_gem, int need_fence)
+{
+	entry->handle = bo_gem->gem_handle;
+	entry->relocation_count = bo_gem->reloc_count;
+	entry->relocs_ptr = (uintptr_t)bo_gem->relocs;
+	entry->alignment = 0;
+	entry->offset = 0;
+	entry->flags = 0;
+	entry->rsvd1 = 0;
+	entry->rsvd2 = 0;
+	if (need_fence)
+		entry->flags |= EXEC_OBJECT_NEEDS_FENCE;
+}
+
 static void
 drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 {
@@ -451,25 +620,193 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	index = bufmgr_gem->exec_count;
 	bo_gem->validate_index = index;
 	/* Fill in array entry */
-	bufmgr_gem->exec2_objects[index].handle = bo_gem->gem_handle;
-	bufmgr_gem->exec2_objects[index].relocation_count = bo_gem->reloc_count;
-	bufmgr_gem->exec2_objects[index].relocs_ptr = (uintptr_t)bo_gem->relocs;
-	bufmgr_gem->exec2_objects[index].alignment = 0;
-	bufmgr_gem->exec2_objects[index].offset = 0;
+	drm_intel_gem_fill_exec_object2(&bufmgr_gem->exec2_objects[index],
+					bo_gem, need_fence);
 	bufmgr_gem->exec_bos[index] = bo;
-	bufmgr_gem->exec2_objects[index].flags = 0;
-	bufmgr_gem->exec2_objects[index].rsvd1 = 0;
-	bufmgr_gem->exec2_objects[index].rsvd2 = 0;
-	if (need_fence) {
-		bufmgr_gem->exec2_objects[index].flags |=
-			EXEC_OBJECT_NEEDS_FENCE;
-	}
 	bufmgr_gem->exec_count++;
 }
 
+/**
+ * Appends bo_gem to the validation list of the tree rooted at root,
+ * always leaving a spare slot behind it for the root itself.
+ */
+static void
+drm_intel_gem_bo_add_tree_buffer(drm_intel_bo_gem *root,
+				 drm_intel_bo_gem *bo_gem,
+				 struct drm_intel_gem_tree_mark *mark,
+				 int need_fence)
+{
+	if (root->exec_bos == NULL || root->exec_stale)
+		return;
+
+	if (root->exec_count + 2 > root->exec_size) {
+		int new_size = root->exec_size * 2;
+		struct drm_i915_gem_exec_object2 *exec2_objects;
+		drm_intel_bo **exec_bos;
+
+		exec2_objects = realloc(root->exec2_objects,
+					sizeof(*root->exec2_objects) * new_size);
+		if (exec2_objects == NULL) {
+			root->exec_stale = true;
+			return;
+		}
+		root->exec2_objects = exec2_objects;
+
+		exec_bos = realloc(root->exec_bos,
+				   sizeof(*root->exec_bos) * new_size);
+		if (exec_bos == NULL) {
+			root->exec_stale = true;
+			return;
+		}
+		root->exec_bos = exec_bos;
+		root->exec_size = new_size;
+	}
+
+	mark->index = root->exec_count;
+	drm_intel_gem_fill_exec_object2(&root->exec2_objects[root->exec_count],
+					bo_gem, need_fence);
+	root->exec_bos[root->exec_count++] = &bo_gem->bo;
+}
+
 #define RELOC_BUF_SIZE(x) ((I915_RELOC_HEADER + x * I915_RELOC0_STRIDE) * \
 	sizeof(uint32_t))
 
+/** Return bo_gem's mark for the tree tree_id, or NULL if it has none. */
+static struct drm_intel_gem_tree_mark *
+drm_intel_gem_bo_find_mark(drm_intel_bo_gem *bo_gem, unsigned int tree_id)
+{
+	int i;
+
+	for (i = 0; i < BO_TREE_MARKS; i++)
+		if (bo_gem->tree_marks[i].tree == tree_id)
+			return &bo_gem->tree_marks[i];
+	return NULL;
+}
+
+/**
+ * Move bo_gem's mark for tree_id to the front, dropping the least
+ * recently used mark to make room if it has none yet.  Return the mark,
+ * and whether it is new in *added.
+ */
+static struct drm_intel_gem_tree_mark *
+drm_intel_gem_bo_touch_mark(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem, unsigned int tree_id,
+			    bool *added)
+{
+	struct drm_intel_gem_tree_mark mark;
+	int i;
+
+	for (i = 0; i < BO_TREE_MARKS - 1; i++)
+		if (bo_gem->tree_marks[i].tree == tree_id)
+			break;
+	mark = bo_gem->tree_marks[i];
+	*added = mark.tree != tree_id;
+	if (*added) {
+		/* With only this tree live, the dropped mark is stale. */
+		if (mark.tree > bo_gem->tree_dropped &&
+		    atomic_read(&bufmgr_gem->tree_live) > 1)
+			bo_gem->tree_dropped = mark.tree;
+		mark.tree = tree_id;
+		mark.index = -1;
+		mark.fence = false;
+	}
+	memmove(&bo_gem->tree_marks[1], &bo_gem->tree_marks[0],
+		i * sizeof(bo_gem->tree_marks[0]));
+	bo_gem->tree_marks[0] = mark;
+	return &bo_gem->tree_marks[0];
+}
+
+/**
+ * Account for bo_gem and whatever it relocates to in the tree rooted at
+ * root, skipping anything already marked with the root's generation,
+ * and append the new buffers to the root's validation list depth-first.
+ *
+ * A buffer's relocations are frozen once it becomes a relocation target,
+ * so a marked buffer's descendents are marked too and only buffers new
+ * to the tree are ever visited.
+ */
+static void
+drm_intel_gem_bo_mark_tree(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *root, drm_intel_bo_gem *bo_gem,
+			   int need_fence)
+{
+	struct drm_intel_gem_tree_mark *mark;
+	bool added;
+	int i;
+
+	/* A mark dropped while other trees were live may have been ours,
+	 * so this buffer could already be listed.
+	 */
+	if (root->tree_id <= bo_gem->tree_dropped &&
+	    drm_intel_gem_bo_find_mark(bo_gem, root->tree_id) == NULL)
+		root->exec_stale = true;
+
+	mark = drm_intel_gem_bo_touch_mark(bufmgr_gem, bo_gem, root->tree_id,
+					   &added);
+	if (added) {
+		root->reloc_tree_size += bo_gem->aperture_size;
+
+		for (i = 0; i < bo_gem->reloc_count; i++) {
+			drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *)
+			    bo_gem->reloc_target_info[i].bo;
+
+			if (target_bo_gem != bo_gem)
+				drm_intel_gem_bo_mark_tree(bufmgr_gem, root,
+							   target_bo_gem,
+							   bo_gem->reloc_target_info[i].flags &
+							   DRM_INTEL_RELOC_FENCE);
+		}
+
+		drm_intel_gem_bo_add_tree_buffer(root, bo_gem, mark,
+						 need_fence);
+	} else if (need_fence && root->exec_bos != NULL && !root->exec_stale) {
+		root->exec2_objects[mark->index].flags |=
+			EXEC_OBJECT_NEEDS_FENCE;
+	}
+
+	if (bo_gem->needs_fence && !mark->fence) {
+		mark->fence = true;
+		root->reloc_tree_fences++;
+	}
+}
+
+/**
+ * Start a new generation for the tree rooted at bo_gem and recount its
+ * current relocations, so that stamps left by the old tree go stale.
+ */
+static void
+drm_intel_gem_bo_reset_reloc_tree(drm_intel_bufmgr_gem *bufmgr_gem,
+				  drm_intel_bo_gem *bo_gem)
+{
+	int i, old, gen;
+
+	/* Buffers are set up outside the lock, and two trees sharing a
+	 * generation would hide buffers from each other.  Zero is unstamped.
+	 */
+	do {
+		old = atomic_read(&bufmgr_gem->tree_gen);
+		gen = (int)((unsigned int)old + 1);
+		if (gen == 0)
+			gen = 1;
+	} while (atomic_cmpxchg(&bufmgr_gem->tree_gen, old, gen) != old);
+	bo_gem->tree_id = gen;
+	bo_gem->reloc_tree_size = bo_gem->aperture_size;
+	bo_gem->reloc_tree_fences = bo_gem->needs_fence;
+	bo_gem->exec_count = 0;
+	bo_gem->exec_stale = false;
+
+	for (i = 0; i < bo_gem->reloc_count; i++) {
+		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *)
+		    bo_gem->reloc_target_info[i].bo;
+
+		if (target_bo_gem != bo_gem)
+			drm_intel_gem_bo_mark_tree(bufmgr_gem, bo_gem,
+						   target_bo_gem,
+						   bo_gem->reloc_target_info[i].flags &
+						   DRM_INTEL_RELOC_FENCE);
+	}
+}
+
 static void
 drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
 				      drm_intel_bo_gem *bo_gem)
@@ -503,7 +840,35 @@ drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
 		size = 2 * min_size;
 	}
 
-	bo_gem->reloc_tree_size = size;
+	bo_gem->aperture_size = size;
+	memset(bo_gem->tree_marks, 0, sizeof(bo_gem->tree_marks));
+	bo_gem->tree_dropped = 0;
+	drm_intel_gem_bo_reset_reloc_tree(bufmgr_gem, bo_gem);
+}
+
+/**
+ * Gives a buffer executed as a batch for the first time its own validation
+ * list, sized for this batch.  Its current relocations were not listed, so
+ * the list stays stale until the buffer's tree is next reset.
+ */
+static void
+drm_intel_gem_bo_setup_exec_list(drm_intel_bo_gem *bo_gem, int exec_size)
+{
+	if (exec_size < 8)
+		exec_size = 8;
+	bo_gem->exec2_objects =
+		malloc(sizeof(*bo_gem->exec2_objects) * exec_size);
+	bo_gem->exec_bos = malloc(sizeof(*bo_gem->exec_bos) * exec_size);
+	if (bo_gem->exec2_objects == NULL || bo_gem->exec_bos == NULL) {
+		free(bo_gem->exec2_objects);
+		bo_gem->exec2_objects = NULL;
+		free(bo_gem->exec_bos);
+		bo_gem->exec_bos = NULL;
+		return;
+	}
+	bo_gem->exec_size = exec_size;
+	bo_gem->exec_count = 0;
+	bo_gem->exec_stale = true;
 }
 
 static int
@@ -520,6 +885,7 @@ drm_intel_setup_reloc_list(drm_intel_bo *bo)
 				sizeof(struct drm_i915_gem_relocation_entry));
 	bo_gem->reloc_target_info = malloc(max_relocs *
 					   sizeof(drm_intel_reloc_target));
+
 	if (bo_gem->relocs == NULL || bo_gem->reloc_target_info == NULL) {
 		bo_gem->has_error = true;
 
@@ -565,6 +931,25 @@ drm_intel_gem_bo_madvise_internal(drm_intel_bufmgr_gem *bufmgr_gem,
 	return madv.retained;
 }
 
+static int
+drm_intel_gem_bo_set_unsynchronized(drm_intel_bufmgr_gem *bufmgr_gem,
+				    drm_intel_bo_gem *bo_gem, bool enable)
+{
+	struct drm_i915_gem_unsynchronized unsync;
+	int ret;
+
+	memset(&unsync, 0, sizeof(unsync));
+	unsync.handle = bo_gem->gem_handle;
+	unsync.enable = enable;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_UNSYNCHRONIZED,
+		       &unsync);
+	if (ret != 0)
+		return -errno;
+
+	bo_gem->unsynchronized = enable;
+	return 0;
+}
+
 static int
 drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 {
@@ -574,120 +959,532 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
+/** Monotonic time in milliseconds, for aging the BO cache */
+static uint64_t
+drm_intel_gem_get_time(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (uint64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+static void
+drm_intel_gem_bo_cache_add(drm_intel_bufmgr_gem *bufmgr_gem,
+			   struct drm_intel_gem_bo_bucket *bucket,
+			   drm_intel_bo_gem *bo_gem, uint64_t time)
+{
+	assert(bo_gem->tiling_mode < BO_CACHE_TILING_MODES);
+	bo_gem->free_time = time;
+	DRMLISTADDTAIL(&bo_gem->head, &bucket->head[bo_gem->tiling_mode]);
+	DRMLISTADDTAIL(&bo_gem->lru, &bufmgr_gem->cache_lru);
+	bufmgr_gem->cache_size += bo_gem->bo.size;
+	bufmgr_gem->cache_count++;
+}
+
+static void
+drm_intel_gem_bo_cache_remove(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem)
+{
+	DRMLISTDEL(&bo_gem->head);
+	DRMLISTDEL(&bo_gem->lru);
+	bufmgr_gem->cache_size -= bo_gem->bo.size;
+	bufmgr_gem->cache_count--;
+}
+
+/*
+ * Picks a cached buffer from @bucket for reuse, or returns NULL.
+ *
+ * A buffer that already has the requested tiling and stride is preferred,
+ * since anything else costs a SET_TILING that may unbind it and drop its
+ * fence.  Otherwise render targets take the most recently freed buffer,
+ * which is likely still hot in the GPU caches and the aperture, and other
+ * buffers the least recently freed, which is most likely to be idle.
+ * For the latter (where we're probably going to map it first thing in
+ * order to fill it with data) only an unbusy buffer is returned, as
+ * allocating a new one is probably faster than waiting for the GPU.
+ *
+ * With @any_tiling the first step is skipped, as the cache did before it
+ * kept tiling modes apart.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_cache_find(struct drm_intel_gem_bo_bucket *bucket,
+			    bool for_render, uint32_t tiling_mode,
+			    unsigned long stride, bool any_tiling)
+{
+	drm_intel_bo_gem *bo_gem, *match = NULL, *pick = NULL;
+	drmMMListHead *list, *entry;
+	int i, n;
+
+	list = &bucket->head[tiling_mode < BO_CACHE_TILING_MODES ?
+			     tiling_mode : I915_TILING_NONE];
+	for (entry = for_render ? list->prev : list->next, n = 0;
+	     !any_tiling && entry != list && n < BO_CACHE_STRIDE_SCAN;
+	     entry = for_render ? entry->prev : entry->next, n++) {
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, entry, head);
+		if (bo_gem->tiling_mode == tiling_mode &&
+		    bo_gem->stride == stride && bo_gem->global_name == 0) {
+			match = bo_gem;
+			break;
+		}
+	}
+	if (match != NULL &&
+	    (for_render || !drm_intel_gem_bo_busy(&match->bo)))
+		return match;
+
+	for (i = 0; i < BO_CACHE_TILING_MODES; i++) {
+		list = &bucket->head[i];
+		if (DRMLISTEMPTY(list))
+			continue;
+
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+				      for_render ? list->prev : list->next,
+				      head);
+		if (pick == NULL ||
+		    (for_render ? bo_gem->free_time > pick->free_time :
+				  bo_gem->free_time < pick->free_time))
+			pick = bo_gem;
+	}
+	if (pick == NULL || pick == match)
+		return NULL;
+	if (!for_render && drm_intel_gem_bo_busy(&pick->bo))
+		return NULL;
+
+	return pick;
+}
+
 /* drop the oldest entries that have been purged by the kernel */
 static void
 drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 				    struct drm_intel_gem_bo_bucket *bucket)
 {
-	while (!DRMLISTEMPTY(&bucket->head)) {
+	int i;
+
+	for (i = 0; i < BO_CACHE_TILING_MODES; i++) {
+		while (!DRMLISTEMPTY(&bucket->head[i])) {
+			drm_intel_bo_gem *bo_gem;
+
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head[i].next, head);
+			if (drm_intel_gem_bo_madvise_internal
+			    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
+				break;
+
+			drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+			drm_intel_gem_bo_free(&bo_gem->bo);
+		}
+	}
+}
+
+/* free the least recently cached buffers until we are within budget */
+static void
+drm_intel_gem_bo_cache_shrink(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	if (bufmgr_gem->cache_max_size == 0)
+		return;
+
+	while (bufmgr_gem->cache_size > bufmgr_gem->cache_max_size) {
 		drm_intel_bo_gem *bo_gem;
 
 		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bucket->head.next, head);
-		if (drm_intel_gem_bo_madvise_internal
-		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
-			break;
-
-		DRMLISTDEL(&bo_gem->head);
+				      bufmgr_gem->cache_lru.next, lru);
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
 		drm_intel_gem_bo_free(&bo_gem->bo);
+		bufmgr_gem->cache_stats.evictions++;
 	}
 }
 
-static drm_intel_bo *
-drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
-				const char *name,
-				unsigned long size,
-				unsigned long flags,
-				uint32_t tiling_mode,
-				unsigned long stride)
+/*
+ * Readies a buffer taken from a cache for its new owner: it must still
+ * have its pages, and gets the requested tiling and maps that wait for
+ * the GPU.  Returns -EAGAIN if the kernel purged it and another error if
+ * it cannot be changed; either way the caller frees it.
+ */
+static int
+drm_intel_gem_bo_revive(drm_intel_bufmgr_gem *bufmgr_gem,
+			drm_intel_bo_gem *bo_gem, uint32_t tiling_mode,
+			unsigned long stride)
 {
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
-	drm_intel_bo_gem *bo_gem;
-	unsigned int page_size = getpagesize();
-	int ret;
-	struct drm_intel_gem_bo_bucket *bucket;
-	bool alloc_from_cache;
-	unsigned long bo_size;
-	bool for_render = false;
+	if (!drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
+					       I915_MADV_WILLNEED))
+		return -EAGAIN;
 
-	if (flags & BO_ALLOC_FOR_RENDER)
-		for_render = true;
+	if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo, tiling_mode,
+						 stride))
+		return -EINVAL;
 
-	/* Round the allocated size up to a power of two number of pages. */
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+	if (bo_gem->unsynchronized &&
+	    drm_intel_gem_bo_set_unsynchronized(bufmgr_gem, bo_gem, false))
+		return -EINVAL;
 
-	/* If we don't have caching at this size, don't actually round the
-	 * allocation up.
-	 */
-	if (bucket == NULL) {
-		bo_size = size;
-		if (bo_size < page_size)
-			bo_size = page_size;
-	} else {
-		bo_size = bucket->size;
-	}
+	return 0;
+}
+
+/*
+ * Takes a buffer out of the shared cache and readies it for reuse, or
+ * returns NULL.  Once it is off the lists it is ours alone, so the ioctls
+ * to revive it are made without holding up other threads.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_cache_take(drm_intel_bufmgr_gem *bufmgr_gem,
+			    struct drm_intel_gem_bo_bucket *bucket,
+			    bool for_render, uint32_t tiling_mode,
+			    unsigned long stride)
+{
+	drm_intel_bo_gem *bo_gem;
+	int ret;
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Get a buffer out of the cache if available */
-retry:
-	alloc_from_cache = false;
-	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
-		if (for_render) {
-			/* Allocate new render-target BOs from the tail (MRU)
-			 * of the list, as it will likely be hot in the GPU
-			 * cache and in the aperture for us.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
-			alloc_from_cache = true;
-		} else {
-			/* For non-render-target BOs (where we're probably
-			 * going to map it first thing in order to fill it
-			 * with data), check if the last BO in the cache is
-			 * unbusy, and only reuse in that case. Otherwise,
-			 * allocating a new buffer is probably faster than
-			 * waiting for the GPU to finish.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
+	/* Age the cache here too, in case nothing is being freed */
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, drm_intel_gem_get_time());
+	while (bucket != NULL) {
+		bo_gem = drm_intel_gem_bo_cache_find(bucket, for_render,
+						     tiling_mode, stride,
+						     bufmgr_gem->cache_any_tiling);
+		if (bo_gem == NULL) {
+			bufmgr_gem->cache_stats.misses++;
+			break;
 		}
 
-		if (alloc_from_cache) {
-			if (!drm_intel_gem_bo_madvise_internal
-			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
-								    bucket);
-				goto retry;
-			}
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+		bufmgr_gem->cache_stats.hits++;
+		if (bo_gem->tiling_mode != tiling_mode ||
+		    bo_gem->stride != stride ||
+		    bo_gem->global_name != 0)
+			bufmgr_gem->cache_stats.retiles++;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
-		}
+		ret = drm_intel_gem_bo_revive(bufmgr_gem, bo_gem,
+					      tiling_mode, stride);
+		if (ret == 0)
+			return bo_gem;
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		bufmgr_gem->cache_stats.hits--;
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		if (ret == -EAGAIN)
+			drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
+							    bucket);
 	}
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-	if (!alloc_from_cache) {
-		struct drm_i915_gem_create create;
+	return NULL;
+}
 
-		bo_gem = calloc(1, sizeof(*bo_gem));
-		if (!bo_gem)
-			return NULL;
+/* Unlinks @bo_gem from the thread cache it is in */
+static void
+drm_intel_gem_thread_cache_remove(struct drm_intel_gem_thread_cache *tc,
+				  drm_intel_bo_gem *bo_gem)
+{
+	DRMLISTDEL(&bo_gem->head);
+	tc->size -= bo_gem->bo.size;
+	tc->count--;
+}
 
-		bo_gem->bo.size = bo_size;
-		memset(&create, 0, sizeof(create));
-		create.size = bo_size;
+/*
+ * Moves the least recently freed buffers of @tc onto @spill until it is
+ * within @max_size and @max_count and nothing left in it has aged out.
+ * Called with tc->lock held.
+ */
+static void
+drm_intel_gem_thread_cache_spill(struct drm_intel_gem_thread_cache *tc,
+				 uint64_t time, unsigned long max_size,
+				 unsigned int max_count, drmMMListHead *spill)
+{
+	while (!DRMLISTEMPTY(&tc->head)) {
+		drm_intel_bo_gem *bo_gem;
 
-		ret = drmIoctl(bufmgr_gem->fd,
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, tc->head.next, head);
+		if (tc->size <= max_size && tc->count <= max_count &&
+		    time - bo_gem->free_time <= BO_CACHE_MAX_AGE)
+			break;
+
+		drm_intel_gem_thread_cache_remove(tc, bo_gem);
+		DRMLISTADDTAIL(&bo_gem->head, spill);
+	}
+}
+
+/*
+ * Hands buffers spilled from a thread cache to the shared cache, freeing
+ * those that have aged out.  The rest are stamped with @time, which keeps
+ * the shared LRU in order at the cost of caching them a little longer.
+ * Called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_thread_cache_release(drm_intel_bufmgr_gem *bufmgr_gem,
+				   drmMMListHead *spill, uint64_t time)
+{
+	while (!DRMLISTEMPTY(spill)) {
+		drm_intel_bo_gem *bo_gem;
+
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, spill->next, head);
+		DRMLISTDEL(&bo_gem->head);
+		if (time - bo_gem->free_time > BO_CACHE_MAX_AGE) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			bufmgr_gem->cache_stats.evictions++;
+			continue;
+		}
+
+		drm_intel_gem_bo_cache_add(bufmgr_gem,
+					   drm_intel_gem_bo_bucket_for_size(bufmgr_gem,
+									    bo_gem->bo.size),
+					   bo_gem, time);
+	}
+	drm_intel_gem_bo_cache_shrink(bufmgr_gem);
+}
+
+/*
+ * Moves whatever has aged out of or no longer fits in @tc, or everything
+ * in it for @all, to the shared cache.  Called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_thread_cache_trim(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_thread_cache *tc,
+				uint64_t time, bool all)
+{
+	drmMMListHead spill;
+
+	DRMINITLISTHEAD(&spill);
+	pthread_mutex_lock(&tc->lock);
+	drm_intel_gem_thread_cache_spill(tc, time,
+					 all ? 0 : tc->max_size,
+					 all ? 0 : BO_THREAD_CACHE_COUNT,
+					 &spill);
+	pthread_mutex_unlock(&tc->lock);
+	drm_intel_gem_thread_cache_release(bufmgr_gem, &spill, time);
+}
+
+/* The most a thread cache holds under a shared cache limit of @size */
+static unsigned long
+drm_intel_gem_thread_cache_max_size(unsigned long size)
+{
+	if (size != 0 && size < BO_THREAD_CACHE_SIZE)
+		return size;
+
+	return BO_THREAD_CACHE_SIZE;
+}
+
+/* Thread exit: the buffers it kept go to the shared cache */
+static void
+drm_intel_gem_thread_cache_exit(void *data)
+{
+	struct drm_intel_gem_thread_cache *tc = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = tc->bufmgr_gem;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_thread_cache_trim(bufmgr_gem, tc,
+					drm_intel_gem_get_time(), true);
+	bufmgr_gem->cache_stats.hits += tc->stats.hits;
+	bufmgr_gem->cache_stats.retiles += tc->stats.retiles;
+	DRMLISTDEL(&tc->link);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	pthread_mutex_destroy(&tc->lock);
+	free(tc);
+}
+
+/*
+ * Returns the calling thread's cache, set up on first use, or NULL if
+ * that fails.
+ */
+static struct drm_intel_gem_thread_cache *
+drm_intel_gem_thread_cache_get(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	struct drm_intel_gem_thread_cache *tc;
+
+	tc = pthread_getspecific(bufmgr_gem->thread_key);
+	if (tc != NULL)
+		return tc;
+
+	tc = calloc(1, sizeof(*tc));
+	if (tc == NULL)
+		return NULL;
+	if (pthread_mutex_init(&tc->lock, NULL) != 0) {
+		free(tc);
+		return NULL;
+	}
+	if (pthread_setspecific(bufmgr_gem->thread_key, tc) != 0) {
+		pthread_mutex_destroy(&tc->lock);
+		free(tc);
+		return NULL;
+	}
+	tc->bufmgr_gem = bufmgr_gem;
+	DRMINITLISTHEAD(&tc->head);
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	tc->max_size =
+	    drm_intel_gem_thread_cache_max_size(bufmgr_gem->cache_max_size);
+	DRMLISTADDTAIL(&tc->link, &bufmgr_gem->thread_caches);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return tc;
+}
+
+/*
+ * Keeps a freed buffer in the calling thread's cache, or returns false
+ * if it is too big for it.  An overflowing cache spills down to half its
+ * limits, so that a thread freeing more than it allocates only takes
+ * bufmgr_gem->lock every so often.
+ */
+static bool
+drm_intel_gem_thread_cache_put(struct drm_intel_gem_thread_cache *tc,
+			       drm_intel_bo_gem *bo_gem, uint64_t time)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = tc->bufmgr_gem;
+	drmMMListHead spill;
+
+	DRMINITLISTHEAD(&spill);
+	pthread_mutex_lock(&tc->lock);
+	if (bo_gem->bo.size > tc->max_size) {
+		pthread_mutex_unlock(&tc->lock);
+		return false;
+	}
+
+	bo_gem->free_time = time;
+	DRMLISTADDTAIL(&bo_gem->head, &tc->head);
+	tc->size += bo_gem->bo.size;
+	tc->count++;
+	if (tc->size > tc->max_size || tc->count > BO_THREAD_CACHE_COUNT)
+		drm_intel_gem_thread_cache_spill(tc, time, tc->max_size / 2,
+						 BO_THREAD_CACHE_COUNT / 2,
+						 &spill);
+	else
+		drm_intel_gem_thread_cache_spill(tc, time, tc->max_size,
+						 BO_THREAD_CACHE_COUNT,
+						 &spill);
+	pthread_mutex_unlock(&tc->lock);
+
+	if (!DRMLISTEMPTY(&spill)) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_thread_cache_release(bufmgr_gem, &spill, time);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	return true;
+}
+
+/*
+ * Takes a buffer of @size out of the calling thread's cache and readies
+ * it for reuse, or returns NULL.  The choice is made as by
+ * drm_intel_gem_bo_cache_find(), over the few buffers kept here.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_thread_cache_take(struct drm_intel_gem_thread_cache *tc,
+				unsigned long size, bool for_render,
+				uint32_t tiling_mode, unsigned long stride)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = tc->bufmgr_gem;
+	drm_intel_bo_gem *bo_gem, *pick;
+	drmMMListHead *entry;
+
+	for (;;) {
+		pick = NULL;
+		pthread_mutex_lock(&tc->lock);
+		for (entry = for_render ? tc->head.prev : tc->head.next;
+		     entry != &tc->head;
+		     entry = for_render ? entry->prev : entry->next) {
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem, entry, head);
+			if (bo_gem->bo.size != size)
+				continue;
+			if (pick == NULL)
+				pick = bo_gem;
+			if (bufmgr_gem->cache_any_tiling)
+				break;
+			if (bo_gem->tiling_mode == tiling_mode &&
+			    bo_gem->stride == stride) {
+				pick = bo_gem;
+				break;
+			}
+		}
+		if (pick != NULL && !for_render &&
+		    drm_intel_gem_bo_busy(&pick->bo))
+			pick = NULL;
+		if (pick != NULL) {
+			drm_intel_gem_thread_cache_remove(tc, pick);
+			tc->stats.hits++;
+			if (pick->tiling_mode != tiling_mode ||
+			    pick->stride != stride)
+				tc->stats.retiles++;
+		}
+		pthread_mutex_unlock(&tc->lock);
+
+		if (pick == NULL ||
+		    drm_intel_gem_bo_revive(bufmgr_gem, pick,
+					    tiling_mode, stride) == 0)
+			return pick;
+
+		pthread_mutex_lock(&tc->lock);
+		tc->stats.hits--;
+		pthread_mutex_unlock(&tc->lock);
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_free(&pick->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+}
+
+static drm_intel_bo *
+drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
+				const char *name,
+				unsigned long size,
+				unsigned long flags,
+				uint32_t tiling_mode,
+				unsigned long stride)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	drm_intel_bo_gem *bo_gem;
+	unsigned int page_size = getpagesize();
+	int ret;
+	struct drm_intel_gem_bo_bucket *bucket;
+	struct drm_intel_gem_thread_cache *tc;
+	bool alloc_from_cache;
+	unsigned long bo_size;
+	bool for_render = false;
+
+	if (flags & BO_ALLOC_FOR_RENDER)
+		for_render = true;
+
+	/* Round the allocated size up to a power of two number of pages. */
+	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+
+	/* If we don't have caching at this size, don't actually round the
+	 * allocation up.
+	 */
+	if (bucket == NULL) {
+		bo_size = size;
+		if (bo_size < page_size)
+			bo_size = page_size;
+	} else {
+		bo_size = bucket->size;
+	}
+
+	/* Get a buffer out of the cache if available, first from the ones
+	 * this thread freed, which needs no lock.
+	 */
+	bo_gem = NULL;
+	if (bucket != NULL && bufmgr_gem->bo_reuse &&
+	    (tc = drm_intel_gem_thread_cache_get(bufmgr_gem)) != NULL)
+		bo_gem = drm_intel_gem_thread_cache_take(tc, bucket->size,
+							 for_render,
+							 tiling_mode, stride);
+	if (bo_gem == NULL)
+		bo_gem = drm_intel_gem_bo_cache_take(bufmgr_gem, bucket,
+						     for_render,
+						     tiling_mode, stride);
+	alloc_from_cache = bo_gem != NULL;
+
+	if (!alloc_from_cache) {
+		struct drm_i915_gem_create create;
+
+		bo_gem = calloc(1, sizeof(*bo_gem));
+		if (!bo_gem)
+			return NULL;
+
+		bo_gem->bo.size = bo_size;
+		memset(&create, 0, sizeof(create));
+		create.size = bo_size;
+
+		ret = drmIoctl(bufmgr_gem->fd,
 			       DRM_IOCTL_I915_GEM_CREATE,
 			       &create);
 		bo_gem->gem_handle = create.handle;
@@ -702,21 +1499,31 @@ retry:
 		bo_gem->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
 		bo_gem->stride = 0;
 
+		DRMINITLISTHEAD(&bo_gem->vma_list);
+
 		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
 							 tiling_mode,
 							 stride)) {
+		    pthread_mutex_lock(&bufmgr_gem->lock);
 		    drm_intel_gem_bo_free(&bo_gem->bo);
+		    pthread_mutex_unlock(&bufmgr_gem->lock);
 		    return NULL;
 		}
 
-		DRMINITLISTHEAD(&bo_gem->name_list);
-		DRMINITLISTHEAD(&bo_gem->vma_list);
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		if (drmHashInsert(bufmgr_gem->handle_table,
+				  bo_gem->gem_handle, bo_gem)) {
+		    drm_intel_gem_bo_free(&bo_gem->bo);
+		    pthread_mutex_unlock(&bufmgr_gem->lock);
+		    return NULL;
+		}
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 	}
 
 	bo_gem->name = name;
 	atomic_set(&bo_gem->refcount, 1);
 	bo_gem->validate_index = -1;
-	bo_gem->reloc_tree_fences = 0;
+	bo_gem->needs_fence = false;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
 	bo_gem->reusable = true;
@@ -726,6 +1533,10 @@ retry:
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_create(bufmgr_gem->trace, bo_gem->gem_handle,
+				       size, flags, tiling_mode, stride);
+
 	return &bo_gem->bo;
 }
 
@@ -802,6 +1613,90 @@ drm_intel_gem_bo_alloc_tiled(drm_intel_bufmgr *bufmgr, const char *name,
 					       tiling, stride);
 }
 
+/**
+ * Wraps size bytes of the caller's memory at addr in a buffer object.
+ *
+ * The kernel shares the pages backing the range with the new object
+ * rather than copying them, so uploads from that memory need no pwrite.
+ * It only accepts page-aligned ranges of shared anonymous memory (for
+ * example a SysV shm segment); anything else fails and NULL is returned,
+ * leaving the caller to fall back to a normal buffer.  The pages belong
+ * to the caller, so the object is never tiled, purged or cached for reuse.
+ */
+static drm_intel_bo *
+drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
+			       const char *name,
+			       void *addr,
+			       uint32_t tiling_mode,
+			       uint32_t stride,
+			       unsigned long size,
+			       unsigned long flags)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	drm_intel_bo_gem *bo_gem;
+	struct drm_i915_gem_userptr userptr;
+	int ret;
+
+	if (tiling_mode != I915_TILING_NONE || flags != 0)
+		return NULL;
+
+	bo_gem = calloc(1, sizeof(*bo_gem));
+	if (!bo_gem)
+		return NULL;
+
+	memset(&userptr, 0, sizeof(userptr));
+	userptr.user_ptr = (uint64_t)(uintptr_t) addr;
+	userptr.user_size = size;
+	ret = drmIoctl(bufmgr_gem->fd,
+		       DRM_IOCTL_I915_GEM_USERPTR,
+		       &userptr);
+	if (ret != 0) {
+		DBG("bo_alloc_userptr: ioctl failed for %s (%p, %lu): %s\n",
+		    name, addr, size, strerror(errno));
+		free(bo_gem);
+		return NULL;
+	}
+
+	bo_gem->bo.size = size;
+	bo_gem->bo.offset = 0;
+	bo_gem->bo.virtual = NULL;
+	bo_gem->bo.bufmgr = bufmgr;
+	bo_gem->name = name;
+	atomic_set(&bo_gem->refcount, 1);
+	bo_gem->validate_index = -1;
+	bo_gem->gem_handle = userptr.handle;
+	bo_gem->bo.handle = userptr.handle;
+	bo_gem->tiling_mode = I915_TILING_NONE;
+	bo_gem->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	bo_gem->stride = stride;
+	bo_gem->reusable = false;
+	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem);
+
+	/* As for any other bo, one missing from handle_table would be
+	 * aliased by the next lookup of its handle, so fail instead.
+	 */
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (drmHashInsert(bufmgr_gem->handle_table, bo_gem->gem_handle,
+			  bo_gem)) {
+		DBG("bo_alloc_userptr: cannot track handle %d (%s)\n",
+		    bo_gem->gem_handle, name);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	DBG("bo_alloc_userptr: %p (%lu) -> %d (%s)\n",
+	    addr, size, bo_gem->gem_handle, bo_gem->name);
+
+	if (bufmgr_gem->trace)
+		drm_intel_trace_create(bufmgr_gem->trace, bo_gem->gem_handle,
+				       size, 0, I915_TILING_NONE, stride);
+
+	return &bo_gem->bo;
+}
+
 /**
  * Returns a drm_intel_bo wrapping the given buffer object handle.
  *
@@ -818,27 +1713,25 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	int ret;
 	struct drm_gem_open open_arg;
 	struct drm_i915_gem_get_tiling get_tiling;
-	drmMMListHead *list;
+	void *value;
 
-	/* At the moment most applications only have a few named bo.
-	 * For instance, in a DRI client only the render buffers passed
-	 * between X and the client are named. And since X returns the
-	 * alternating names for the front/back buffer a linear search
-	 * provides a sufficiently fast match.
+	/* DRI2 clients and the X server import the same front and back
+	 * buffers over and over, so look the name up in the hash table
+	 * rather than opening it again.
 	 */
-	for (list = bufmgr_gem->named.next;
-	     list != &bufmgr_gem->named;
-	     list = list->next) {
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, list, name_list);
-		if (bo_gem->global_name == handle) {
-			drm_intel_gem_bo_reference(&bo_gem->bo);
-			return &bo_gem->bo;
-		}
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (drmHashLookup(bufmgr_gem->name_table, handle, &value) == 0) {
+		bo_gem = value;
+		drm_intel_gem_bo_reference(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return &bo_gem->bo;
 	}
 
 	bo_gem = calloc(1, sizeof(*bo_gem));
-	if (!bo_gem)
+	if (!bo_gem) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 		return NULL;
+	}
 
 	memset(&open_arg, 0, sizeof(open_arg));
 	open_arg.name = handle;
@@ -849,8 +1742,21 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		DBG("Couldn't reference %s handle 0x%08x: %s\n",
 		    name, handle, strerror(errno));
 		free(bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 		return NULL;
 	}
+
+	/* A kernel that hands back a handle we already have gives us the
+	 * same object, so share the existing bo rather than aliasing it.
+	 */
+	if (drmHashLookup(bufmgr_gem->handle_table, open_arg.handle,
+			  &value) == 0) {
+		free(bo_gem);
+		bo_gem = value;
+		drm_intel_gem_bo_reference(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return &bo_gem->bo;
+	}
 	bo_gem->bo.size = open_arg.size;
 	bo_gem->bo.offset = 0;
 	bo_gem->bo.virtual = NULL;
@@ -862,6 +1768,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	bo_gem->bo.handle = open_arg.handle;
 	bo_gem->global_name = handle;
 	bo_gem->reusable = false;
+	DRMINITLISTHEAD(&bo_gem->vma_list);
 
 	memset(&get_tiling, 0, sizeof(get_tiling));
 	get_tiling.handle = bo_gem->gem_handle;
@@ -869,7 +1776,8 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		       DRM_IOCTL_I915_GEM_GET_TILING,
 		       &get_tiling);
 	if (ret != 0) {
-		drm_intel_gem_bo_unreference(&bo_gem->bo);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 		return NULL;
 	}
 	bo_gem->tiling_mode = get_tiling.tiling_mode;
@@ -877,10 +1785,28 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem);
 
-	DRMINITLISTHEAD(&bo_gem->vma_list);
-	DRMLISTADDTAIL(&bo_gem->name_list, &bufmgr_gem->named);
+	/* A bo missing from either table would be aliased by the next
+	 * import, so fail rather than hand it out.
+	 */
+	if (drmHashInsert(bufmgr_gem->handle_table, bo_gem->gem_handle,
+			  bo_gem)) {
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
+	if (drmHashInsert(bufmgr_gem->name_table, handle, bo_gem)) {
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 	DBG("bo_create_from_handle: %d (%s)\n", handle, bo_gem->name);
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_create(bufmgr_gem->trace, bo_gem->gem_handle,
+				       bo_gem->bo.size, 0, bo_gem->tiling_mode,
+				       0);
+
 	return &bo_gem->bo;
 }
 
@@ -890,18 +1816,32 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_gem_close close;
+	void *value;
 	int ret;
 
 	DRMLISTDEL(&bo_gem->vma_list);
 	if (bo_gem->mem_virtual) {
-		munmap(bo_gem->mem_virtual, bo_gem->bo.size);
+		drmMunmap(bo_gem->mem_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_size -= bo_gem->bo.size;
+		bufmgr_gem->vma_stats.unmaps++;
 	}
 	if (bo_gem->gtt_virtual) {
-		munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
+		drmMunmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_size -= bo_gem->bo.size;
+		bufmgr_gem->vma_stats.unmaps++;
 	}
 
+	/* Only drop our own entry: a bo freed because its insert failed
+	 * must not take out the one that was already there.
+	 */
+	if (drmHashLookup(bufmgr_gem->handle_table, bo_gem->gem_handle,
+			  &value) == 0 && value == bo_gem)
+		drmHashDelete(bufmgr_gem->handle_table, bo_gem->gem_handle);
+	free(bo_gem->exec2_objects);
+	free(bo_gem->exec_bos);
+
 	/* Close this object */
 	memset(&close, 0, sizeof(close));
 	close.handle = bo_gem->gem_handle;
@@ -913,31 +1853,30 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 	free(bo);
 }
 
-/** Frees all cached buffers significantly older than @time. */
+/**
+ * Frees all cached buffers unused for longer than BO_CACHE_MAX_AGE ms
+ * before @time.
+ *
+ * The LRU is in order of free_time, so this only looks at the buffers
+ * it frees.
+ */
 static void
-drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
+drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, uint64_t time)
 {
-	int i;
-
-	if (bufmgr_gem->time == time)
+	if (time - bufmgr_gem->time < BO_CACHE_TRIM_INTERVAL)
 		return;
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			drm_intel_bo_gem *bo_gem;
-
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (time - bo_gem->free_time <= 1)
-				break;
+	while (!DRMLISTEMPTY(&bufmgr_gem->cache_lru)) {
+		drm_intel_bo_gem *bo_gem;
 
-			DRMLISTDEL(&bo_gem->head);
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+				      bufmgr_gem->cache_lru.next, lru);
+		if (time - bo_gem->free_time <= BO_CACHE_MAX_AGE)
+			break;
 
-			drm_intel_gem_bo_free(&bo_gem->bo);
-		}
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		bufmgr_gem->cache_stats.evictions++;
 	}
 
 	bufmgr_gem->time = time;
@@ -947,18 +1886,23 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 {
 	int limit;
 
-	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
-	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
-
-	if (bufmgr_gem->vma_max < 0)
-		return;
+	DBG("%s: cached=%d (%ldkb), open=%d, limit=%d (%ldkb)\n", __FUNCTION__,
+	    bufmgr_gem->vma_count, bufmgr_gem->vma_size / 1024,
+	    bufmgr_gem->vma_open, bufmgr_gem->vma_max,
+	    bufmgr_gem->vma_max_size / 1024);
 
 	/* We may need to evict a few entries in order to create new mmaps */
-	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
+	if (bufmgr_gem->vma_max < 0)
+		limit = INT_MAX;
+	else
+		limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
 	if (limit < 0)
 		limit = 0;
 
-	while (bufmgr_gem->vma_count > limit) {
+	while (!DRMLISTEMPTY(&bufmgr_gem->vma_cache) &&
+	       (bufmgr_gem->vma_count > limit ||
+		(bufmgr_gem->vma_max_size != 0 &&
+		 bufmgr_gem->vma_size > bufmgr_gem->vma_max_size))) {
 		drm_intel_bo_gem *bo_gem;
 
 		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
@@ -968,14 +1912,18 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 		DRMLISTDELINIT(&bo_gem->vma_list);
 
 		if (bo_gem->mem_virtual) {
-			munmap(bo_gem->mem_virtual, bo_gem->bo.size);
+			drmMunmap(bo_gem->mem_virtual, bo_gem->bo.size);
 			bo_gem->mem_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_size -= bo_gem->bo.size;
+			bufmgr_gem->vma_stats.unmaps++;
 		}
 		if (bo_gem->gtt_virtual) {
-			munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
+			drmMunmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 			bo_gem->gtt_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_size -= bo_gem->bo.size;
+			bufmgr_gem->vma_stats.unmaps++;
 		}
 	}
 }
@@ -985,10 +1933,14 @@ static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 {
 	bufmgr_gem->vma_open--;
 	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
+	if (bo_gem->mem_virtual) {
 		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
+		bufmgr_gem->vma_size += bo_gem->bo.size;
+	}
+	if (bo_gem->gtt_virtual) {
 		bufmgr_gem->vma_count++;
+		bufmgr_gem->vma_size += bo_gem->bo.size;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
@@ -997,35 +1949,56 @@ static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 {
 	bufmgr_gem->vma_open++;
 	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
+	if (bo_gem->mem_virtual) {
 		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
+		bufmgr_gem->vma_size -= bo_gem->bo.size;
+	}
+	if (bo_gem->gtt_virtual) {
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_size -= bo_gem->bo.size;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+/*
+ * Releases a buffer once its last reference is gone.  With @locked the
+ * caller holds bufmgr_gem->lock and a reusable buffer goes back to the
+ * shared cache.  Otherwise the lock is only taken for the mapping cache
+ * and to free the buffer, and a reusable buffer goes to this thread's
+ * cache.
+ */
 static void
-drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
+drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, uint64_t time,
+				   bool locked)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_intel_gem_bo_bucket *bucket;
+	struct drm_intel_gem_thread_cache *tc;
 	int i;
 
 	/* Unreference all the target buffers */
 	for (i = 0; i < bo_gem->reloc_count; i++) {
-		if (bo_gem->reloc_target_info[i].bo != bo) {
-			drm_intel_gem_bo_unreference_locked_timed(bo_gem->
-								  reloc_target_info[i].bo,
-								  time);
-		}
+		drm_intel_bo *target = bo_gem->reloc_target_info[i].bo;
+
+		if (target == bo)
+			continue;
+		if (locked)
+			drm_intel_gem_bo_unreference_locked_timed(target, time);
+		else
+			drm_intel_gem_bo_unreference_timed(target, time);
 	}
+	if (bo_gem->reloc_count > 0)
+		atomic_dec(&bufmgr_gem->tree_live, 1);
 	bo_gem->reloc_count = 0;
 	bo_gem->used_as_reloc_target = false;
 
 	DBG("bo_unreference final: %d (%s)\n",
 	    bo_gem->gem_handle, bo_gem->name);
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_destroy(bufmgr_gem->trace, bo_gem->gem_handle);
+
 	/* release memory associated with this object */
 	if (bo_gem->reloc_target_info) {
 		free(bo_gem->reloc_target_info);
@@ -1040,54 +2013,109 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	if (bo_gem->map_count) {
 		DBG("bo freed with non-zero map-count %d\n", bo_gem->map_count);
 		bo_gem->map_count = 0;
+		if (!locked)
+			pthread_mutex_lock(&bufmgr_gem->lock);
 		drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
+		if (!locked)
+			pthread_mutex_unlock(&bufmgr_gem->lock);
 	}
 
-	DRMLISTDEL(&bo_gem->name_list);
+	/* Named buffers are only released locked, see unreference_last */
+	if (bo_gem->global_name != 0)
+		drmHashDelete(bufmgr_gem->name_table, bo_gem->global_name);
 
 	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo->size);
 	/* Put the buffer into our internal cache for reuse if we can. */
 	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
 	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
 					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
-
 		bo_gem->name = NULL;
 		bo_gem->validate_index = -1;
 
-		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		if (!locked) {
+			tc = drm_intel_gem_thread_cache_get(bufmgr_gem);
+			if (tc != NULL &&
+			    drm_intel_gem_thread_cache_put(tc, bo_gem, time))
+				return;
+			pthread_mutex_lock(&bufmgr_gem->lock);
+		}
+		if (bufmgr_gem->cache_max_size == 0 ||
+		    bo->size <= bufmgr_gem->cache_max_size) {
+			drm_intel_gem_bo_cache_add(bufmgr_gem, bucket, bo_gem,
+						   time);
+			drm_intel_gem_bo_cache_shrink(bufmgr_gem);
+		} else {
+			drm_intel_gem_bo_free(bo);
+		}
 	} else {
+		if (!locked)
+			pthread_mutex_lock(&bufmgr_gem->lock);
 		drm_intel_gem_bo_free(bo);
 	}
+	if (!locked)
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time)
+						      uint64_t time)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 	assert(atomic_read(&bo_gem->refcount) > 0);
 	if (atomic_dec_and_test(&bo_gem->refcount))
-		drm_intel_gem_bo_unreference_final(bo, time);
+		drm_intel_gem_bo_unreference_final(bo, time, true);
 }
 
-static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
+/* Drops what may be the last reference to @bo */
+static void drm_intel_gem_bo_unreference_last(drm_intel_bo *bo,
+					      uint64_t time)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 
-	assert(atomic_read(&bo_gem->refcount) > 0);
+	/* The last reference to a reusable buffer needs no lock: it was
+	 * never flinked, so no other thread can look it up and revive it.
+	 */
+	if (bo_gem->reusable) {
+		if (atomic_dec_and_test(&bo_gem->refcount))
+			drm_intel_gem_bo_unreference_final(bo, time, false);
+		return;
+	}
+
+	/* Any other is dropped under the lock, so that create_from_name
+	 * cannot find the buffer in the tables and revive it while it is
+	 * freed.
+	 */
+	pthread_mutex_lock(&bufmgr_gem->lock);
 	if (atomic_dec_and_test(&bo_gem->refcount)) {
-		drm_intel_bufmgr_gem *bufmgr_gem =
-		    (drm_intel_bufmgr_gem *) bo->bufmgr;
-		struct timespec time;
+		drm_intel_gem_bo_unreference_final(bo, time, true);
+		drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
+static void drm_intel_gem_bo_unreference_timed(drm_intel_bo *bo,
+					       uint64_t time)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-		pthread_mutex_lock(&bufmgr_gem->lock);
-		drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
-		drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
-		pthread_mutex_unlock(&bufmgr_gem->lock);
-	}
+	assert(atomic_read(&bo_gem->refcount) > 0);
+
+	/* Dropping anything but the last reference needs no lock. */
+	if (atomic_add_unless(&bo_gem->refcount, -1, 1))
+		drm_intel_gem_bo_unreference_last(bo, time);
+}
+
+static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	assert(atomic_read(&bo_gem->refcount) > 0);
+
+	/* Dropping anything but the last reference needs no lock. */
+	if (atomic_add_unless(&bo_gem->refcount, -1, 1))
+		drm_intel_gem_bo_unreference_last(bo,
+						  drm_intel_gem_get_time());
 }
 
 /*
@@ -1097,21 +2125,39 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
  *
  * Therefore, bo_map_gtt calls bo_map.
  */
-static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
+static int
+drm_intel_gem_bo_map_internal(drm_intel_bo *bo, int write_enable, int flags)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_set_domain set_domain;
 	int ret;
 
+	/* Moving the buffer to the GTT domain would wait for the GPU. */
+	if ((flags & DRM_INTEL_MAP_NONBLOCKING) && drm_intel_gem_bo_busy(bo)) {
+		DBG("bo_map: %d (%s) busy\n", bo_gem->gem_handle, bo_gem->name);
+		return -EBUSY;
+	}
+
+	/* Without the kernel's help, the first access after the next
+	 * execbuffer would fault and wait anyway, so sync up front.
+	 */
+	if ((flags & DRM_INTEL_MAP_UNSYNCHRONIZED) && !bo_gem->unsynchronized &&
+	    (!bufmgr_gem->has_unsynchronized ||
+	     drm_intel_gem_bo_set_unsynchronized(bufmgr_gem, bo_gem, true)))
+		flags &= ~DRM_INTEL_MAP_UNSYNCHRONIZED;
+
 	pthread_mutex_lock(&bufmgr_gem->lock);
 
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
-	if (!bo_gem->mem_virtual) {
+	if (bo_gem->mem_virtual)
+		bufmgr_gem->vma_stats.hits++;
+	else {
 		struct drm_i915_gem_mmap mmap_arg;
 
+		bufmgr_gem->vma_stats.misses++;
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
@@ -1138,29 +2184,70 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 	    bo_gem->mem_virtual);
 	bo->virtual = bo_gem->mem_virtual;
 
-	set_domain.handle = bo_gem->gem_handle;
-	set_domain.read_domains = I915_GEM_DOMAIN_GTT /* XXX _CPU */;
-	if (write_enable)
-		set_domain.write_domain = I915_GEM_DOMAIN_GTT /* XXX _CPU */;
-	else
-		set_domain.write_domain = 0;
-	ret = drmIoctl(bufmgr_gem->fd,
-		       DRM_IOCTL_I915_GEM_SET_DOMAIN,
-		       &set_domain);
-	if (ret != 0) {
-		DBG("%s:%d: Error setting to CPU domain %d: %s\n",
-		    __FILE__, __LINE__, bo_gem->gem_handle,
-		    strerror(errno));
-	}
-
 	if (write_enable)
 		bo_gem->mapped_cpu_write = true;
 
+	/* Waiting for the GPU needs nothing from the bufmgr, so don't make
+	 * every other thread wait with us.
+	 */
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
+	if ((flags & DRM_INTEL_MAP_UNSYNCHRONIZED) == 0) {
+		set_domain.handle = bo_gem->gem_handle;
+		set_domain.read_domains = I915_GEM_DOMAIN_GTT /* XXX _CPU */;
+		if (write_enable)
+			set_domain.write_domain =
+			    I915_GEM_DOMAIN_GTT /* XXX _CPU */;
+		else
+			set_domain.write_domain = 0;
+		ret = drmIoctl(bufmgr_gem->fd,
+			       DRM_IOCTL_I915_GEM_SET_DOMAIN,
+			       &set_domain);
+		if (ret != 0) {
+			DBG("%s:%d: Error setting to CPU domain %d: %s\n",
+			    __FILE__, __LINE__, bo_gem->gem_handle,
+			    strerror(errno));
+		}
+	}
+
 	return 0;
 }
 
+static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
+{
+	return drm_intel_gem_bo_map_internal(bo, write_enable, 0);
+}
+
+/**
+ * Maps the buffer for writing without waiting for the GPU to finish with
+ * it, for callers that do their own synchronisation, such as streaming
+ * uploads into ranges the GPU is known not to be using.
+ *
+ * The kernel is told that the buffer is synchronized by us, so that its
+ * mapping survives execbuffer and faulting it back in doesn't wait for
+ * rendering either; the buffer stays that way until it is reused from the
+ * cache.  Kernels without I915_PARAM_HAS_UNSYNCHRONIZED get an ordinary,
+ * waiting map.  Since every mapping goes through the GTT, skipping the
+ * domain change cannot leave stale CPU cachelines behind.  Unmap with
+ * drm_intel_bo_unmap() as usual.
+ */
+int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
+{
+	return drm_intel_gem_bo_map_internal(bo, 1,
+					     DRM_INTEL_MAP_UNSYNCHRONIZED);
+}
+
+/**
+ * Maps the buffer like drm_intel_bo_map(), but returns -EBUSY instead of
+ * stalling if the GPU is still using it, so that the caller can take a
+ * fresh buffer from the cache instead.
+ */
+int drm_intel_gem_bo_map_nonblocking(drm_intel_bo *bo, int write_enable)
+{
+	return drm_intel_gem_bo_map_internal(bo, write_enable,
+					     DRM_INTEL_MAP_NONBLOCKING);
+}
+
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 {
 	return drm_intel_gem_bo_map(bo, 1);
@@ -1202,9 +2289,10 @@ int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 		}
 
 		/* and mmap it */
-		bo_gem->gtt_virtual = mmap(0, bo->size, PROT_READ | PROT_WRITE,
-					   MAP_SHARED, bufmgr_gem->fd,
-					   mmap_arg.offset);
+		bo_gem->gtt_virtual = drmMmap(0, bo->size,
+					      PROT_READ | PROT_WRITE,
+					      MAP_SHARED, bufmgr_gem->fd,
+					      mmap_arg.offset);
 		if (bo_gem->gtt_virtual == MAP_FAILED) {
 			bo_gem->gtt_virtual = NULL;
 			ret = -errno;
@@ -1277,6 +2365,10 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 			       &sw_finish);
 		ret = ret == -1 ? -errno : 0;
 #endif
+		if (bufmgr_gem->trace)
+			drm_intel_trace_write(bufmgr_gem->trace,
+					      bo_gem->gem_handle, 0,
+					      bo->virtual, bo->size);
 		bo_gem->mapped_cpu_write = false;
 	}
 
@@ -1307,6 +2399,10 @@ drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
 	struct drm_i915_gem_pwrite pwrite;
 	int ret;
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_write(bufmgr_gem->trace, bo_gem->gem_handle,
+				      offset, data, size);
+
 	memset(&pwrite, 0, sizeof(pwrite));
 	pwrite.handle = bo_gem->gem_handle;
 	pwrite.offset = offset;
@@ -1380,6 +2476,11 @@ drm_intel_gem_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
 static void
 drm_intel_gem_bo_wait_rendering(drm_intel_bo *bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+
+	if (bufmgr_gem->trace)
+		drm_intel_trace_wait(bufmgr_gem->trace, bo->handle);
+
 	drm_intel_gem_bo_start_gtt_access(bo, 1);
 }
 
@@ -1416,7 +2517,6 @@ static void
 drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
-	int i;
 
 	free(bufmgr_gem->exec2_objects);
 #if !(defined(__OpenBSD__) || defined(__NetBSD__))
@@ -1427,19 +2527,37 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
 	/* Free any cached buffer objects we were going to reuse */
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		drm_intel_bo_gem *bo_gem;
+	pthread_key_delete(bufmgr_gem->thread_key);
+	while (!DRMLISTEMPTY(&bufmgr_gem->thread_caches)) {
+		struct drm_intel_gem_thread_cache *tc;
 
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			DRMLISTDEL(&bo_gem->head);
+		tc = DRMLISTENTRY(struct drm_intel_gem_thread_cache,
+				  bufmgr_gem->thread_caches.next, link);
+		while (!DRMLISTEMPTY(&tc->head)) {
+			drm_intel_bo_gem *bo_gem;
 
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      tc->head.next, head);
+			drm_intel_gem_thread_cache_remove(tc, bo_gem);
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
+		DRMLISTDEL(&tc->link);
+		pthread_mutex_destroy(&tc->lock);
+		free(tc);
 	}
+	while (!DRMLISTEMPTY(&bufmgr_gem->cache_lru)) {
+		drm_intel_bo_gem *bo_gem;
+
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+				      bufmgr_gem->cache_lru.next, lru);
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+
+		drm_intel_gem_bo_free(&bo_gem->bo);
+	}
+
+	drmHashDestroy(bufmgr_gem->handle_table);
+	drmHashDestroy(bufmgr_gem->name_table);
+	drm_intel_trace_close(bufmgr_gem->trace);
 
 	free(bufmgr);
 }
@@ -1495,16 +2613,20 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	 * already been accounted for.
 	 */
 	assert(!bo_gem->used_as_reloc_target);
-	if (target_bo_gem != bo_gem) {
-		target_bo_gem->used_as_reloc_target = true;
-		bo_gem->reloc_tree_size += target_bo_gem->reloc_tree_size;
-	}
 	/* An object needing a fence is a tiled buffer, so it won't have
 	 * relocs to other buffers.
 	 */
-	if (need_fence)
-		target_bo_gem->reloc_tree_fences = 1;
-	bo_gem->reloc_tree_fences += target_bo_gem->reloc_tree_fences;
+	if (need_fence && !target_bo_gem->needs_fence) {
+		target_bo_gem->needs_fence = true;
+		target_bo_gem->reloc_tree_fences++;
+	}
+	if (bo_gem->reloc_count == 0)
+		atomic_inc(&bufmgr_gem->tree_live);
+	if (target_bo_gem != bo_gem) {
+		target_bo_gem->used_as_reloc_target = true;
+		drm_intel_gem_bo_mark_tree(bufmgr_gem, bo_gem, target_bo_gem,
+					   fenced_command);
+	}
 
 	bo_gem->relocs[bo_gem->reloc_count].offset = offset;
 	bo_gem->relocs[bo_gem->reloc_count].delta = target_offset;
@@ -1525,6 +2647,12 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 
 	bo_gem->reloc_count++;
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_reloc(bufmgr_gem->trace, bo_gem->gem_handle,
+				      offset, target_bo_gem->gem_handle,
+				      target_offset, read_domains,
+				      write_domain, fenced_command);
+
 	return 0;
 }
 
@@ -1568,28 +2696,35 @@ drm_intel_gem_bo_get_reloc_count(drm_intel_bo *bo)
  * batchbuffer including drm_intel_gem_get_reloc_count(), emit all the
  * state, and then check if it still fits in the aperture.
  *
- * Any further drm_intel_bufmgr_check_aperture_space() queries
- * involving this buffer in the tree are undefined after this call.
+ * The aperture accounting for this buffer's tree is recounted from the
+ * relocations that remain, so later drm_intel_bufmgr_check_aperture_space()
+ * queries stay accurate.
  */
 void
 drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int i;
-	struct timespec time;
-
-	clock_gettime(CLOCK_MONOTONIC, &time);
+	uint64_t time = drm_intel_gem_get_time();
 
 	assert(bo_gem->reloc_count >= start);
 	/* Unreference the cleared target buffers */
 	for (i = start; i < bo_gem->reloc_count; i++) {
 		if (bo_gem->reloc_target_info[i].bo != bo) {
-			drm_intel_gem_bo_unreference_locked_timed(bo_gem->
-								  reloc_target_info[i].bo,
-								  time.tv_sec);
+			drm_intel_gem_bo_unreference_timed(bo_gem->
+							   reloc_target_info[i].bo,
+							   time);
 		}
 	}
+	if (start == 0 && bo_gem->reloc_count > 0)
+		atomic_dec(&bufmgr_gem->tree_live, 1);
 	bo_gem->reloc_count = start;
+	drm_intel_gem_bo_reset_reloc_tree(bufmgr_gem, bo_gem);
+
+	if (bufmgr_gem->trace)
+		drm_intel_trace_clear_relocs(bufmgr_gem->trace,
+					     bo_gem->gem_handle, start);
 }
 
 #if !(defined(__OpenBSD__) || defined(__NetBSD__))
@@ -1673,20 +2808,22 @@ drm_intel_update_buffer_offsets(drm_intel_bufmgr_gem *bufmgr_gem)
 #endif
 
 static void
-drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem)
+drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem,
+				  struct drm_i915_gem_exec_object2 *exec2_objects,
+				  drm_intel_bo **exec_bos, int exec_count)
 {
 	int i;
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+	for (i = 0; i < exec_count; i++) {
+		drm_intel_bo *bo = exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
 
 		/* Update the buffer offset */
-		if (bufmgr_gem->exec2_objects[i].offset != bo->offset) {
+		if (exec2_objects[i].offset != bo->offset) {
 			DBG("BO %d (%s) migrated: 0x%08lx -> 0x%08llx\n",
 			    bo_gem->gem_handle, bo_gem->name, bo->offset,
-			    (unsigned long long)bufmgr_gem->exec2_objects[i].offset);
-			bo->offset = bufmgr_gem->exec2_objects[i].offset;
+			    (unsigned long long)exec2_objects[i].offset);
+			bo->offset = exec2_objects[i].offset;
 		}
 	}
 }
@@ -1704,6 +2841,10 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	if (bo_gem->has_error)
 		return -ENOMEM;
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_exec(bufmgr_gem->trace, bo_gem->gem_handle,
+				     used, 0);
+
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	/* Update indices and set up the validate list. */
 	drm_intel_gem_bo_process_reloc(bo);
@@ -1742,7 +2883,9 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	drm_intel_update_buffer_offsets(bufmgr_gem);
 
 	if (bufmgr_gem->bufmgr.debug)
-		drm_intel_gem_dump_validation_list(bufmgr_gem);
+		drm_intel_gem_dump_validation_list(bufmgr_gem,
+						   bufmgr_gem->exec_bos,
+						   bufmgr_gem->exec_count);
 
 	for (i = 0; i < bufmgr_gem->exec_count; i++) {
 		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
@@ -1753,6 +2896,7 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		bufmgr_gem->exec_bos[i] = NULL;
 	}
 	bufmgr_gem->exec_count = 0;
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, drm_intel_gem_get_time());
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return ret;
@@ -1765,7 +2909,11 @@ drm_intel_gem_bo_mrb_exec2(drm_intel_bo *bo, int used,
 			unsigned int flags)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
 	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_exec_object2 *exec2_objects;
+	drm_intel_bo **exec_bos;
+	int exec_count;
 	int ret, i;
 
 	switch (flags & 0x7) {
@@ -1784,17 +2932,41 @@ drm_intel_gem_bo_mrb_exec2(drm_intel_bo *bo, int used,
 		break;
 	}
 
+	if (bufmgr_gem->trace)
+		drm_intel_trace_exec(bufmgr_gem->trace, bo_gem->gem_handle,
+				     used, flags);
+
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
+	if (bo_gem->exec_bos != NULL && !bo_gem->exec_stale) {
+		/* The validate list was built as the relocations were
+		 * emitted; only the batch buffer itself is missing, and
+		 * there is always a slot left for it.
+		 */
+		exec2_objects = bo_gem->exec2_objects;
+		exec_bos = bo_gem->exec_bos;
+		exec_count = bo_gem->exec_count;
+		drm_intel_gem_fill_exec_object2(&exec2_objects[exec_count],
+						bo_gem, 0);
+		exec_bos[exec_count++] = bo;
+	} else {
+		/* Update indices and set up the validate list. */
+		drm_intel_gem_bo_process_reloc2(bo);
 
-	/* Add the batch buffer to the validation list.  There are no relocations
-	 * pointing to it.
-	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+		/* Add the batch buffer to the validation list.  There are
+		 * no relocations pointing to it.
+		 */
+		drm_intel_add_validate_buffer2(bo, 0);
 
-	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
-	execbuf.buffer_count = bufmgr_gem->exec_count;
+		exec2_objects = bufmgr_gem->exec2_objects;
+		exec_bos = bufmgr_gem->exec_bos;
+		exec_count = bufmgr_gem->exec_count;
+
+		if (bo_gem->exec_bos == NULL)
+			drm_intel_gem_bo_setup_exec_list(bo_gem, exec_count);
+	}
+
+	execbuf.buffers_ptr = (uintptr_t)exec2_objects;
+	execbuf.buffer_count = exec_count;
 	execbuf.batch_start_offset = 0;
 	execbuf.batch_len = used;
 #if !(defined(__OpenBSD__) || defined(__NetBSD__))
@@ -1815,17 +2987,19 @@ drm_intel_gem_bo_mrb_exec2(drm_intel_bo *bo, int used,
 		if (ret == -ENOSPC) {
 			DBG("Execbuffer fails to pin. "
 			    "Estimate: %u. Actual: %u. Available: %u\n",
-			    drm_intel_gem_estimate_batch_space(bufmgr_gem->exec_bos,
-							       bufmgr_gem->exec_count),
-			    drm_intel_gem_compute_batch_space(bufmgr_gem->exec_bos,
-							      bufmgr_gem->exec_count),
+			    drm_intel_gem_estimate_batch_space(exec_bos,
+							       exec_count),
+			    drm_intel_gem_compute_batch_space(exec_bos,
+							      exec_count),
 			    (unsigned int) bufmgr_gem->gtt_size);
 		}
 	}
-	drm_intel_update_buffer_offsets2(bufmgr_gem);
+	drm_intel_update_buffer_offsets2(bufmgr_gem, exec2_objects, exec_bos,
+					 exec_count);
 
 	if (bufmgr_gem->bufmgr.debug)
-		drm_intel_gem_dump_validation_list(bufmgr_gem);
+		drm_intel_gem_dump_validation_list(bufmgr_gem, exec_bos,
+						   exec_count);
 
 	for (i = 0; i < bufmgr_gem->exec_count; i++) {
 		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
@@ -1836,6 +3010,7 @@ drm_intel_gem_bo_mrb_exec2(drm_intel_bo *bo, int used,
 		bufmgr_gem->exec_bos[i] = NULL;
 	}
 	bufmgr_gem->exec_count = 0;
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, drm_intel_gem_get_time());
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return ret;
@@ -1916,9 +3091,9 @@ drm_intel_gem_bo_set_tiling_internal(drm_intel_bo *bo,
 		set_tiling.tiling_mode = tiling_mode;
 		set_tiling.stride = stride;
 
-		ret = ioctl(bufmgr_gem->fd,
-			    DRM_IOCTL_I915_GEM_SET_TILING,
-			    &set_tiling);
+		ret = drmIoctlOnce(bufmgr_gem->fd,
+				   DRM_IOCTL_I915_GEM_SET_TILING,
+				   &set_tiling);
 	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
 	if (ret == -1)
 		return -errno;
@@ -1970,18 +3145,27 @@ drm_intel_gem_bo_flink(drm_intel_bo *bo, uint32_t * name)
 	struct drm_gem_flink flink;
 	int ret;
 
+	pthread_mutex_lock(&bufmgr_gem->lock);
 	if (!bo_gem->global_name) {
 		memset(&flink, 0, sizeof(flink));
 		flink.handle = bo_gem->gem_handle;
 
 		ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_GEM_FLINK, &flink);
-		if (ret != 0)
-			return -errno;
-		bo_gem->global_name = flink.name;
+		if (ret != 0) {
+			ret = -errno;
+			pthread_mutex_unlock(&bufmgr_gem->lock);
+			return ret;
+		}
 		bo_gem->reusable = false;
 
-		DRMLISTADDTAIL(&bo_gem->name_list, &bufmgr_gem->named);
+		if (drmHashInsert(bufmgr_gem->name_table, flink.name,
+				  bo_gem)) {
+			pthread_mutex_unlock(&bufmgr_gem->lock);
+			return -ENOMEM;
+		}
+		bo_gem->global_name = flink.name;
 	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	*name = bo_gem->global_name;
 	return 0;
@@ -2002,6 +3186,120 @@ drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
 	bufmgr_gem->bo_reuse = true;
 }
 
+/**
+ * Limits the total size of buffers kept in the reuse cache to @size bytes,
+ * freeing the least recently used ones as needed.  Zero removes the limit.
+ *
+ * Each thread also keeps up to 8MB, or @size if less, of the buffers it
+ * freed for itself, outside of this limit.
+ */
+void
+drm_intel_bufmgr_gem_set_cache_size(drm_intel_bufmgr *bufmgr,
+				    unsigned long size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	struct drm_intel_gem_thread_cache *tc;
+	drmMMListHead *entry;
+	uint64_t time = drm_intel_gem_get_time();
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->cache_max_size = size;
+	for (entry = bufmgr_gem->thread_caches.next;
+	     entry != &bufmgr_gem->thread_caches; entry = entry->next) {
+		tc = DRMLISTENTRY(struct drm_intel_gem_thread_cache, entry,
+				  link);
+		pthread_mutex_lock(&tc->lock);
+		tc->max_size = drm_intel_gem_thread_cache_max_size(size);
+		pthread_mutex_unlock(&tc->lock);
+		drm_intel_gem_thread_cache_trim(bufmgr_gem, tc, time, false);
+	}
+	drm_intel_gem_bo_cache_shrink(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Frees cached buffers that have aged out.
+ *
+ * This normally happens as buffers are allocated and freed; an otherwise
+ * idle client can call this from its idle or timer handler to give the
+ * memory back.
+ */
+void
+drm_intel_bufmgr_gem_trim_cache(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	struct drm_intel_gem_thread_cache *tc;
+	drmMMListHead *entry;
+	uint64_t time = drm_intel_gem_get_time();
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	for (entry = bufmgr_gem->thread_caches.next;
+	     entry != &bufmgr_gem->thread_caches; entry = entry->next) {
+		tc = DRMLISTENTRY(struct drm_intel_gem_thread_cache, entry,
+				  link);
+		drm_intel_gem_thread_cache_trim(bufmgr_gem, tc, time, false);
+	}
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Returns the reuse cache statistics: allocations satisfied from the
+ * cache, cacheable allocations that were not, buffers freed by aging or
+ * the size limit, cache hits that had to change the buffer's tiling, and
+ * the number and total size of cached buffers.
+ */
+void
+drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+				     struct drm_intel_bo_cache_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+
+	struct drm_intel_gem_thread_cache *tc;
+	drmMMListHead *entry;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	*stats = bufmgr_gem->cache_stats;
+	stats->count = bufmgr_gem->cache_count;
+	stats->size = bufmgr_gem->cache_size;
+	for (entry = bufmgr_gem->thread_caches.next;
+	     entry != &bufmgr_gem->thread_caches; entry = entry->next) {
+		tc = DRMLISTENTRY(struct drm_intel_gem_thread_cache, entry,
+				  link);
+		pthread_mutex_lock(&tc->lock);
+		stats->hits += tc->stats.hits;
+		stats->retiles += tc->stats.retiles;
+		stats->count += tc->count;
+		stats->size += tc->size;
+		pthread_mutex_unlock(&tc->lock);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Starts recording buffer activity on bufmgr to the file at path, for
+ * later replay with drm_intel_trace_replay().  Recording stops when the
+ * bufmgr is destroyed.
+ *
+ * Data written through drm_intel_bo_subdata() and CPU maps opened for
+ * writing is recorded; writes through GTT maps are not.
+ */
+int
+drm_intel_bufmgr_gem_start_trace(drm_intel_bufmgr *bufmgr, const char *path)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+
+	if (bufmgr_gem->trace != NULL)
+		return -EBUSY;
+
+	errno = 0;
+	bufmgr_gem->trace = drm_intel_trace_open(path);
+	if (bufmgr_gem->trace == NULL)
+		return errno ? -errno : -ENOMEM;
+
+	return 0;
+}
+
 /**
  * Enable use of fenced reloc type.
  *
@@ -2049,21 +3347,30 @@ drm_intel_gem_bo_get_aperture_space(drm_intel_bo *bo)
  * If the count is greater than the number of available regs, we'll have
  * to ask the caller to resubmit a batch with fewer tiled buffers.
  *
- * This function over-counts if the same buffer is used multiple times.
+ * Buffers already in the first buffer's relocation tree are not counted
+ * again, but this still over-counts buffers shared by the other trees.
  */
 static unsigned int
 drm_intel_gem_total_fences(drm_intel_bo ** bo_array, int count)
 {
+	drm_intel_bo_gem *root = (drm_intel_bo_gem *) bo_array[0];
+	struct drm_intel_gem_tree_mark *mark;
 	int i;
 	unsigned int total = 0;
 
 	for (i = 0; i < count; i++) {
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
 
-		if (bo_gem == NULL)
+		if (bo_gem == NULL || (i > 0 && bo_gem == root))
 			continue;
 
-		total += bo_gem->reloc_tree_fences;
+		mark = i > 0 ? drm_intel_gem_bo_find_mark(bo_gem,
+							  root->tree_id) : NULL;
+		if (mark != NULL) {
+			if (bo_gem->needs_fence && !mark->fence)
+				total++;
+		} else
+			total += bo_gem->reloc_tree_fences;
 	}
 	return total;
 }
@@ -2090,18 +3397,27 @@ drm_intel_gem_bo_clear_aperture_space_flag(drm_intel_bo *bo)
 
 /**
  * Return a conservative estimate for the amount of aperture required
- * for a collection of buffers. This may double-count some buffers.
+ * for a collection of buffers. Buffers already in the first buffer's
+ * relocation tree are skipped, but the trees of the others may still
+ * double-count some buffers.
  */
 static unsigned int
 drm_intel_gem_estimate_batch_space(drm_intel_bo **bo_array, int count)
 {
+	drm_intel_bo_gem *root = (drm_intel_bo_gem *) bo_array[0];
 	int i;
 	unsigned int total = 0;
 
 	for (i = 0; i < count; i++) {
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
-		if (bo_gem != NULL)
-			total += bo_gem->reloc_tree_size;
+
+		if (bo_gem == NULL)
+			continue;
+		if (i > 0 && (bo_gem == root ||
+			      drm_intel_gem_bo_find_mark(bo_gem,
+							 root->tree_id)))
+			continue;
+		total += bo_gem->reloc_tree_size;
 	}
 	return total;
 }
@@ -2117,23 +3433,8 @@ drm_intel_gem_compute_batch_space(drm_intel_bo **bo_array, int count)
 	int i;
 	unsigned int total = 0;
 
-	for (i = 0; i < count; i++) {
+	for (i = 0; i < count; i++)
 		total += drm_intel_gem_bo_get_aperture_space(bo_array[i]);
-		/* For the first buffer object in the array, we get an
-		 * accurate count back for its reloc_tree size (since nothing
-		 * had been flagged as being counted yet).  We can save that
-		 * value out as a more conservative reloc_tree_size that
-		 * avoids double-counting target buffers.  Since the first
-		 * buffer happens to usually be the batch buffer in our
-		 * callers, this can pull us back from doing the tree
-		 * walk on every new batch emit.
-		 */
-		if (i == 0) {
-			drm_intel_bo_gem *bo_gem =
-			    (drm_intel_bo_gem *) bo_array[i];
-			bo_gem->reloc_tree_size = total;
-		}
-	}
 
 	for (i = 0; i < count; i++)
 		drm_intel_gem_bo_clear_aperture_space_flag(bo_array[i]);
@@ -2233,11 +3534,19 @@ _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 static int
 drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
 
 	if (bo == NULL || target_bo == NULL)
 		return 0;
-	if (target_bo_gem->used_as_reloc_target)
+	if (!target_bo_gem->used_as_reloc_target)
+		return 0;
+	/* Everything in bo's tree carries its mark, unless the mark was
+	 * dropped while other trees were live; only then do we need the walk.
+	 */
+	if (drm_intel_gem_bo_find_mark(target_bo_gem, bo_gem->tree_id))
+		return 1;
+	if (bo_gem->tree_id <= target_bo_gem->tree_dropped)
 		return _drm_intel_gem_bo_references(bo, target_bo);
 	return 0;
 }
@@ -2246,10 +3555,12 @@ static void
 add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
 {
 	unsigned int i = bufmgr_gem->num_buckets;
+	int j;
 
 	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
 
-	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
+	for (j = 0; j < BO_CACHE_TILING_MODES; j++)
+		DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head[j]);
 	bufmgr_gem->cache_bucket[i].size = size;
 	bufmgr_gem->num_buckets++;
 }
@@ -2291,6 +3602,256 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+/**
+ * Sets the limit on the total size of idle mappings kept for reuse, in
+ * bytes, on top of the count set by drm_intel_bufmgr_gem_set_vma_cache_size().
+ * Zero removes the limit.
+ */
+void
+drm_intel_bufmgr_gem_set_vma_cache_max_size(drm_intel_bufmgr *bufmgr,
+					    unsigned long size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_max_size = size;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Returns the mapping cache statistics: maps that reused an existing
+ * mapping, maps that needed a new one, mappings torn down, and the number
+ * and total size of idle mappings currently kept.
+ */
+void
+drm_intel_bufmgr_gem_get_vma_stats(drm_intel_bufmgr *bufmgr,
+				   struct drm_intel_bo_vma_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	*stats = bufmgr_gem->vma_stats;
+	stats->count = bufmgr_gem->vma_count;
+	stats->size = bufmgr_gem->vma_size;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/*
+ * Streaming uploads.
+ *
+ * A stream is a ring of a few equally sized buffers, each mapped once for
+ * the life of the stream.  Small uploads are packed into the current
+ * segment and handed back as (bo, offset) pairs; when a segment fills up
+ * the stream moves on to the next one, which only has to be waited for if
+ * the GPU is still reading it.  The kernel tracks activity per object, so
+ * a segment is the unit of fencing.
+ *
+ * Segments are marked unsynchronized in the kernel, so that writing past
+ * an upload a submitted batch is reading neither faults nor waits; the
+ * waits counted in the stream stats are the only ones.
+ */
+#define STREAM_SEGMENTS	4
+
+struct _drm_intel_stream {
+	drm_intel_bufmgr_gem *bufmgr_gem;
+	const char *name;
+	unsigned long segment_size;
+	unsigned long head;		/* next free byte in the current segment */
+	int current;
+	drm_intel_bo *segment[STREAM_SEGMENTS];
+	struct drm_intel_stream_stats stats;
+};
+
+static void
+drm_intel_stream_free_segment(drm_intel_bo *bo)
+{
+	drm_intel_gem_bo_unmap(bo);
+	drm_intel_gem_bo_unreference(bo);
+}
+
+static drm_intel_bo *
+drm_intel_stream_new_segment(drm_intel_stream *stream)
+{
+	drm_intel_bo *bo;
+
+	bo = drm_intel_gem_bo_alloc(&stream->bufmgr_gem->bufmgr, stream->name,
+				    stream->segment_size, 4096);
+	if (bo == NULL)
+		return NULL;
+
+	/* The stream never writes a range the GPU may still be reading. */
+	if (drm_intel_gem_bo_map_unsynchronized(bo) != 0) {
+		drm_intel_gem_bo_unreference(bo);
+		return NULL;
+	}
+	if (!((drm_intel_bo_gem *) bo)->unsynchronized) {
+		drm_intel_stream_free_segment(bo);
+		return NULL;
+	}
+
+	return bo;
+}
+
+/**
+ * Makes the next segment of the ring current, waiting for the GPU to
+ * finish with it if necessary.
+ */
+static int
+drm_intel_stream_advance(drm_intel_stream *stream)
+{
+	int next = (stream->current + 1) % STREAM_SEGMENTS;
+	drm_intel_bo *bo = stream->segment[next];
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (atomic_read(&bo_gem->refcount) > 1) {
+		drm_intel_bo *fresh;
+
+		/* Still referenced by a batch that has not been submitted
+		 * (or by the caller), so the kernel cannot know it is in use.
+		 * Leave it to its users and carry on with a new buffer.
+		 */
+		fresh = drm_intel_stream_new_segment(stream);
+		if (fresh == NULL)
+			return -ENOMEM;
+		drm_intel_stream_free_segment(bo);
+		stream->segment[next] = fresh;
+		stream->stats.orphans++;
+	} else if (drm_intel_gem_bo_busy(bo)) {
+		drm_intel_gem_bo_wait_rendering(bo);
+		stream->stats.waits++;
+	}
+
+	stream->current = next;
+	stream->head = 0;
+	stream->stats.wraps++;
+
+	return 0;
+}
+
+/**
+ * Creates a stream for small uploads, backed by size bytes of buffer
+ * objects that stay mapped until drm_intel_stream_destroy().
+ *
+ * Returns NULL on kernels without I915_PARAM_HAS_UNSYNCHRONIZED, where
+ * every write after a batch using the segment would wait for it.
+ * A stream is not locked; each thread should use its own.
+ */
+drm_intel_stream *
+drm_intel_stream_create(drm_intel_bufmgr *bufmgr, const char *name,
+			unsigned long size)
+{
+	drm_intel_stream *stream;
+	int i;
+
+	if (!((drm_intel_bufmgr_gem *) bufmgr)->has_unsynchronized)
+		return NULL;
+
+	stream = calloc(1, sizeof(*stream));
+	if (stream == NULL)
+		return NULL;
+
+	stream->bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	stream->name = name;
+	stream->segment_size = ALIGN(size / STREAM_SEGMENTS, 4096);
+	if (stream->segment_size == 0)
+		stream->segment_size = 4096;
+
+	for (i = 0; i < STREAM_SEGMENTS; i++) {
+		stream->segment[i] = drm_intel_stream_new_segment(stream);
+		if (stream->segment[i] == NULL) {
+			drm_intel_stream_destroy(stream);
+			return NULL;
+		}
+	}
+
+	return stream;
+}
+
+void
+drm_intel_stream_destroy(drm_intel_stream *stream)
+{
+	int i;
+
+	if (stream == NULL)
+		return;
+
+	for (i = 0; i < STREAM_SEGMENTS; i++) {
+		if (stream->segment[i] != NULL)
+			drm_intel_stream_free_segment(stream->segment[i]);
+	}
+	free(stream);
+}
+
+/**
+ * Reserves size bytes at a multiple of alignment and returns a CPU pointer
+ * to them.  *bo and *offset say where the GPU will find the data.
+ *
+ * The returned buffer belongs to the stream: emit a relocation to it (which
+ * takes a reference) rather than keeping the pointer.  Returns NULL if the
+ * request is larger than a segment or no buffer could be had; the caller
+ * should then upload through a buffer of its own.
+ */
+void *
+drm_intel_stream_alloc(drm_intel_stream *stream, unsigned long size,
+		       unsigned int alignment, drm_intel_bo **bo,
+		       unsigned long *offset)
+{
+	unsigned long start;
+	drm_intel_bo *seg;
+
+	if (alignment == 0)
+		alignment = 1;
+	if (size > stream->segment_size)
+		return NULL;
+
+	start = ROUND_UP_TO(stream->head, alignment);
+	if (start + size > stream->segment_size) {
+		if (drm_intel_stream_advance(stream) != 0)
+			return NULL;
+		start = 0;
+	}
+
+	seg = stream->segment[stream->current];
+	stream->head = start + size;
+	stream->stats.allocs++;
+	stream->stats.bytes += size;
+
+	*bo = seg;
+	*offset = start;
+	return (char *) seg->virtual + start;
+}
+
+/**
+ * Copies size bytes of data into the stream; see drm_intel_stream_alloc().
+ */
+int
+drm_intel_stream_write(drm_intel_stream *stream, const void *data,
+		       unsigned long size, unsigned int alignment,
+		       drm_intel_bo **bo, unsigned long *offset)
+{
+	void *ptr;
+
+	ptr = drm_intel_stream_alloc(stream, size, alignment, bo, offset);
+	if (ptr == NULL)
+		return -ENOMEM;
+
+	memcpy(ptr, data, size);
+	return 0;
+}
+
+/**
+ * Reports how much the stream was used, how often it moved to the next
+ * segment, and how many of those moves waited for the GPU or had to
+ * replace a segment a pending batch still referenced.
+ */
+void
+drm_intel_stream_get_stats(drm_intel_stream *stream,
+			   struct drm_intel_stream_stats *stats)
+{
+	*stats = stream->stats;
+}
+
 /**
  * Initializes the GEM buffer manager, which uses the kernel to allocate, map,
  * and manage map buffer objections.
@@ -2318,6 +3879,26 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 		free(bufmgr_gem);
 		return NULL;
 	}
+	if (pthread_key_create(&bufmgr_gem->thread_key,
+			       drm_intel_gem_thread_cache_exit) != 0) {
+		pthread_mutex_destroy(&bufmgr_gem->lock);
+		free(bufmgr_gem);
+		return NULL;
+	}
+
+	bufmgr_gem->name_table = drmHashCreate();
+	bufmgr_gem->handle_table = drmHashCreate();
+	if (bufmgr_gem->name_table == NULL ||
+	    bufmgr_gem->handle_table == NULL) {
+		if (bufmgr_gem->name_table != NULL)
+			drmHashDestroy(bufmgr_gem->name_table);
+		if (bufmgr_gem->handle_table != NULL)
+			drmHashDestroy(bufmgr_gem->handle_table);
+		pthread_key_delete(bufmgr_gem->thread_key);
+		pthread_mutex_destroy(&bufmgr_gem->lock);
+		free(bufmgr_gem);
+		return NULL;
+	}
 
 	ret = drmIoctl(bufmgr_gem->fd,
 		       DRM_IOCTL_I915_GEM_GET_APERTURE,
@@ -2388,6 +3969,10 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_relaxed_fencing = ret == 0;
 
+	gp.param = I915_PARAM_HAS_UNSYNCHRONIZED;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_unsynchronized = ret == 0 && tmp;
+
 #if !(defined(__OpenBSD__) || defined(__NetBSD__))
 	gp.param = I915_PARAM_HAS_LLC;
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
@@ -2441,6 +4026,7 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	bufmgr_gem->bufmgr.bo_alloc_for_render =
 	    drm_intel_gem_bo_alloc_for_render;
 	bufmgr_gem->bufmgr.bo_alloc_tiled = drm_intel_gem_bo_alloc_tiled;
+	bufmgr_gem->bufmgr.bo_alloc_userptr = drm_intel_gem_bo_alloc_userptr;
 	bufmgr_gem->bufmgr.bo_reference = drm_intel_gem_bo_reference;
 	bufmgr_gem->bufmgr.bo_unreference = drm_intel_gem_bo_unreference;
 	bufmgr_gem->bufmgr.bo_map = drm_intel_gem_bo_map;
@@ -2479,12 +4065,692 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	bufmgr_gem->bufmgr.get_pipe_from_crtc_id =
 	    drm_intel_gem_get_pipe_from_crtc_id;
 	bufmgr_gem->bufmgr.bo_references = drm_intel_gem_bo_references;
+	bufmgr_gem->bufmgr.bo_clear_relocs = drm_intel_gem_bo_clear_relocs;
 
-	DRMINITLISTHEAD(&bufmgr_gem->named);
 	init_cache_buckets(bufmgr_gem);
+	DRMINITLISTHEAD(&bufmgr_gem->cache_lru);
+	bufmgr_gem->cache_max_size = BO_CACHE_MAX_SIZE;
+	DRMINITLISTHEAD(&bufmgr_gem->thread_caches);
 
 	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
-	bufmgr_gem->vma_max = -1; /* unlimited by default */
+	bufmgr_gem->vma_max = VMA_CACHE_MAX_COUNT;
+	bufmgr_gem->vma_max_size = VMA_CACHE_MAX_SIZE;
 
 	return &bufmgr_gem->bufmgr;
 }
+
+#if INTEL_BUFMGR_MAIN
+/*
+ * Benchmarks on the in-process mock device (drmMockOpen()), selected by
+ * name on the command line, all of them by default.  Build with
+ * something like
+ *
+ *   cc -DINTEL_BUFMGR_MAIN=1 -I.. -I<kernel drm headers> \
+ *      intel_bufmgr_gem.c intel_bufmgr.c intel_bufmgr_trace.c \
+ *      ../xf86drm.c ../xf86drmHash.c ../xf86drmMock.c \
+ *      ../xf86drmRandom.c ../xf86drmSL.c -lpthread
+ */
+#define BENCH_TEXTURES	64
+#define BENCH_BATCHES	500
+#define BENCH_STATES	8	/* state buffers per batch */
+#define BENCH_SAMPLERS	4	/* textures per state buffer */
+#define BENCH_DIRECT	2	/* textures the batch relocates to directly */
+#define BENCH_EXEC_TEXTURES	512
+#define BENCH_EXEC_STATES	64
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static drm_intel_bufmgr *bench_bufmgr(int *fd, bool reuse,
+				      drmMockParamsPtr params)
+{
+	drm_intel_bufmgr *bufmgr;
+
+	*fd = drmMockOpen(params);
+	if (*fd < 0)
+		return NULL;
+	bufmgr = drm_intel_bufmgr_gem_init(*fd, 4096);
+	if (bufmgr == NULL) {
+		drmMockClose(*fd);
+		return NULL;
+	}
+	if (reuse)
+		drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+	return bufmgr;
+}
+
+/*
+ * Size of the buffers on bo's prebuilt validation list, or 0 if it lists
+ * one twice.
+ */
+static unsigned int bench_list_size(drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	unsigned int size = 0;
+	int i, j;
+
+	for (i = 0; i < bo_gem->exec_count; i++) {
+		for (j = 0; j < i; j++)
+			if (bo_gem->exec_bos[j] == bo_gem->exec_bos[i])
+				return 0;
+		size += bo_gem->exec_bos[i]->size;
+	}
+	return size;
+}
+
+/*
+ * Aperture check cost.  Each batch relocates to a few textures and to
+ * state buffers that sample from textures shared with the other state
+ * buffers, and the aperture is checked after every state buffer, as the
+ * DDX does before each operation.  The running tree totals are compared
+ * with the exact walk that check_aperture_space falls back to, both for
+ * time and for how far they overestimate, and bo_references and the
+ * prebuilt validation lists are checked against the tree.
+ */
+static int bench_tree(void)
+{
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo *tex[BENCH_TEXTURES], *batch, *state;
+	unsigned int est, exact, checks = 0, over = 0, stale = 0;
+	double t, t_est = 0, t_exact = 0, worst = 1;
+	int fd, i, b, s, k, off;
+
+	bufmgr = bench_bufmgr(&fd, true, NULL);
+	if (bufmgr == NULL)
+		return 1;
+	for (i = 0; i < BENCH_TEXTURES; i++)
+		tex[i] = drm_intel_bo_alloc(bufmgr, "tex", 64 * 1024, 4096);
+
+	srandom(1);
+	for (b = 0; b < BENCH_BATCHES; b++) {
+		batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 4096);
+		off = 0;
+		for (s = 0; s < BENCH_STATES; s++) {
+			state = drm_intel_bo_alloc(bufmgr, "state", 4096, 64);
+			for (k = 0; k < BENCH_SAMPLERS; k++)
+				drm_intel_bo_emit_reloc(state, k * 4,
+							tex[random() % BENCH_TEXTURES], 0,
+							I915_GEM_DOMAIN_SAMPLER, 0);
+			drm_intel_bo_emit_reloc(batch, off, state, 0,
+						I915_GEM_DOMAIN_INSTRUCTION, 0);
+			off += 4;
+			drm_intel_bo_unreference(state);
+			for (k = 0; k < BENCH_DIRECT; k++, off += 4)
+				drm_intel_bo_emit_reloc(batch, off,
+							tex[random() % BENCH_TEXTURES], 0,
+							I915_GEM_DOMAIN_RENDER,
+							I915_GEM_DOMAIN_RENDER);
+
+			t = bench_now();
+			est = drm_intel_gem_estimate_batch_space(&batch, 1);
+			t_est += bench_now() - t;
+			t = bench_now();
+			exact = drm_intel_gem_compute_batch_space(&batch, 1);
+			t_exact += bench_now() - t;
+
+			checks++;
+			if (est < exact) {
+				fprintf(stderr, "tree total %u below exact %u\n",
+					est, exact);
+				return 1;
+			}
+			k = random() % BENCH_TEXTURES;
+			if (drm_intel_gem_bo_references(batch, tex[k]) !=
+			    _drm_intel_gem_bo_references(batch, tex[k])) {
+				fprintf(stderr, "bo_references disagrees\n");
+				return 1;
+			}
+			if (est > exact) {
+				over++;
+				if ((double)est / exact > worst)
+					worst = (double)est / exact;
+			}
+		}
+		if (((drm_intel_bo_gem *)batch)->exec_bos == NULL ||
+		    ((drm_intel_bo_gem *)batch)->exec_stale)
+			stale++;
+		else if (bench_list_size(batch) != exact - batch->size) {
+			fprintf(stderr, "validation list does not match tree\n");
+			return 1;
+		}
+		if (drm_intel_bo_exec(batch, off, NULL, 0, 0)) {
+			fprintf(stderr, "exec failed\n");
+			return 1;
+		}
+		drm_intel_bo_unreference(batch);
+	}
+
+	printf("tree: %u checks, running total %.0f ns, exact walk %.0f ns; "
+	       "%u overestimates, worst %.2fx; %u of %d validation lists "
+	       "rebuilt at exec\n", checks, t_est * 1e9 / checks,
+	       t_exact * 1e9 / checks, over, worst, stale, BENCH_BATCHES);
+
+	for (i = 0; i < BENCH_TEXTURES; i++)
+		drm_intel_bo_unreference(tex[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return 0;
+}
+
+/*
+ * Exec cost for batches with many buffers: each batch relocates to
+ * BENCH_EXEC_STATES state buffers sampling from a large texture set.  The
+ * same batches are executed from the list built as relocations were
+ * emitted and again with the list forced stale, so that exec walks the
+ * tree as it used to.  A last run without buffer reuse counts the state
+ * buffers, which are never executed themselves, that were given a
+ * validation list.
+ */
+static int bench_exec_run(drm_intel_bufmgr *bufmgr, drm_intel_bo **tex,
+			  bool walk, double *t_exec, unsigned int *listed)
+{
+	drm_intel_bo *batch, *state;
+	double t;
+	int b, s, k, off;
+
+	srandom(1);
+	*t_exec = 0;
+	*listed = 0;
+	for (b = 0; b < BENCH_BATCHES; b++) {
+		batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 4096);
+		off = 0;
+		for (s = 0; s < BENCH_EXEC_STATES; s++, off += 4) {
+			state = drm_intel_bo_alloc(bufmgr, "state", 4096, 64);
+			for (k = 0; k < BENCH_SAMPLERS; k++)
+				drm_intel_bo_emit_reloc(state, k * 4,
+							tex[random() % BENCH_EXEC_TEXTURES], 0,
+							I915_GEM_DOMAIN_SAMPLER, 0);
+			drm_intel_bo_emit_reloc(batch, off, state, 0,
+						I915_GEM_DOMAIN_INSTRUCTION, 0);
+			if (((drm_intel_bo_gem *)state)->exec_bos != NULL)
+				(*listed)++;
+			drm_intel_bo_unreference(state);
+		}
+		if (walk)
+			((drm_intel_bo_gem *)batch)->exec_stale = true;
+
+		t = bench_now();
+		if (drm_intel_bo_exec(batch, off, NULL, 0, 0)) {
+			fprintf(stderr, "exec failed\n");
+			return 1;
+		}
+		*t_exec += bench_now() - t;
+		drm_intel_bo_unreference(batch);
+	}
+	return 0;
+}
+
+static int bench_exec_bufmgr(bool reuse, double *t_list, double *t_walk,
+			     unsigned int *listed)
+{
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo *tex[BENCH_EXEC_TEXTURES];
+	int fd, i, ret;
+
+	bufmgr = bench_bufmgr(&fd, reuse, NULL);
+	if (bufmgr == NULL)
+		return 1;
+	for (i = 0; i < BENCH_EXEC_TEXTURES; i++)
+		tex[i] = drm_intel_bo_alloc(bufmgr, "tex", 4096, 4096);
+
+	/* The first run only warms up the cache. */
+	ret = bench_exec_run(bufmgr, tex, true, t_walk, listed) ||
+	    bench_exec_run(bufmgr, tex, false, t_list, listed) ||
+	    bench_exec_run(bufmgr, tex, true, t_walk, listed);
+
+	for (i = 0; i < BENCH_EXEC_TEXTURES; i++)
+		drm_intel_bo_unreference(tex[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return ret;
+}
+
+static int bench_exec(void)
+{
+	unsigned int listed;
+	double t_list, t_walk, t;
+	int ret;
+
+	ret = bench_exec_bufmgr(true, &t_list, &t_walk, &listed) ||
+	    bench_exec_bufmgr(false, &t, &t, &listed);
+	if (ret == 0)
+		printf("exec: %d batches of ~%d buffers, tree walk %.0f ns, "
+		       "prebuilt list %.0f ns per exec; %u of %d state "
+		       "buffers carry a list\n", BENCH_BATCHES,
+		       BENCH_EXEC_STATES * (BENCH_SAMPLERS + 1),
+		       t_walk * 1e9 / BENCH_BATCHES,
+		       t_list * 1e9 / BENCH_BATCHES, listed,
+		       BENCH_BATCHES * BENCH_EXEC_STATES);
+	return ret;
+}
+
+/*
+ * Writes into a buffer the GPU keeps reading, on a mock device that drops
+ * mappings at exec as the kernel does: a synchronized map, an
+ * unsynchronized one on a kernel without I915_PARAM_HAS_UNSYNCHRONIZED,
+ * which falls back to waiting at map time since the fault would wait
+ * anyway, and one with it.  Fails if the last one waits at all.
+ */
+#define BENCH_UNSYNC_ROUNDS	100
+
+static int bench_unsync_run(const char *mode, int flags, bool kernel)
+{
+	drmMockParams params;
+	drmMockStats stats;
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo *vbo, *batch;
+	double t;
+	int fd, r, ret = 0;
+
+	memset(&params, 0, sizeof(params));
+	params.exec_usec = 1000;
+	params.faults = 1;
+	bufmgr = bench_bufmgr(&fd, true, &params);
+	if (bufmgr == NULL)
+		return 1;
+	((drm_intel_bufmgr_gem *)bufmgr)->has_unsynchronized = kernel;
+
+	vbo = drm_intel_bo_alloc(bufmgr, "vbo", 64 * 1024, 4096);
+	t = bench_now();
+	for (r = 0; r < BENCH_UNSYNC_ROUNDS && ret == 0; r++) {
+		ret = drm_intel_gem_bo_map_internal(vbo, 1, flags);
+		if (ret)
+			break;
+		((uint32_t *)vbo->virtual)[r] = r;
+		drm_intel_bo_unmap(vbo);
+
+		batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 4096);
+		drm_intel_bo_emit_reloc(batch, 0, vbo, r * 4,
+					I915_GEM_DOMAIN_VERTEX, 0);
+		ret = drm_intel_bo_exec(batch, 8, NULL, 0, 0);
+		drm_intel_bo_unreference(batch);
+	}
+	t = bench_now() - t;
+	drmMockGetStats(fd, &stats);
+
+	if (ret)
+		fprintf(stderr, "unsync: %s failed: %d\n", mode, ret);
+	else
+		printf("unsync: %-26s %3llu waits (%llu at faults), "
+		       "%.0f us per round\n", mode,
+		       (unsigned long long)stats.waits,
+		       (unsigned long long)stats.faults,
+		       t * 1e6 / BENCH_UNSYNC_ROUNDS);
+	if (ret == 0 && kernel && flags && stats.waits) {
+		fprintf(stderr, "unsync: unsynchronized map waited\n");
+		ret = 1;
+	}
+
+	drm_intel_bo_unreference(vbo);
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return ret != 0;
+}
+
+static int bench_unsync(void)
+{
+	return bench_unsync_run("synchronized", 0, true) ||
+	    bench_unsync_run("unsynchronized, old kernel",
+			     DRM_INTEL_MAP_UNSYNCHRONIZED, false) ||
+	    bench_unsync_run("unsynchronized",
+			     DRM_INTEL_MAP_UNSYNCHRONIZED, true);
+}
+
+/*
+ * Streams uploads into one segment while each batch using them is still
+ * running, on a mock device that drops mappings at exec.  Fails if writing
+ * next to a busy upload waits at all; for comparison, the same is then
+ * done with the segments' kernel flag cleared behind the stream's back.
+ */
+#define BENCH_STREAM_UPLOADS	100
+#define BENCH_STREAM_BATCH	4	/* uploads per batch */
+
+static int bench_stream_run(const char *mode, bool flagged)
+{
+	drmMockParams params;
+	drmMockStats stats;
+	struct drm_intel_stream_stats stream_stats;
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_stream *stream;
+	drm_intel_bo *batch = NULL, *bo;
+	unsigned long offset;
+	uint32_t data[16];
+	double t;
+	int fd, i, ret = 0;
+
+	memset(&params, 0, sizeof(params));
+	params.exec_usec = 10000;
+	params.faults = 1;
+	bufmgr = bench_bufmgr(&fd, true, &params);
+	if (bufmgr == NULL)
+		return 1;
+
+	stream = drm_intel_stream_create(bufmgr, "stream", 64 * 1024);
+	if (stream == NULL) {
+		fprintf(stderr, "stream: no stream\n");
+		return 1;
+	}
+	for (i = 0; !flagged && i < STREAM_SEGMENTS; i++)
+		drm_intel_gem_bo_set_unsynchronized((drm_intel_bufmgr_gem *)
+						    bufmgr,
+						    (drm_intel_bo_gem *)
+						    stream->segment[i], false);
+
+	memset(data, 0, sizeof(data));
+	t = bench_now();
+	for (i = 0; i < BENCH_STREAM_UPLOADS && ret == 0; i++) {
+		data[0] = i;
+		ret = drm_intel_stream_write(stream, data, sizeof(data), 64,
+					     &bo, &offset);
+		if (ret)
+			break;
+		if (batch == NULL)
+			batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 4096);
+		drm_intel_bo_emit_reloc(batch, (i % BENCH_STREAM_BATCH) * 4,
+					bo, offset, I915_GEM_DOMAIN_VERTEX, 0);
+		if (i % BENCH_STREAM_BATCH == BENCH_STREAM_BATCH - 1) {
+			ret = drm_intel_bo_exec(batch, 4 * BENCH_STREAM_BATCH,
+						NULL, 0, 0);
+			drm_intel_bo_unreference(batch);
+			batch = NULL;
+		}
+	}
+	t = bench_now() - t;
+	drm_intel_bo_unreference(batch);
+	drmMockGetStats(fd, &stats);
+	drm_intel_stream_get_stats(stream, &stream_stats);
+
+	if (ret)
+		fprintf(stderr, "stream: %s failed: %d\n", mode, ret);
+	else
+		printf("stream: %-16s %d uploads, %llu wraps, %llu waits "
+		       "(%llu at faults, %llu seen by the stream), "
+		       "%.0f us per upload\n", mode, BENCH_STREAM_UPLOADS,
+		       (unsigned long long)stream_stats.wraps,
+		       (unsigned long long)stats.waits,
+		       (unsigned long long)stats.faults,
+		       (unsigned long long)stream_stats.waits,
+		       t * 1e6 / BENCH_STREAM_UPLOADS);
+	if (ret == 0 && flagged && stats.waits) {
+		fprintf(stderr, "stream: uploads waited\n");
+		ret = 1;
+	}
+
+	drm_intel_stream_destroy(stream);
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return ret != 0;
+}
+
+static int bench_stream(void)
+{
+	return bench_stream_run("unsynchronized", true) ||
+	    bench_stream_run("flag cleared", false);
+}
+
+/*
+ * Allocation scaling over 1 to 8 threads, each allocating a batch and a
+ * few state buffers it relocates to and freeing them again, as a GL
+ * context per thread does.  The mock sleeps in every ioctl as the kernel
+ * takes its time, so threads only overlap where they do not hold
+ * bufmgr_gem->lock, even on one CPU.  Also counts the allocations that
+ * had to go to the shared cache under the lock.
+ */
+#define BENCH_THREAD_ROUNDS	500
+#define BENCH_THREAD_STATES	3	/* state buffers per batch */
+#define BENCH_THREAD_MAX	8
+
+struct bench_thread {
+	drm_intel_bufmgr *bufmgr;
+	pthread_t thread;
+	uint64_t hits;		/* allocations served by its own cache */
+	int ret;
+};
+
+static void *bench_threads_loop(void *data)
+{
+	struct bench_thread *bt = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bt->bufmgr;
+	struct drm_intel_gem_thread_cache *tc;
+	drm_intel_bo *batch, *state;
+	int r, i;
+
+	for (r = 0; r < BENCH_THREAD_ROUNDS && bt->ret == 0; r++) {
+		batch = drm_intel_bo_alloc(bt->bufmgr, "batch", 16384, 4096);
+		if (batch == NULL) {
+			bt->ret = 1;
+			break;
+		}
+		for (i = 0; i < BENCH_THREAD_STATES; i++) {
+			state = drm_intel_bo_alloc(bt->bufmgr, "state",
+						   4096 << i, 4096);
+			if (state == NULL ||
+			    drm_intel_bo_emit_reloc(batch, i * 4, state, 0,
+						    I915_GEM_DOMAIN_INSTRUCTION,
+						    0))
+				bt->ret = 1;
+			drm_intel_bo_unreference(state);
+		}
+		drm_intel_bo_unreference(batch);
+	}
+
+	tc = pthread_getspecific(bufmgr_gem->thread_key);
+	if (tc != NULL)
+		bt->hits = tc->stats.hits;
+	return NULL;
+}
+
+static int bench_threads_run(int threads, double *base)
+{
+	struct bench_thread bt[BENCH_THREAD_MAX];
+	struct drm_intel_bo_cache_stats stats;
+	drmMockParams params;
+	drm_intel_bufmgr *bufmgr;
+	uint64_t allocs, own = 0;
+	double t, rate;
+	int fd, i, n, ret = 0;
+
+	memset(&params, 0, sizeof(params));
+	params.ioctl_usec = 20;
+	bufmgr = bench_bufmgr(&fd, true, &params);
+	if (bufmgr == NULL)
+		return 1;
+
+	memset(bt, 0, sizeof(bt));
+	t = bench_now();
+	for (n = 0; n < threads; n++) {
+		bt[n].bufmgr = bufmgr;
+		if (pthread_create(&bt[n].thread, NULL, bench_threads_loop,
+				   &bt[n]) != 0) {
+			ret = 1;
+			break;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(bt[i].thread, NULL);
+		ret |= bt[i].ret;
+		own += bt[i].hits;
+	}
+	t = bench_now() - t;
+	drm_intel_bufmgr_gem_get_cache_stats(bufmgr, &stats);
+
+	allocs = (uint64_t)threads * BENCH_THREAD_ROUNDS *
+	    (1 + BENCH_THREAD_STATES);
+	rate = allocs / t;
+	if (*base == 0)
+		*base = rate;
+	if (ret == 0 && stats.hits + stats.misses != allocs) {
+		fprintf(stderr, "threads: %llu hits and %llu misses "
+			"for %llu allocations\n",
+			(unsigned long long)stats.hits,
+			(unsigned long long)stats.misses,
+			(unsigned long long)allocs);
+		ret = 1;
+	}
+	if (ret)
+		fprintf(stderr, "threads: %d threads failed\n", threads);
+	else
+		printf("threads: %d, %6.0f allocs/s, %4.2fx of 1 thread; "
+		       "%llu of %llu allocs went to the shared cache\n",
+		       threads, rate, rate / *base,
+		       (unsigned long long)(allocs - own),
+		       (unsigned long long)allocs);
+
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return ret != 0;
+}
+
+static int bench_threads(void)
+{
+	double base = 0;
+	int threads;
+
+	for (threads = 1; threads <= BENCH_THREAD_MAX; threads *= 2)
+		if (bench_threads_run(threads, &base))
+			return 1;
+	return 0;
+}
+
+/*
+ * SET_TILING ioctls saved by keeping cached buffers apart by tiling.  A
+ * pixmap churn like the DDX's (intel_uxa_create_pixmap()), mixed sizes
+ * and tilings freed in random order, is recorded as a trace and replayed
+ * on fresh mock devices, once with the cache ignoring tiling as it used
+ * to and once as it is, and the mock counts the ioctls.
+ */
+#define BENCH_PIXMAPS	32	/* pixmaps alive at once */
+#define BENCH_PIXMAP_ROUNDS	4000
+
+static int bench_pixmaps_replay(const char *path, bool any_tiling,
+				uint64_t *tilings)
+{
+	drm_intel_bufmgr *bufmgr;
+	drmMockStats stats;
+	int fd, ret;
+
+	bufmgr = bench_bufmgr(&fd, true, NULL);
+	if (bufmgr == NULL)
+		return 1;
+	((drm_intel_bufmgr_gem *) bufmgr)->cache_any_tiling = any_tiling;
+	ret = drm_intel_trace_replay(bufmgr, path);
+	if (ret)
+		fprintf(stderr, "pixmaps: replay: %s\n", strerror(-ret));
+	drmMockGetStats(fd, &stats);
+	*tilings = stats.tilings;
+
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	return ret != 0;
+}
+
+static int bench_pixmaps(void)
+{
+	static const struct {
+		int width, height;
+	} sizes[] = {
+		{ 16, 16 }, { 64, 64 }, { 256, 256 }, { 512, 512 },
+		{ 1024, 768 },
+	};
+	char path[] = "/tmp/pixmapsXXXXXX";
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo *pix[BENCH_PIXMAPS];
+	uint64_t blind, aware;
+	unsigned long pitch;
+	uint32_t tiling;
+	int fd, i, k, r, ret = 1;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	bufmgr = bench_bufmgr(&fd, true, NULL);
+	if (bufmgr == NULL)
+		goto out;
+	if (drm_intel_bufmgr_gem_start_trace(bufmgr, path)) {
+		drm_intel_bufmgr_destroy(bufmgr);
+		drmMockClose(fd);
+		goto out;
+	}
+
+	memset(pix, 0, sizeof(pix));
+	srandom(1);
+	for (r = 0; r < BENCH_PIXMAP_ROUNDS; r++) {
+		i = random() % BENCH_PIXMAPS;
+		drm_intel_bo_unreference(pix[i]);
+
+		/* Mostly X-tiled, with linear and Y-tiled pixmaps of the
+		 * same sizes in between.
+		 */
+		k = random() % 10;
+		tiling = k < 6 ? I915_TILING_X :
+		    k < 9 ? I915_TILING_NONE : I915_TILING_Y;
+		k = random() % ARRAY_SIZE(sizes);
+		pix[i] = drm_intel_bo_alloc_tiled(bufmgr, "pixmap",
+						  sizes[k].width,
+						  sizes[k].height, 4,
+						  &tiling, &pitch,
+						  random() % 2 ?
+						  BO_ALLOC_FOR_RENDER : 0);
+		if (pix[i] == NULL)
+			break;
+	}
+	for (i = 0; i < BENCH_PIXMAPS; i++)
+		drm_intel_bo_unreference(pix[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+	drmMockClose(fd);
+	if (r < BENCH_PIXMAP_ROUNDS) {
+		fprintf(stderr, "pixmaps: allocation failed\n");
+		goto out;
+	}
+
+	if (bench_pixmaps_replay(path, true, &blind) ||
+	    bench_pixmaps_replay(path, false, &aware))
+		goto out;
+
+	printf("pixmaps: %d allocations, %llu SET_TILING ioctls when the "
+	       "cache ignores tiling, %llu when it does; %llu avoided\n",
+	       BENCH_PIXMAP_ROUNDS, (unsigned long long)blind,
+	       (unsigned long long)aware,
+	       (unsigned long long)(blind > aware ? blind - aware : 0));
+	ret = 0;
+out:
+	unlink(path);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(void);
+} benches[] = {
+	{ "tree", bench_tree },
+	{ "exec", bench_exec },
+	{ "unsync", bench_unsync },
+	{ "stream", bench_stream },
+	{ "threads", bench_threads },
+	{ "pixmaps", bench_pixmaps },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int j, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		for (j = 1; j < argc; j++)
+			if (strcmp(argv[j], benches[i].name) == 0)
+				break;
+		if (argc > 1 && j == argc)
+			continue;
+		if (benches[i].run())
+			ret = 1;
+	}
+	return ret;
+}
+#endif
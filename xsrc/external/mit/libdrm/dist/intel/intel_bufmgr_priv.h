@@ -83,6 +83,20 @@ struct _drm_intel_bufmgr {
 					 unsigned long *pitch,
 					 unsigned long flags);
 
+	/**
+	 * Wraps an existing range of the caller's address space in a
+	 * buffer object, so the GPU reads and writes those pages directly.
+	 *
+	 * Returns NULL if the kernel cannot share the range; callers should
+	 * then allocate a normal buffer and copy.
+	 */
+	drm_intel_bo *(*bo_alloc_userptr) (drm_intel_bufmgr *bufmgr,
+					   const char *name,
+					   void *addr, uint32_t tiling_mode,
+					   uint32_t stride,
+					   unsigned long size,
+					   unsigned long flags);
+
 	/** Takes a reference on a buffer object */
 	void (*bo_reference) (drm_intel_bo *bo);
 
@@ -276,10 +290,37 @@ struct _drm_intel_bufmgr {
 	/** Returns true if target_bo is in the relocation tree rooted at bo. */
 	int (*bo_references) (drm_intel_bo *bo, drm_intel_bo *target_bo);
 
+	/**
+	 * Drops the relocations of bo after the first start, as
+	 * drm_intel_gem_bo_clear_relocs() does.
+	 */
+	void (*bo_clear_relocs) (drm_intel_bo *bo, int start);
+
 	/**< Enables verbose debugging printouts */
 	int debug;
 };
 
+struct drm_intel_trace;
+
+struct drm_intel_trace *drm_intel_trace_open(const char *path);
+void drm_intel_trace_close(struct drm_intel_trace *trace);
+void drm_intel_trace_create(struct drm_intel_trace *trace, uint32_t id,
+			    unsigned long size, unsigned long flags,
+			    uint32_t tiling_mode, unsigned long stride);
+void drm_intel_trace_destroy(struct drm_intel_trace *trace, uint32_t id);
+void drm_intel_trace_write(struct drm_intel_trace *trace, uint32_t id,
+			   unsigned long offset, const void *data,
+			   unsigned long size);
+void drm_intel_trace_reloc(struct drm_intel_trace *trace, uint32_t id,
+			   uint32_t offset, uint32_t target, uint32_t delta,
+			   uint32_t read_domains, uint32_t write_domain,
+			   int fence);
+void drm_intel_trace_exec(struct drm_intel_trace *trace, uint32_t id,
+			  int used, unsigned int flags);
+void drm_intel_trace_clear_relocs(struct drm_intel_trace *trace, uint32_t id,
+				  int start);
+void drm_intel_trace_wait(struct drm_intel_trace *trace, uint32_t id);
+
 #define ALIGN(value, alignment)	((value + alignment - 1) & ~(alignment - 1))
 #define ROUND_UP_TO(x, y)	(((x) + (y) - 1) / (y) * (y))
 #define ROUND_UP_TO_MB(x)	ROUND_UP_TO((x), 1024*1024)
@@ -0,0 +1,828 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file intel_bufmgr_trace.c
+ *
+ * Recording and replay of buffer manager activity.
+ *
+ * A trace is a header followed by records, all in host byte order:
+ *
+ *   header:  uint32_t magic (TRACE_MAGIC), uint32_t version
+ *   record:  uint32_t type, uint32_t size, then size bytes of payload
+ *
+ * Buffers are named by the id the recording bufmgr gave them (the GEM
+ * handle); an id is only meaningful between its CREATE and DESTROY.
+ * Data written into buffers is stored once per distinct content as a BLOB
+ * record and referenced from WRITE records by blob id, so a texture or
+ * batch uploaded over and over costs one copy in the trace.  A blob with
+ * the same 64-bit FNV-1a hash and length is read back from the trace and
+ * compared before it is reused.
+ *
+ * drm_intel_trace_replay() replays a trace against any bufmgr through the
+ * public API, so the same trace can drive GEM or the simulated fake bufmgr.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <xf86drm.h>
+#include <drm.h>
+#include <i915_drm.h>
+#include "intel_bufmgr.h"
+#include "intel_bufmgr_priv.h"
+
+#ifndef INTEL_TRACE_MAIN
+#define INTEL_TRACE_MAIN 0	/* Build the replay tool at the end */
+#endif
+
+#define TRACE_MAGIC	0x52544944	/* "DITR" */
+#define TRACE_VERSION	2	/* 2 added CLEAR_RELOCS */
+
+enum trace_type {
+	TRACE_CREATE = 1,
+	TRACE_DESTROY,
+	TRACE_BLOB,
+	TRACE_WRITE,
+	TRACE_RELOC,
+	TRACE_EXEC,
+	TRACE_WAIT,
+	TRACE_CLEAR_RELOCS,
+};
+
+struct trace_record {
+	uint32_t type;
+	uint32_t size;
+};
+
+struct trace_create {
+	uint32_t id;
+	uint32_t tiling_mode;
+	uint64_t size;
+	uint64_t flags;			/* BO_ALLOC_* */
+	uint64_t stride;
+};
+
+struct trace_id {
+	uint32_t id;
+	uint32_t pad;
+};
+
+struct trace_blob {
+	uint32_t blob;
+	uint32_t pad;
+	uint64_t size;
+	/* followed by size bytes */
+};
+
+struct trace_write {
+	uint32_t id;
+	uint32_t blob;
+	uint64_t offset;
+};
+
+struct trace_reloc {
+	uint32_t id;
+	uint32_t offset;
+	uint32_t target;
+	uint32_t delta;
+	uint32_t read_domains;
+	uint32_t write_domain;
+	uint32_t fence;
+	uint32_t pad;
+};
+
+struct trace_exec {
+	uint32_t id;
+	int32_t used;
+	uint32_t flags;			/* I915_EXEC_* ring */
+	uint32_t pad;
+};
+
+struct trace_clear_relocs {
+	uint32_t id;
+	uint32_t start;
+};
+
+struct trace_blob_key {
+	uint64_t hash;
+	uint64_t size;
+	off_t offset;			/* of the data in the trace */
+	uint32_t blob;
+	struct trace_blob_key *next;	/* same low hash bits */
+};
+
+struct drm_intel_trace {
+	pthread_mutex_t lock;
+	FILE *file;
+	FILE *reader;			/* the same file, to compare blobs */
+	void *blobs;			/* low hash bits -> trace_blob_key */
+	uint32_t next_blob;
+};
+
+static uint64_t
+trace_hash(const void *data, unsigned long size)
+{
+	const unsigned char *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void
+trace_emit(struct drm_intel_trace *trace, uint32_t type,
+	   const void *payload, uint32_t size)
+{
+	struct trace_record record;
+
+	record.type = type;
+	record.size = size;
+	fwrite(&record, sizeof(record), 1, trace->file);
+	fwrite(payload, size, 1, trace->file);
+}
+
+/**
+ * Opens path for writing and starts a trace.  Returns NULL on failure.
+ */
+struct drm_intel_trace *
+drm_intel_trace_open(const char *path)
+{
+	struct drm_intel_trace *trace;
+	uint32_t header[2] = { TRACE_MAGIC, TRACE_VERSION };
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return NULL;
+
+	trace->file = fopen(path, "wb");
+	if (trace->file != NULL)
+		trace->reader = fopen(path, "rb");
+	trace->blobs = drmHashCreate();
+	if (trace->file == NULL || trace->reader == NULL ||
+	    trace->blobs == NULL ||
+	    fwrite(header, sizeof(header), 1, trace->file) != 1) {
+		if (trace->file)
+			fclose(trace->file);
+		if (trace->reader)
+			fclose(trace->reader);
+		if (trace->blobs)
+			drmHashDestroy(trace->blobs);
+		free(trace);
+		return NULL;
+	}
+	pthread_mutex_init(&trace->lock, NULL);
+
+	return trace;
+}
+
+void
+drm_intel_trace_close(struct drm_intel_trace *trace)
+{
+	unsigned long key;
+	void *value;
+
+	if (trace == NULL)
+		return;
+
+	while (drmHashFirst(trace->blobs, &key, &value) == 1) {
+		struct trace_blob_key *blob = value, *next;
+
+		drmHashDelete(trace->blobs, key);
+		for (; blob; blob = next) {
+			next = blob->next;
+			free(blob);
+		}
+	}
+	drmHashDestroy(trace->blobs);
+	fclose(trace->file);
+	fclose(trace->reader);
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+void
+drm_intel_trace_create(struct drm_intel_trace *trace, uint32_t id,
+		       unsigned long size, unsigned long flags,
+		       uint32_t tiling_mode, unsigned long stride)
+{
+	struct trace_create create;
+
+	memset(&create, 0, sizeof(create));
+	create.id = id;
+	create.size = size;
+	create.flags = flags;
+	create.tiling_mode = tiling_mode;
+	create.stride = stride;
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_CREATE, &create, sizeof(create));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void
+drm_intel_trace_destroy(struct drm_intel_trace *trace, uint32_t id)
+{
+	struct trace_id destroy = { id, 0 };
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_DESTROY, &destroy, sizeof(destroy));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/* Whether the blob of key holds the same bytes as data */
+static int
+trace_blob_equal(struct drm_intel_trace *trace, struct trace_blob_key *key,
+		 const void *data, unsigned long size)
+{
+	const unsigned char *p = data;
+	unsigned char buf[4096];
+	unsigned long n;
+
+	if (fflush(trace->file) != 0 ||
+	    fseeko(trace->reader, key->offset, SEEK_SET) != 0)
+		return 0;
+
+	while (size) {
+		n = size < sizeof(buf) ? size : sizeof(buf);
+		if (fread(buf, n, 1, trace->reader) != 1 ||
+		    memcmp(buf, p, n) != 0)
+			return 0;
+		p += n;
+		size -= n;
+	}
+	return 1;
+}
+
+/**
+ * Records size bytes of data written to buffer id at offset.
+ */
+void
+drm_intel_trace_write(struct drm_intel_trace *trace, uint32_t id,
+		      unsigned long offset, const void *data,
+		      unsigned long size)
+{
+	struct trace_blob_key *key;
+	struct trace_write write;
+	uint64_t hash = trace_hash(data, size);
+	void *value;
+
+	pthread_mutex_lock(&trace->lock);
+
+	key = NULL;
+	if (drmHashLookup(trace->blobs, (unsigned long)hash, &value) == 0)
+		key = value;
+	for (; key; key = key->next) {
+		if (key->hash == hash && key->size == size &&
+		    trace_blob_equal(trace, key, data, size))
+			break;
+	}
+
+	if (key == NULL) {
+		struct trace_blob blob;
+		struct trace_record record;
+
+		key = calloc(1, sizeof(*key));
+		if (key == NULL) {
+			pthread_mutex_unlock(&trace->lock);
+			return;
+		}
+		key->hash = hash;
+		key->size = size;
+		key->blob = ++trace->next_blob;
+		if (drmHashLookup(trace->blobs, (unsigned long)hash,
+				  &value) == 0) {
+			key->next = ((struct trace_blob_key *)value)->next;
+			((struct trace_blob_key *)value)->next = key;
+		} else
+			drmHashInsert(trace->blobs, (unsigned long)hash, key);
+
+		memset(&blob, 0, sizeof(blob));
+		blob.blob = key->blob;
+		blob.size = size;
+		record.type = TRACE_BLOB;
+		record.size = sizeof(blob) + size;
+		fwrite(&record, sizeof(record), 1, trace->file);
+		fwrite(&blob, sizeof(blob), 1, trace->file);
+		key->offset = ftello(trace->file);
+		fwrite(data, size, 1, trace->file);
+	}
+
+	write.id = id;
+	write.blob = key->blob;
+	write.offset = offset;
+	trace_emit(trace, TRACE_WRITE, &write, sizeof(write));
+
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void
+drm_intel_trace_reloc(struct drm_intel_trace *trace, uint32_t id,
+		      uint32_t offset, uint32_t target, uint32_t delta,
+		      uint32_t read_domains, uint32_t write_domain, int fence)
+{
+	struct trace_reloc reloc;
+
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.id = id;
+	reloc.offset = offset;
+	reloc.target = target;
+	reloc.delta = delta;
+	reloc.read_domains = read_domains;
+	reloc.write_domain = write_domain;
+	reloc.fence = fence;
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_RELOC, &reloc, sizeof(reloc));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void
+drm_intel_trace_exec(struct drm_intel_trace *trace, uint32_t id, int used,
+		     unsigned int flags)
+{
+	struct trace_exec exec;
+
+	memset(&exec, 0, sizeof(exec));
+	exec.id = id;
+	exec.used = used;
+	exec.flags = flags;
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_EXEC, &exec, sizeof(exec));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void
+drm_intel_trace_clear_relocs(struct drm_intel_trace *trace, uint32_t id,
+			     int start)
+{
+	struct trace_clear_relocs clear = { id, start };
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_CLEAR_RELOCS, &clear, sizeof(clear));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void
+drm_intel_trace_wait(struct drm_intel_trace *trace, uint32_t id)
+{
+	struct trace_id wait = { id, 0 };
+
+	pthread_mutex_lock(&trace->lock);
+	trace_emit(trace, TRACE_WAIT, &wait, sizeof(wait));
+	pthread_mutex_unlock(&trace->lock);
+}
+
+struct replay_blob {
+	uint64_t size;
+	unsigned char data[];
+};
+
+static void
+replay_free_table(void *table, int bos)
+{
+	unsigned long key;
+	void *value;
+
+	while (drmHashFirst(table, &key, &value) == 1) {
+		drmHashDelete(table, key);
+		if (bos)
+			drm_intel_bo_unreference(value);
+		else
+			free(value);
+	}
+	drmHashDestroy(table);
+}
+
+static drm_intel_bo *
+replay_bo(void *bos, uint32_t id)
+{
+	void *value;
+
+	if (drmHashLookup(bos, id, &value) != 0)
+		return NULL;
+	return value;
+}
+
+/**
+ * Replays the trace at path against bufmgr, creating, filling, relocating
+ * and executing buffers as they were when it was recorded.
+ *
+ * Returns 0 on success, -errno if the trace can't be read, -EINVAL if it is
+ * malformed, or the error from the first failed exec.
+ */
+int
+drm_intel_trace_replay(drm_intel_bufmgr *bufmgr, const char *path)
+{
+	struct trace_record record;
+	uint32_t header[2];
+	unsigned char *payload = NULL;
+	uint32_t payload_size = 0;
+	void *bos, *blobs;
+	FILE *file;
+	int ret = 0;
+
+	file = fopen(path, "rb");
+	if (file == NULL)
+		return -errno;
+
+	bos = drmHashCreate();
+	blobs = drmHashCreate();
+	if (bos == NULL || blobs == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (fread(header, sizeof(header), 1, file) != 1 ||
+	    header[0] != TRACE_MAGIC || header[1] == 0 ||
+	    header[1] > TRACE_VERSION) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	while (ret == 0 && fread(&record, sizeof(record), 1, file) == 1) {
+		if (record.size > payload_size) {
+			unsigned char *tmp = realloc(payload, record.size);
+
+			if (tmp == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			payload = tmp;
+			payload_size = record.size;
+		}
+		if (record.size &&
+		    fread(payload, record.size, 1, file) != 1) {
+			ret = -EINVAL;
+			break;
+		}
+
+		switch (record.type) {
+		case TRACE_CREATE: {
+			struct trace_create *create = (void *)payload;
+			unsigned long pitch;
+			uint32_t tiling;
+			drm_intel_bo *bo;
+			void *old;
+
+			if (record.size < sizeof(*create)) {
+				ret = -EINVAL;
+				break;
+			}
+			tiling = create->tiling_mode;
+			/* Tiled buffers are asked for as such, so that the
+			 * cache can hand back one already tiled that way.
+			 */
+			if (tiling != I915_TILING_NONE && create->stride)
+				bo = drm_intel_bo_alloc_tiled(bufmgr, "replay",
+							      create->stride,
+							      create->size /
+							      create->stride,
+							      1, &tiling,
+							      &pitch,
+							      create->flags);
+			else if (create->flags & BO_ALLOC_FOR_RENDER)
+				bo = drm_intel_bo_alloc_for_render(bufmgr,
+								   "replay",
+								   create->size,
+								   4096);
+			else
+				bo = drm_intel_bo_alloc(bufmgr, "replay",
+							create->size, 4096);
+			if (bo == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			if (drmHashLookup(bos, create->id, &old) == 0) {
+				drm_intel_bo_unreference(old);
+				drmHashDelete(bos, create->id);
+			}
+			drmHashInsert(bos, create->id, bo);
+			break;
+		}
+		case TRACE_DESTROY: {
+			struct trace_id *destroy = (void *)payload;
+			drm_intel_bo *bo;
+
+			if (record.size < sizeof(*destroy)) {
+				ret = -EINVAL;
+				break;
+			}
+			bo = replay_bo(bos, destroy->id);
+			if (bo) {
+				drmHashDelete(bos, destroy->id);
+				drm_intel_bo_unreference(bo);
+			}
+			break;
+		}
+		case TRACE_BLOB: {
+			struct trace_blob *blob = (void *)payload;
+			struct replay_blob *copy;
+
+			if (record.size < sizeof(*blob) ||
+			    record.size - sizeof(*blob) != blob->size) {
+				ret = -EINVAL;
+				break;
+			}
+			copy = malloc(sizeof(*copy) + blob->size);
+			if (copy == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			copy->size = blob->size;
+			memcpy(copy->data, blob + 1, blob->size);
+			drmHashInsert(blobs, blob->blob, copy);
+			break;
+		}
+		case TRACE_WRITE: {
+			struct trace_write *write = (void *)payload;
+			struct replay_blob *blob;
+			drm_intel_bo *bo;
+			void *value;
+
+			if (record.size < sizeof(*write) ||
+			    drmHashLookup(blobs, write->blob, &value) != 0) {
+				ret = -EINVAL;
+				break;
+			}
+			blob = value;
+			bo = replay_bo(bos, write->id);
+			if (bo && write->offset + blob->size <= bo->size)
+				drm_intel_bo_subdata(bo, write->offset,
+						     blob->size, blob->data);
+			break;
+		}
+		case TRACE_RELOC: {
+			struct trace_reloc *reloc = (void *)payload;
+			drm_intel_bo *bo, *target;
+
+			if (record.size < sizeof(*reloc)) {
+				ret = -EINVAL;
+				break;
+			}
+			bo = replay_bo(bos, reloc->id);
+			target = replay_bo(bos, reloc->target);
+			if (bo == NULL || target == NULL) {
+				ret = -EINVAL;
+				break;
+			}
+			if (reloc->fence)
+				drm_intel_bo_emit_reloc_fence(bo, reloc->offset,
+							      target,
+							      reloc->delta,
+							      reloc->read_domains,
+							      reloc->write_domain);
+			else
+				drm_intel_bo_emit_reloc(bo, reloc->offset,
+							target, reloc->delta,
+							reloc->read_domains,
+							reloc->write_domain);
+			break;
+		}
+		case TRACE_EXEC: {
+			struct trace_exec *exec = (void *)payload;
+			drm_intel_bo *bo;
+
+			if (record.size < sizeof(*exec)) {
+				ret = -EINVAL;
+				break;
+			}
+			bo = replay_bo(bos, exec->id);
+			if (bo == NULL) {
+				ret = -EINVAL;
+				break;
+			}
+			/* A bufmgr with a single ring, like the fake one,
+			 * runs every batch there.
+			 */
+			ret = drm_intel_bo_mrb_exec(bo, exec->used, NULL, 0, 0,
+						    exec->flags);
+			if (ret == -ENODEV)
+				ret = drm_intel_bo_exec(bo, exec->used,
+							NULL, 0, 0);
+			break;
+		}
+		case TRACE_CLEAR_RELOCS: {
+			struct trace_clear_relocs *clear = (void *)payload;
+			drm_intel_bo *bo;
+
+			if (record.size < sizeof(*clear)) {
+				ret = -EINVAL;
+				break;
+			}
+			bo = replay_bo(bos, clear->id);
+			if (bo == NULL || bufmgr->bo_clear_relocs == NULL) {
+				ret = -EINVAL;
+				break;
+			}
+			bufmgr->bo_clear_relocs(bo, clear->start);
+			break;
+		}
+		case TRACE_WAIT: {
+			struct trace_id *wait = (void *)payload;
+			drm_intel_bo *bo;
+
+			if (record.size < sizeof(*wait)) {
+				ret = -EINVAL;
+				break;
+			}
+			bo = replay_bo(bos, wait->id);
+			if (bo)
+				drm_intel_bo_wait_rendering(bo);
+			break;
+		}
+		default:
+			/* Skip records from newer writers. */
+			break;
+		}
+	}
+
+out:
+	free(payload);
+	if (bos)
+		replay_free_table(bos, 1);
+	if (blobs)
+		replay_free_table(blobs, 0);
+	fclose(file);
+	return ret;
+}
+
+#if INTEL_TRACE_MAIN
+/*
+ * Replays traces and reports what each one cost:
+ *
+ *   replay [-d device | -f] trace...
+ *
+ * By default the traces run with GEM on the in-process mock device
+ * (drmMockOpen()), with -d with GEM on the given device, and with -f on
+ * the simulated fake bufmgr, once with each placement policy so their
+ * evictions, copies and stalls can be compared.  Build with something like
+ *
+ *   cc -DINTEL_TRACE_MAIN=1 -I.. -I<kernel drm headers> \
+ *      intel_bufmgr_trace.c intel_bufmgr.c intel_bufmgr_gem.c \
+ *      intel_bufmgr_fake.c mm.c ../xf86drm.c ../xf86drmHash.c \
+ *      ../xf86drmMock.c ../xf86drmRandom.c ../xf86drmSL.c -lpthread
+ */
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_APERTURE	(256 * 1024 * 1024)	/* for -f */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+static double replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const struct replay_policy {
+	const char *name;
+	unsigned int policy;
+} replay_policies[] = {
+	{ "fake", DRM_INTEL_FAKE_SIM_POLICY_FAKE },
+	{ "gem", DRM_INTEL_FAKE_SIM_POLICY_GEM },
+};
+
+/* Replays path on the simulator with policy, or with GEM if it is NULL. */
+static int replay_one(const char *path, const char *device,
+		      const struct replay_policy *policy)
+{
+	struct drm_intel_fake_sim_params params;
+	struct drm_intel_fake_sim_stats sim;
+	struct drm_intel_bo_cache_stats cache;
+	drm_intel_bufmgr *bufmgr = NULL;
+	drmMockStats mock;
+	double t;
+	int fd = -1, ret;
+
+	if (policy) {
+		memset(&params, 0, sizeof(params));
+		params.aperture_size = REPLAY_APERTURE;
+		params.policy = policy->policy;
+		bufmgr = drm_intel_bufmgr_fake_init_sim(&params);
+	} else {
+		fd = device ? open(device, O_RDWR) : drmMockOpen(NULL);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n",
+				device ? device : "mock", strerror(errno));
+			return 1;
+		}
+		bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+		if (bufmgr)
+			drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+	}
+	if (bufmgr == NULL) {
+		fprintf(stderr, "%s: no bufmgr\n", path);
+		ret = -ENODEV;
+		goto out;
+	}
+
+	t = replay_now();
+	ret = drm_intel_trace_replay(bufmgr, path);
+	t = replay_now() - t;
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+	} else if (policy) {
+		drm_intel_bufmgr_fake_get_sim_stats(bufmgr, &sim);
+		printf("%s (%s): %.3f s, %llu batches, %llu ticks, "
+		       "%llu stalls (%llu ticks), %llu evictions, "
+		       "%llu bytes copied\n", path,
+		       policy->name, t,
+		       (unsigned long long)sim.batches,
+		       (unsigned long long)sim.clock,
+		       (unsigned long long)sim.stalls,
+		       (unsigned long long)sim.stall_ticks,
+		       (unsigned long long)sim.evictions,
+		       (unsigned long long)sim.bytes_copied);
+	} else {
+		drm_intel_bufmgr_gem_get_cache_stats(bufmgr, &cache);
+		printf("%s: %.3f s, cache %llu hits, %llu misses, "
+		       "%llu retiles", path, t,
+		       (unsigned long long)cache.hits,
+		       (unsigned long long)cache.misses,
+		       (unsigned long long)cache.retiles);
+		if (device == NULL && drmMockGetStats(fd, &mock) == 0)
+			printf("; %llu ioctls, %llu batches, %llu relocs, "
+			       "%llu waits, %llu set_tilings",
+			       (unsigned long long)mock.ioctls,
+			       (unsigned long long)mock.batches,
+			       (unsigned long long)mock.relocs,
+			       (unsigned long long)mock.waits,
+			       (unsigned long long)mock.tilings);
+		printf("\n");
+	}
+
+out:
+	if (bufmgr)
+		drm_intel_bufmgr_destroy(bufmgr);
+	if (fd >= 0) {
+		if (device)
+			close(fd);
+		else
+			drmMockClose(fd);
+	}
+	return ret != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = NULL;
+	int i, j, fake = 0, ret = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-f") == 0)
+			fake = 1;
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			device = argv[++i];
+		else
+			i = argc;
+	}
+	if (i >= argc || (fake && device)) {
+		fprintf(stderr, "usage: %s [-d device | -f] trace...\n",
+			argv[0]);
+		return 2;
+	}
+
+	for (; i < argc; i++) {
+		if (!fake) {
+			ret |= replay_one(argv[i], device, NULL);
+			continue;
+		}
+		for (j = 0; j < ARRAY_SIZE(replay_policies); j++)
+			ret |= replay_one(argv[i], NULL, &replay_policies[j]);
+	}
+	return ret;
+}
+#endif
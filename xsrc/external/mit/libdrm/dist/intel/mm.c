@@ -22,169 +22,387 @@
  *
  */
 
+/*
+ * Free blocks are kept in size classes, one per power of two, with a bitmap
+ * of the classes that have any.  Within a class the free blocks form a
+ * treap ordered by size and then offset, so an unaligned allocation finds
+ * the smallest block that fits (best fit) in O(log n) instead of walking
+ * one free list from the start.
+ *
+ * An aligned allocation may not fit in a block of less than size + align - 1
+ * bytes, depending on where the block starts.  Only MM_NEAR_FITS of those
+ * are tried in a class before looking up the smallest block that fits
+ * whatever its offset, or moving on to the next class, so the result is
+ * the best fit among the blocks tried.  The skipped near fits are walked
+ * only when nothing else fits, and a nonzero startSearch walks every
+ * class: in those cases an allocation is still linear in the number of
+ * free blocks.
+ */
+
+#include <limits.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <assert.h>
 
 #include "xf86drm.h"
 #include "mm.h"
 
+#ifndef MM_MAIN
+#define MM_MAIN 0	/* Build the fuzz test and benchmark at the end */
+#endif
+
+#if MM_MAIN
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#endif
+
+#define MM_BINS		32
+#define MM_NEAR_FITS	8
+
+struct mem_heap {
+	struct mem_block head;		/* must be first */
+	struct mem_block *bins[MM_BINS];
+	unsigned int binmap;		/* classes with free blocks */
+};
+
+static int mmSizeClass(int size)
+{
+	int class = 0;
+
+	while (size >>= 1)
+		class++;
+	return class;
+}
+
+/* Free tree order: size, then offset. */
+static int mmBefore(const struct mem_block *a, const struct mem_block *b)
+{
+	if (a->size != b->size)
+		return a->size < b->size;
+	return a->ofs < b->ofs;
+}
+
+/* Treap priorities are derived from the offset, which is unique. */
+static unsigned int mmPriority(const struct mem_block *p)
+{
+	return (unsigned int)p->ofs * 2654435761U;
+}
+
+static struct mem_block **mmLink(struct mem_heap *h, struct mem_block *p)
+{
+	if (!p->parent)
+		return &h->bins[mmSizeClass(p->size)];
+	return p->parent->left == p ? &p->parent->left : &p->parent->right;
+}
+
+/* Rotate p above its parent. */
+static void mmRotateUp(struct mem_heap *h, struct mem_block *p)
+{
+	struct mem_block *q = p->parent;
+	struct mem_block **link = mmLink(h, q);
+
+	if (q->left == p) {
+		q->left = p->right;
+		if (q->left)
+			q->left->parent = q;
+		p->right = q;
+	} else {
+		q->right = p->left;
+		if (q->right)
+			q->right->parent = q;
+		p->left = q;
+	}
+	p->parent = q->parent;
+	q->parent = p;
+	*link = p;
+}
+
+static void mmBinInsert(struct mem_heap *h, struct mem_block *p)
+{
+	int class = mmSizeClass(p->size);
+	struct mem_block **link = &h->bins[class];
+	struct mem_block *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		link = mmBefore(p, parent) ? &parent->left : &parent->right;
+	}
+	p->left = p->right = NULL;
+	p->parent = parent;
+	*link = p;
+	h->binmap |= 1U << class;
+
+	while (p->parent && mmPriority(p) > mmPriority(p->parent))
+		mmRotateUp(h, p);
+}
+
+static void mmBinRemove(struct mem_heap *h, struct mem_block *p)
+{
+	int class = mmSizeClass(p->size);
+
+	/* Rotate p down until it has at most one child, then splice. */
+	while (p->left && p->right) {
+		if (mmPriority(p->left) > mmPriority(p->right))
+			mmRotateUp(h, p->left);
+		else
+			mmRotateUp(h, p->right);
+	}
+	*mmLink(h, p) = p->left ? p->left : p->right;
+	if (p->left)
+		p->left->parent = p->parent;
+	else if (p->right)
+		p->right->parent = p->parent;
+	p->left = p->right = p->parent = NULL;
+
+	if (!h->bins[class])
+		h->binmap &= ~(1U << class);
+}
+
+/* Smallest block in the tree of at least size bytes. */
+static struct mem_block *mmLowerBound(struct mem_block *p, int size)
+{
+	struct mem_block *best = NULL;
+
+	while (p) {
+		if (p->size >= size) {
+			best = p;
+			p = p->left;
+		} else
+			p = p->right;
+	}
+	return best;
+}
+
+static struct mem_block *mmSuccessor(struct mem_block *p)
+{
+	if (p->right) {
+		for (p = p->right; p->left; p = p->left)
+			;
+		return p;
+	}
+	while (p->parent && p->parent->right == p)
+		p = p->parent;
+	return p->parent;
+}
+
+static void mmTreeStats(const struct mem_block *p, int *count)
+{
+	for (; p; p = p->right) {
+		(*count)++;
+		mmTreeStats(p->left, count);
+	}
+}
+
 void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
+		const struct mem_heap *h = (const struct mem_heap *)heap;
 		const struct mem_block *p;
+		int used = 0, avail = 0, largest = 0, blocks = 0, holes = 0;
+		int class, count;
 
 		for (p = heap->next; p != heap; p = p->next) {
 			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
 			       p->size, p->free ? 'F' : '.',
 			       p->reserved ? 'R' : '.');
+			blocks++;
+			if (p->free) {
+				holes++;
+				avail += p->size;
+				if (p->size > largest)
+					largest = p->size;
+			} else
+				used += p->size;
 		}
 
-		drmMsg("\nFree list:\n");
+		drmMsg("\nFree blocks by size class:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (class = 0; class < MM_BINS; class++) {
+			if (!h->bins[class])
+				continue;
+			count = 0;
+			mmTreeStats(h->bins[class], &count);
+			drmMsg(" FREE %08x-%08x: %d\n", 1U << class,
+			       (2U << class) - 1, count);
 		}
 
+		drmMsg("\n%d blocks, %08x used, %08x free in %d holes, "
+		       "largest %08x, fragmentation %d%%\n",
+		       blocks, used, avail, holes, largest,
+		       avail ? 100 - (int)((long long)largest * 100 / avail) : 0);
 	}
 	drmMsg("End of memory blocks\n");
 }
 
 struct mem_block *mmInit(int ofs, int size)
 {
+	struct mem_heap *h;
 	struct mem_block *heap, *block;
 
 	if (size <= 0)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
-	if (!heap)
+	h = (struct mem_heap *)calloc(1, sizeof(struct mem_heap));
+	if (!h)
 		return NULL;
+	heap = &h->head;
 
 	block = (struct mem_block *)calloc(1, sizeof(struct mem_block));
 	if (!block) {
-		free(heap);
+		free(h);
 		return NULL;
 	}
 
 	heap->next = block;
 	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
 
 	block->heap = heap;
 	block->next = heap;
 	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
 
 	block->ofs = ofs;
 	block->size = size;
 	block->free = 1;
+	mmBinInsert(h, block);
 
 	return heap;
 }
 
+/* Insert a new free block of size bytes at ofs after p. */
+static struct mem_block *InsertFreeBlock(struct mem_block *p, int ofs,
+					 int size)
+{
+	struct mem_block *newblock;
+
+	newblock = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	if (!newblock)
+		return NULL;
+	newblock->ofs = ofs;
+	newblock->size = size;
+	newblock->free = 1;
+	newblock->heap = p->heap;
+
+	newblock->next = p->next;
+	newblock->prev = p;
+	p->next->prev = newblock;
+	p->next = newblock;
+
+	return newblock;
+}
+
 static struct mem_block *SliceBlock(struct mem_block *p,
 				    int startofs, int size,
 				    int reserved, int alignment)
 {
+	struct mem_heap *h = (struct mem_heap *)p->heap;
 	struct mem_block *newblock;
 
+	mmBinRemove(h, p);
+
 	/* break left  [p, newblock, p->next], then p = newblock */
 	if (startofs > p->ofs) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		newblock = InsertFreeBlock(p, startofs,
+					   p->size - (startofs - p->ofs));
+		if (!newblock) {
+			mmBinInsert(h, p);
 			return NULL;
-		newblock->ofs = startofs;
-		newblock->size = p->size - (startofs - p->ofs);
-		newblock->free = 1;
-		newblock->heap = p->heap;
-
-		newblock->next = p->next;
-		newblock->prev = p;
-		p->next->prev = newblock;
-		p->next = newblock;
-
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
+		}
 		p->size -= newblock->size;
+		mmBinInsert(h, p);
 		p = newblock;
 	}
 
 	/* break right, also [p, newblock, p->next] */
 	if (size < p->size) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		newblock = InsertFreeBlock(p, startofs + size, p->size - size);
+		if (!newblock) {
+			mmBinInsert(h, p);
 			return NULL;
-		newblock->ofs = startofs + size;
-		newblock->size = p->size - size;
-		newblock->free = 1;
-		newblock->heap = p->heap;
-
-		newblock->next = p->next;
-		newblock->prev = p;
-		p->next->prev = newblock;
-		p->next = newblock;
-
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
+		}
 		p->size = size;
+		mmBinInsert(h, newblock);
 	}
 
 	/* p = middle block */
 	p->free = 0;
-
-	/* Remove p from the free list: 
-	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
-
 	p->reserved = reserved;
 	return p;
 }
 
+/* Whether size bytes fit in free block p; if so, where they start. */
+static int mmFits(const struct mem_block *p, int size, int mask,
+		  int startSearch, int *startofs)
+{
+	*startofs = (p->ofs + mask) & ~mask;
+	if (*startofs < startSearch)
+		*startofs = startSearch;
+	return *startofs - p->ofs <= p->size - size;
+}
+
 struct mem_block *mmAllocMem(struct mem_block *heap, int size, int align2,
 			     int startSearch)
 {
-	struct mem_block *p;
-	const int mask = (1 << align2) - 1;
+	struct mem_heap *h = (struct mem_heap *)heap;
+	struct mem_block *p = NULL;
+	int mask;
 	int startofs = 0;
-	int endofs;
+	int anywhere;		/* any block this big fits */
+	int class, tried;
+	unsigned int bins, unsure = 0;
 
-	if (!heap || align2 < 0 || size <= 0)
+	if (!heap || align2 < 0 || align2 > 30 || size <= 0)
 		return NULL;
+	mask = (1 << align2) - 1;
+	anywhere = size > INT_MAX - mask ? INT_MAX : size + mask;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
-		assert(p->free);
-
-		startofs = (p->ofs + mask) & ~mask;
-		if (startofs < startSearch) {
-			startofs = startSearch;
-		}
-		endofs = startofs + size;
-		if (endofs <= (p->ofs + p->size))
+	/* Smallest class that could hold size bytes, then each larger
+	 * non-empty class in turn; within a class, blocks in size order.
+	 */
+	bins = h->binmap & ~((1U << mmSizeClass(size)) - 1);
+	while (bins) {
+		class = ffs(bins) - 1;
+		bins &= ~(1U << class);
+
+		tried = 0;
+		for (p = mmLowerBound(h->bins[class], size); p;
+		     p = mmSuccessor(p)) {
+			assert(p->free);
+
+			if (mmFits(p, size, mask, startSearch, &startofs))
+				goto found;
+			if (startSearch || ++tried < MM_NEAR_FITS)
+				continue;
+
+			/* Too many misaligned near fits: take the smallest
+			 * block that fits regardless, or try the larger
+			 * classes before walking the rest of this one.
+			 */
+			p = mmLowerBound(h->bins[class], anywhere);
+			if (p && mmFits(p, size, mask, 0, &startofs))
+				goto found;
+			unsure |= 1U << class;
 			break;
+		}
 	}
 
-	if (p == heap)
-		return NULL;
+	/* Nothing else fits: walk the near fits that were skipped. */
+	while (unsure) {
+		class = ffs(unsure) - 1;
+		unsure &= ~(1U << class);
+
+		for (p = mmLowerBound(h->bins[class], size); p;
+		     p = mmSuccessor(p))
+			if (mmFits(p, size, mask, 0, &startofs))
+				goto found;
+	}
 
+	return NULL;
+
+found:
 	assert(p->free);
 	p = SliceBlock(p, startofs, size, 0, mask + 1);
 
@@ -203,32 +421,24 @@ struct mem_block *mmFindBlock(struct mem_block *heap, int start)
 	return NULL;
 }
 
-static int Join2Blocks(struct mem_block *p)
+/* Merge p's successor into p; neither may be in a size class. */
+static void Join2Blocks(struct mem_block *p)
 {
-	/* XXX there should be some assertions here */
-
-	/* NOTE: heap->free == 0 */
-
-	if (p->free && p->next->free) {
-		struct mem_block *q = p->next;
-
-		assert(p->ofs + p->size == q->ofs);
-		p->size += q->size;
+	struct mem_block *q = p->next;
 
-		p->next = q->next;
-		q->next->prev = p;
+	assert(p->ofs + p->size == q->ofs);
+	p->size += q->size;
 
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
+	p->next = q->next;
+	q->next->prev = p;
 
-		free(q);
-		return 1;
-	}
-	return 0;
+	free(q);
 }
 
 int mmFreeMem(struct mem_block *b)
 {
+	struct mem_heap *h;
+
 	if (!b)
 		return 0;
 
@@ -241,15 +451,19 @@ int mmFreeMem(struct mem_block *b)
 		return -1;
 	}
 
+	/* NOTE: heap->free == 0, so the heap head never merges */
+	h = (struct mem_heap *)b->heap;
 	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
-
-	Join2Blocks(b);
-	if (b->prev != b->heap)
-		Join2Blocks(b->prev);
+	if (b->next->free) {
+		mmBinRemove(h, b->next);
+		Join2Blocks(b);
+	}
+	if (b->prev->free) {
+		b = b->prev;
+		mmBinRemove(h, b);
+		Join2Blocks(b);
+	}
+	mmBinInsert(h, b);
 
 	return 0;
 }
@@ -267,5 +481,285 @@ void mmDestroy(struct mem_block *heap)
 		p = next;
 	}
 
-	free(heap);
+	free((struct mem_heap *)heap);
+}
+
+#if MM_MAIN
+/*
+ * Fuzz test and benchmark.  The fuzz test runs random allocations and
+ * frees against a byte map of the heap, checks every result against a
+ * naive best fit over that map, and checks the block list and the size
+ * class trees after every step.  The benchmark times allocation with the
+ * size classes against a best fit walk of the block list on heaps with
+ * more and more free blocks.  Build with something like
+ *
+ *   cc -DMM_MAIN=1 -I.. -I<kernel drm headers> mm.c
+ */
+#include <stdarg.h>
+
+#define FUZZ_HEAP	(16 * 1024)
+#define FUZZ_STEPS	50000
+#define FUZZ_LIVE	64
+#define BENCH_HEAP	(256 * 1024 * 1024)
+#define BENCH_OPS	20000
+
+void drmMsg(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+static unsigned char fuzz_used[FUZZ_HEAP];
+static int failures;
+
+#define FAIL(...) do {							\
+	fprintf(stderr, "FAIL: " __VA_ARGS__);				\
+	fprintf(stderr, "\n");						\
+	failures++;							\
+} while (0)
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Check one class tree; return the number of blocks in it. */
+static int check_tree(const struct mem_block *p, const struct mem_block *parent,
+		      int class, const struct mem_block **prev)
+{
+	int count;
+
+	if (!p)
+		return 0;
+	if (p->parent != parent)
+		FAIL("block %x: bad parent", p->ofs);
+	if (parent && mmPriority(p) > mmPriority(parent))
+		FAIL("block %x: priority above its parent", p->ofs);
+	if (!p->free || mmSizeClass(p->size) != class)
+		FAIL("block %x: in the wrong tree", p->ofs);
+	count = check_tree(p->left, p, class, prev);
+	if (*prev && !mmBefore(*prev, p))
+		FAIL("block %x: out of order", p->ofs);
+	*prev = p;
+	return count + 1 + check_tree(p->right, p, class, prev);
+}
+
+/* Check the block list against the byte map, and the trees against it. */
+static void check_heap(struct mem_block *heap, int size)
+{
+	struct mem_heap *h = (struct mem_heap *)heap;
+	const struct mem_block *p, *prev;
+	int ofs = 0, nfree = 0, ntree = 0, class, i;
+
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->ofs != ofs || p->size <= 0 || p->prev->next != p)
+			FAIL("block list broken at %x", ofs);
+		if (p->free && p->next->free)
+			FAIL("free blocks %x and %x not merged", p->ofs,
+			     p->next->ofs);
+		for (i = p->ofs; i < p->ofs + p->size; i++)
+			if (fuzz_used[i] != !p->free) {
+				FAIL("block %x: byte %x is %s", p->ofs, i,
+				     fuzz_used[i] ? "used" : "free");
+				break;
+			}
+		nfree += p->free;
+		ofs += p->size;
+	}
+	if (ofs != size)
+		FAIL("block list covers %x bytes of %x", ofs, size);
+
+	for (class = 0; class < MM_BINS; class++) {
+		prev = NULL;
+		if (!h->bins[class] != !(h->binmap & (1U << class)))
+			FAIL("class %d: binmap disagrees", class);
+		ntree += check_tree(h->bins[class], NULL, class, &prev);
+	}
+	if (ntree != nfree)
+		FAIL("%d free blocks, %d in the trees", nfree, ntree);
+}
+
+/*
+ * Naive best fit over the byte map: the smallest free run that fits,
+ * lowest offset first.  Return its start, or -1.
+ */
+static int naive_alloc(int heapsize, int size, int align2, int startSearch,
+		       int *runsize)
+{
+	const int mask = (1 << align2) - 1;
+	int ofs, end, start, best = -1, bestsize = 0;
+
+	for (ofs = 0; ofs < heapsize; ofs = end) {
+		for (end = ofs; end < heapsize &&
+		     fuzz_used[end] == fuzz_used[ofs]; end++)
+			;
+		if (fuzz_used[ofs])
+			continue;
+		start = (ofs + mask) & ~mask;
+		if (start < startSearch)
+			start = startSearch;
+		if (start + size <= end &&
+		    (best < 0 || end - ofs < bestsize)) {
+			best = start;
+			bestsize = end - ofs;
+		}
+	}
+	*runsize = bestsize;
+	return best;
+}
+
+static void fuzz(void)
+{
+	struct mem_block *heap, *live[FUZZ_LIVE], *b;
+	int nlive = 0, step, size, align2, startSearch, want, runsize, i;
+	int got, exact = 0, aligned = 0, other = 0, nulls = 0;
+
+	heap = mmInit(0, FUZZ_HEAP);
+	for (step = 0; step < FUZZ_STEPS; step++) {
+		if (nlive == FUZZ_LIVE || (nlive > 0 && random() % 2)) {
+			i = random() % nlive;
+			b = live[i];
+			memset(fuzz_used + b->ofs, 0, b->size);
+			if (mmFreeMem(b))
+				FAIL("free of %x refused", b->ofs);
+			live[i] = live[--nlive];
+		} else {
+			size = 1 + random() % (random() % 8 ? 256 : 2048);
+			align2 = random() % 4 ? random() % 10 : 0;
+			startSearch = random() % 16 ?
+				0 : random() % FUZZ_HEAP;
+			want = naive_alloc(FUZZ_HEAP, size, align2,
+					   startSearch, &runsize);
+			b = mmAllocMem(heap, size, align2, startSearch);
+			got = b ? b->ofs : -1;
+
+			if (!b) {
+				if (want >= 0)
+					FAIL("%d bytes align %d from %x: "
+					     "refused, fits at %x", size,
+					     align2, startSearch, want);
+				nulls++;
+			} else if (b->size != size ||
+				   ((got & ((1 << align2) - 1)) &&
+				    got != startSearch) ||
+				   got < startSearch ||
+				   memchr(fuzz_used + got, 1, size)) {
+				FAIL("%d bytes align %d from %x: bad block "
+				     "%x+%x", size, align2, startSearch, got,
+				     b->size);
+			} else if (got == want) {
+				exact++;
+			} else if (align2 == 0 && startSearch == 0) {
+				FAIL("%d bytes: got %x, best fit %x", size,
+				     got, want);
+			} else if (align2 != 0) {
+				aligned++;
+			} else {
+				other++;
+			}
+			if (b) {
+				if (mmFindBlock(heap, got) != b)
+					FAIL("block %x not found", got);
+				memset(fuzz_used + got, 1, size);
+				live[nlive++] = b;
+			}
+		}
+		check_heap(heap, FUZZ_HEAP);
+		if (failures > 10)
+			break;
+	}
+	mmDestroy(heap);
+
+	printf("fuzz: %d steps, %d best fit, %d other aligned fits, "
+	       "%d other fits from startSearch, %d refused\n",
+	       step, exact, aligned, other, nulls);
+}
+
+/* What allocation did before the size classes: best fit over the list. */
+static struct mem_block *list_alloc(struct mem_block *heap, int size,
+				    int align2)
+{
+	const int mask = (1 << align2) - 1;
+	struct mem_block *p, *best = NULL;
+	int startofs;
+
+	for (p = heap->next; p != heap; p = p->next)
+		if (p->free && mmFits(p, size, mask, 0, &startofs) &&
+		    (!best || p->size < best->size))
+			best = p;
+	if (!best)
+		return NULL;
+	mmFits(best, size, mask, 0, &startofs);
+	return SliceBlock(best, startofs, size, 0, mask + 1);
+}
+
+/*
+ * Fill the heap with nblocks page-aligned blocks and free every other
+ * one, then time allocating and freeing BENCH_OPS blocks of random sizes.
+ * With near set, the holes are misaligned and too short to be sure of
+ * an aligned fit, to show the cost of trying them.
+ */
+static double bench(int nblocks, int near, int use_list, int *nfree)
+{
+	static struct mem_block *blocks[16384];
+	struct mem_block *heap, *b;
+	int i, size, pad;
+	double t;
+
+	heap = mmInit(0, BENCH_HEAP);
+	pad = near ? 2048 : 0;
+	for (i = 0; i < nblocks; i++)
+		blocks[i] = mmAllocMem(heap, (i & 1) ? 4096 : 4096 + pad,
+				       (i & 1) ? 0 : 12, 0);
+	for (i = 0; i < nblocks; i += 2)
+		mmFreeMem(blocks[i]);
+	*nfree = 0;
+	for (b = heap->next; b != heap; b = b->next)
+		*nfree += b->free;
+
+	srandom(2);
+	t = bench_now();
+	for (i = 0; i < BENCH_OPS; i++) {
+		size = 4096 * (1 + random() % 4);
+		b = use_list ? list_alloc(heap, size, 12) :
+			       mmAllocMem(heap, size, 12, 0);
+		mmFreeMem(b);
+	}
+	t = bench_now() - t;
+	mmDestroy(heap);
+	return t * 1e9 / BENCH_OPS;
+}
+
+int main(void)
+{
+	static const int counts[] = { 1024, 4096, 16384 };
+	double classes, list;
+	int i, near, nfree;
+
+	srandom(1);
+	fuzz();
+
+	for (near = 0; near < 2; near++) {
+		for (i = 0; i < 3; i++) {
+			classes = bench(counts[i], near, 0, &nfree);
+			list = bench(counts[i], near, 1, &nfree);
+			printf("%5d free blocks%s: size classes %7.0f ns, "
+			       "list walk %9.0f ns per alloc+free\n",
+			       nfree, near ? " (near fits)" : "", classes,
+			       list);
+		}
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
 }
+#endif
@@ -30,8 +30,8 @@
 #define MM_H
 
 struct mem_block {
-	struct mem_block *next, *prev;
-	struct mem_block *next_free, *prev_free;
+	struct mem_block *next, *prev;	/* all blocks, in address order */
+	struct mem_block *left, *right, *parent; /* free block size tree */
 	struct mem_block *heap;
 	int ofs, size;
 	unsigned int free:1;
@@ -87,7 +87,7 @@ extern struct mem_block *mmFindBlock(struct mem_block *heap, int start);
 extern void mmDestroy(struct mem_block *mmInit);
 
 /**
- * For debuging purpose.
+ * For debuging purpose.  Also reports how fragmented the free space is.
  */
 extern void mmDumpMemInfo(const struct mem_block *mmInit);
 
@@ -23,42 +23,73 @@
  * Authors:
  *      Jerome Glisse
  */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "bof.h"
 
+#ifndef BOF_MAIN
+#define BOF_MAIN 0	/* Build the round-trip benchmark at the end */
+#endif
+
+#if BOF_MAIN
+#include <time.h>
+#endif
+
 /*
  * helpers
  */
 static int bof_entry_grow(bof_t *bof)
 {
 	bof_t **array;
+	unsigned nentry;
 
-	if (bof->array_size < bof->nentry)
+	if (bof->array_size + 2 <= bof->nentry)
 		return 0;
-	array = realloc(bof->array, (bof->nentry + 16) * sizeof(void*));
+	nentry = bof->nentry ? bof->nentry * 2 : 16;
+	array = realloc(bof->array, nentry * sizeof(void*));
 	if (array == NULL)
 		return -ENOMEM;
 	bof->array = array;
-	bof->nentry += 16;
+	bof->nentry = nentry;
 	return 0;
 }
 
 /*
- * object 
+ * Allocate a node with room for size bytes of payload right behind it, so
+ * that a leaf costs a single allocation and freeing it never has to look
+ * at value.
  */
-bof_t *bof_object(void)
+static bof_t *bof_node(uint32_t type, unsigned size, const void *value)
 {
-	bof_t *object;
+	bof_t *bof;
 
-	object = calloc(1, sizeof(bof_t));
-	if (object == NULL)
+	bof = calloc(1, sizeof(bof_t) + size);
+	if (bof == NULL)
 		return NULL;
-	object->refcount = 1;
-	object->type = BOF_TYPE_OBJECT;
-	object->size = 12;
-	return object;
+	bof->refcount = 1;
+	bof->type = type;
+	bof->size = size + 12;
+	if (size) {
+		bof->value = bof + 1;
+		if (value)
+			memcpy(bof->value, value, size);
+	}
+	return bof;
+}
+
+/*
+ * object 
+ */
+bof_t *bof_object(void)
+{
+	return bof_node(BOF_TYPE_OBJECT, 0, NULL);
 }
 
 bof_t *bof_object_get(bof_t *object, const char *keyname)
@@ -99,13 +130,7 @@ int bof_object_set(bof_t *object, const char *keyname, bof_t *value)
  */
 bof_t *bof_array(void)
 {
-	bof_t *array = bof_object();
-
-	if (array == NULL)
-		return NULL;
-	array->type = BOF_TYPE_ARRAY;
-	array->size = 12;
-	return array;
+	return bof_node(BOF_TYPE_ARRAY, 0, NULL);
 }
 
 int bof_array_append(bof_t *array, bof_t *value)
@@ -141,19 +166,21 @@ unsigned bof_array_size(bof_t *bof)
  */
 bof_t *bof_blob(unsigned size, void *value)
 {
-	bof_t *blob = bof_object();
+	return bof_node(BOF_TYPE_BLOB, size, value);
+}
+
+/*
+ * Like bof_blob() but value is not copied; it must stay valid until the
+ * blob and everything holding it have been dumped or released.
+ */
+bof_t *bof_blob_ref(unsigned size, void *value)
+{
+	bof_t *blob = bof_node(BOF_TYPE_BLOB, 0, NULL);
 
 	if (blob == NULL)
 		return NULL;
-	blob->type = BOF_TYPE_BLOB;
-	blob->value = calloc(1, size);
-	if (blob->value == NULL) {
-		bof_decref(blob);
-		return NULL;
-	}
-	blob->size = size;
-	memcpy(blob->value, value, size);
-	blob->size += 12;
+	blob->value = value;
+	blob->size += size;
 	return blob;
 }
 
@@ -176,20 +203,7 @@ void *bof_blob_value(bof_t *bof)
  */
 bof_t *bof_string(const char *value)
 {
-	bof_t *string = bof_object();
-
-	if (string == NULL)
-		return NULL;
-	string->type = BOF_TYPE_STRING;
-	string->size = strlen(value) + 1;
-	string->value = calloc(1, string->size);
-	if (string->value == NULL) {
-		bof_decref(string);
-		return NULL;
-	}
-	strcpy(string->value, value);
-	string->size += 12;
-	return string;
+	return bof_node(BOF_TYPE_STRING, strlen(value) + 1, value);
 }
 
 /*
@@ -197,20 +211,7 @@ bof_t *bof_string(const char *value)
  */
 bof_t *bof_int32(int32_t value)
 {
-	bof_t *int32 = bof_object();
-
-	if (int32 == NULL)
-		return NULL;
-	int32->type = BOF_TYPE_INT32;
-	int32->size = 4;
-	int32->value = calloc(1, int32->size);
-	if (int32->value == NULL) {
-		bof_decref(int32);
-		return NULL;
-	}
-	memcpy(int32->value, &value, 4);
-	int32->size += 12;
-	return int32;
+	return bof_node(BOF_TYPE_INT32, 4, &value);
 }
 
 int32_t bof_int32_value(bof_t *bof)
@@ -276,97 +277,114 @@ void bof_print(bof_t *bof)
 	bof_print_rec(bof, 0, 0);
 }
 
-static int bof_read(bof_t *root, FILE *file, long end, int level)
+/*
+ * Parse the children of root from buf[off, end).  Payloads are copied out
+ * of the mapping into their nodes so the file can be unmapped as soon as
+ * the tree is built.  Anything the accessors would trip over is rejected
+ * here: leaves with children, strings without their NUL, int32s of the
+ * wrong size and object keys that are not strings.
+ */
+static int bof_read(bof_t *root, const char *buf, size_t off, size_t end)
 {
-	bof_t *bof = NULL;
+	bof_t *bof;
+	uint32_t hdr[3];
 	int r;
 
-	if (ftell(file) >= end) {
-		return 0;
-	}
-	r = bof_entry_grow(root);
-	if (r)
-		return r;
-	bof = bof_object();
-	if (bof == NULL)
-		return -ENOMEM;
-	bof->offset = ftell(file);
-	r = fread(&bof->type, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->array_size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	switch (bof->type) {
-	case BOF_TYPE_STRING:
-	case BOF_TYPE_INT32:
-	case BOF_TYPE_BLOB:
-		bof->value = calloc(1, bof->size - 12);
-		if (bof->value == NULL) {
-			goto out_err;
-		}
-		r = fread(bof->value, bof->size - 12, 1, file);
-		if (r != 1) {
-			fprintf(stderr, "error reading %d\n", bof->size - 12);
-			goto out_err;
-		}
-		break;
-	case BOF_TYPE_NULL:
-		return 0;
-	case BOF_TYPE_OBJECT:
-	case BOF_TYPE_ARRAY:
-		r = bof_read(bof, file, bof->offset + bof->size, level + 2);
+	while (off < end) {
+		if (end - off < 12)
+			return -EINVAL;
+		memcpy(hdr, buf + off, 12);
+		if (hdr[0] == BOF_TYPE_NULL)
+			return 0;
+		if (hdr[1] < 12 || hdr[1] > end - off)
+			return -EINVAL;
+		if (root->type == BOF_TYPE_OBJECT && !(root->array_size & 1) &&
+		    hdr[0] != BOF_TYPE_STRING)
+			return -EINVAL;
+		r = bof_entry_grow(root);
 		if (r)
-			goto out_err;
-		break;
-	default:
-		fprintf(stderr, "invalid type %d\n", bof->type);
-		goto out_err;
+			return r;
+		switch (hdr[0]) {
+		case BOF_TYPE_STRING:
+		case BOF_TYPE_INT32:
+		case BOF_TYPE_BLOB:
+			if (hdr[2])
+				return -EINVAL;
+			if (hdr[0] == BOF_TYPE_STRING &&
+			    (hdr[1] == 12 || buf[off + hdr[1] - 1] != '\0'))
+				return -EINVAL;
+			if (hdr[0] == BOF_TYPE_INT32 && hdr[1] != 12 + 4)
+				return -EINVAL;
+			bof = bof_node(hdr[0], hdr[1] - 12, buf + off + 12);
+			if (bof == NULL)
+				return -ENOMEM;
+			break;
+		case BOF_TYPE_OBJECT:
+		case BOF_TYPE_ARRAY:
+			bof = bof_node(hdr[0], 0, NULL);
+			if (bof == NULL)
+				return -ENOMEM;
+			bof->size = hdr[1];
+			r = bof_read(bof, buf, off + 12, off + hdr[1]);
+			if (r == 0 && (bof->array_size != hdr[2] ||
+			    (hdr[0] == BOF_TYPE_OBJECT && (hdr[2] & 1))))
+				r = -EINVAL;
+			if (r) {
+				bof_decref(bof);
+				return r;
+			}
+			break;
+		default:
+			fprintf(stderr, "invalid type %d\n", hdr[0]);
+			return -EINVAL;
+		}
+		bof->offset = off;
+		root->array[root->array_size++] = bof;
+		root->centry = root->array_size;
+		off += hdr[1];
 	}
-	root->array[root->centry++] = bof;
-	return bof_read(root, file, end, level);
-out_err:
-	bof_decref(bof);
-	return -EINVAL;
+	return 0;
 }
 
 bof_t *bof_load_file(const char *filename)
 {
-	bof_t *root = bof_object();
-	int r;
-
+	bof_t *root = NULL;
+	struct stat st;
+	uint32_t hdr[3];
+	void *buf = MAP_FAILED;
+	int fd, r;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < 12)
+		goto out;
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "%s failed to map file %s\n", __func__, filename);
+		goto out;
+	}
+	memcpy(hdr, buf, 12);
+	if ((hdr[0] != BOF_TYPE_OBJECT && hdr[0] != BOF_TYPE_ARRAY) ||
+	    hdr[1] < 12 || hdr[1] > st.st_size)
+		goto out;
+	root = bof_node(hdr[0], 0, NULL);
 	if (root == NULL) {
 		fprintf(stderr, "%s failed to create root object\n", __func__);
-		return NULL;
+		goto out;
 	}
-	root->file = fopen(filename, "r");
-	if (root->file == NULL)
-		goto out_err;
-	r = fseek(root->file, 0L, SEEK_SET);
-	if (r) {
-		fprintf(stderr, "%s failed to seek into file %s\n", __func__, filename);
-		goto out_err;
+	root->size = hdr[1];
+	r = bof_read(root, buf, 12, hdr[1]);
+	if (r || root->array_size != hdr[2] ||
+	    (hdr[0] == BOF_TYPE_OBJECT && (hdr[2] & 1))) {
+		bof_decref(root);
+		root = NULL;
 	}
-	root->offset = ftell(root->file);
-	r = fread(&root->type, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&root->size, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&root->array_size, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = bof_read(root, root->file, root->offset + root->size, 2);
-	if (r)
-		goto out_err;
+out:
+	if (buf != MAP_FAILED)
+		munmap(buf, st.st_size);
+	close(fd);
 	return root;
-out_err:
-	bof_decref(root);
-	return NULL;
 }
 
 void bof_incref(bof_t *bof)
@@ -392,24 +410,104 @@ void bof_decref(bof_t *bof)
 		bof->file = NULL;
 	}
 	free(bof->array);
-	free(bof->value);
 	free(bof);
 }
 
-static int bof_file_write(bof_t *bof, FILE *file)
+/*
+ * Dumps are written in a single walk of the tree.  Headers and small
+ * payloads are packed into a staging buffer; larger payloads are pointed
+ * at in place.  Both go out through one iovec list that is handed to
+ * writev() whenever it or the staging buffer fills up.
+ */
+#define BOF_IOV_MAX	64
+#define BOF_STAGE_SIZE	(64 * 1024)
+#define BOF_REF_MIN	512
+
+struct bof_writer {
+	int		fd;
+	int		niov;
+	unsigned	staged;
+	struct iovec	iov[BOF_IOV_MAX];
+	char		stage[BOF_STAGE_SIZE];
+};
+
+static int bof_writer_flush(struct bof_writer *w)
+{
+	struct iovec *iov = w->iov;
+	int niov = w->niov;
+	ssize_t r;
+
+	while (niov > 0) {
+		r = writev(w->fd, iov, niov);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		while (niov > 0 && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	w->niov = 0;
+	w->staged = 0;
+	return 0;
+}
+
+static int bof_writer_ref(struct bof_writer *w, void *data, size_t size)
 {
-	unsigned i;
 	int r;
 
-	r = fwrite(&bof->type, 4, 1, file);
-	if (r != 1)
-		return -EINVAL;
-	r = fwrite(&bof->size, 4, 1, file);
-	if (r != 1)
-		return -EINVAL;
-	r = fwrite(&bof->array_size, 4, 1, file);
-	if (r != 1)
-		return -EINVAL;
+	if (w->niov == BOF_IOV_MAX) {
+		r = bof_writer_flush(w);
+		if (r)
+			return r;
+	}
+	w->iov[w->niov].iov_base = data;
+	w->iov[w->niov].iov_len = size;
+	w->niov++;
+	return 0;
+}
+
+static int bof_writer_copy(struct bof_writer *w, const void *data, size_t size)
+{
+	char *dst;
+	int r;
+
+	if (w->staged + size > BOF_STAGE_SIZE || w->niov == BOF_IOV_MAX) {
+		r = bof_writer_flush(w);
+		if (r)
+			return r;
+	}
+	dst = w->stage + w->staged;
+	memcpy(dst, data, size);
+	w->staged += size;
+	/* Extend the last iovec if it ends where this copy starts. */
+	if (w->niov && (char *)w->iov[w->niov - 1].iov_base +
+	    w->iov[w->niov - 1].iov_len == dst) {
+		w->iov[w->niov - 1].iov_len += size;
+		return 0;
+	}
+	return bof_writer_ref(w, dst, size);
+}
+
+static int bof_file_write(bof_t *bof, struct bof_writer *w)
+{
+	uint32_t hdr[3];
+	unsigned i, size;
+	int r;
+
+	hdr[0] = bof->type;
+	hdr[1] = bof->size;
+	hdr[2] = bof->array_size;
+	r = bof_writer_copy(w, hdr, 12);
+	if (r)
+		return r;
 	switch (bof->type) {
 	case BOF_TYPE_NULL:
 		if (bof->size)
@@ -418,14 +516,18 @@ static int bof_file_write(bof_t *bof, FILE *file)
 	case BOF_TYPE_STRING:
 	case BOF_TYPE_INT32:
 	case BOF_TYPE_BLOB:
-		r = fwrite(bof->value, bof->size - 12, 1, file);
-		if (r != 1)
-			return -EINVAL;
+		size = bof->size - 12;
+		if (size >= BOF_REF_MIN)
+			r = bof_writer_ref(w, bof->value, size);
+		else if (size)
+			r = bof_writer_copy(w, bof->value, size);
+		if (r)
+			return r;
 		break;
 	case BOF_TYPE_OBJECT:
 	case BOF_TYPE_ARRAY:
 		for (i = 0; i < bof->array_size; i++) {
-			r = bof_file_write(bof->array[i], file);
+			r = bof_file_write(bof->array[i], w);
 			if (r)
 				return r;
 		}
@@ -438,40 +540,170 @@ static int bof_file_write(bof_t *bof, FILE *file)
 
 int bof_dump_file(bof_t *bof, const char *filename)
 {
-	unsigned i;
-	int r = 0;
+	struct bof_writer *w;
+	int r;
 
 	if (bof->file) {
 		fclose(bof->file);
 		bof->file = NULL;
 	}
-	bof->file = fopen(filename, "w");
-	if (bof->file == NULL) {
+	w = malloc(sizeof(*w));
+	if (w == NULL)
+		return -ENOMEM;
+	w->niov = 0;
+	w->staged = 0;
+	w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (w->fd < 0) {
 		fprintf(stderr, "%s failed to open file %s\n", __func__, filename);
-		r = -EINVAL;
-		goto out_err;
+		free(w);
+		return -EINVAL;
 	}
-	r = fseek(bof->file, 0L, SEEK_SET);
-	if (r) {
-		fprintf(stderr, "%s failed to seek into file %s\n", __func__, filename);
-		goto out_err;
+	r = bof_file_write(bof, w);
+	if (r == 0)
+		r = bof_writer_flush(w);
+	if (close(w->fd) && r == 0)
+		r = -errno;
+	free(w);
+	return r;
+}
+
+#if BOF_MAIN
+/*
+ * Round-trip benchmark: build a tree shaped like a CS dump (a handful of
+ * BOs with payloads from a few bytes to a megabyte), dump it, load it back
+ * and compare, then check that malformed files are refused.  Build with
+ *
+ *   cc -DBOF_MAIN=1 -I.. bof.c
+ */
+#define BENCH_BOS	64
+#define BENCH_LOOPS	20
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_same(bof_t *a, bof_t *b)
+{
+	unsigned i;
+
+	if (a->type != b->type || a->size != b->size ||
+	    a->array_size != b->array_size)
+		return 0;
+	if (a->size > 12 && a->array_size == 0 &&
+	    memcmp(a->value, b->value, a->size - 12))
+		return 0;
+	for (i = 0; i < a->array_size; i++)
+		if (!bench_same(a->array[i], b->array[i]))
+			return 0;
+	return 1;
+}
+
+/* bof_object_set() takes its own reference. */
+static void bench_set(bof_t *object, const char *keyname, bof_t *value)
+{
+	bof_object_set(object, keyname, value);
+	bof_decref(value);
+}
+
+static bof_t *bench_tree(char *data)
+{
+	bof_t *root, *bos, *bo;
+	unsigned i, size;
+
+	root = bof_object();
+	bos = bof_array();
+	bench_set(root, "pm4", bof_blob_ref(16 * 1024, data));
+	for (i = 0; i < BENCH_BOS; i++) {
+		size = (i % 8 == 7) ? 1024 * 1024 : 64 << (i % 8);
+		bo = bof_object();
+		bench_set(bo, "size", bof_int32(size));
+		bench_set(bo, "handle", bof_int32(i + 1));
+		bench_set(bo, "data", bof_blob_ref(size, data + i));
+		bof_array_append(bos, bo);
+		bof_decref(bo);
 	}
-	r = fwrite(&bof->type, 4, 1, bof->file);
-	if (r != 1)
-		goto out_err;
-	r = fwrite(&bof->size, 4, 1, bof->file);
-	if (r != 1)
-		goto out_err;
-	r = fwrite(&bof->array_size, 4, 1, bof->file);
-	if (r != 1)
-		goto out_err;
-	for (i = 0; i < bof->array_size; i++) {
-		r = bof_file_write(bof->array[i], bof->file);
-		if (r)
-			return r;
+	bench_set(root, "bo", bos);
+	return root;
+}
+
+static int bench_refused(const char *path, const uint32_t *words, unsigned n)
+{
+	bof_t *bof;
+	FILE *f;
+
+	f = fopen(path, "w");
+	fwrite(words, 4, n, f);
+	fclose(f);
+	bof = bof_load_file(path);
+	bof_decref(bof);
+	return bof == NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t leaf_children[] = {
+		BOF_TYPE_ARRAY, 28, 1, BOF_TYPE_BLOB, 16, 1, 0 };
+	static const uint32_t unterminated[] = {
+		BOF_TYPE_ARRAY, 28, 1, BOF_TYPE_STRING, 16, 0, 0x61616161 };
+	static const uint32_t short_int32[] = {
+		BOF_TYPE_ARRAY, 24, 1, BOF_TYPE_INT32, 12, 0 };
+	static const uint32_t int32_key[] = {
+		BOF_TYPE_OBJECT, 44, 2, BOF_TYPE_INT32, 16, 0, 1,
+		BOF_TYPE_INT32, 16, 0, 2 };
+	const char *path = argc > 1 ? argv[1] : "bof_main.bof";
+	double t, dump = 0, load = 0;
+	bof_t *root, *copy;
+	char *data;
+	int i, ret = 0;
+
+	data = malloc(1024 * 1024 + BENCH_BOS);
+	for (i = 0; i < 1024 * 1024 + BENCH_BOS; i++)
+		data[i] = i * 31;
+	root = bench_tree(data);
+
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		t = bench_now();
+		if (bof_dump_file(root, path)) {
+			fprintf(stderr, "dump failed\n");
+			return 1;
+		}
+		dump += bench_now() - t;
+		t = bench_now();
+		copy = bof_load_file(path);
+		load += bench_now() - t;
+		if (copy == NULL || !bench_same(root, copy)) {
+			fprintf(stderr, "round trip mismatch\n");
+			return 1;
+		}
+		bof_decref(copy);
 	}
-out_err:
-	fclose(bof->file);
-	bof->file = NULL;
-	return r;
+	printf("%u bytes: dump %.3f ms, load %.3f ms\n", root->size,
+	       dump * 1e3 / BENCH_LOOPS, load * 1e3 / BENCH_LOOPS);
+
+	if (!bench_refused(path, leaf_children, 7)) {
+		fprintf(stderr, "accepted a leaf with children\n");
+		ret = 1;
+	}
+	if (!bench_refused(path, unterminated, 7)) {
+		fprintf(stderr, "accepted an unterminated string\n");
+		ret = 1;
+	}
+	if (!bench_refused(path, short_int32, 6)) {
+		fprintf(stderr, "accepted an empty int32\n");
+		ret = 1;
+	}
+	if (!bench_refused(path, int32_key, 11)) {
+		fprintf(stderr, "accepted a non-string object key\n");
+		ret = 1;
+	}
+
+	unlink(path);
+	bof_decref(root);
+	free(data);
+	return ret;
 }
+#endif
@@ -66,6 +66,7 @@ extern bof_t *bof_array_get(bof_t *bof, unsigned i);
 extern unsigned bof_array_size(bof_t *bof);
 /* blob */
 extern bof_t *bof_blob(unsigned size, void *value);
+extern bof_t *bof_blob_ref(unsigned size, void *value);
 extern unsigned bof_blob_size(bof_t *bof);
 extern void *bof_blob_value(bof_t *bof);
 /* string */
@@ -336,7 +336,7 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     struct radeon_cs_manager_gem *csm;
     bof_t *bcs, *blob, *array, *bo, *size, *handle, *device_id, *root;
     char tmp[256];
-    unsigned i;
+    unsigned i, nmapped = 0;
 
     csm = (struct radeon_cs_manager_gem *)cs->csm;
     root = device_id = bcs = blob = array = bo = size = handle = NULL;
@@ -351,7 +351,7 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     bof_decref(device_id);
     device_id = NULL;
     /* dump relocs */
-    blob = bof_blob(csg->nrelocs * 16, csg->relocs);
+    blob = bof_blob_ref(csg->nrelocs * 16, csg->relocs);
     if (blob == NULL)
         goto out_err;
     if (bof_object_set(root, "reloc", blob))
@@ -359,7 +359,7 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     bof_decref(blob);
     blob = NULL;
     /* dump cs */
-    blob = bof_blob(cs->cdw * 4, cs->packets);
+    blob = bof_blob_ref(cs->cdw * 4, cs->packets);
     if (blob == NULL)
         goto out_err;
     if (bof_object_set(root, "pm4", blob))
@@ -388,9 +388,11 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
             goto out_err;
         bof_decref(handle);
         handle = NULL;
-        radeon_bo_map((struct radeon_bo*)csg->relocs_bo[i], 0);
-        blob = bof_blob(csg->relocs_bo[i]->size, csg->relocs_bo[i]->ptr);
-        radeon_bo_unmap((struct radeon_bo*)csg->relocs_bo[i]);
+        /* Referenced in place; stays mapped until the dump is written. */
+        if (radeon_bo_map((struct radeon_bo*)csg->relocs_bo[i], 0))
+            goto out_err;
+        nmapped++;
+        blob = bof_blob_ref(csg->relocs_bo[i]->size, csg->relocs_bo[i]->ptr);
         if (blob == NULL)
             goto out_err;
         if (bof_object_set(bo, "data", blob))
@@ -414,6 +416,8 @@ out_err:
     bof_decref(handle);
     bof_decref(device_id);
     bof_decref(root);
+    for (i = 0; i < nmapped; i++)
+        radeon_bo_unmap((struct radeon_bo*)csg->relocs_bo[i]);
 }
 
 static int cs_gem_emit(struct radeon_cs_int *cs)
@@ -447,6 +451,7 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
     cs->csm->read_used = 0;
     cs->csm->vram_write_used = 0;
     cs->csm->gart_write_used = 0;
+    cs->csm->space_gen++;
     return r;
 }
 
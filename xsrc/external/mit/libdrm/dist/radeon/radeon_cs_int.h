@@ -29,6 +29,10 @@ struct radeon_cs_int {
     void                        (*space_flush_fn)(void *);
     void                        *space_flush_data;
     uint32_t                    id;
+    /* bos[0, bo_accounted) were committed by a space check made while
+       csm->space_gen was space_gen */
+    int                         bo_accounted;
+    uint32_t                    space_gen;
 };
 
 /* cs functions */
@@ -63,5 +67,7 @@ struct radeon_cs_manager {
     int32_t vram_limit, gart_limit;
     int32_t vram_write_used, gart_write_used;
     int32_t read_used;
+    /* bumped whenever the *_used totals are reset */
+    uint32_t space_gen;
 };
 #endif
@@ -32,6 +32,15 @@
 #include "radeon_bo_int.h"
 #include "radeon_cs_int.h"
 
+#ifndef RADEON_CS_SPACE_MAIN
+#define RADEON_CS_SPACE_MAIN 0	/* Build the benchmark at the end */
+#endif
+
+#if RADEON_CS_SPACE_MAIN
+#include <stdio.h>
+#include <time.h>
+#endif
+
 struct rad_sizes {
     int32_t op_read;
     int32_t op_gart_write;
@@ -117,8 +126,15 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
 
     memset(&sizes, 0, sizeof(struct rad_sizes));
 
-    /* prepare */
-    for (i = 0; i < cs->bo_count; i++) {
+    /* a reset of the manager totals drops everything accounted so far */
+    if (cs->space_gen != csm->space_gen) {
+        cs->bo_accounted = 0;
+        cs->space_gen = csm->space_gen;
+    }
+
+    /* prepare - bos committed by an earlier check are already in the
+       manager totals, so only the ones added since need sizing */
+    for (i = cs->bo_accounted; i < cs->bo_count; i++) {
         ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
         if (ret)
             return ret;
@@ -147,11 +163,13 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     csm->gart_write_used += sizes.op_gart_write;
     csm->vram_write_used += sizes.op_vram_write;
     csm->read_used += sizes.op_read;
-    /* commit */
-    for (i = 0; i < cs->bo_count; i++) {
+    /* commit - on failure above nothing has been touched, so the next
+       check starts from the same state */
+    for (i = cs->bo_accounted; i < cs->bo_count; i++) {
         bo = cs->bos[i].bo;
         bo->space_accounted = cs->bos[i].new_accounted;
     }
+    cs->bo_accounted = cs->bo_count;
     if (new_tmp)
         new_tmp->bo->space_accounted = new_tmp->new_accounted;
 
@@ -239,4 +257,133 @@ void radeon_cs_space_reset_bos(struct radeon_cs *cs)
         csi->bos[i].new_accounted = 0;
     }
     csi->bo_count = 0;
+    csi->bo_accounted = 0;
+}
+
+#if RADEON_CS_SPACE_MAIN
+/*
+ * Space check microbenchmark: each CS checks several hundred BOs one at a
+ * time, the way the DDX checks every BO it is about to emit a reloc for,
+ * while the persistent list fills up to MAX_SPACE_BOS - 1.  "rescan"
+ * forces every check to walk the whole persistent list again, which is
+ * what the checks did before bos[0, bo_accounted) were skipped; both must
+ * end up with the same totals.  Build with something like
+ *
+ *   cc -DRADEON_CS_SPACE_MAIN=1 -I.. -I<kernel drm headers> \
+ *      radeon_cs_space.c radeon_bo.c
+ */
+#define BENCH_BOS	512
+#define BENCH_PERSIST	(MAX_SPACE_BOS - 1)
+#define BENCH_CS	2000
+#define BENCH_BO_SIZE	(64 * 1024)
+
+static void bench_bo_ref(struct radeon_bo_int *bo)
+{
+}
+
+static struct radeon_bo *bench_bo_unref(struct radeon_bo_int *bo)
+{
+    return NULL;
+}
+
+static struct radeon_bo_funcs bench_bo_funcs = {
+    .bo_ref = bench_bo_ref,
+    .bo_unref = bench_bo_unref,
+};
+
+static int bench_flushes;
+
+static void bench_flush(void *data)
+{
+    bench_flushes++;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One CS worth of checks, then what cs_gem_emit() does to the totals. */
+static void bench_cs(struct radeon_cs_int *cs, struct radeon_bo_int *bos,
+                     int rescan, int32_t *used)
+{
+    struct radeon_cs_manager *csm = cs->csm;
+    struct radeon_bo *bo;
+    uint32_t rd, wd;
+    int i;
+
+    for (i = 0; i < BENCH_BOS; i++) {
+        bo = (struct radeon_bo *)&bos[i];
+        rd = (i & 3) ? RADEON_GEM_DOMAIN_GTT : 0;
+        wd = (i & 3) ? 0 : RADEON_GEM_DOMAIN_VRAM;
+        if (rescan)
+            cs->bo_accounted = 0;
+        if (i % (BENCH_BOS / BENCH_PERSIST) == 0 && cs->bo_count < BENCH_PERSIST) {
+            radeon_cs_space_add_persistent_bo((struct radeon_cs *)cs, bo, rd, wd);
+            radeon_cs_space_check((struct radeon_cs *)cs);
+        } else {
+            radeon_cs_space_check_with_bo((struct radeon_cs *)cs, bo, rd, wd);
+        }
+    }
+
+    used[0] = csm->vram_write_used;
+    used[1] = csm->read_used + csm->gart_write_used;
+    for (i = 0; i < BENCH_BOS; i++)
+        bos[i].space_accounted = 0;
+    csm->vram_write_used = 0;
+    csm->read_used = 0;
+    csm->gart_write_used = 0;
+    csm->space_gen++;
+    radeon_cs_space_reset_bos((struct radeon_cs *)cs);
+}
+
+int main(void)
+{
+    struct radeon_bo_manager bom = { &bench_bo_funcs, -1 };
+    struct radeon_cs_manager csm;
+    struct radeon_cs_int *cs;
+    struct radeon_bo_int *bos;
+    int32_t used[2][2];
+    double t[2];
+    int i, pass;
+
+    memset(&csm, 0, sizeof(csm));
+    csm.vram_limit = 256 * 1024 * 1024;
+    csm.gart_limit = 256 * 1024 * 1024;
+    cs = calloc(1, sizeof(*cs));
+    bos = calloc(BENCH_BOS, sizeof(*bos));
+    cs->csm = &csm;
+    cs->space_flush_fn = bench_flush;
+    for (i = 0; i < BENCH_BOS; i++) {
+        bos[i].handle = i + 1;
+        bos[i].size = BENCH_BO_SIZE;
+        bos[i].bom = &bom;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        t[pass] = bench_now();
+        for (i = 0; i < BENCH_CS; i++)
+            bench_cs(cs, bos, pass, used[pass]);
+        t[pass] = bench_now() - t[pass];
+    }
+
+    free(bos);
+    free(cs);
+
+    printf("%d BOs per CS, %d persistent: incremental %.1f ns/check,"
+           " rescan %.1f ns/check\n", BENCH_BOS, BENCH_PERSIST,
+           t[0] * 1e9 / (BENCH_CS * BENCH_BOS),
+           t[1] * 1e9 / (BENCH_CS * BENCH_BOS));
+    if (bench_flushes || memcmp(used[0], used[1], sizeof(used[0])) ||
+        used[0][0] != BENCH_BOS / 4 * BENCH_BO_SIZE ||
+        used[0][1] != BENCH_BOS / 4 * 3 * BENCH_BO_SIZE) {
+        fprintf(stderr, "bad totals: vram %d/%d gart %d/%d, %d flushes\n",
+                used[0][0], used[1][0], used[0][1], used[1][1], bench_flushes);
+        return 1;
+    }
+    return 0;
 }
+#endif
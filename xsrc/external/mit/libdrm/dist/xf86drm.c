@@ -51,6 +51,7 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 /* Not all systems have MAP_FAILED defined */
 #ifndef MAP_FAILED
@@ -87,12 +88,29 @@
 #define DRM_NODE_RENDER 1
 
 static drmServerInfoPtr drm_server_info;
+static drmBackendPtr drm_backend;
 
 void drmSetServerInfo(drmServerInfoPtr info)
 {
     drm_server_info = info;
 }
 
+/**
+ * Route device access through another implementation.
+ *
+ * \param backend replacement ioctl/mmap/munmap entry points, or NULL to
+ * talk to the kernel directly.
+ *
+ * \internal
+ * The backend sees every drmIoctl(), drmMmap() and drmMunmap() call, for all
+ * file descriptors, and must pass through the ones it does not handle.
+ * drmMockOpen() installs one backed by plain memory.
+ */
+void drmSetBackend(drmBackendPtr backend)
+{
+    drm_backend = backend;
+}
+
 /**
  * Output a message to stderr.
  *
@@ -132,11 +150,51 @@ drmSetDebugMsgFunction(int (*debug_msg_ptr)(const char *format, va_list ap))
     drm_debug_print = debug_msg_ptr;
 }
 
-static void *drmHashTable = NULL; /* Context switch callbacks */
+/*
+ * Per-fd entries (context switch callbacks and context tags) live in an
+ * array indexed by fd.  Lookups are lock-free: they acquire-load the
+ * published table and the slot and never block.  Creating, closing and
+ * growing serialize on drmEntryLock and release-store what they publish.
+ *
+ * Nothing a reader can reach is ever freed.  A table that has been
+ * outgrown is kept on a retired list; tables double in size, so the
+ * retired ones never add up to more than the live one.  A closed entry
+ * loses its tag table and goes on a free list for the next fd to reuse,
+ * so there are never more entries than the most fds open at once.  A
+ * reader that found the entry before the close takes tagLock and then
+ * sees fd no longer matching, so it behaves as if the lookup had missed.
+ */
+typedef struct drmFdEntry {
+    drmHashEntry      entry;	/* Must be first */
+    pthread_rwlock_t  tagLock;	/* Guards entry.fd and entry.tagTable */
+    struct drmFdEntry *next;	/* On drmFreeEntries */
+} drmFdEntry;
+
+typedef struct drmEntryTable {
+    struct drmEntryTable *retired;
+    int                  size;
+    drmFdEntry           *slot[1];
+} drmEntryTable;
+
+#define DRM_ENTRY_TABLE_MIN 64
+
+#ifndef DRM_ENTRY_MAIN
+#define DRM_ENTRY_MAIN 0	/* Build the stress test at the end of the file */
+#endif
+
+static drmEntryTable *drmEntries = NULL;
+static drmFdEntry *drmFreeEntries = NULL;
+static pthread_mutex_t drmEntryLock = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * Return the legacy device-keyed entry table.
+ *
+ * \deprecated Entries are now indexed by fd and kept private to libdrm,
+ * so this always returns NULL.  Use drmGetEntry() instead.
+ */
 void *drmGetHashTable(void)
 {
-    return drmHashTable;
+    return NULL;
 }
 
 void *drmMalloc(int size)
@@ -153,6 +211,18 @@ void drmFree(void *pt)
 	free(pt);
 }
 
+/**
+ * Call ioctl once, through the backend if one is set.  For ioctls that
+ * clobber their argument on failure, whose callers restart them by hand.
+ */
+int
+drmIoctlOnce(int fd, unsigned long request, void *arg)
+{
+    if (drm_backend)
+	return drm_backend->ioctl(fd, request, arg);
+    return ioctl(fd, request, arg);
+}
+
 /**
  * Call ioctl, restarting if it is interupted
  */
@@ -162,39 +232,145 @@ drmIoctl(int fd, unsigned long request, void *arg)
     int	ret;
 
     do {
-	ret = ioctl(fd, request, arg);
+	ret = drmIoctlOnce(fd, request, arg);
     } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
     return ret;
 }
 
-static unsigned long drmGetKeyFromFd(int fd)
+/**
+ * Map device memory, through the backend if one is set.
+ */
+void *
+drmMmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
-    stat_t     st;
+    if (drm_backend)
+	return drm_backend->mmap(addr, length, prot, flags, fd, offset);
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+/**
+ * Unmap memory obtained from drmMmap() or a mapping ioctl.
+ */
+int
+drmMunmap(void *addr, size_t length)
+{
+    if (drm_backend)
+	return drm_backend->munmap(addr, length);
+    return munmap(addr, length);
+}
+
+static drmFdEntry *drmLookupEntry(int fd)
+{
+    drmEntryTable *table = __atomic_load_n(&drmEntries, __ATOMIC_ACQUIRE);
+
+    if (!table || fd < 0 || fd >= table->size)
+	return NULL;
+    return __atomic_load_n(&table->slot[fd], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Take e->tagLock and check that e still belongs to fd.  Returns 0 with
+ * the lock dropped if it was closed (or reused) since it was looked up.
+ */
+static int drmLockEntry(drmFdEntry *e, int fd, int write)
+{
+    if (write)
+	pthread_rwlock_wrlock(&e->tagLock);
+    else
+	pthread_rwlock_rdlock(&e->tagLock);
+    if (e->entry.fd == fd && e->entry.tagTable)
+	return 1;
+    pthread_rwlock_unlock(&e->tagLock);
+    return 0;
+}
+
+/* Make room for fd.  Called with drmEntryLock held. */
+static drmEntryTable *drmGrowEntries(int fd)
+{
+    drmEntryTable *old = drmEntries;
+    drmEntryTable *table;
+    int           size = old ? old->size : DRM_ENTRY_TABLE_MIN;
+    int           i;
+
+    while (size <= fd)
+	size *= 2;
+
+    table = drmMalloc(sizeof(*table) + (size - 1) * sizeof(table->slot[0]));
+    if (!table)
+	return NULL;
+    table->size = size;
+    if (old) {
+	for (i = 0; i < old->size; i++)
+	    table->slot[i] = __atomic_load_n(&old->slot[i], __ATOMIC_RELAXED);
+	table->retired = old;
+    }
 
-    st.st_rdev = 0;
-    fstat(fd, &st);
-    return st.st_rdev;
+    /* Release: the copied slots are visible before the table is. */
+    __atomic_store_n(&drmEntries, table, __ATOMIC_RELEASE);
+    return table;
 }
 
+/**
+ * Get the per-fd entry, creating it on first use.
+ *
+ * \param fd file descriptor.
+ *
+ * \return pointer to the entry, or NULL if \p fd is negative or memory
+ * could not be allocated.
+ *
+ * \internal
+ * The common case of an existing entry takes no locks and makes no system
+ * calls.
+ */
 drmHashEntry *drmGetEntry(int fd)
 {
-    unsigned long key = drmGetKeyFromFd(fd);
-    void          *value;
-    drmHashEntry  *entry;
+    drmEntryTable *table;
+    drmFdEntry    *e;
+
+    if (fd < 0)
+	return NULL;
 
-    if (!drmHashTable)
-	drmHashTable = drmHashCreate();
+    if ((e = drmLookupEntry(fd)))
+	return &e->entry;
 
-    if (drmHashLookup(drmHashTable, key, &value)) {
-	entry           = drmMalloc(sizeof(*entry));
-	entry->fd       = fd;
-	entry->f        = NULL;
-	entry->tagTable = drmHashCreate();
-	drmHashInsert(drmHashTable, key, entry);
+    pthread_mutex_lock(&drmEntryLock);
+    if ((e = drmLookupEntry(fd)))
+	goto out;
+
+    table = drmEntries;
+    if (!table || fd >= table->size) {
+	if (!(table = drmGrowEntries(fd)))
+	    goto out;
+    }
+
+    if ((e = drmFreeEntries)) {
+	drmFreeEntries = e->next;
     } else {
-	entry = value;
+	if (!(e = drmMalloc(sizeof(*e))))
+	    goto out;
+	e->entry.fd = -1;
+	pthread_rwlock_init(&e->tagLock, NULL);
+    }
+
+    /* A stale reader may still hold a reused entry; it sees fd change. */
+    pthread_rwlock_wrlock(&e->tagLock);
+    e->entry.f        = NULL;
+    e->entry.tagTable = drmHashCreate();
+    if (e->entry.tagTable)
+	e->entry.fd   = fd;
+    pthread_rwlock_unlock(&e->tagLock);
+    if (!e->entry.tagTable) {
+	e->next = drmFreeEntries;
+	drmFreeEntries = e;
+	e = NULL;
+	goto out;
     }
-    return entry;
+
+    /* Release: the initialized entry is visible before the slot is. */
+    __atomic_store_n(&table->slot[fd], e, __ATOMIC_RELEASE);
+out:
+    pthread_mutex_unlock(&drmEntryLock);
+    return e ? &e->entry : NULL;
 }
 
 /**
@@ -1107,16 +1283,22 @@ int drmFreeBufs(int fd, int count, int *list)
  */
 int drmClose(int fd)
 {
-    unsigned long key    = drmGetKeyFromFd(fd);
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmFdEntry *e;
 
-    drmHashDestroy(entry->tagTable);
-    entry->fd       = 0;
-    entry->f        = NULL;
-    entry->tagTable = NULL;
+    pthread_mutex_lock(&drmEntryLock);
+    if ((e = drmLookupEntry(fd))) {
+	__atomic_store_n(&drmEntries->slot[fd], NULL, __ATOMIC_RELEASE);
 
-    drmHashDelete(drmHashTable, key);
-    drmFree(entry);
+	/* Lookups that already found e may still use it; recycle, don't free. */
+	pthread_rwlock_wrlock(&e->tagLock);
+	drmHashDestroy(e->entry.tagTable);
+	e->entry.tagTable = NULL;
+	e->entry.fd       = -1;
+	pthread_rwlock_unlock(&e->tagLock);
+	e->next = drmFreeEntries;
+	drmFreeEntries = e;
+    }
+    pthread_mutex_unlock(&drmEntryLock);
 
     return close(fd);
 }
@@ -1134,7 +1316,7 @@ int drmClose(int fd)
  * \return zero on success, or a negative value on failure.
  * 
  * \internal
- * This function is a wrapper for mmap().
+ * This function is a wrapper for drmMmap().
  */
 int drmMap(int fd, drm_handle_t handle, drmSize size, drmAddressPtr address)
 {
@@ -1148,7 +1330,7 @@ int drmMap(int fd, drm_handle_t handle, drmSize size, drmAddressPtr address)
 
     size = (size + pagesize_mask) & ~pagesize_mask;
 
-    *address = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, handle);
+    *address = drmMmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, handle);
     if (*address == MAP_FAILED)
 	return -errno;
     return 0;
@@ -1164,11 +1346,11 @@ int drmMap(int fd, drm_handle_t handle, drmSize size, drmAddressPtr address)
  * \return zero on success, or a negative value on failure.
  *
  * \internal
- * This function is a wrapper for munmap().
+ * This function is a wrapper for drmMunmap().
  */
 int drmUnmap(drmAddress address, drmSize size)
 {
-    return munmap(address, size);
+    return drmMunmap(address, size);
 }
 
 drmBufInfoPtr drmGetBufInfo(int fd)
@@ -2094,33 +2276,55 @@ int drmGetInterruptFromBusID(int fd, int busnum, int devnum, int funcnum)
     return p.irq;
 }
 
+/*
+ * Context tags are read far more often than they change, so each entry's
+ * tag table sits behind a reader/writer lock; drmHashLookup() does not
+ * modify the table, so readers share it.
+ */
 int drmAddContextTag(int fd, drm_context_t context, void *tag)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmFdEntry    *e = (drmFdEntry *)drmGetEntry(fd);
+    int           ret;
 
-    if (drmHashInsert(entry->tagTable, context, tag)) {
-	drmHashDelete(entry->tagTable, context);
-	drmHashInsert(entry->tagTable, context, tag);
+    if (!e)
+	return -ENOMEM;
+
+    if (!drmLockEntry(e, fd, 1))
+	return -EBADF;		/* Closed under us */
+    if ((ret = drmHashInsert(e->entry.tagTable, context, tag)) == 1) {
+	drmHashDelete(e->entry.tagTable, context);
+	ret = drmHashInsert(e->entry.tagTable, context, tag);
     }
-    return 0;
+    pthread_rwlock_unlock(&e->tagLock);
+    return ret ? -ENOMEM : 0;
 }
 
 int drmDelContextTag(int fd, drm_context_t context)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmFdEntry    *e = drmLookupEntry(fd);
+    int           ret;
+
+    if (!e || !drmLockEntry(e, fd, 1))
+	return 1;		/* Not found */
 
-    return drmHashDelete(entry->tagTable, context);
+    ret = drmHashDelete(e->entry.tagTable, context);
+    pthread_rwlock_unlock(&e->tagLock);
+    return ret;
 }
 
 void *drmGetContextTag(int fd, drm_context_t context)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmFdEntry    *e = drmLookupEntry(fd);
     void          *value;
+    int           ret;
 
-    if (drmHashLookup(entry->tagTable, context, &value))
+    if (!e || !drmLockEntry(e, fd, 0))
 	return NULL;
 
-    return value;
+    ret = drmHashLookup(e->entry.tagTable, context, &value);
+    pthread_rwlock_unlock(&e->tagLock);
+
+    return ret ? NULL : value;
 }
 
 int drmAddContextPrivateMapping(int fd, drm_context_t ctx_id,
@@ -2558,6 +2762,94 @@ char *drmGetDeviceNameFromFd(int fd)
 	return strdup(name);
 }
 
+#if DRM_ENTRY_MAIN
+/*
+ * Stress the per-fd entries: workers open, tag, look up and close their
+ * own fds (enough of them to grow the table) while readers look up every
+ * fd without synchronizing with them.  Build with something like
+ *
+ *   cc -DDRM_ENTRY_MAIN=1 -fsanitize=thread xf86drm.c xf86drmHash.c \
+ *      xf86drmRandom.c xf86drmSL.c -lpthread
+ */
+#define ENTRY_WORKERS 8
+#define ENTRY_READERS 4
+#define ENTRY_FDS     48	/* Per worker and round */
+#define ENTRY_ROUNDS  200
+#define ENTRY_SCAN    1024
+
+static char entry_marker[ENTRY_WORKERS];
+static int  entry_stop;
+static int  entry_errors;
+
+static void *entry_worker(void *arg)
+{
+    char *tag = arg;
+    int  fds[ENTRY_FDS];
+    int  round, i;
+
+    for (round = 0; round < ENTRY_ROUNDS; round++) {
+	for (i = 0; i < ENTRY_FDS; i++) {
+	    if ((fds[i] = open("/dev/null", O_RDONLY)) < 0 ||
+		drmAddContextTag(fds[i], fds[i], tag))
+		__atomic_add_fetch(&entry_errors, 1, __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < ENTRY_FDS; i++) {
+	    if (drmGetContextTag(fds[i], fds[i]) != tag)
+		__atomic_add_fetch(&entry_errors, 1, __ATOMIC_RELAXED);
+	    if ((i & 1) && drmDelContextTag(fds[i], fds[i]))
+		__atomic_add_fetch(&entry_errors, 1, __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < ENTRY_FDS; i++)
+	    drmClose(fds[i]);
+    }
+    return NULL;
+}
+
+static void *entry_reader(void *arg)
+{
+    char *tag;
+    long hits = 0;
+    int  fd;
+
+    while (!__atomic_load_n(&entry_stop, __ATOMIC_RELAXED)) {
+	for (fd = 0; fd < ENTRY_SCAN; fd++) {
+	    if (!(tag = drmGetContextTag(fd, fd)))
+		continue;
+	    if (tag < entry_marker || tag >= entry_marker + ENTRY_WORKERS)
+		__atomic_add_fetch(&entry_errors, 1, __ATOMIC_RELAXED);
+	    hits++;
+	}
+    }
+    return (void *)hits;
+}
+
+int main(void)
+{
+    pthread_t workers[ENTRY_WORKERS], readers[ENTRY_READERS];
+    long      hits = 0;
+    void      *ret;
+    int       i;
+
+    for (i = 0; i < ENTRY_READERS; i++)
+	pthread_create(&readers[i], NULL, entry_reader, NULL);
+    for (i = 0; i < ENTRY_WORKERS; i++)
+	pthread_create(&workers[i], NULL, entry_worker, &entry_marker[i]);
+    for (i = 0; i < ENTRY_WORKERS; i++)
+	pthread_join(workers[i], NULL);
+    __atomic_store_n(&entry_stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < ENTRY_READERS; i++) {
+	pthread_join(readers[i], &ret);
+	hits += (long)ret;
+    }
+
+    printf("%d workers x %d rounds x %d fds, table size %d,"
+	   " %ld reader hits, %d errors\n",
+	   ENTRY_WORKERS, ENTRY_ROUNDS, ENTRY_FDS, drmEntries->size,
+	   hits, entry_errors);
+    return entry_errors != 0;
+}
+#endif
+
 #ifdef X_PRIVSEP
 static int
 _priv_open_device(const char *path)
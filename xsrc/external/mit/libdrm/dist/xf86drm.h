@@ -98,6 +98,38 @@ typedef struct _drmServerInfo {
   void (*get_perms)(gid_t *, mode_t *);
 } drmServerInfo, *drmServerInfoPtr;
 
+typedef struct _drmBackend {
+  int (*ioctl)(int fd, unsigned long request, void *arg);
+  void *(*mmap)(void *addr, size_t length, int prot, int flags, int fd,
+		off_t offset);
+  int (*munmap)(void *addr, size_t length);
+} drmBackend, *drmBackendPtr;
+
+/**
+ * In-process GEM device backed by plain memory.
+ *
+ * \sa drmMockOpen().
+ */
+typedef struct _drmMockParams {
+  uint32_t     devid;		/**< PCI id reported as I915_PARAM_CHIPSET_ID */
+  uint64_t     aperture_size;	/**< reported by GET_APERTURE */
+  unsigned int ioctl_usec;	/**< latency added to every ioctl */
+  unsigned int exec_usec;	/**< how long a batch keeps its buffers busy */
+  int          faults;		/**< drop mappings at exec, wait on refault */
+} drmMockParams, *drmMockParamsPtr;
+
+typedef struct _drmMockStats {
+  uint64_t     ioctls;		/**< ioctls handled */
+  uint64_t     batches;		/**< execbuffers submitted */
+  uint64_t     relocs;		/**< relocations rewritten */
+  uint64_t     waits;		/**< accesses that waited for a busy object */
+  uint64_t     wait_usec;	/**< time spent in those waits */
+  uint64_t     faults;		/**< accesses to a dropped mapping */
+  uint64_t     tilings;		/**< SET_TILING ioctls */
+  unsigned int objects;		/**< objects currently allocated */
+  uint64_t     bytes;		/**< bytes currently allocated */
+} drmMockStats, *drmMockStatsPtr;
+
 typedef struct drmHashEntry {
     int      fd;
     void     (*f)(int, void *, void *);
@@ -105,6 +137,10 @@ typedef struct drmHashEntry {
 } drmHashEntry;
 
 extern int drmIoctl(int fd, unsigned long request, void *arg);
+extern int drmIoctlOnce(int fd, unsigned long request, void *arg);
+extern void *drmMmap(void *addr, size_t length, int prot, int flags, int fd,
+		     off_t offset);
+extern int drmMunmap(void *addr, size_t length);
 extern void *drmGetHashTable(void);
 extern drmHashEntry *drmGetEntry(int fd);
 
@@ -661,6 +697,7 @@ extern int           drmWaitVBlank(int fd, drmVBlankPtr vbl);
 
 /* Support routines */
 extern void          drmSetServerInfo(drmServerInfoPtr info);
+extern void          drmSetBackend(drmBackendPtr backend);
 extern int           drmError(int err, const char *label);
 extern void          *drmMalloc(int size);
 extern void          drmFree(void *pt);
@@ -694,6 +731,11 @@ extern int  drmSLLookupNeighbors(void *l, unsigned long key,
 				 unsigned long *prev_key, void **prev_value,
 				 unsigned long *next_key, void **next_value);
 
+/* Mock device routines */
+extern int  drmMockOpen(drmMockParamsPtr params);
+extern int  drmMockClose(int fd);
+extern int  drmMockGetStats(int fd, drmMockStatsPtr stats);
+
 extern int drmOpenOnce(void *unused, const char *BusID, int *newlyopened);
 extern void drmCloseOnce(int fd);
 extern void drmMsg(const char *format, ...);
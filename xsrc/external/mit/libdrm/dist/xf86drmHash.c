@@ -27,49 +27,44 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward implementation of a fixed-sized
- * hash table using self-organizing linked lists [Knuth73, pp. 398-399] for
- * collision resolution.  There are two potentially interesting things
- * about this implementation:
+ * This file contains an implementation of a dynamic hash table using open
+ * addressing with linear probing and Robin Hood insertion [Celis86].  There
+ * are a few potentially interesting things about this implementation:
  *
- * 1) The table is power-of-two sized.  Prime sized tables are more
- * traditional, but do not have a significant advantage over power-of-two
- * sized table, especially when double hashing is not used for collision
- * resolution.
+ * 1) The table is power-of-two sized and doubles when it becomes three
+ * quarters full (halving again when it drops below an eighth), so it stays
+ * fast from a handful of keys to millions.
  *
- * 2) The hash computation uses a table of random integers [Hanson97,
- * pp. 39-41].
+ * 2) Each slot records how far it is from its home slot.  Insertion lets
+ * a key displace any resident that is closer to home, which keeps probe
+ * sequences short and lets a lookup stop as soon as it passes the point
+ * where its key would have been placed.  Deletion shifts the following
+ * run back by one slot instead of leaving tombstones.
  *
- * FUTURE ENHANCEMENTS
+ * 3) Lookups do not modify the table, so any number of threads may look
+ * keys up concurrently as long as nothing inserts or deletes at the same
+ * time.  (The previous implementation moved found keys to the front of
+ * their chain, which made even lookups writers.)
  *
- * With a table size of 512, the current implementation is sufficient for a
- * few hundred keys.  Since this is well above the expected size of the
- * tables for which this implementation was designed, the implementation of
- * dynamic hash tables was postponed until the need arises.  A common (and
- * naive) approach to dynamic hash table implementation simply creates a
- * new hash table when necessary, rehashes all the data into the new table,
- * and destroys the old table.  The approach in [Larson88] is superior in
- * two ways: 1) only a portion of the table is expanded when needed,
- * distributing the expansion cost over several insertions, and 2) portions
- * of the table can be locked, enabling a scalable thread-safe
- * implementation.
+ * 4) The hash is a multiplicative (Fibonacci) hash [Knuth73, pp. 508-513],
+ * taking the top bits of the product as the slot number.
+ *
+ * Deleting keys during a drmHashFirst()/drmHashNext() walk may cause the
+ * walk to miss keys that were moved back past the current position.
  *
  * REFERENCES
  *
- * [Hanson97] David R. Hanson.  C Interfaces and Implementations:
- * Techniques for Creating Reusable Software.  Reading, Massachusetts:
- * Addison-Wesley, 1997.
+ * [Celis86] Pedro Celis.  Robin Hood Hashing.  Ph.D. thesis, University of
+ * Waterloo, 1986.
  *
  * [Knuth73] Donald E. Knuth. The Art of Computer Programming.  Volume 3:
  * Sorting and Searching.  Reading, Massachusetts: Addison-Wesley, 1973.
  *
- * [Larson88] Per-Ake Larson. "Dynamic Hash Tables".  CACM 31(4), April
- * 1988, pp. 446-457.
- *
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #define HASH_MAIN 0
 
@@ -77,87 +72,127 @@
 # include "xf86drm.h"
 #endif
 
-#define HASH_MAGIC 0xdeadbeef
-#define HASH_DEBUG 0
-#define HASH_SIZE  512		/* Good for about 100 entries */
-				/* If you change this value, you probably
-                                   have to change the HashHash hashing
-                                   function! */
+#define HASH_MAGIC    0xdeadbeef
+#define HASH_DEBUG    0
+#define HASH_MIN_BITS 4		/* Smallest table is 16 slots */
 
 #if HASH_MAIN
-#define HASH_ALLOC malloc
-#define HASH_FREE  free
-#define HASH_RANDOM_DECL
-#define HASH_RANDOM_INIT(seed)  srandom(seed)
-#define HASH_RANDOM             random()
-#define HASH_RANDOM_DESTROY
+#include <time.h>
+#define HASH_ALLOC(size)  calloc(1, size)
+#define HASH_FREE         free
+#define HASH_COUNT(x)     (++(x))
 #else
 #define HASH_ALLOC drmMalloc
 #define HASH_FREE  drmFree
-#define HASH_RANDOM_DECL        void *state
-#define HASH_RANDOM_INIT(seed)  state = drmRandomCreate(seed)
-#define HASH_RANDOM             drmRandom(state)
-#define HASH_RANDOM_DESTROY     drmRandomDestroy(state)
+#define HASH_COUNT(x)     ((void)0)	/* Lookups must not write */
+#endif
 
+#if ULONG_MAX > 0xffffffffUL
+#define HASH_LONG_BITS 64
+#define HASH_GOLDEN    0x9e3779b97f4a7c15UL
+#else
+#define HASH_LONG_BITS 32
+#define HASH_GOLDEN    0x9e3779b9UL
 #endif
 
 typedef struct HashBucket {
     unsigned long     key;
     void              *value;
-    struct HashBucket *next;
+    unsigned long     dist;	/* 1 + distance from home slot, 0 if empty */
 } HashBucket, *HashBucketPtr;
 
 typedef struct HashTable {
     unsigned long    magic;
     unsigned long    entries;
-    unsigned long    hits;	/* At top of linked list */
-    unsigned long    partials;	/* Not at top of linked list */
+    unsigned long    hits;	/* Found in home slot */
+    unsigned long    partials;	/* Found after probing */
     unsigned long    misses;	/* Not in table */
-    HashBucketPtr    buckets[HASH_SIZE];
-    int              p0;
-    HashBucketPtr    p1;
+    int              bits;	/* log2 of the number of slots */
+    unsigned long    mask;	/* Number of slots - 1 */
+    HashBucketPtr    buckets;
+    unsigned long    p0;	/* Next slot for drmHashNext */
 } HashTable, *HashTablePtr;
 
 #if HASH_MAIN
 extern void *drmHashCreate(void);
 extern int  drmHashDestroy(void *t);
-extern int  drmHashLookup(void *t, unsigned long key, unsigned long *value);
-extern int  drmHashInsert(void *t, unsigned long key, unsigned long value);
+extern int  drmHashLookup(void *t, unsigned long key, void **value);
+extern int  drmHashInsert(void *t, unsigned long key, void *value);
 extern int  drmHashDelete(void *t, unsigned long key);
 #endif
 
-static unsigned long HashHash(unsigned long key)
+static unsigned long HashHash(HashTablePtr table, unsigned long key)
 {
-    unsigned long        hash = 0;
-    unsigned long        tmp  = key;
-    static int           init = 0;
-    static unsigned long scatter[256];
-    int                  i;
-
-    if (!init) {
-	HASH_RANDOM_DECL;
-	HASH_RANDOM_INIT(37);
-	for (i = 0; i < 256; i++) scatter[i] = HASH_RANDOM;
-	HASH_RANDOM_DESTROY;
-	++init;
-    }
+    unsigned long hash = (key * HASH_GOLDEN) >> (HASH_LONG_BITS - table->bits);
 
-    while (tmp) {
-	hash = (hash << 1) + scatter[tmp & 0xff];
-	tmp >>= 8;
-    }
-
-    hash %= HASH_SIZE;
 #if HASH_DEBUG
-    printf( "Hash(%d) = %d\n", key, hash);
+    printf( "Hash(%lu) = %lu\n", key, hash);
 #endif
     return hash;
 }
 
+static HashBucketPtr HashAllocBuckets(int bits)
+{
+    unsigned long size = 1UL << bits;
+
+    if (size > INT_MAX / sizeof(HashBucket)) return NULL;
+    return HASH_ALLOC(size * sizeof(HashBucket));
+}
+
+/* Place a key known not to be in the table, displacing residents that are
+   closer to their home slot than the key being placed. */
+
+static void HashPlace(HashTablePtr table, unsigned long key, void *value)
+{
+    unsigned long i    = HashHash(table, key);
+    unsigned long dist = 1;
+    HashBucket    tmp;
+
+    for (;;) {
+	HashBucketPtr bucket = &table->buckets[i];
+
+	if (!bucket->dist) {
+	    bucket->key   = key;
+	    bucket->value = value;
+	    bucket->dist  = dist;
+	    return;
+	}
+	if (bucket->dist < dist) {
+	    tmp           = *bucket;
+	    bucket->key   = key;
+	    bucket->value = value;
+	    bucket->dist  = dist;
+	    key           = tmp.key;
+	    value         = tmp.value;
+	    dist          = tmp.dist;
+	}
+	i = (i + 1) & table->mask;
+	++dist;
+    }
+}
+
+static int HashResize(HashTablePtr table, int bits)
+{
+    HashBucketPtr old     = table->buckets;
+    unsigned long oldsize = table->mask + 1;
+    HashBucketPtr buckets;
+    unsigned long i;
+
+    buckets = HashAllocBuckets(bits);
+    if (!buckets) return -1;
+
+    table->buckets = buckets;
+    table->bits    = bits;
+    table->mask    = (1UL << bits) - 1;
+    for (i = 0; i < oldsize; i++)
+	if (old[i].dist) HashPlace(table, old[i].key, old[i].value);
+    HASH_FREE(old);
+    return 0;
+}
+
 void *drmHashCreate(void)
 {
     HashTablePtr table;
-    int          i;
 
     table           = HASH_ALLOC(sizeof(*table));
     if (!table) return NULL;
@@ -166,59 +201,49 @@ void *drmHashCreate(void)
     table->hits     = 0;
     table->partials = 0;
     table->misses   = 0;
-
-    for (i = 0; i < HASH_SIZE; i++) table->buckets[i] = NULL;
+    table->bits     = HASH_MIN_BITS;
+    table->mask     = (1UL << HASH_MIN_BITS) - 1;
+    table->p0       = 0;
+    table->buckets  = HashAllocBuckets(HASH_MIN_BITS);
+    if (!table->buckets) {
+	HASH_FREE(table);
+	return NULL;
+    }
     return table;
 }
 
 int drmHashDestroy(void *t)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    HashBucketPtr next;
-    int           i;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    for (i = 0; i < HASH_SIZE; i++) {
-	for (bucket = table->buckets[i]; bucket;) {
-	    next = bucket->next;
-	    HASH_FREE(bucket);
-	    bucket = next;
-	}
-    }
+    HASH_FREE(table->buckets);
     HASH_FREE(table);
     return 0;
 }
 
-/* Find the bucket and organize the list so that this bucket is at the
-   top. */
+/* Find the bucket holding key.  Robin Hood placement means key cannot lie
+   beyond the first slot whose resident is closer to home than we are. */
 
-static HashBucketPtr HashFind(HashTablePtr table,
-			      unsigned long key, unsigned long *h)
+static HashBucketPtr HashFind(HashTablePtr table, unsigned long key)
 {
-    unsigned long hash = HashHash(key);
-    HashBucketPtr prev = NULL;
-    HashBucketPtr bucket;
+    unsigned long i    = HashHash(table, key);
+    unsigned long dist = 1;
 
-    if (h) *h = hash;
+    for (;;) {
+	HashBucketPtr bucket = &table->buckets[i];
 
-    for (bucket = table->buckets[hash]; bucket; bucket = bucket->next) {
+	if (bucket->dist < dist) break;
 	if (bucket->key == key) {
-	    if (prev) {
-				/* Organize */
-		prev->next           = bucket->next;
-		bucket->next         = table->buckets[hash];
-		table->buckets[hash] = bucket;
-		++table->partials;
-	    } else {
-		++table->hits;
-	    }
+	    if (dist == 1) HASH_COUNT(table->hits);
+	    else           HASH_COUNT(table->partials);
 	    return bucket;
 	}
-	prev = bucket;
+	i = (i + 1) & table->mask;
+	++dist;
     }
-    ++table->misses;
+    HASH_COUNT(table->misses);
     return NULL;
 }
 
@@ -229,7 +254,7 @@ int drmHashLookup(void *t, unsigned long key, void **value)
 
     if (!table || table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    bucket = HashFind(table, key, NULL);
+    bucket = HashFind(table, key);
     if (!bucket) return 1;	/* Not found */
     *value = bucket->value;
     return 0;			/* Found */
@@ -238,21 +263,21 @@ int drmHashLookup(void *t, unsigned long key, void **value)
 int drmHashInsert(void *t, unsigned long key, void *value)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    unsigned long hash;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    if (HashFind(table, key, &hash)) return 1; /* Already in table */
+    if (HashFind(table, key)) return 1; /* Already in table */
+
+				/* Keep the load factor below 3/4 */
+    if ((table->entries + 1) * 4 > (table->mask + 1) * 3
+	&& HashResize(table, table->bits + 1)
+	&& table->entries >= table->mask)
+	return -1;		/* Error */
 
-    bucket               = HASH_ALLOC(sizeof(*bucket));
-    if (!bucket) return -1;	/* Error */
-    bucket->key          = key;
-    bucket->value        = value;
-    bucket->next         = table->buckets[hash];
-    table->buckets[hash] = bucket;
+    HashPlace(table, key, value);
+    ++table->entries;
 #if HASH_DEBUG
-    printf("Inserted %d at %d/%p\n", key, hash, bucket);
+    printf("Inserted %lu (%lu entries)\n", key, table->entries);
 #endif
     return 0;			/* Added to table */
 }
@@ -260,17 +285,33 @@ int drmHashInsert(void *t, unsigned long key, void *value)
 int drmHashDelete(void *t, unsigned long key)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    unsigned long hash;
     HashBucketPtr bucket;
+    HashBucketPtr next;
+    unsigned long i;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    bucket = HashFind(table, key, &hash);
+    bucket = HashFind(table, key);
 
     if (!bucket) return 1;	/* Not found */
 
-    table->buckets[hash] = bucket->next;
-    HASH_FREE(bucket);
+				/* Shift the rest of the run back a slot */
+    i = bucket - table->buckets;
+    for (;;) {
+	i    = (i + 1) & table->mask;
+	next = &table->buckets[i];
+	if (next->dist <= 1) break;
+	*bucket = *next;
+	--bucket->dist;
+	bucket = next;
+    }
+    bucket->dist = 0;
+    --table->entries;
+
+				/* Shrinking is optional, so ignore failure */
+    if (table->bits > HASH_MIN_BITS
+	&& table->entries * 8 < table->mask + 1)
+	HashResize(table, table->bits - 1);
     return 0;
 }
 
@@ -278,15 +319,14 @@ int drmHashNext(void *t, unsigned long *key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
 
-    while (table->p0 < HASH_SIZE) {
-	if (table->p1) {
-	    *key       = table->p1->key;
-	    *value     = table->p1->value;
-	    table->p1  = table->p1->next;
+    while (table->p0 <= table->mask) {
+	HashBucketPtr bucket = &table->buckets[table->p0++];
+
+	if (bucket->dist) {
+	    *key   = bucket->key;
+	    *value = bucket->value;
 	    return 1;
 	}
-	table->p1 = table->buckets[table->p0];
-	++table->p0;
     }
     return 0;
 }
@@ -298,7 +338,6 @@ int drmHashFirst(void *t, unsigned long *key, void **value)
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
     table->p0 = 0;
-    table->p1 = table->buckets[0];
     return drmHashNext(table, key, value);
 }
 
@@ -312,34 +351,27 @@ static void clear_dist(void) {
     for (i = 0; i < DIST_LIMIT; i++) dist[i] = 0;
 }
 
-static int count_entries(HashBucketPtr bucket)
-{
-    int count = 0;
-
-    for (; bucket; bucket = bucket->next) ++count;
-    return count;
-}
-
-static void update_dist(int count)
+static void update_dist(unsigned long count)
 {
     if (count >= DIST_LIMIT) ++dist[DIST_LIMIT-1];
     else                     ++dist[count];
 }
 
+/* Distribution of probe lengths; bucket 0 counts empty slots. */
+
 static void compute_dist(HashTablePtr table)
 {
-    int           i;
-    HashBucketPtr bucket;
+    unsigned long i;
 
-    printf("Entries = %ld, hits = %ld, partials = %ld, misses = %ld\n",
-	   table->entries, table->hits, table->partials, table->misses);
+    printf("Entries = %ld, slots = %ld, hits = %ld, partials = %ld,"
+	   " misses = %ld\n",
+	   table->entries, table->mask + 1,
+	   table->hits, table->partials, table->misses);
     clear_dist();
-    for (i = 0; i < HASH_SIZE; i++) {
-	bucket = table->buckets[i];
-	update_dist(count_entries(bucket));
-    }
+    for (i = 0; i <= table->mask; i++)
+	update_dist(table->buckets[i].dist);
     for (i = 0; i < DIST_LIMIT; i++) {
-	if (i != DIST_LIMIT-1) printf("%5d %10d\n", i, dist[i]);
+	if (i != DIST_LIMIT-1) printf("%5ld %10d\n", i, dist[i]);
 	else                   printf("other %10d\n", dist[i]);
     }
 }
@@ -347,64 +379,123 @@ static void compute_dist(HashTablePtr table)
 static void check_table(HashTablePtr table,
 			unsigned long key, unsigned long value)
 {
-    unsigned long retval  = 0;
+    void          *retval  = NULL;
     int           retcode = drmHashLookup(table, key, &retval);
 
     switch (retcode) {
     case -1:
 	printf("Bad magic = 0x%08lx:"
 	       " key = %lu, expected = %lu, returned = %lu\n",
-	       table->magic, key, value, retval);
+	       table->magic, key, value, (unsigned long)retval);
 	break;
     case 1:
 	printf("Not found: key = %lu, expected = %lu returned = %lu\n",
-	       key, value, retval);
+	       key, value, (unsigned long)retval);
 	break;
     case 0:
-	if (value != retval)
+	if (value != (unsigned long)retval)
 	    printf("Bad value: key = %lu, expected = %lu, returned = %lu\n",
-		   key, value, retval);
+		   key, value, (unsigned long)retval);
 	break;
     default:
 	printf("Bad retcode = %d: key = %lu, expected = %lu, returned = %lu\n",
-	       retcode, key, value, retval);
+	       retcode, key, value, (unsigned long)retval);
 	break;
     }
 }
 
+static void check_table_miss(HashTablePtr table, unsigned long key)
+{
+    void *retval;
+
+    if (drmHashLookup(table, key, &retval) != 1)
+	printf("Unexpectedly found: key = %lu\n", key);
+}
+
+static double elapsed(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Scattered keys that are distinct for distinct i < 2^24. */
+
+static unsigned long time_key(unsigned long i)
+{
+    return ((unsigned long)random() << 24) | (i & 0xffffff);
+}
+
+/* Time inserting, finding, missing and deleting n random keys. */
+
+static void time_table(unsigned long n)
+{
+    HashTablePtr  table;
+    unsigned long i;
+    clock_t       start;
+    double        insert, lookup, miss, delete;
+
+    table = drmHashCreate();
+    srandom(0xbeefbeef);
+    start = clock();
+    for (i = 0; i < n; i++) drmHashInsert(table, time_key(i), (void *)i);
+    insert = elapsed(start);
+
+    srandom(0xbeefbeef);
+    start = clock();
+    for (i = 0; i < n; i++) check_table(table, time_key(i), i);
+    lookup = elapsed(start);
+
+    start = clock();
+    for (i = 0; i < n; i++) check_table_miss(table, time_key(n + i));
+    miss = elapsed(start);
+
+    srandom(0xbeefbeef);
+    start = clock();
+    for (i = 0; i < n; i++) drmHashDelete(table, time_key(i));
+    delete = elapsed(start);
+    if (table->entries)
+	printf("%lu entries left after deleting all keys\n", table->entries);
+    drmHashDestroy(table);
+
+    printf("%8lu keys: insert %7.1f ns, lookup %7.1f ns,"
+	   " miss %7.1f ns, delete %7.1f ns\n", n,
+	   insert * 1e9 / n, lookup * 1e9 / n,
+	   miss * 1e9 / n, delete * 1e9 / n);
+}
+
 int main(void)
 {
-    HashTablePtr table;
-    int          i;
+    HashTablePtr  table;
+    int           i;
+    unsigned long n;
 
     printf("\n***** 256 consecutive integers ****\n");
     table = drmHashCreate();
-    for (i = 0; i < 256; i++) drmHashInsert(table, i, i);
+    for (i = 0; i < 256; i++) drmHashInsert(table, i, (void *)(long)i);
     for (i = 0; i < 256; i++) check_table(table, i, i);
-    for (i = 256; i >= 0; i--) check_table(table, i, i);
+    for (i = 255; i >= 0; i--) check_table(table, i, i);
     compute_dist(table);
     drmHashDestroy(table);
 
     printf("\n***** 1024 consecutive integers ****\n");
     table = drmHashCreate();
-    for (i = 0; i < 1024; i++) drmHashInsert(table, i, i);
+    for (i = 0; i < 1024; i++) drmHashInsert(table, i, (void *)(long)i);
     for (i = 0; i < 1024; i++) check_table(table, i, i);
-    for (i = 1024; i >= 0; i--) check_table(table, i, i);
+    for (i = 1023; i >= 0; i--) check_table(table, i, i);
     compute_dist(table);
     drmHashDestroy(table);
 
     printf("\n***** 1024 consecutive page addresses (4k pages) ****\n");
     table = drmHashCreate();
-    for (i = 0; i < 1024; i++) drmHashInsert(table, i*4096, i);
+    for (i = 0; i < 1024; i++) drmHashInsert(table, i*4096, (void *)(long)i);
     for (i = 0; i < 1024; i++) check_table(table, i*4096, i);
-    for (i = 1024; i >= 0; i--) check_table(table, i*4096, i);
+    for (i = 1023; i >= 0; i--) check_table(table, i*4096, i);
     compute_dist(table);
     drmHashDestroy(table);
 
     printf("\n***** 1024 random integers ****\n");
     table = drmHashCreate();
     srandom(0xbeefbeef);
-    for (i = 0; i < 1024; i++) drmHashInsert(table, random(), i);
+    for (i = 0; i < 1024; i++) drmHashInsert(table, random(), (void *)(long)i);
     srandom(0xbeefbeef);
     for (i = 0; i < 1024; i++) check_table(table, random(), i);
     srandom(0xbeefbeef);
@@ -415,7 +506,7 @@ int main(void)
     printf("\n***** 5000 random integers ****\n");
     table = drmHashCreate();
     srandom(0xbeefbeef);
-    for (i = 0; i < 5000; i++) drmHashInsert(table, random(), i);
+    for (i = 0; i < 5000; i++) drmHashInsert(table, random(), (void *)(long)i);
     srandom(0xbeefbeef);
     for (i = 0; i < 5000; i++) check_table(table, random(), i);
     srandom(0xbeefbeef);
@@ -423,6 +514,9 @@ int main(void)
     compute_dist(table);
     drmHashDestroy(table);
 
+    printf("\n***** timing, 100 to 1M random integers ****\n");
+    for (n = 100; n <= 1000000; n *= 10) time_table(n);
+
     return 0;
 }
 #endif
@@ -0,0 +1,780 @@
+/* xf86drmMock.c -- In-process GEM device for running without hardware
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * drmMockOpen() returns a file descriptor that behaves like an i915 GEM
+ * device as far as libdrm and libdrm_intel can tell, so the buffer manager
+ * and anything built on it can be exercised and timed on machines without
+ * the hardware.  It works by installing a drmSetBackend() backend that
+ * handles ioctls and mmaps on mock descriptors and passes everything else
+ * through to the kernel.
+ *
+ * Objects are anonymous memory.  GEM create, close, flink, open, mmap,
+ * mmap_gtt, pread, pwrite, set_domain, busy, madvise, tiling, pin,
+ * unsynchronized and execbuffer2 are implemented.  Each object is given a
+ * fixed address in a pretend aperture; execbuffer2 rewrites any relocation
+ * whose presumed offset is stale, reports the offsets back and keeps every
+ * object in the batch busy for exec_usec.  Accesses that would stall on
+ * real hardware (set_domain, pread, pwrite) sleep until the object is idle.
+ *
+ * With the faults parameter set, execbuffer2 also drops the mappings of the
+ * objects in the batch, as the kernel does, unless they were marked
+ * unsynchronized.  The memory is protected, and the SIGSEGV the next access
+ * raises sleeps until the object is idle and lets the access through.
+ *
+ * Mappings of an object all share its memory, which stays valid until the
+ * last handle is closed and the last mapping is released with drmMunmap().
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#ifndef MAP_FAILED
+#define MAP_FAILED ((void *)-1)
+#endif
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+
+#define MOCK_APERTURE_SIZE (256 * 1024 * 1024)
+#define MOCK_DEVID         0x2a42	/* GM45 */
+#define MOCK_NUM_FENCES    16
+
+typedef struct _mockDevice *mockDevicePtr;
+
+typedef struct _mockObject {
+    mockDevicePtr dev;		/* owner; kept alive by its objects */
+    uint32_t     handles;	/* open handles */
+    uint32_t     maps;		/* live mappings */
+    uint32_t     name;		/* flink name, or 0 */
+    uint32_t     tiling_mode;
+    uint32_t     stride;
+    int          userptr;	/* mem belongs to the client */
+    int          unsynchronized; /* mappings survive exec */
+    int          dropped;	/* mem protected until the next access */
+    uint64_t     size;
+    uint64_t     offset;	/* address in the pretend aperture */
+    uint64_t     busy_until;	/* usec, on the monotonic clock */
+    void         *mem;
+} mockObject, *mockObjectPtr;
+
+typedef struct _mockDevice {
+    int             fd;
+    drmMockParams   params;
+    drmMockStats    stats;
+    void            *handles;	/* handle -> mockObject */
+    void            *names;	/* flink name -> mockObject */
+    uint32_t        next_handle;
+    uint32_t        next_name;
+    uint64_t        next_offset;
+    int             closed;	/* freed with its last object */
+    struct _mockDevice *next;
+} mockDevice;
+
+/* One lock covers every mock device; it is dropped only to sleep */
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static mockDevicePtr   mock_devices;
+/* Mapped address -> mockObject; maps may outlive their device */
+static void            *mock_maps;
+/* SIGSEGV handler in place before the first faults device was opened */
+static struct sigaction mock_old_segv;
+static int             mock_segv;
+
+static uint64_t mockTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void mockDelay(unsigned long usec)
+{
+    struct timespec ts;
+
+    if (!usec)
+	return;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	;
+}
+
+static mockDevicePtr mockFind(int fd)
+{
+    mockDevicePtr dev;
+
+    for (dev = mock_devices; dev; dev = dev->next)
+	if (dev->fd == fd)
+	    break;
+    return dev;
+}
+
+static mockObjectPtr mockLookup(mockDevicePtr dev, uint32_t handle)
+{
+    void *value;
+
+    if (drmHashLookup(dev->handles, handle, &value))
+	return NULL;
+    return value;
+}
+
+static void mockRelease(mockObjectPtr obj)
+{
+    mockDevicePtr dev = obj->dev;
+
+    if (obj->handles || obj->maps)
+	return;
+    dev->stats.objects--;
+    dev->stats.bytes -= obj->size;
+    if (!obj->userptr)
+	munmap(obj->mem, obj->size);
+    drmFree(obj);
+
+    /* A closed device lingers only for the objects still mapped */
+    if (dev->closed && !dev->stats.objects)
+	drmFree(dev);
+}
+
+/*
+ * Wait for the GPU to finish with obj.  The object is kept alive across the
+ * sleep; -ENOENT means every handle to it was closed meanwhile.
+ */
+static int mockWait(mockDevicePtr dev, mockObjectPtr obj)
+{
+    uint64_t now = mockTime();
+
+    if (obj->busy_until <= now)
+	return 0;
+    dev->stats.waits++;
+    dev->stats.wait_usec += obj->busy_until - now;
+
+    obj->maps++;
+    pthread_mutex_unlock(&mock_lock);
+    mockDelay(obj->busy_until - now);
+    pthread_mutex_lock(&mock_lock);
+    obj->maps--;
+    if (!obj->handles) {
+	mockRelease(obj);
+	return -ENOENT;
+    }
+    return 0;
+}
+
+/*
+ * Drop the client's mappings of obj, so that its next access faults.  The
+ * mock itself only touches object memory after mockRestore().
+ */
+static void mockDrop(mockDevicePtr dev, mockObjectPtr obj)
+{
+    if (!dev->params.faults || !obj->maps || obj->userptr || obj->dropped)
+	return;
+    if (mprotect(obj->mem, obj->size, PROT_NONE) == 0)
+	obj->dropped = 1;
+}
+
+static void mockRestore(mockObjectPtr obj)
+{
+    if (obj->dropped && mprotect(obj->mem, obj->size,
+				 PROT_READ | PROT_WRITE) == 0)
+	obj->dropped = 0;
+}
+
+/*
+ * An access to a dropped mapping: wait for the object as the kernel's
+ * fault handler would, then map it again.  Anything else goes to the
+ * handler that was there before.
+ */
+static void mockSegv(int sig, siginfo_t *info, void *context)
+{
+    char          *addr = info->si_addr;
+    mockObjectPtr obj = NULL;
+    unsigned long key;
+    void          *value;
+
+    pthread_mutex_lock(&mock_lock);
+    if (drmHashFirst(mock_maps, &key, &value) == 1) {
+	do {
+	    obj = value;
+	    if (obj->dropped && addr >= (char *)obj->mem &&
+		addr < (char *)obj->mem + obj->size)
+		break;
+	    obj = NULL;
+	} while (drmHashNext(mock_maps, &key, &value) == 1);
+    }
+    if (!obj) {
+	pthread_mutex_unlock(&mock_lock);
+	/* Returning faults again, into the old handler */
+	sigaction(SIGSEGV, &mock_old_segv, NULL);
+	return;
+    }
+    obj->dev->stats.faults++;
+    mockWait(obj->dev, obj);
+    mockRestore(obj);
+    pthread_mutex_unlock(&mock_lock);
+}
+
+static int mockAddHandle(mockDevicePtr dev, mockObjectPtr obj,
+			 uint32_t *handle)
+{
+    *handle = ++dev->next_handle;
+    if (drmHashInsert(dev->handles, *handle, obj))
+	return -ENOMEM;
+    obj->handles++;
+    return 0;
+}
+
+static int mockCreate(mockDevicePtr dev, uint64_t size, void *mem,
+		      uint32_t *handle)
+{
+    mockObjectPtr obj;
+    long          pagesize = getpagesize();
+
+    if (size == 0)
+	return -EINVAL;
+    size = (size + pagesize - 1) & ~(uint64_t)(pagesize - 1);
+
+    if (!(obj = drmMalloc(sizeof(*obj))))
+	return -ENOMEM;
+    obj->dev = dev;
+    obj->size = size;
+    if (mem) {
+	obj->mem = mem;
+	obj->userptr = 1;
+    } else {
+	obj->mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (obj->mem == MAP_FAILED) {
+	    drmFree(obj);
+	    return -ENOMEM;
+	}
+    }
+    obj->offset = dev->next_offset;
+    dev->next_offset += size;
+    dev->stats.objects++;
+    dev->stats.bytes += size;
+    if (mockAddHandle(dev, obj, handle)) {
+	mockRelease(obj);
+	return -ENOMEM;
+    }
+    return 0;
+}
+
+static int mockClose(mockDevicePtr dev, uint32_t handle)
+{
+    mockObjectPtr obj = mockLookup(dev, handle);
+
+    if (!obj)
+	return -ENOENT;
+    drmHashDelete(dev->handles, handle);
+    if (--obj->handles == 0 && obj->name)
+	drmHashDelete(dev->names, obj->name);
+    mockRelease(obj);
+    return 0;
+}
+
+static int mockMap(mockObjectPtr obj, void **addr)
+{
+    if (drmHashInsert(mock_maps, (unsigned long)obj->mem, obj) < 0)
+	return -ENOMEM;
+    obj->maps++;
+    *addr = obj->mem;
+    return 0;
+}
+
+static int mockExec(mockDevicePtr dev, struct drm_i915_gem_execbuffer2 *exec)
+{
+    struct drm_i915_gem_exec_object2 *objects;
+    mockObjectPtr                    obj, target;
+    uint64_t                         busy_until;
+    uint32_t                         i, j;
+
+    objects = (struct drm_i915_gem_exec_object2 *)(uintptr_t)exec->buffers_ptr;
+    if (exec->buffer_count == 0)
+	return -EINVAL;
+
+    for (i = 0; i < exec->buffer_count; i++)
+	if (!mockLookup(dev, objects[i].handle))
+	    return -ENOENT;
+
+    busy_until = mockTime() + dev->params.exec_usec;
+    for (i = 0; i < exec->buffer_count; i++) {
+	struct drm_i915_gem_relocation_entry *relocs;
+
+	obj = mockLookup(dev, objects[i].handle);
+	mockRestore(obj);
+	relocs = (struct drm_i915_gem_relocation_entry *)
+	    (uintptr_t)objects[i].relocs_ptr;
+	for (j = 0; j < objects[i].relocation_count; j++) {
+	    if (!(target = mockLookup(dev, relocs[j].target_handle)) ||
+		relocs[j].offset > obj->size - 4)
+		return -EINVAL;
+	    if (relocs[j].presumed_offset == target->offset)
+		continue;
+	    *(uint32_t *)((char *)obj->mem + relocs[j].offset) =
+		target->offset + relocs[j].delta;
+	    relocs[j].presumed_offset = target->offset;
+	    dev->stats.relocs++;
+	}
+	objects[i].offset = obj->offset;
+	obj->busy_until = busy_until;
+	if (!obj->unsynchronized)
+	    mockDrop(dev, obj);
+    }
+    dev->stats.batches++;
+    return 0;
+}
+
+static int mockIoctlLocked(mockDevicePtr dev, unsigned long request,
+			   void *arg)
+{
+    mockObjectPtr obj;
+    void          *value;
+    int           ret;
+
+    switch (request) {
+    case DRM_IOCTL_I915_GETPARAM: {
+	drm_i915_getparam_t *gp = arg;
+
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+	    *gp->value = dev->params.devid;
+	    return 0;
+	case I915_PARAM_HAS_GEM:
+	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_BSD:
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_RELAXED_FENCING:
+	case I915_PARAM_HAS_RELAXED_DELTA:
+	case I915_PARAM_HAS_UNSYNCHRONIZED:
+	    *gp->value = 1;
+	    return 0;
+	case I915_PARAM_NUM_FENCES_AVAIL:
+	    *gp->value = MOCK_NUM_FENCES;
+	    return 0;
+	default:
+	    return -EINVAL;
+	}
+    }
+    case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+	struct drm_i915_gem_get_aperture *aperture = arg;
+
+	aperture->aper_size = dev->params.aperture_size;
+	aperture->aper_available_size = dev->params.aperture_size;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_CREATE: {
+	struct drm_i915_gem_create *create = arg;
+
+	return mockCreate(dev, create->size, NULL, &create->handle);
+    }
+    case DRM_IOCTL_I915_GEM_USERPTR: {
+	struct drm_i915_gem_userptr *userptr = arg;
+
+	if (userptr->flags ||
+	    (userptr->user_ptr | userptr->user_size) & (getpagesize() - 1))
+	    return -EINVAL;
+	return mockCreate(dev, userptr->user_size,
+			  (void *)(uintptr_t)userptr->user_ptr,
+			  &userptr->handle);
+    }
+    case DRM_IOCTL_GEM_CLOSE:
+	return mockClose(dev, ((struct drm_gem_close *)arg)->handle);
+    case DRM_IOCTL_GEM_FLINK: {
+	struct drm_gem_flink *flink = arg;
+
+	if (!(obj = mockLookup(dev, flink->handle)))
+	    return -ENOENT;
+	if (!obj->name) {
+	    obj->name = ++dev->next_name;
+	    if (drmHashInsert(dev->names, obj->name, obj)) {
+		obj->name = 0;
+		return -ENOMEM;
+	    }
+	}
+	flink->name = obj->name;
+	return 0;
+    }
+    case DRM_IOCTL_GEM_OPEN: {
+	struct drm_gem_open *open_arg = arg;
+
+	if (drmHashLookup(dev->names, open_arg->name, &value))
+	    return -ENOENT;
+	obj = value;
+	open_arg->size = obj->size;
+	return mockAddHandle(dev, obj, &open_arg->handle);
+    }
+    case DRM_IOCTL_I915_GEM_MMAP: {
+	struct drm_i915_gem_mmap *mmap_arg = arg;
+	void                     *addr;
+
+	if (!(obj = mockLookup(dev, mmap_arg->handle)))
+	    return -ENOENT;
+	/* Only whole-object maps, which is all libdrm asks for */
+	if (mmap_arg->offset != 0 || mmap_arg->size > obj->size)
+	    return -EINVAL;
+	if ((ret = mockMap(obj, &addr)))
+	    return ret;
+	mmap_arg->addr_ptr = (uintptr_t)addr;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_MMAP_GTT: {
+	struct drm_i915_gem_mmap_gtt *mmap_arg = arg;
+
+	if (!mockLookup(dev, mmap_arg->handle))
+	    return -ENOENT;
+	mmap_arg->offset = (uint64_t)mmap_arg->handle * getpagesize();
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_PREAD: {
+	struct drm_i915_gem_pread *pread = arg;
+
+	if (!(obj = mockLookup(dev, pread->handle)))
+	    return -ENOENT;
+	if (pread->offset > obj->size || pread->size > obj->size - pread->offset)
+	    return -EINVAL;
+	if ((ret = mockWait(dev, obj)))
+	    return ret;
+	mockRestore(obj);
+	memcpy((void *)(uintptr_t)pread->data_ptr,
+	       (char *)obj->mem + pread->offset, pread->size);
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_PWRITE: {
+	struct drm_i915_gem_pwrite *pwrite = arg;
+
+	if (!(obj = mockLookup(dev, pwrite->handle)))
+	    return -ENOENT;
+	if (pwrite->offset > obj->size || pwrite->size > obj->size - pwrite->offset)
+	    return -EINVAL;
+	if ((ret = mockWait(dev, obj)))
+	    return ret;
+	mockRestore(obj);
+	memcpy((char *)obj->mem + pwrite->offset,
+	       (void *)(uintptr_t)pwrite->data_ptr, pwrite->size);
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+	if (!(obj = mockLookup(dev,
+			       ((struct drm_i915_gem_set_domain *)arg)->handle)))
+	    return -ENOENT;
+	if ((ret = mockWait(dev, obj)))
+	    return ret;
+	/* The next access would fault, but no longer wait */
+	mockRestore(obj);
+	return 0;
+    case DRM_IOCTL_I915_GEM_SW_FINISH:
+	if (!mockLookup(dev, ((struct drm_i915_gem_sw_finish *)arg)->handle))
+	    return -ENOENT;
+	return 0;
+    case DRM_IOCTL_I915_GEM_BUSY: {
+	struct drm_i915_gem_busy *busy = arg;
+
+	if (!(obj = mockLookup(dev, busy->handle)))
+	    return -ENOENT;
+	busy->busy = obj->busy_until > mockTime();
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_MADVISE: {
+	struct drm_i915_gem_madvise *madv = arg;
+
+	if (!mockLookup(dev, madv->handle))
+	    return -ENOENT;
+	madv->retained = 1;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_UNSYNCHRONIZED: {
+	struct drm_i915_gem_unsynchronized *unsync = arg;
+
+	if (!(obj = mockLookup(dev, unsync->handle)))
+	    return -ENOENT;
+	obj->unsynchronized = unsync->enable != 0;
+	if (!obj->unsynchronized)
+	    mockDrop(dev, obj);
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_SET_TILING: {
+	struct drm_i915_gem_set_tiling *tiling = arg;
+
+	if (!(obj = mockLookup(dev, tiling->handle)))
+	    return -ENOENT;
+	if (tiling->tiling_mode > I915_TILING_Y)
+	    return -EINVAL;
+	dev->stats.tilings++;
+	obj->tiling_mode = tiling->tiling_mode;
+	obj->stride = tiling->tiling_mode == I915_TILING_NONE ?
+	    0 : tiling->stride;
+	tiling->stride = obj->stride;
+	tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_GET_TILING: {
+	struct drm_i915_gem_get_tiling *tiling = arg;
+
+	if (!(obj = mockLookup(dev, tiling->handle)))
+	    return -ENOENT;
+	tiling->tiling_mode = obj->tiling_mode;
+	tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_PIN: {
+	struct drm_i915_gem_pin *pin = arg;
+
+	if (!(obj = mockLookup(dev, pin->handle)))
+	    return -ENOENT;
+	pin->offset = obj->offset;
+	return 0;
+    }
+    case DRM_IOCTL_I915_GEM_UNPIN:
+	if (!mockLookup(dev, ((struct drm_i915_gem_unpin *)arg)->handle))
+	    return -ENOENT;
+	return 0;
+    case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+	return mockExec(dev, arg);
+    default:
+	return -ENOTTY;
+    }
+}
+
+static int mockIoctl(int fd, unsigned long request, void *arg)
+{
+    mockDevicePtr dev;
+    unsigned int  delay;
+    int           ret;
+
+    pthread_mutex_lock(&mock_lock);
+    if (!(dev = mockFind(fd))) {
+	pthread_mutex_unlock(&mock_lock);
+	return ioctl(fd, request, arg);
+    }
+    delay = dev->params.ioctl_usec;
+    pthread_mutex_unlock(&mock_lock);
+
+    mockDelay(delay);
+
+    pthread_mutex_lock(&mock_lock);
+    if ((dev = mockFind(fd))) {
+	dev->stats.ioctls++;
+	ret = mockIoctlLocked(dev, request, arg);
+    } else
+	ret = -EBADF;
+    pthread_mutex_unlock(&mock_lock);
+    if (ret) {
+	errno = -ret;
+	return -1;
+    }
+    return 0;
+}
+
+static void *mockMmap(void *addr, size_t length, int prot, int flags, int fd,
+		      off_t offset)
+{
+    mockDevicePtr dev;
+    mockObjectPtr obj;
+    void          *ret;
+
+    pthread_mutex_lock(&mock_lock);
+    if (!(dev = mockFind(fd))) {
+	pthread_mutex_unlock(&mock_lock);
+	return mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    obj = mockLookup(dev, offset / getpagesize());
+    if (!obj || offset % getpagesize() || length > obj->size ||
+	mockMap(obj, &ret)) {
+	pthread_mutex_unlock(&mock_lock);
+	errno = EINVAL;
+	return MAP_FAILED;
+    }
+    pthread_mutex_unlock(&mock_lock);
+    return ret;
+}
+
+static int mockMunmap(void *addr, size_t length)
+{
+    mockObjectPtr obj;
+    void          *value;
+
+    pthread_mutex_lock(&mock_lock);
+    if (!mock_maps || drmHashLookup(mock_maps, (unsigned long)addr, &value)) {
+	pthread_mutex_unlock(&mock_lock);
+	return munmap(addr, length);
+    }
+    obj = value;
+    if (--obj->maps == 0)
+	drmHashDelete(mock_maps, (unsigned long)addr);
+    mockRelease(obj);
+    pthread_mutex_unlock(&mock_lock);
+    return 0;
+}
+
+static drmBackend mock_backend = {
+    mockIoctl,
+    mockMmap,
+    mockMunmap
+};
+
+/**
+ * Open a mock GEM device.
+ *
+ * \param params device description and latencies, or NULL for defaults.
+ *
+ * \return a file descriptor for use with drmIoctl() and
+ * drm_intel_bufmgr_gem_init(), or a negative errno on failure.
+ *
+ * \internal
+ * The descriptor is a real one (on /dev/null) so that fstat() and the like
+ * work; the first call installs the mock backend with drmSetBackend().
+ */
+int drmMockOpen(drmMockParamsPtr params)
+{
+    mockDevicePtr dev;
+
+    if (!(dev = drmMalloc(sizeof(*dev))))
+	return -ENOMEM;
+    if (params)
+	dev->params = *params;
+    if (!dev->params.devid)
+	dev->params.devid = MOCK_DEVID;
+    if (!dev->params.aperture_size)
+	dev->params.aperture_size = MOCK_APERTURE_SIZE;
+    dev->next_offset = getpagesize();	/* keep 0 as "not yet placed" */
+
+    dev->handles = drmHashCreate();
+    dev->names = drmHashCreate();
+    if (!dev->handles || !dev->names ||
+	(dev->fd = open("/dev/null", O_RDWR)) < 0) {
+	if (dev->handles)
+	    drmHashDestroy(dev->handles);
+	if (dev->names)
+	    drmHashDestroy(dev->names);
+	drmFree(dev);
+	return -ENOMEM;
+    }
+
+    pthread_mutex_lock(&mock_lock);
+    if (!mock_maps && !(mock_maps = drmHashCreate())) {
+	pthread_mutex_unlock(&mock_lock);
+	close(dev->fd);
+	drmHashDestroy(dev->handles);
+	drmHashDestroy(dev->names);
+	drmFree(dev);
+	return -ENOMEM;
+    }
+    if (dev->params.faults && !mock_segv) {
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = mockSegv;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGSEGV, &sa, &mock_old_segv)) {
+	    pthread_mutex_unlock(&mock_lock);
+	    close(dev->fd);
+	    drmHashDestroy(dev->handles);
+	    drmHashDestroy(dev->names);
+	    drmFree(dev);
+	    return -EINVAL;
+	}
+	mock_segv = 1;
+    }
+    if (!mock_devices)
+	drmSetBackend(&mock_backend);
+    dev->next = mock_devices;
+    mock_devices = dev;
+    pthread_mutex_unlock(&mock_lock);
+
+    return dev->fd;
+}
+
+/**
+ * Close a mock GEM device, releasing every object not still mapped.
+ * Mapped objects keep the device structure alive until drmMunmap()
+ * releases the last of them.
+ *
+ * \return zero on success, or -EBADF if \p fd is not a mock device.
+ */
+int drmMockClose(int fd)
+{
+    mockDevicePtr *prev, dev;
+    unsigned long key;
+    void          *value;
+
+    pthread_mutex_lock(&mock_lock);
+    for (prev = &mock_devices; (dev = *prev); prev = &dev->next)
+	if (dev->fd == fd)
+	    break;
+    if (!dev) {
+	pthread_mutex_unlock(&mock_lock);
+	return -EBADF;
+    }
+    *prev = dev->next;
+
+    while (drmHashFirst(dev->handles, &key, &value) == 1) {
+	mockObjectPtr obj = value;
+
+	drmHashDelete(dev->handles, key);
+	obj->handles--;
+	mockRelease(obj);
+    }
+
+    drmHashDestroy(dev->handles);
+    drmHashDestroy(dev->names);
+    dev->handles = dev->names = NULL;
+    close(dev->fd);
+    dev->closed = 1;
+    if (!dev->stats.objects)
+	drmFree(dev);
+    pthread_mutex_unlock(&mock_lock);
+    return 0;
+}
+
+/**
+ * Get the counters of a mock GEM device.
+ *
+ * \return zero on success, or -EBADF if \p fd is not a mock device.
+ */
+int drmMockGetStats(int fd, drmMockStatsPtr stats)
+{
+    mockDevicePtr dev;
+
+    pthread_mutex_lock(&mock_lock);
+    if (!(dev = mockFind(fd))) {
+	pthread_mutex_unlock(&mock_lock);
+	return -EBADF;
+    }
+    *stats = dev->stats;
+    pthread_mutex_unlock(&mock_lock);
+    return 0;
+}
@@ -38,6 +38,7 @@
  * platforms find which headers to include to get uint32_t
  */
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -80,6 +81,18 @@ void* drmAllocCpy(void *array, int count, int entry_size)
 	return r;
 }
 
+/* Grows a caller-owned array to hold count entries. */
+static int drmModeGrow(void **array, int count, int entry_size)
+{
+	void *r;
+
+	if (!(r = realloc(*array, count*entry_size)))
+		return -ENOMEM;
+	*array = r;
+
+	return 0;
+}
+
 /*
  * A couple of free functions.
  */
@@ -239,6 +252,85 @@ err_allocs:
 	return r;
 }
 
+/*
+ * Like drmModeGetResources(), but into buf.  Once buf is large enough
+ * this is a single ioctl and no allocation; it only asks again when the
+ * arrays had to grow.
+ */
+int drmModeGetResourcesInto(int fd, drmModeResBufPtr buf)
+{
+	struct drm_mode_card_res res;
+	drmModeResPtr r = &buf->res;
+	int ret;
+
+	for (;;) {
+		memset(&res, 0, sizeof(struct drm_mode_card_res));
+		res.count_fbs = buf->size_fbs;
+		res.fb_id_ptr = VOID2U64(r->fbs);
+		res.count_crtcs = buf->size_crtcs;
+		res.crtc_id_ptr = VOID2U64(r->crtcs);
+		res.count_connectors = buf->size_connectors;
+		res.connector_id_ptr = VOID2U64(r->connectors);
+		res.count_encoders = buf->size_encoders;
+		res.encoder_id_ptr = VOID2U64(r->encoders);
+
+		if ((ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_GETRESOURCES, &res)))
+			return ret;
+
+		/* The kernel fills in an array only if it is big enough */
+		if (res.count_fbs <= buf->size_fbs &&
+		    res.count_crtcs <= buf->size_crtcs &&
+		    res.count_connectors <= buf->size_connectors &&
+		    res.count_encoders <= buf->size_encoders)
+			break;
+
+		if (res.count_fbs > buf->size_fbs) {
+			if (drmModeGrow((void **)&r->fbs, res.count_fbs,
+					sizeof(uint32_t)))
+				return -ENOMEM;
+			buf->size_fbs = res.count_fbs;
+		}
+		if (res.count_crtcs > buf->size_crtcs) {
+			if (drmModeGrow((void **)&r->crtcs, res.count_crtcs,
+					sizeof(uint32_t)))
+				return -ENOMEM;
+			buf->size_crtcs = res.count_crtcs;
+		}
+		if (res.count_connectors > buf->size_connectors) {
+			if (drmModeGrow((void **)&r->connectors,
+					res.count_connectors, sizeof(uint32_t)))
+				return -ENOMEM;
+			buf->size_connectors = res.count_connectors;
+		}
+		if (res.count_encoders > buf->size_encoders) {
+			if (drmModeGrow((void **)&r->encoders,
+					res.count_encoders, sizeof(uint32_t)))
+				return -ENOMEM;
+			buf->size_encoders = res.count_encoders;
+		}
+	}
+
+	r->min_width     = res.min_width;
+	r->max_width     = res.max_width;
+	r->min_height    = res.min_height;
+	r->max_height    = res.max_height;
+	r->count_fbs     = res.count_fbs;
+	r->count_crtcs   = res.count_crtcs;
+	r->count_connectors = res.count_connectors;
+	r->count_encoders = res.count_encoders;
+
+	return 0;
+}
+
+void drmModeResBufFini(drmModeResBufPtr buf)
+{
+	drmFree(buf->res.fbs);
+	drmFree(buf->res.crtcs);
+	drmFree(buf->res.connectors);
+	drmFree(buf->res.encoders);
+	memset(buf, 0, sizeof(*buf));
+}
+
 int drmModeAddFB(int fd, uint32_t width, uint32_t height, uint8_t depth,
                  uint8_t bpp, uint32_t pitch, uint32_t bo_handle,
 		 uint32_t *buf_id)
@@ -537,6 +629,136 @@ err_allocs:
 	return r;
 }
 
+/*
+ * Like drmModeGetConnector(), but into buf.  Once buf is large enough a
+ * query is one ioctl, or two when probing finds modes (the kernel only
+ * probes when asked for no modes), and allocates nothing.  With
+ * DRM_MODE_CONNECTOR_PROPERTIES the property metadata is kept in buf and
+ * only fetched for properties not seen before.
+ */
+int drmModeGetConnectorInto(int fd, uint32_t connector_id, int flags,
+			    drmModeConnectorBufPtr buf)
+{
+	struct drm_mode_get_connector conn;
+	drmModeConnectorPtr r = &buf->connector;
+	drmModePropertyPtr *p;
+	int probe = flags & DRM_MODE_CONNECTOR_PROBE;
+	int i, j, ret;
+
+	/* Asking for no modes is what triggers a probe, so keep room for one */
+	if (!buf->size_modes) {
+		if (drmModeGrow((void **)&r->modes, 1,
+				sizeof(struct drm_mode_modeinfo)))
+			return -ENOMEM;
+		buf->size_modes = 1;
+	}
+
+	for (;;) {
+		memset(&conn, 0, sizeof(struct drm_mode_get_connector));
+		conn.connector_id = connector_id;
+		if (!probe) {
+			conn.count_modes = buf->size_modes;
+			conn.modes_ptr = VOID2U64(r->modes);
+		}
+		conn.count_props = buf->size_props;
+		conn.props_ptr = VOID2U64(r->props);
+		conn.prop_values_ptr = VOID2U64(r->prop_values);
+		conn.count_encoders = buf->size_encoders;
+		conn.encoders_ptr = VOID2U64(r->encoders);
+
+		if ((ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn)))
+			return ret;
+
+		if ((probe ? conn.count_modes == 0 :
+			     conn.count_modes <= buf->size_modes) &&
+		    conn.count_props <= buf->size_props &&
+		    conn.count_encoders <= buf->size_encoders)
+			break;
+
+		/* The modes are fresh now; fetch them without probing again */
+		probe = 0;
+
+		if (conn.count_modes > buf->size_modes) {
+			if (drmModeGrow((void **)&r->modes, conn.count_modes,
+					sizeof(struct drm_mode_modeinfo)))
+				return -ENOMEM;
+			buf->size_modes = conn.count_modes;
+		}
+		if (conn.count_props > buf->size_props) {
+			if (drmModeGrow((void **)&r->props, conn.count_props,
+					sizeof(uint32_t)) ||
+			    drmModeGrow((void **)&r->prop_values,
+					conn.count_props, sizeof(uint64_t)) ||
+			    drmModeGrow((void **)&buf->properties,
+					conn.count_props,
+					sizeof(drmModePropertyPtr)))
+				return -ENOMEM;
+			memset(buf->properties + buf->size_props, 0,
+			       (conn.count_props - buf->size_props) *
+			       sizeof(drmModePropertyPtr));
+			buf->size_props = conn.count_props;
+		}
+		if (conn.count_encoders > buf->size_encoders) {
+			if (drmModeGrow((void **)&r->encoders,
+					conn.count_encoders, sizeof(uint32_t)))
+				return -ENOMEM;
+			buf->size_encoders = conn.count_encoders;
+		}
+	}
+
+	r->connector_id = conn.connector_id;
+	r->encoder_id = conn.encoder_id;
+	r->connection   = conn.connection;
+	r->mmWidth      = conn.mm_width;
+	r->mmHeight     = conn.mm_height;
+	/* convert subpixel from kernel to userspace */
+	r->subpixel     = conn.subpixel + 1;
+	r->count_modes  = conn.count_modes;
+	r->count_props  = conn.count_props;
+	r->count_encoders = conn.count_encoders;
+	r->connector_type  = conn.connector_type;
+	r->connector_type_id = conn.connector_type_id;
+
+	if (!(flags & DRM_MODE_CONNECTOR_PROPERTIES))
+		return 0;
+
+	/* Property ids rarely change; move cached metadata into place */
+	p = buf->properties;
+	for (i = 0; i < r->count_props; i++) {
+		drmModePropertyPtr tmp;
+
+		if (p[i] && p[i]->prop_id == r->props[i])
+			continue;
+		for (j = i + 1; j < buf->size_props; j++)
+			if (p[j] && p[j]->prop_id == r->props[i])
+				break;
+		if (j < buf->size_props) {
+			tmp = p[i];
+			p[i] = p[j];
+			p[j] = tmp;
+			continue;
+		}
+		drmModeFreeProperty(p[i]);
+		p[i] = drmModeGetProperty(fd, r->props[i]);
+	}
+
+	return 0;
+}
+
+void drmModeConnectorBufFini(drmModeConnectorBufPtr buf)
+{
+	int i;
+
+	for (i = 0; i < buf->size_props; i++)
+		drmModeFreeProperty(buf->properties[i]);
+	drmFree(buf->properties);
+	drmFree(buf->connector.modes);
+	drmFree(buf->connector.props);
+	drmFree(buf->connector.prop_values);
+	drmFree(buf->connector.encoders);
+	memset(buf, 0, sizeof(*buf));
+}
+
 int drmModeAttachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
 {
 	struct drm_mode_mode_cmd res;
@@ -298,6 +298,29 @@ typedef struct _drmModePlaneRes {
 	uint32_t *planes;
 } drmModePlaneRes, *drmModePlaneResPtr;
 
+/*
+ * Caller-owned storage for repeated queries.  Zero before first use; the
+ * arrays grow to fit and are reused by later queries, so once they are
+ * large enough a query allocates nothing.  The embedded result points
+ * into the buffer and must not be passed to the drmModeFree functions.
+ */
+typedef struct _drmModeResBuf {
+	drmModeRes res;
+	int size_fbs, size_crtcs, size_connectors, size_encoders;
+} drmModeResBuf, *drmModeResBufPtr;
+
+typedef struct _drmModeConnectorBuf {
+	drmModeConnector connector;
+	/** Property metadata, parallel to connector.props */
+	drmModePropertyPtr *properties;
+	int size_modes, size_props, size_encoders;
+} drmModeConnectorBuf, *drmModeConnectorBufPtr;
+
+/** Probe the connector for modes, as drmModeGetConnector() does */
+#define DRM_MODE_CONNECTOR_PROBE	(1 << 0)
+/** Fill in properties[]; each property is fetched once and then cached */
+#define DRM_MODE_CONNECTOR_PROPERTIES	(1 << 1)
+
 extern void drmModeFreeModeInfo( drmModeModeInfoPtr ptr );
 extern void drmModeFreeResources( drmModeResPtr ptr );
 extern void drmModeFreeFB( drmModeFBPtr ptr );
@@ -312,6 +335,12 @@ extern void drmModeFreePlaneResources(drmModePlaneResPtr ptr);
  */
 extern drmModeResPtr drmModeGetResources(int fd);
 
+/**
+ * Retrieves the resources of a card into caller-owned storage.
+ */
+extern int drmModeGetResourcesInto(int fd, drmModeResBufPtr buf);
+extern void drmModeResBufFini(drmModeResBufPtr buf);
+
 /*
  * FrameBuffer manipulation.
  */
@@ -389,6 +418,14 @@ drmModeEncoderPtr drmModeGetEncoder(int fd, uint32_t encoder_id);
 extern drmModeConnectorPtr drmModeGetConnector(int fd,
 		uint32_t connectorId);
 
+/**
+ * Retrieves the connector connectorId into caller-owned storage, together
+ * with its modes and, optionally, the metadata of its properties.
+ */
+extern int drmModeGetConnectorInto(int fd, uint32_t connectorId, int flags,
+		drmModeConnectorBufPtr buf);
+extern void drmModeConnectorBufFini(drmModeConnectorBufPtr buf);
+
 /**
  * Attaches the given mode to an connector.
  */
@@ -1,4 +1,4 @@
-/* xf86drmSL.c -- Skip list support
+/* xf86drmSL.c -- Skip list and block list support
  * Created: Mon May 10 09:28:13 1999 by faith@precisioninsight.com
  *
  * Copyright 1999 Precision Insight, Inc., Cedar Park, Texas.
@@ -27,9 +27,22 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward skip list implementation.n
+ * This file contains two implementations of an ordered map from unsigned
+ * long keys to pointers behind the drmSL* interface:
  *
- * FUTURE ENHANCEMENTS
+ * 1) A straightforward skip list [Pugh90].  Every entry is a separate
+ * allocation, and a search follows a pointer per level, touching a new
+ * cacheline almost every step.
+ *
+ * 2) A sorted array of blocks, each holding up to SL_BLOCK_KEYS sorted keys
+ * in contiguous arrays, with a sorted directory of the lowest key in each
+ * block.  A search is two binary searches over contiguous memory; full
+ * blocks are split in half, and a block is merged into its successor when
+ * the two would fill less than half a block.
+ *
+ * drmSLCreate() makes block lists unless SL_SKIP_LIST is set.  Each object
+ * starts with its magic number, which the drmSL* entry points use to pick
+ * the implementation, so the SL_MAIN harness can compare both.
  *
  * REFERENCES
  *
@@ -40,6 +53,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define SL_MAIN 0
 
@@ -55,6 +69,9 @@
 #define SL_MAX_LEVEL   16
 #define SL_DEBUG       0
 #define SL_RANDOM_SEED 0xc01055a1LU
+#define SL_BLOCK_MAGIC 0xb10cb10cLU
+#define SL_BLOCK_KEYS  64
+#define SL_SKIP_LIST   0	/* drmSLCreate() makes skip lists */
 
 #if SL_MAIN
 #define SL_ALLOC malloc
@@ -87,6 +104,23 @@ typedef struct SkipList {
     SLEntryPtr       p0;	/* Position for iteration */
 } SkipList, *SkipListPtr;
 
+typedef struct SLBlock {
+    int               count;
+    unsigned long     key[SL_BLOCK_KEYS];
+    void              *value[SL_BLOCK_KEYS];
+} SLBlock, *SLBlockPtr;
+
+typedef struct BlockList {
+    unsigned long    magic;	/* SL_BLOCK_MAGIC */
+    int              count;	/* Entries */
+    int              blocks;	/* Blocks in use */
+    int              size;	/* Slots in first[] and block[] */
+    unsigned long    *first;	/* Lowest key in each block */
+    SLBlockPtr       *block;
+    int              p0;	/* Block for iteration */
+    int              p1;	/* Entry within p0 for iteration */
+} BlockList, *BlockListPtr;
+
 #if SL_MAIN
 extern void *drmSLCreate(void);
 extern int  drmSLDestroy(void *l);
@@ -129,7 +163,8 @@ static int SLRandomLevel(void)
     return level;
 }
 
-void *drmSLCreate(void)
+#if SL_SKIP_LIST || SL_MAIN
+static void *SkipListCreate(void)
 {
     SkipListPtr  list;
     int          i;
@@ -145,8 +180,9 @@ void *drmSLCreate(void)
     
     return list;
 }
+#endif
 
-int drmSLDestroy(void *l)
+static int SkipListDestroy(void *l)
 {
     SkipListPtr   list  = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -183,7 +219,7 @@ static SLEntryPtr SLLocate(void *l, unsigned long key, SLEntryPtr *update)
     return entry->forward[0];
 }
 
-int drmSLInsert(void *l, unsigned long key, void *value)
+static int SkipListInsert(void *l, unsigned long key, void *value)
 {
     SkipListPtr   list  = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -216,7 +252,7 @@ int drmSLInsert(void *l, unsigned long key, void *value)
     return 0;			/* Added to table */
 }
 
-int drmSLDelete(void *l, unsigned long key)
+static int SkipListDelete(void *l, unsigned long key)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    update[SL_MAX_LEVEL + 1];
@@ -243,7 +279,7 @@ int drmSLDelete(void *l, unsigned long key)
     return 0;
 }
 
-int drmSLLookup(void *l, unsigned long key, void **value)
+static int SkipListLookup(void *l, unsigned long key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    update[SL_MAX_LEVEL + 1];
@@ -252,38 +288,43 @@ int drmSLLookup(void *l, unsigned long key, void **value)
     entry = SLLocate(list, key, update);
 
     if (entry && entry->key == key) {
-	*value = entry;
+	*value = entry->value;
 	return 0;
     }
     *value = NULL;
     return -1;
 }
 
-int drmSLLookupNeighbors(void *l, unsigned long key,
-			 unsigned long *prev_key, void **prev_value,
-			 unsigned long *next_key, void **next_value)
+static int SkipListLookupNeighbors(void *l, unsigned long key,
+				   unsigned long *prev_key, void **prev_value,
+				   unsigned long *next_key, void **next_value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    update[SL_MAX_LEVEL + 1];
+    SLEntryPtr    entry;
     int           retcode = 0;
 
     *prev_key   = *next_key   = key;
     *prev_value = *next_value = NULL;
-	
-    if (update[0]) {
+
+    if (list->magic != SL_LIST_MAGIC) return 0; /* Bad magic */
+
+    entry = SLLocate(list, key, update);
+
+    if (update[0] != list->head) {
 	*prev_key   = update[0]->key;
 	*prev_value = update[0]->value;
 	++retcode;
-	if (update[0]->forward[0]) {
-	    *next_key   = update[0]->forward[0]->key;
-	    *next_value = update[0]->forward[0]->value;
-	    ++retcode;
-	}
+    }
+    if (entry) {
+	*next_key   = entry->key;
+	*next_value = entry->value;
+	++retcode;
     }
     return retcode;
 }
 
-int drmSLNext(void *l, unsigned long *key, void **value)
+static int SkipListNext(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -302,18 +343,17 @@ int drmSLNext(void *l, unsigned long *key, void **value)
     return 0;
 }
 
-int drmSLFirst(void *l, unsigned long *key, void **value)
+static int SkipListFirst(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
     
     list->p0 = list->head->forward[0];
-    return drmSLNext(list, key, value);
+    return SkipListNext(list, key, value);
 }
 
-/* Dump internal data structures for debugging. */
-void drmSLDump(void *l)
+static void SkipListDump(void *l)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -347,8 +387,415 @@ void drmSLDump(void *l)
     }
 }
 
+static void *BlockListCreate(void)
+{
+    BlockListPtr list;
+
+    list         = SL_ALLOC(sizeof(*list));
+    if (!list) return NULL;
+    list->magic  = SL_BLOCK_MAGIC;
+    list->count  = 0;
+    list->blocks = 0;
+    list->size   = 0;
+    list->first  = NULL;
+    list->block  = NULL;
+    return list;
+}
+
+static int BlockListDestroy(void *l)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    int          i;
+
+    if (list->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+
+    for (i = 0; i < list->blocks; i++) SL_FREE(list->block[i]);
+    if (list->first) SL_FREE(list->first);
+    if (list->block) SL_FREE(list->block);
+
+    list->magic = SL_FREED_MAGIC;
+    SL_FREE(list);
+    return 0;
+}
+
+/* Find the block that holds key, or would hold it if it were inserted,
+   and the index of the first entry in that block not less than key. */
+
+static int BlockLocate(BlockListPtr list, unsigned long key, int *index)
+{
+    SLBlockPtr block;
+    int        lo, hi, mid;
+
+				/* Last block whose first key is <= key */
+    lo = 0;
+    hi = list->blocks;
+    while (hi - lo > 1) {
+	mid = (lo + hi) / 2;
+	if (list->first[mid] <= key) lo = mid;
+	else                         hi = mid;
+    }
+
+				/* First entry in that block >= key */
+    block = list->block[lo];
+    *index = 0;
+    hi = block->count;
+    while (*index < hi) {
+	mid = (*index + hi) / 2;
+	if (block->key[mid] < key) *index = mid + 1;
+	else                       hi = mid;
+    }
+    return lo;
+}
+
+/* Make room for a block at position b of the directory. */
+
+static int BlockMakeRoom(BlockListPtr list, int b)
+{
+    if (list->blocks == list->size) {
+	int           size  = list->size ? list->size * 2 : 4;
+	unsigned long *first = SL_ALLOC(size * sizeof(*first));
+	SLBlockPtr    *block = SL_ALLOC(size * sizeof(*block));
+
+	if (!first || !block) {
+	    if (first) SL_FREE(first);
+	    if (block) SL_FREE(block);
+	    return -1;
+	}
+	if (list->blocks) {
+	    memcpy(first, list->first, list->blocks * sizeof(*first));
+	    memcpy(block, list->block, list->blocks * sizeof(*block));
+	    SL_FREE(list->first);
+	    SL_FREE(list->block);
+	}
+	list->first = first;
+	list->block = block;
+	list->size  = size;
+    }
+    memmove(&list->first[b + 1], &list->first[b],
+	    (list->blocks - b) * sizeof(list->first[0]));
+    memmove(&list->block[b + 1], &list->block[b],
+	    (list->blocks - b) * sizeof(list->block[0]));
+    ++list->blocks;
+    return 0;
+}
+
+static void BlockRemove(BlockListPtr list, int b)
+{
+    SL_FREE(list->block[b]);
+    --list->blocks;
+    memmove(&list->first[b], &list->first[b + 1],
+	    (list->blocks - b) * sizeof(list->first[0]));
+    memmove(&list->block[b], &list->block[b + 1],
+	    (list->blocks - b) * sizeof(list->block[0]));
+}
+
+static int BlockListInsert(void *l, unsigned long key, void *value)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    SLBlockPtr   block;
+    SLBlockPtr   next;
+    int          b, i, half;
+
+    if (list->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+
+    if (!list->blocks) {
+	block = SL_ALLOC(sizeof(*block));
+	if (!block) return -1;
+	if (BlockMakeRoom(list, 0)) {
+	    SL_FREE(block);
+	    return -1;
+	}
+	block->count   = 0;
+	list->block[0] = block;
+    }
+
+    b     = BlockLocate(list, key, &i);
+    block = list->block[b];
+    if (i < block->count && block->key[i] == key) return 1; /* Already in list */
+
+    if (block->count == SL_BLOCK_KEYS) {
+				/* Split, moving the upper half along */
+	next = SL_ALLOC(sizeof(*next));
+	if (!next) return -1;
+	if (BlockMakeRoom(list, b + 1)) {
+	    SL_FREE(next);
+	    return -1;
+	}
+	half        = SL_BLOCK_KEYS / 2;
+	next->count = SL_BLOCK_KEYS - half;
+	memcpy(next->key, &block->key[half], next->count * sizeof(next->key[0]));
+	memcpy(next->value, &block->value[half],
+	       next->count * sizeof(next->value[0]));
+	block->count       = half;
+	list->block[b + 1] = next;
+	list->first[b + 1] = next->key[0];
+	if (i > half) {
+	    block = next;
+	    i    -= half;
+	    ++b;
+	}
+    }
+
+    memmove(&block->key[i + 1], &block->key[i],
+	    (block->count - i) * sizeof(block->key[0]));
+    memmove(&block->value[i + 1], &block->value[i],
+	    (block->count - i) * sizeof(block->value[0]));
+    block->key[i]   = key;
+    block->value[i] = value;
+    ++block->count;
+    list->first[b] = block->key[0];
+
+    ++list->count;
+    return 0;			/* Added to table */
+}
+
+static int BlockListDelete(void *l, unsigned long key)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    SLBlockPtr   block;
+    SLBlockPtr   next;
+    int          b, i;
+
+    if (list->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+    if (!list->blocks) return 1; /* Not found */
+
+    b     = BlockLocate(list, key, &i);
+    block = list->block[b];
+    if (i == block->count || block->key[i] != key) return 1; /* Not found */
+
+    --block->count;
+    memmove(&block->key[i], &block->key[i + 1],
+	    (block->count - i) * sizeof(block->key[0]));
+    memmove(&block->value[i], &block->value[i + 1],
+	    (block->count - i) * sizeof(block->value[0]));
+    --list->count;
+
+    if (!block->count) {
+	BlockRemove(list, b);
+	return 0;
+    }
+    list->first[b] = block->key[0];
+
+				/* Merge sparse neighbours */
+    if (b + 1 < list->blocks) {
+	next = list->block[b + 1];
+	if (block->count + next->count <= SL_BLOCK_KEYS / 2) {
+	    memcpy(&block->key[block->count], next->key,
+		   next->count * sizeof(next->key[0]));
+	    memcpy(&block->value[block->count], next->value,
+		   next->count * sizeof(next->value[0]));
+	    block->count += next->count;
+	    BlockRemove(list, b + 1);
+	}
+    }
+    return 0;
+}
+
+static int BlockListLookup(void *l, unsigned long key, void **value)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    SLBlockPtr   block;
+    int          b, i;
+
+    *value = NULL;
+    if (!list->blocks) return -1;
+
+    b     = BlockLocate(list, key, &i);
+    block = list->block[b];
+    if (i == block->count || block->key[i] != key) return -1;
+
+    *value = block->value[i];
+    return 0;
+}
+
+static int BlockListLookupNeighbors(void *l, unsigned long key,
+				    unsigned long *prev_key, void **prev_value,
+				    unsigned long *next_key, void **next_value)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    SLBlockPtr   block;
+    int          b, i;
+    int          retcode = 0;
+
+    *prev_key   = *next_key   = key;
+    *prev_value = *next_value = NULL;
+
+    if (!list->blocks) return 0;
+
+    b     = BlockLocate(list, key, &i);
+    block = list->block[b];
+
+    if (i > 0) {
+	*prev_key   = block->key[i - 1];
+	*prev_value = block->value[i - 1];
+	++retcode;
+    } else if (b > 0) {
+	SLBlockPtr prev = list->block[b - 1];
+
+	*prev_key   = prev->key[prev->count - 1];
+	*prev_value = prev->value[prev->count - 1];
+	++retcode;
+    }
+
+    if (i < block->count) {
+	*next_key   = block->key[i];
+	*next_value = block->value[i];
+	++retcode;
+    } else if (b + 1 < list->blocks) {
+	*next_key   = list->block[b + 1]->key[0];
+	*next_value = list->block[b + 1]->value[0];
+	++retcode;
+    }
+    return retcode;
+}
+
+static int BlockListNext(void *l, unsigned long *key, void **value)
+{
+    BlockListPtr list = (BlockListPtr)l;
+
+    if (list->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+
+    while (list->p0 < list->blocks) {
+	SLBlockPtr block = list->block[list->p0];
+
+	if (list->p1 < block->count) {
+	    *key   = block->key[list->p1];
+	    *value = block->value[list->p1];
+	    ++list->p1;
+	    return 1;
+	}
+	++list->p0;
+	list->p1 = 0;
+    }
+    return 0;
+}
+
+static int BlockListFirst(void *l, unsigned long *key, void **value)
+{
+    BlockListPtr list = (BlockListPtr)l;
+
+    if (list->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+
+    list->p0 = 0;
+    list->p1 = 0;
+    return BlockListNext(list, key, value);
+}
+
+static void BlockListDump(void *l)
+{
+    BlockListPtr list = (BlockListPtr)l;
+    int          b, i;
+
+    printf("Blocks = %d (of %d), count = %d\n",
+	   list->blocks, list->size, list->count);
+    for (b = 0; b < list->blocks; b++) {
+	SLBlockPtr block = list->block[b];
+
+	printf("\nBlock %d %p: first 0x%08lx, %d entries\n",
+	       b, block, list->first[b], block->count);
+	for (i = 0; i < block->count; i++)
+	    printf("   %2d: <0x%08lx, %p>\n", i, block->key[i], block->value[i]);
+    }
+}
+
+/* Public entry points, dispatching on the magic at the start of each
+   list. */
+
+#define SL_MAGIC(l) (*(unsigned long *)(l))
+
+void *drmSLCreate(void)
+{
+#if SL_SKIP_LIST
+    return SkipListCreate();
+#else
+    return BlockListCreate();
+#endif
+}
+
+int drmSLDestroy(void *l)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListDestroy(l);
+    case SL_BLOCK_MAGIC: return BlockListDestroy(l);
+    }
+    return -1;			/* Bad magic */
+}
+
+int drmSLLookup(void *l, unsigned long key, void **value)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListLookup(l, key, value);
+    case SL_BLOCK_MAGIC: return BlockListLookup(l, key, value);
+    }
+    *value = NULL;
+    return -1;			/* Bad magic */
+}
+
+int drmSLInsert(void *l, unsigned long key, void *value)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListInsert(l, key, value);
+    case SL_BLOCK_MAGIC: return BlockListInsert(l, key, value);
+    }
+    return -1;			/* Bad magic */
+}
+
+int drmSLDelete(void *l, unsigned long key)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListDelete(l, key);
+    case SL_BLOCK_MAGIC: return BlockListDelete(l, key);
+    }
+    return -1;			/* Bad magic */
+}
+
+int drmSLLookupNeighbors(void *l, unsigned long key,
+			 unsigned long *prev_key, void **prev_value,
+			 unsigned long *next_key, void **next_value)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:
+	return SkipListLookupNeighbors(l, key, prev_key, prev_value,
+				       next_key, next_value);
+    case SL_BLOCK_MAGIC:
+	return BlockListLookupNeighbors(l, key, prev_key, prev_value,
+					next_key, next_value);
+    }
+    *prev_key   = *next_key   = key;
+    *prev_value = *next_value = NULL;
+    return 0;
+}
+
+int drmSLNext(void *l, unsigned long *key, void **value)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListNext(l, key, value);
+    case SL_BLOCK_MAGIC: return BlockListNext(l, key, value);
+    }
+    return -1;			/* Bad magic */
+}
+
+int drmSLFirst(void *l, unsigned long *key, void **value)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  return SkipListFirst(l, key, value);
+    case SL_BLOCK_MAGIC: return BlockListFirst(l, key, value);
+    }
+    return -1;			/* Bad magic */
+}
+
+/* Dump internal data structures for debugging. */
+void drmSLDump(void *l)
+{
+    switch (SL_MAGIC(l)) {
+    case SL_LIST_MAGIC:  SkipListDump(l); return;
+    case SL_BLOCK_MAGIC: BlockListDump(l); return;
+    }
+    printf("Bad magic: 0x%08lx\n", SL_MAGIC(l));
+}
+
 #if SL_MAIN
-static void print(SkipListPtr list)
+static void print(void *list)
 {
     unsigned long key;
     void          *value;
@@ -360,56 +807,91 @@ static void print(SkipListPtr list)
     }
 }
 
-static double do_time(int size, int iter)
+#define SL_PATTERN_RANDOM     0	/* Random keys, looked up in insertion order */
+#define SL_PATTERN_SEQUENTIAL 1	/* Ascending keys, looked up in order */
+#define SL_PATTERN_NEIGHBORS  2	/* Random keys, neighbours of key + 1 */
+
+static const char *pattern_name[] = { "random", "sequential", "neighbors" };
+
+static double elapsed(struct timeval *start)
+{
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    return (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		    - start->tv_sec * 1000000 - start->tv_usec);
+}
+
+static double do_time(void *(*create)(void), const char *name,
+		      int size, int iter, int pattern)
 {
-    SkipListPtr    list;
+    void           *list;
     int            i, j;
-    unsigned long  keys[1000000];
+    static unsigned long keys[1000000];
     unsigned long  previous;
-    unsigned long  key;
-    void           *value;
-    struct timeval start, stop;
-    double         usec;
-    SL_RANDOM_DECL;
+    unsigned long  key, prev_key, next_key;
+    void           *value, *prev_value, *next_value;
+    struct timeval start;
+    double         insert, usec;
 
-    SL_RANDOM_INIT(12345);
-    
-    list = drmSLCreate();
+    srandom(12345);
+
+    list = create();
 
+    gettimeofday(&start, NULL);
     for (i = 0; i < size; i++) {
-	keys[i] = SL_RANDOM;
-	drmSLInsert(list, keys[i], NULL);
+	keys[i] = pattern == SL_PATTERN_SEQUENTIAL ? i * 16 : random();
+	drmSLInsert(list, keys[i], (void *)keys[i]);
     }
+    insert = elapsed(&start) / size;
 
     previous = 0;
     if (drmSLFirst(list, &key, &value)) {
 	do {
-	    if (key <= previous) {
+	    if (key <= previous && previous) {
 		printf( "%lu !< %lu\n", previous, key);
 	    }
 	    previous = key;
 	} while (drmSLNext(list, &key, &value));
     }
-    
+
     gettimeofday(&start, NULL);
     for (j = 0; j < iter; j++) {
 	for (i = 0; i < size; i++) {
-	    if (drmSLLookup(list, keys[i], &value))
+	    if (pattern == SL_PATTERN_NEIGHBORS) {
+		if (!drmSLLookupNeighbors(list, keys[i] + 1,
+					  &prev_key, &prev_value,
+					  &next_key, &next_value)
+		    || prev_key != keys[i])
+		    printf("Error %lu %d\n", keys[i], i);
+	    } else if (drmSLLookup(list, keys[i], &value)
+		       || value != (void *)keys[i])
 		printf("Error %lu %d\n", keys[i], i);
 	}
     }
-    gettimeofday(&stop, NULL);
-    
-    usec = (double)(stop.tv_sec * 1000000 + stop.tv_usec
-		    - start.tv_sec * 1000000 - start.tv_usec) / (size * iter);
-    
-    printf("%0.2f microseconds for list length %d\n", usec, size);
+    usec = elapsed(&start) / (size * iter);
+
+    printf("%-6s %-10s %7d entries: insert %0.3f, lookup %0.3f microseconds\n",
+	   name, pattern_name[pattern], size, insert, usec);
 
     drmSLDestroy(list);
-    
+
     return usec;
 }
 
+static void compare(int size, int iter)
+{
+    int pattern;
+
+    for (pattern = 0; pattern <= SL_PATTERN_NEIGHBORS; pattern++) {
+	double skip  = do_time(SkipListCreate, "skip", size, iter, pattern);
+	double block = do_time(BlockListCreate, "block", size, iter, pattern);
+
+	printf("%-6s %-10s %7d entries: block lists take %0.2f of the time\n",
+	       "", pattern_name[pattern], size, block / skip);
+    }
+}
+
 static void print_neighbors(void *list, unsigned long key)
 {
     unsigned long prev_key = 0;
@@ -427,8 +909,7 @@ static void print_neighbors(void *list, unsigned long key)
 
 int main(void)
 {
-    SkipListPtr    list;
-    double         usec, usec2, usec3, usec4;
+    void           *list;
 
     list = drmSLCreate();
     printf( "list at %p\n", list);
@@ -459,18 +940,11 @@ int main(void)
     drmSLDestroy(list);
     printf("\n==============================\n\n");
 
-    usec  = do_time(100, 10000);
-    usec2 = do_time(1000, 500);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   1000.0/100.0, usec2 / usec);
-    
-    usec3 = do_time(10000, 50);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   10000.0/100.0, usec3 / usec);
-    
-    usec4 = do_time(100000, 4);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   100000.0/100.0, usec4 / usec);
+    compare(100, 10000);
+    compare(1000, 500);
+    compare(10000, 50);
+    compare(100000, 4);
+    compare(1000000, 1);
 
     return 0;
 }
@@ -45,7 +45,8 @@
 typedef struct {
     int fd;
     uint32_t fb_id;
-    drmModeResPtr mode_res;
+    drmModeResBuf res_buf;
+    drmModeResPtr mode_res;	/* &res_buf.res */
     int cpp;
 } drmmode_rec, *drmmode_ptr;
 
@@ -72,7 +73,8 @@ struct fixed_panel_lvds {
 typedef struct {
     drmmode_ptr drmmode;
     int output_id;
-    drmModeConnectorPtr mode_output;
+    drmModeConnectorBuf mode_buf;
+    drmModeConnectorPtr mode_output;	/* &mode_buf.connector */
     drmModeEncoderPtr mode_encoder;
     drmModePropertyBlobPtr edid_blob;
     int num_props;
@@ -621,14 +623,16 @@ drmmode_crtc_set_cursor_bo(xf86CrtcPtr crtc, dri_bo *cursor)
 static xf86OutputStatus
 drmmode_output_detect(xf86OutputPtr output)
 {
-	/* go to the hw and retrieve a new output struct */
+	/* go to the hw and refresh the output struct in place */
 	drmmode_output_private_ptr drmmode_output = output->driver_private;
 	drmmode_ptr drmmode = drmmode_output->drmmode;
 	xf86OutputStatus status;
-	drmModeFreeConnector(drmmode_output->mode_output);
 
-	drmmode_output->mode_output =
-		drmModeGetConnector(drmmode->fd, drmmode_output->output_id);
+	if (drmModeGetConnectorInto(drmmode->fd, drmmode_output->output_id,
+				    DRM_MODE_CONNECTOR_PROBE |
+				    DRM_MODE_CONNECTOR_PROPERTIES,
+				    &drmmode_output->mode_buf))
+		return XF86OutputStatusUnknown;
 
 	switch (drmmode_output->mode_output->connection) {
 	case DRM_MODE_CONNECTED:
@@ -806,13 +810,9 @@ drmmode_output_get_modes(xf86OutputPtr output)
 
 	/* look for an EDID property */
 	for (i = 0; i < koutput->count_props; i++) {
-		props = drmModeGetProperty(drmmode->fd, koutput->props[i]);
-		if (!props)
-			continue;
-		if (!(props->flags & DRM_MODE_PROP_BLOB)) {
-			drmModeFreeProperty(props);
+		props = drmmode_output->mode_buf.properties[i];
+		if (!props || !(props->flags & DRM_MODE_PROP_BLOB))
 			continue;
-		}
 
 		if (!strcmp(props->name, "EDID")) {
 			drmModeFreePropertyBlob(drmmode_output->edid_blob);
@@ -820,7 +820,6 @@ drmmode_output_get_modes(xf86OutputPtr output)
 				drmModeGetPropertyBlob(drmmode->fd,
 						       koutput->prop_values[i]);
 		}
-		drmModeFreeProperty(props);
 	}
 
 	if (drmmode_output->edid_blob)
@@ -874,12 +873,11 @@ drmmode_output_destroy(xf86OutputPtr output)
 
 	if (drmmode_output->edid_blob)
 		drmModeFreePropertyBlob(drmmode_output->edid_blob);
-	for (i = 0; i < drmmode_output->num_props; i++) {
-	    drmModeFreeProperty(drmmode_output->props[i].mode_prop);
+	/* mode_prop belongs to mode_buf, which frees it */
+	for (i = 0; i < drmmode_output->num_props; i++)
 	    free(drmmode_output->props[i].atoms);
-	}
 	free(drmmode_output->props);
-	drmModeFreeConnector(drmmode_output->mode_output);
+	drmModeConnectorBufFini(&drmmode_output->mode_buf);
 	if (drmmode_output->private_data) {
 		free(drmmode_output->private_data);
 		drmmode_output->private_data = NULL;
@@ -920,7 +918,7 @@ drmmode_output_dpms(xf86OutputPtr output, int mode)
 	drmModePropertyPtr props;
 
 	for (i = 0; i < koutput->count_props; i++) {
-		props = drmModeGetProperty(drmmode->fd, koutput->props[i]);
+		props = drmmode_output->mode_buf.properties[i];
 		if (!props)
 			continue;
 
@@ -933,10 +931,8 @@ drmmode_output_dpms(xf86OutputPtr output, int mode)
 				drmmode_output->dpms_mode,
 				mode);
 			drmmode_output->dpms_mode = mode;
-                        drmModeFreeProperty(props);
                         return;
 		}
-		drmModeFreeProperty(props);
 	}
 }
 
@@ -973,7 +969,6 @@ drmmode_output_create_resources(xf86OutputPtr output)
 {
     drmmode_output_private_ptr drmmode_output = output->driver_private;
     drmModeConnectorPtr mode_output = drmmode_output->mode_output;
-    drmmode_ptr drmmode = drmmode_output->drmmode;
     drmModePropertyPtr drmmode_prop;
     int i, j, err;
 
@@ -982,12 +977,15 @@ drmmode_output_create_resources(xf86OutputPtr output)
 	return;
 
     drmmode_output->num_props = 0;
+    /*
+     * drmmode_output_init() fetched the metadata of every property into
+     * mode_buf; borrow it from there.  A connector's property ids don't
+     * change, so later refreshes of mode_buf keep these alive.
+     */
     for (i = 0, j = 0; i < mode_output->count_props; i++) {
-	drmmode_prop = drmModeGetProperty(drmmode->fd, mode_output->props[i]);
-	if (drmmode_property_ignore(drmmode_prop)) {
-	    drmModeFreeProperty(drmmode_prop);
+	drmmode_prop = drmmode_output->mode_buf.properties[i];
+	if (drmmode_property_ignore(drmmode_prop))
 	    continue;
-	}
 	drmmode_output->props[j].mode_prop = drmmode_prop;
 	drmmode_output->props[j].value = mode_output->prop_values[i];
 	drmmode_output->num_props++;
@@ -1243,19 +1241,24 @@ static void
 drmmode_output_init(ScrnInfoPtr scrn, drmmode_ptr drmmode, int num)
 {
 	xf86OutputPtr output;
-	drmModeConnectorPtr koutput;
+	drmModeConnectorBuf kbuf;
+	drmModeConnectorPtr koutput = &kbuf.connector;
 	drmModeEncoderPtr kencoder;
 	drmmode_output_private_ptr drmmode_output;
 	char name[32];
 
-	koutput = drmModeGetConnector(drmmode->fd,
-				      drmmode->mode_res->connectors[num]);
-	if (!koutput)
+	memset(&kbuf, 0, sizeof(kbuf));
+	if (drmModeGetConnectorInto(drmmode->fd,
+				    drmmode->mode_res->connectors[num],
+				    DRM_MODE_CONNECTOR_PROBE |
+				    DRM_MODE_CONNECTOR_PROPERTIES, &kbuf)) {
+		drmModeConnectorBufFini(&kbuf);
 		return;
+	}
 
 	kencoder = drmModeGetEncoder(drmmode->fd, koutput->encoders[0]);
 	if (!kencoder) {
-		drmModeFreeConnector(koutput);
+		drmModeConnectorBufFini(&kbuf);
 		return;
 	}
 
@@ -1265,14 +1268,14 @@ drmmode_output_init(ScrnInfoPtr scrn, drmmode_ptr drmmode, int num)
 	output = xf86OutputCreate (scrn, &drmmode_output_funcs, name);
 	if (!output) {
 		drmModeFreeEncoder(kencoder);
-		drmModeFreeConnector(koutput);
+		drmModeConnectorBufFini(&kbuf);
 		return;
 	}
 
 	drmmode_output = calloc(sizeof(drmmode_output_private_rec), 1);
 	if (!drmmode_output) {
 		xf86OutputDestroy(output);
-		drmModeFreeConnector(koutput);
+		drmModeConnectorBufFini(&kbuf);
 		drmModeFreeEncoder(kencoder);
 		return;
 	}
@@ -1290,7 +1293,10 @@ drmmode_output_init(ScrnInfoPtr scrn, drmmode_ptr drmmode, int num)
 				"Can't allocate private memory for LVDS.\n");
 	}
 	drmmode_output->output_id = drmmode->mode_res->connectors[num];
-	drmmode_output->mode_output = koutput;
+	/* The buffer's arrays live on the heap, so it can be moved */
+	drmmode_output->mode_buf = kbuf;
+	koutput = drmmode_output->mode_output =
+		&drmmode_output->mode_buf.connector;
 	drmmode_output->mode_encoder = kencoder;
 	drmmode_output->drmmode = drmmode;
 	output->mm_width = koutput->mmWidth;
@@ -1401,12 +1407,14 @@ Bool drmmode_pre_init(ScrnInfoPtr scrn, int fd, int cpp)
 	xf86_config = XF86_CRTC_CONFIG_PTR(scrn);
 
 	drmmode->cpp = cpp;
-	drmmode->mode_res = drmModeGetResources(drmmode->fd);
-	if (!drmmode->mode_res) {
+	memset(&drmmode->res_buf, 0, sizeof(drmmode->res_buf));
+	if (drmModeGetResourcesInto(drmmode->fd, &drmmode->res_buf)) {
 		xf86DrvMsg(scrn->scrnIndex, X_ERROR,
 			   "failed to get resources: %s\n", strerror(errno));
+		drmModeResBufFini(&drmmode->res_buf);
 		return FALSE;
 	}
+	drmmode->mode_res = &drmmode->res_buf.res;
 
 	xf86CrtcSetSizeRange(scrn, 320, 200, drmmode->mode_res->max_width,
 			     drmmode->mode_res->max_height);